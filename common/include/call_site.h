@@ -41,12 +41,11 @@ typedef struct __attribute__((__packed__)) unwind_loc {
   int16_t offset; /* offset from FBP where register contents were spilled */
 } unwind_loc;
 
-// TODO currently we encode some function-specific information into the call
-// site record (e.g., fbp_offset).  This information is duplicated when there
-// are multiple stack maps in a given function.  Should we offload fbp_offset,
-// num_unwind & unwind_offset into a separate section and store an index into
-// that section here?  It may adversely affect cache behavior in terms of
-// pointer chasing but will reduce the size of these records.
+// Note: version 1 metadata encodes some function-specific information into
+// the call site record (e.g., frame_size), which is duplicated when there are
+// multiple stack maps in a given function.  Version 2 metadata offloads it
+// into a separate per-function table (see call_site_v2 & function_info
+// below).  The runtime expands both formats into call_site records.
 
 #define EMPTY_CALL_SITE \
   ((call_site){ \
@@ -75,6 +74,59 @@ typedef struct __attribute__((__packed__)) call_site {
   uint16_t padding; /* Make 4-byte aligned */
 } call_site;
 
+/* Metadata format versions. */
+#define METADATA_V1 1
+#define METADATA_V2 2
+#define METADATA_VERSION METADATA_V2
+
+/*
+ * Version 2 per-function information.  Stored in the same order as (and
+ * indexed the same as) the unwinding address range section.
+ */
+typedef struct function_info {
+  uint32_t frame_size; /* size of the stack frame */
+  uint32_t unwind_offset; /* beginning of unwinding info records */
+  uint16_t num_unwind; /* number of registers saved by the function */
+  uint16_t padding;
+} function_info;
+
+/*
+ * Version 2 call site record, sorted by return address.  Return addresses &
+ * IDs (the lookup keys) are stored in separate arrays so that searches only
+ * touch the keys.
+ */
+typedef struct call_site_v2 {
+  uint64_t id; /* call site ID -- maps sites across binaries */
+  uint32_t func; /* index of enclosing function's information */
+  uint32_t live_offset; /* beginning of live value location records */
+  uint32_t arch_live_offset; /* beginning of arch-specific live values */
+  uint16_t num_live; /* number of live values at site */
+  uint16_t num_arch_live; /* number of arch-specific live values at site */
+} call_site_v2;
+
+/*
+ * Call site lookup index.  Contains two open-addressed hash tables (linear
+ * probing) which share the same power-of-two number of slots -- one keyed by
+ * return address which maps into the address-sorted call sites, and one keyed
+ * by call site ID which maps into the ID-sorted call sites.
+ * Indexes are stored plus one so that zero marks an empty slot.
+ *
+ * Address slots also store the index of the enclosing function's record in
+ * the unwinding address range section.
+ */
+typedef struct __attribute__((__packed__)) site_index_slot {
+  uint32_t addr_site; /* address-sorted call site index + 1, 0 if empty */
+  uint32_t addr_func; /* unwinding address range index for addr_site */
+  uint32_t id_site; /* ID-sorted call site index + 1, 0 if empty */
+} site_index_slot;
+
+/* Hash a return address or call site ID into a table with NUM_SLOTS slots. */
+static inline uint64_t site_index_hash(uint64_t key, uint64_t num_slots)
+{
+  /* Fibonacci hashing, keep the well-mixed upper bits */
+  return ((key * 0x9e3779b97f4a7c15UL) >> 32) & (num_slots - 1);
+}
+
 /* Type of location where live value lives. */
 enum location_type {
   SM_REGISTER = 0x1,
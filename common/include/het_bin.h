@@ -30,5 +30,25 @@
 /* Architecture-specific constant locations & values. */
 #define SECTION_ARCH "arch_const"
 
+/* Hash index for looking up call sites by address & ID (optional). */
+#define SECTION_INDEX "index"
+
+/*
+ * Metadata format version.  Version 1 binaries don't have a version section
+ * and store call sites in the ID- & address-sorted sections above.
+ */
+#define SECTION_VERSION "version"
+
+/*
+ * Version 2 call site sections: lookup keys (return addresses sorted by
+ * address, IDs sorted by ID), a map from ID order to address order, call site
+ * records in address order and per-function information.
+ */
+#define SECTION_SITE_ADDR "site_addr"
+#define SECTION_SITE_ID "site_id"
+#define SECTION_SITE_ID_MAP "site_id_map"
+#define SECTION_SITE "site"
+#define SECTION_FUNC "func"
+
 #endif /* _HET_BIN_H */
 
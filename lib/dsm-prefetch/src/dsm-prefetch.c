@@ -155,7 +155,7 @@ static void __attribute__((destructor)) print_stats() {
 
 void popcorn_prefetch(access_type_t type, const void *low, const void *high)
 {
-  popcorn_prefetch_node(current_nid(), type, low, high);
+  popcorn_prefetch_node(cached_nid(), type, low, high);
 }
 
 void popcorn_prefetch_node(int nid,
@@ -297,9 +297,9 @@ static void popcorn_prefetch_execute_internal(int nid, stats_t *stats)
 
   // We can't prefetch to another node, so warn & clear out lists to prevent
   // them from growing forever due to failed prefetch executions.
-  if(current_nid() != nid) {
+  if(cached_nid() != nid) {
     warn("Cannot prefetch to node on which we're not running (%d vs. %d)\n",
-         current_nid(), nid);
+         cached_nid(), nid);
     list_clear(&requests[nid].write);
     list_clear(&requests[nid].read);
     list_clear(&requests[nid].release);
@@ -405,7 +405,7 @@ static void popcorn_prefetch_execute_internal(int nid, stats_t *stats)
 
 size_t popcorn_prefetch_execute()
 {
-  return popcorn_prefetch_execute_node(current_nid());
+  return popcorn_prefetch_execute_node(cached_nid());
 }
 
 size_t popcorn_prefetch_execute_node(int nid)
@@ -443,7 +443,7 @@ prefetch_thread_main(void *arg)
         gettid(), param->nid);
 
   migrate(param->nid, NULL, NULL);
-  if(current_nid() != param->nid) warn("PID %d: still on origin\n", gettid());
+  if(cached_nid() != param->nid) warn("PID %d: still on origin\n", gettid());
 
   sem_wait(&param->work);
   while(!param->exit)
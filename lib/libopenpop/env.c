@@ -1301,6 +1301,9 @@ handle_omp_display_env (unsigned long stacksize, int wait_policy)
     case GFS_HIERARCHY_STATIC:
       fputs ("STATIC (hierarchy)", stderr);
       break;
+    case GFS_HIERARCHY_GUIDED:
+      fputs ("GUIDED (hierarchy)", stderr);
+      break;
     case GFS_HETPROBE:
       fputs ("HETPROBE", stderr);
       break;
@@ -1376,12 +1379,17 @@ handle_omp_display_env (unsigned long stacksize, int wait_policy)
       fprintf (stderr, "  POPCORN_MAX_PROBES = %lu\n", popcorn_max_probes);
       fprintf (stderr, "  POPCORN_LOG_STATISTICS = %d\n",
                popcorn_log_statistics);
+      if (popcorn_hetprobe_cache)
+        fprintf (stderr, "  POPCORN_HETPROBE_CACHE = '%s'\n",
+                 popcorn_hetprobe_cache);
       if (popcorn_prime_region)
         {
           fprintf(stderr, "  POPCORN_PRIME_REGION = %s\n",
                   popcorn_prime_region);
           fprintf(stderr, "  POPCORN_PREFERRED_NODE = %d\n",
                   popcorn_preferred_node);
+          fprintf(stderr, "  POPCORN_REPROBE_PERIOD = %lu\n",
+                  popcorn_reprobe_period);
         }
     }
 
@@ -1545,9 +1553,15 @@ initialize_env (void)
       popcorn_log_statistics = false;
       parse_boolean("POPCORN_LOG_STATISTICS", &popcorn_log_statistics);
       popcorn_init_workshare_cache(128);
+      popcorn_hetprobe_cache = getenv("POPCORN_HETPROBE_CACHE");
+      if (popcorn_hetprobe_cache)
+        popcorn_load_workshare_cache(popcorn_hetprobe_cache);
       popcorn_prime_region = getenv("POPCORN_PRIME_REGION");
       if (!parse_int("POPCORN_PREFERRED_NODE", &popcorn_preferred_node, true))
         popcorn_preferred_node = 0;
+      if (!parse_unsigned_long("POPCORN_REPROBE_PERIOD",
+                               &popcorn_reprobe_period, true))
+        popcorn_reprobe_period = 100;
     }
 
   /* Popcorn's page access trace files don't provide a clean mapping of task
@@ -9,7 +9,10 @@
 #include <math.h>
 #include <assert.h>
 #include <float.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "hierarchy.h"
+#include "wait.h"
 
 global_info_t ALIGN_PAGE popcorn_global;
 node_info_t ALIGN_PAGE popcorn_node[MAX_POPCORN_NODES];
@@ -47,6 +50,12 @@ unsigned long omp_popcorn_core_speed(int nid)
   else return UINT64_MAX;
 }
 
+void omp_popcorn_page_align(const void *base, size_t elem_size)
+{
+  popcorn_global.primary.elem_size = elem_size;
+  popcorn_global.primary.base = elem_size ? base : NULL;
+}
+
 void popcorn_set_distributed(bool flag) { popcorn_global.distributed = flag; }
 void popcorn_set_finished(bool flag) { popcorn_global.finished = flag; }
 void popcorn_set_hybrid_barrier(bool flag) { popcorn_global.hybrid_barrier = flag; }
@@ -129,6 +138,18 @@ void hierarchy_init_node(int nid)
   gomp_barrier_reinit_all(&popcorn_node[nid].bar, num);
 }
 
+void hierarchy_init_node_gang(int nid, size_t num)
+{
+  /* Note: on failure the gang is left empty & threads migrate individually */
+  migrate_gang_reset(&popcorn_node[nid].gang, num);
+}
+
+void hierarchy_migrate_node_gang(int nid)
+{
+  if(migrate_gang(&popcorn_node[nid].gang, nid, NULL, NULL))
+    migrate(nid, NULL, NULL);
+}
+
 int hierarchy_assign_node(unsigned tnum)
 {
   unsigned cur = 0, thr_total = 0;
@@ -191,6 +212,57 @@ void hierarchy_clear_node_team_state(int nid)
   popcorn_node[nid].ns.fn = NULL;
 }
 
+void hierarchy_update_node_subset(void)
+{
+  int i;
+  unsigned long nthreads = 0;
+
+  if(!popcorn_global.popcorn_killswitch) return;
+
+  if(!popcorn_global.subset.active)
+  {
+    /* Nodes outside the subset have a core speed rating of zero */
+    popcorn_global.subset.nthreads = omp_get_max_threads();
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
+    {
+      popcorn_global.subset.node_places[i] = popcorn_global.node_places[i];
+      if(!popcorn_global.core_speed_rating[i] &&
+         popcorn_global.node_places[i])
+      {
+        popcorn_global.node_places[i] = 0;
+        hierarchy_clear_node_team_state(i);
+      }
+    }
+
+    /* The main thread can't leave the origin */
+    if(!popcorn_global.node_places[0]) popcorn_global.node_places[0] = 1;
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
+      nthreads += popcorn_global.node_places[i];
+    omp_set_num_threads(nthreads);
+
+    popcorn_global.subset.regions = 0;
+    popcorn_global.subset.active = true;
+  }
+  else if(popcorn_reprobe_period &&
+          ++popcorn_global.subset.regions >= popcorn_reprobe_period)
+  {
+    /* Restore all nodes & re-probe the prime region */
+    memcpy(popcorn_global.node_places, popcorn_global.subset.node_places,
+           sizeof(unsigned long) * MAX_POPCORN_NODES);
+    memcpy(popcorn_global.core_speed_rating,
+           popcorn_global.subset.core_speed_rating,
+           sizeof(unsigned long) * MAX_POPCORN_NODES);
+    popcorn_global.scaled_thread_range =
+      popcorn_global.subset.scaled_thread_range;
+    popcorn_global.het_workshare = popcorn_global.subset.het_workshare;
+    omp_set_num_threads(popcorn_global.subset.nthreads);
+
+    popcorn_global.subset.active = false;
+    popcorn_global.subset.reprobe = true;
+    popcorn_global.popcorn_killswitch = false;
+  }
+}
+
 /* Note: the main thread should already have initialized this node's
    synchronization data structures! */
 void hierarchy_init_thread(int nid)
@@ -415,10 +487,21 @@ bool hierarchy_reduce(int nid,
    need to continue probing for previously-seen regions. */
 #define _CACHE_HETPROBE
 
+/* Schedules between which the auto scheduler chooses, in the order in which
+   they're first tried. */
+enum auto_schedule {
+  AUTO_HETPROBE = 0,
+  AUTO_GUIDED,
+  AUTO_STATIC,
+  AUTO_SCHEDULES
+};
+
 /* Core speed ratings for a particular work-sharing region */
 typedef struct workshare_csr
 {
   const void *ident;
+  bool probed; /* The probing scheduler has run the region */
+  bool cached; /* Results were loaded from the persistent probe cache */
   size_t trips;
   union {
     long remaining;
@@ -431,6 +514,11 @@ typedef struct workshare_csr
   float uspf;
   float scaled_thread_range;
   float core_speed_rating[MAX_POPCORN_NODES];
+
+  /* Auto scheduler history -- how many times each schedule ran the region &
+     the time-weighted average microseconds per iteration it took */
+  size_t auto_trials[AUTO_SCHEDULES];
+  float auto_us_per_iter[AUTO_SCHEDULES];
 } workshare_csr_t;
 
 typedef workshare_csr_t *hash_entry_type;
@@ -450,12 +538,16 @@ static inline hash_entry_type new_hash_value(const void *ident)
      read/updated on multiple nodes */
   hash_entry_type new_val = (hash_entry_type)malloc(sizeof(workshare_csr_t));
   new_val->ident = ident;
+  new_val->probed = false;
+  new_val->cached = false;
   new_val->trips = 0;
   new_val->remaining = 0;
   new_val->chunk_size = 0;
   new_val->uspf = 0.0;
   new_val->scaled_thread_range = 0.0;
   memset(&new_val->core_speed_rating, 0, sizeof(float) * MAX_POPCORN_NODES);
+  memset(&new_val->auto_trials, 0, sizeof(size_t) * AUTO_SCHEDULES);
+  memset(&new_val->auto_us_per_iter, 0, sizeof(float) * AUTO_SCHEDULES);
   return new_val;
 }
 
@@ -465,6 +557,8 @@ void popcorn_init_workshare_cache(size_t size)
 size_t popcorn_max_probes;
 const char *popcorn_prime_region;
 int popcorn_preferred_node;
+size_t popcorn_reprobe_period;
+const char *popcorn_hetprobe_cache;
 
 #ifndef _CACHE_HETPROBE
 /* If not using a cache, use a single global core speed rating struct which
@@ -472,6 +566,243 @@ int popcorn_preferred_node;
 static workshare_csr_t global_csr;
 #endif
 
+/************************** Persistent probe cache ***************************/
+
+/* Probing results persisted across runs, keyed by the region's source location
+   string (its identifier) & the node configuration.  Each line of the file
+   contains the node configuration, the identifier, the microseconds per fault,
+   the scaled thread range & each node's core speed rating, separated by
+   whitespace (tabs separate fields that may contain spaces). */
+typedef struct {
+  char *ident;
+  bool used; /* The region was seen & its cache entry saves the results */
+  float uspf;
+  float scaled_thread_range;
+  float core_speed_rating[MAX_POPCORN_NODES];
+} persistent_csr_t;
+
+static char node_config[MAX_POPCORN_NODES * 32];
+static persistent_csr_t *persistent;
+static size_t num_persistent;
+
+/* Lines for other node configurations, written back verbatim */
+static char **other_configs;
+static size_t num_other_configs;
+
+/* Describe the node configuration, i.e., each node's architecture & the number
+   of threads the user placed on it, e.g., "0:1:16,1:0:96".  Results probed
+   under a different configuration aren't used. */
+static void get_node_config(char *buf, size_t size)
+{
+  int i, origin;
+  size_t len = 0;
+  unsigned long places;
+  struct popcorn_node_status status[MAX_POPCORN_NODES];
+
+  if(popcorn_getnodeinfo(&origin, status))
+    for(i = 0; i < MAX_POPCORN_NODES; i++) status[i].arch = -1;
+
+  buf[0] = '\0';
+  for(i = 0; i < MAX_POPCORN_NODES && len < size; i++)
+  {
+    places = popcorn_global.subset.active ?
+             popcorn_global.subset.node_places[i] :
+             popcorn_global.node_places[i];
+    if(places)
+      len += snprintf(buf + len, size - len, "%s%d:%d:%lu",
+                      len ? "," : "", i, status[i].arch, places);
+  }
+}
+
+static void write_persistent(FILE *fp,
+                             const char *ident,
+                             float uspf,
+                             float scaled_thread_range,
+                             const float *core_speed_rating)
+{
+  int i;
+
+  fprintf(fp, "%s\t%s\t%.9g %.9g", node_config, ident, uspf,
+          scaled_thread_range);
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+    fprintf(fp, " %.9g", core_speed_rating[i]);
+  fputc('\n', fp);
+}
+
+/* Whether an entry stored before slot END of the cache has the same source
+   location as ENT, i.e., whether ENT's results have already been saved. */
+static bool saved_region(htab_t htab, size_t end, hash_entry_type ent)
+{
+  size_t i;
+  hash_entry_type cur;
+
+  for(i = 0; i < end; i++)
+  {
+    cur = htab->entries[i];
+    if(cur != HTAB_EMPTY_ENTRY && cur != HTAB_DELETED_ENTRY &&
+       cur->scaled_thread_range > 0.0 && !strcmp(cur->ident, ent->ident))
+      return true;
+  }
+  return false;
+}
+
+/* Note: other runs may be reading or saving the file at the same time, so
+   write a temporary file & atomically replace the file with it. */
+static void save_workshare_cache(void)
+{
+  size_t i;
+  int fd;
+  FILE *fp;
+  char *tmp;
+  hash_entry_type ent;
+  htab_t htab = popcorn_global.workshare_cache;
+
+  if(asprintf(&tmp, "%s.XXXXXX", popcorn_hetprobe_cache) < 0) return;
+  if((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "w")))
+  {
+    popcorn_log("Could not save probe results to '%s'\n",
+                popcorn_hetprobe_cache);
+    if(fd >= 0)
+    {
+      close(fd);
+      unlink(tmp);
+    }
+    free(tmp);
+    return;
+  }
+
+  fchmod(fd, 0644);
+  for(i = 0; i < num_other_configs; i++)
+    fprintf(fp, "%s\n", other_configs[i]);
+
+  /* Regions not seen during this run keep their previous results */
+  for(i = 0; i < num_persistent; i++)
+    if(!persistent[i].used)
+      write_persistent(fp, persistent[i].ident, persistent[i].uspf,
+                       persistent[i].scaled_thread_range,
+                       persistent[i].core_speed_rating);
+
+  /* Only save regions which have been probed at least once.  Distinct
+     identifiers may have the same source location, only save the first. */
+  for(i = 0; i < htab_size(htab); i++)
+  {
+    ent = htab->entries[i];
+    if(ent == HTAB_EMPTY_ENTRY || ent == HTAB_DELETED_ENTRY ||
+       ent->scaled_thread_range <= 0.0 || saved_region(htab, i, ent))
+      continue;
+    write_persistent(fp, ent->ident, ent->uspf, ent->scaled_thread_range,
+                     ent->core_speed_rating);
+  }
+
+  if(fclose(fp) || rename(tmp, popcorn_hetprobe_cache))
+  {
+    popcorn_log("Could not save probe results to '%s'\n",
+                popcorn_hetprobe_cache);
+    unlink(tmp);
+  }
+  free(tmp);
+}
+
+/* Parse a line for the current node configuration, or return false if it's
+   malformed.  Note: modifies the line. */
+static bool parse_persistent(char *line, persistent_csr_t *csr)
+{
+  int i;
+  char *tab, *cur, *end;
+
+  if(!(tab = strchr(line, '\t'))) return false;
+  *tab = '\0';
+  csr->ident = line;
+  csr->used = false;
+
+  cur = tab + 1;
+  csr->uspf = strtof(cur, &end);
+  if(end == cur) return false;
+  csr->scaled_thread_range = strtof(cur = end, &end);
+  if(end == cur) return false;
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    csr->core_speed_rating[i] = strtof(cur = end, &end);
+    if(end == cur) return false;
+  }
+  return true;
+}
+
+void popcorn_load_workshare_cache(const char *path)
+{
+  FILE *fp;
+  char *line = NULL, *tab;
+  size_t len = 0;
+  ssize_t read;
+  persistent_csr_t csr;
+
+  popcorn_hetprobe_cache = path;
+  get_node_config(node_config, sizeof(node_config));
+  if(atexit(save_workshare_cache))
+    popcorn_log("Could not register saving probe results\n");
+
+  /* No results yet, this is a cold run */
+  if(!(fp = fopen(path, "r"))) return;
+
+  while((read = getline(&line, &len, fp)) > 0)
+  {
+    if(line[read - 1] == '\n') line[--read] = '\0';
+    if(!(tab = strchr(line, '\t'))) continue;
+
+    if((size_t)(tab - line) != strlen(node_config) ||
+       strncmp(line, node_config, tab - line))
+    {
+      other_configs = realloc(other_configs,
+                              sizeof(char *) * (num_other_configs + 1));
+      other_configs[num_other_configs++] = strdup(line);
+    }
+    else if(parse_persistent(tab + 1, &csr))
+    {
+      csr.ident = strdup(csr.ident);
+      persistent = realloc(persistent,
+                           sizeof(persistent_csr_t) * (num_persistent + 1));
+      persistent[num_persistent++] = csr;
+    }
+  }
+
+  free(line);
+  fclose(fp);
+}
+
+/*
+ * Re-apply the node subset chosen when the prime region's persisted results
+ * were probed, i.e., drop the nodes whose persisted ratings are NO_ITER.
+ */
+static void restore_node_subset(workshare_csr_t *csr);
+
+/* Seed a new cache entry with the region's persisted results, if any.  The
+   region is considered to have been probed the maximum number of times so
+   its loops are split using the persisted ratings from the first visit (if the
+   number of probes is unlimited, the results instead seed further probing). */
+static bool load_entry(hash_entry_type ent)
+{
+  size_t i;
+
+  for(i = 0; i < num_persistent; i++)
+  {
+    if(strcmp(persistent[i].ident, ent->ident)) continue;
+    ent->uspf = persistent[i].uspf;
+    ent->scaled_thread_range = persistent[i].scaled_thread_range;
+    memcpy(ent->core_speed_rating, persistent[i].core_speed_rating,
+           sizeof(float) * MAX_POPCORN_NODES);
+    ent->probed = true;
+    ent->cached = true;
+    ent->trips = popcorn_max_probes != UINT64_MAX ? popcorn_max_probes : 1;
+    persistent[i].used = true;
+
+    /* The prime region isn't probed again, so re-apply its node subset */
+    if(popcorn_prime_region && strcmp(ent->ident, popcorn_prime_region) == 0)
+      restore_node_subset(ent);
+    return true;
+  }
+  return false;
+}
+
 static hash_entry_type get_entry(const void *ident)
 {
   workshare_csr_t tmp = { .ident = ident };
@@ -495,7 +826,7 @@ static hash_entry_type get_or_create_entry(const void *ident, bool *new)
   {
     ret = new_hash_value(ident);
     *htab_find_slot(&popcorn_global.workshare_cache, &tmp, INSERT) = ret;
-    *new = true;
+    *new = !load_entry(ret);
   }
   return ret;
 }
@@ -635,6 +966,358 @@ static inline void loop_init_ull(struct gomp_work_share *ws,
 #define ROUND_LONG( val, incr ) ROUND(long, val, incr)
 #define ROUND_ULL( val, incr ) ROUND(unsigned long long, val, incr)
 
+/* Signal core speed value indicating that a particular node shouldn't receive
+   any iterations. */
+#define NO_ITER FLT_MIN
+
+/*************************** Page-aligned splits ****************************/
+
+/* Round the split between two nodes' iterations, iteration TRIP of a loop with
+   TRIPS iterations starting at LB with increment INCR, to the nearest
+   iteration that starts a page of the primary array so that nodes don't write
+   to the same pages.  Splits aren't moved below MIN.  Element i of the primary
+   array is assumed to be accessed by the iteration with loop index i. */
+static unsigned long long align_trip(unsigned long long trip,
+                                     unsigned long long min,
+                                     unsigned long long trips,
+                                     long long lb,
+                                     long long incr)
+{
+  uintptr_t addr, down, stride;
+  unsigned long long back, t_down, t_up;
+  size_t elem_size = popcorn_global.primary.elem_size;
+
+  if(!popcorn_global.primary.base || incr <= 0 || trip >= trips) return trip;
+  stride = (uintptr_t)incr * elem_size;
+  if(stride >= PAGESZ) return trip;
+
+  addr = (uintptr_t)popcorn_global.primary.base +
+         ((uintptr_t)lb + (uintptr_t)trip * incr) * elem_size;
+  down = addr & ~((uintptr_t)PAGESZ - 1);
+  if(addr == down) return trip;
+
+  /* First iterations at or after the page boundaries on either side.  If the
+     page starts before the array (or below MIN), don't move down. */
+  back = (addr - down) / stride;
+  t_down = (trip < min || back > trip - min) ? trip : trip - back;
+  t_up = trip + (down + PAGESZ - addr + stride - 1) / stride;
+  if(t_up > trips) t_up = trip;
+  if(t_up == trip) return t_down;
+  if(t_down == trip || t_up - trip < trip - t_down) return t_up;
+  return t_down;
+}
+
+/* Page-align split point SPLIT for work share WS, keeping it at or after
+   PREV.  Only loops counting upwards are aligned. */
+static inline long align_split(long split,
+                               long prev,
+                               struct gomp_work_share *ws)
+{
+  unsigned long long trips;
+
+  if(!popcorn_global.primary.base || ws->incr <= 0) return split;
+  trips = (ws->end - ws->next + ws->incr - 1) / ws->incr;
+  return ws->next + ws->incr *
+         (long)align_trip((split - ws->next) / ws->incr,
+                          (prev - ws->next) / ws->incr,
+                          trips, ws->next, ws->incr);
+}
+
+/* Same as above but with unsigned long long types */
+static inline unsigned long long
+align_split_ull(unsigned long long split,
+                unsigned long long prev,
+                struct gomp_work_share *ws)
+{
+  unsigned long long trips;
+
+  if(!popcorn_global.primary.base) return split;
+  trips = (ws->end_ull - ws->next_ull + ws->incr_ull - 1) / ws->incr_ull;
+  return ws->next_ull + ws->incr_ull *
+         align_trip((split - ws->next_ull) / ws->incr_ull,
+                    (prev - ws->next_ull) / ws->incr_ull,
+                    trips, ws->next_ull, ws->incr_ull);
+}
+
+/*********************** Hierarchical dynamic scheduler **********************/
+
+/* Each node hands out iterations from its own range (see dyn_range_t).  The
+   range's next unit only grows by fetch-adds from the node's own threads, and
+   its end unit only shrinks by compare-and-swaps from nodes stealing its
+   second half, so claims & steals never overlap.  Claims which find the range
+   empty still bump the next unit, so ranges are limited to DYN_MAX_UNITS units
+   & chunks to DYN_MAX_CHUNK units to leave headroom in the upper 32 bits. */
+#define DYN_RANGE( next, end ) (((uint64_t)(next) << 32) | (uint32_t)(end))
+#define DYN_NEXT( range ) ((uint32_t)((range) >> 32))
+#define DYN_END( range ) ((uint32_t)(range))
+
+/* Set up the iteration space for a loop with ITERS iterations. */
+static void dyn_init_space(unsigned long long iters)
+{
+  popcorn_global.dyn.iters = iters;
+  popcorn_global.dyn.stolen = 0;
+  popcorn_global.dyn.grain = iters > DYN_MAX_UNITS ?
+                             (iters + DYN_MAX_UNITS - 1) / DYN_MAX_UNITS : 1;
+}
+
+/* Convert an iteration number to the unit starting at or after it. */
+static inline uint32_t dyn_unit(unsigned long long iter)
+{
+  unsigned long long grain = popcorn_global.dyn.grain;
+  return (iter + grain - 1) / grain;
+}
+
+/* Set the number of iterations claimed at a time by node NID's threads. */
+static inline void dyn_set_chunk(int nid, unsigned long long chunk)
+{
+  chunk /= popcorn_global.dyn.grain;
+  if(!chunk) chunk = 1;
+  else if(chunk > DYN_MAX_CHUNK) chunk = DYN_MAX_CHUNK;
+  popcorn_node[nid].dyn.chunk = chunk;
+}
+
+/* Give node NID iterations [FIRST, LAST), claimed CHUNK at a time.  Nodes
+   which may not steal are marked as done so they only run their own range. */
+static void dyn_init_node(int nid,
+                          unsigned long long first,
+                          unsigned long long last,
+                          unsigned long long chunk,
+                          bool steal)
+{
+  dyn_range_t *r = &popcorn_node[nid].dyn;
+
+  dyn_set_chunk(nid, chunk);
+  r->stealing = 0;
+  r->done = !steal;
+  __atomic_store_n(&r->range, DYN_RANGE(dyn_unit(first), dyn_unit(last)),
+                   MEMMODEL_RELEASE);
+}
+
+/* Split the loop's iterations between nodes in proportion to WEIGHT, claimed
+   CHUNK iterations at a time.  If SHARE is set, each of a node's threads
+   instead claims an equal share of the node's iterations & the node doesn't
+   steal, i.e., iterations are statically scheduled within nodes.  Nodes
+   without weight get no iterations & don't steal either. */
+static void dyn_init_weighted(const float *weight,
+                              unsigned long long chunk,
+                              bool share)
+{
+  int i;
+  double total = 0.0, before = 0.0;
+  unsigned long threads;
+  unsigned long long iters = popcorn_global.dyn.iters, first, last = 0;
+  unsigned long long node_chunk;
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++) total += weight[i];
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    first = last;
+    before += weight[i];
+    if(before < total)
+      last = (unsigned long long)((double)iters * (before / total));
+    else last = iters;
+    if(weight[i] > 0.0)
+      last = align_trip(last, first, iters, popcorn_global.dyn.lb,
+                        popcorn_global.dyn.incr);
+    threads = popcorn_global.threads_per_node[i];
+    if(share && threads) node_chunk = (last - first + threads - 1) / threads;
+    else node_chunk = chunk;
+    dyn_init_node(i, first, last, node_chunk, weight[i] > 0.0 && !share);
+  }
+}
+
+/* Calculate each node's weight for splitting a loop's iterations, i.e., its
+   number of threads.  If RATED, scale by the core speed ratings probed for the
+   loop's region in CSR, or by the user-supplied ratings if CSR is NULL or
+   hasn't been probed & heterogeneous work sharing is enabled. */
+static void dyn_node_weights(float *weight,
+                             bool rated,
+                             const workshare_csr_t *csr)
+{
+  int i;
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    weight[i] = popcorn_global.threads_per_node[i];
+    if(!rated) continue;
+    if(csr && csr->scaled_thread_range > 0.0)
+      weight[i] *= csr->core_speed_rating[i] > NO_ITER ?
+                   csr->core_speed_rating[i] : 0.0;
+    else if(popcorn_global.het_workshare)
+      weight[i] *= popcorn_global.core_speed_rating[i];
+  }
+}
+
+/* Steal the second half of the remaining range of the node with the most work
+   left into node NID's (empty) range.  Returns true if any work was stolen. */
+static bool dyn_steal_remote(int nid)
+{
+  int i, victim;
+  uint64_t range, best = 0;
+  uint32_t next, end, mid, remaining, most;
+
+  while(true)
+  {
+    /* Leave single units, they're about to be claimed by their owners */
+    victim = -1;
+    most = 1;
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
+    {
+      if(i == nid) continue;
+      range = __atomic_load_n(&popcorn_node[i].dyn.range, MEMMODEL_RELAXED);
+      next = DYN_NEXT(range);
+      end = DYN_END(range);
+      remaining = next < end ? end - next : 0;
+      if(remaining > most)
+      {
+        most = remaining;
+        victim = i;
+        best = range;
+      }
+    }
+    if(victim < 0) return false;
+
+    /* Retry if the victim's threads claimed more work in the meantime */
+    next = DYN_NEXT(best);
+    end = DYN_END(best);
+    mid = next + (end - next) / 2;
+    if(__atomic_compare_exchange_n(&popcorn_node[victim].dyn.range, &best,
+                                   DYN_RANGE(next, mid), false,
+                                   MEMMODEL_ACQ_REL, MEMMODEL_RELAXED))
+    {
+      __atomic_store_n(&popcorn_node[nid].dyn.range, DYN_RANGE(mid, end),
+                       MEMMODEL_RELEASE);
+      __atomic_add_fetch(&popcorn_global.dyn.stolen, end - mid,
+                         MEMMODEL_RELAXED);
+      return true;
+    }
+  }
+}
+
+/* Called by node NID's threads when its range is empty.  Only one thread per
+   node steals, the rest wait to see whether it found more work.  Returns true
+   if the node's range may have work again. */
+static bool dyn_steal(int nid)
+{
+  bool stolen;
+  uint64_t range;
+  dyn_range_t *r = &popcorn_node[nid].dyn;
+
+  if(__atomic_load_n(&r->done, MEMMODEL_ACQUIRE)) return false;
+
+  if(__atomic_exchange_n(&r->stealing, 1, MEMMODEL_ACQUIRE))
+  {
+    while(__atomic_load_n(&r->stealing, MEMMODEL_ACQUIRE))
+      do_wait(&r->stealing, 1);
+    return !__atomic_load_n(&r->done, MEMMODEL_ACQUIRE);
+  }
+
+  /* Another thread may have refilled the range since we found it empty.
+     Otherwise it stays empty until we refill it, as nobody else can. */
+  range = __atomic_load_n(&r->range, MEMMODEL_ACQUIRE);
+  if(DYN_NEXT(range) < DYN_END(range)) stolen = true;
+  else if(!(stolen = dyn_steal_remote(nid)))
+    __atomic_store_n(&r->done, true, MEMMODEL_RELAXED);
+  __atomic_store_n(&r->stealing, 0, MEMMODEL_RELEASE);
+  futex_wake(&r->stealing, INT_MAX);
+
+  return stolen;
+}
+
+/* Claim the next chunk of node NID's iterations, [FIRST, LAST). */
+static bool dyn_next(int nid,
+                     unsigned long long *first,
+                     unsigned long long *last)
+{
+  dyn_range_t *r = &popcorn_node[nid].dyn;
+  unsigned long long grain = popcorn_global.dyn.grain, chunk = r->chunk;
+  uint64_t range;
+  uint32_t next, end;
+
+  do
+  {
+    range = __atomic_fetch_add(&r->range, chunk << 32, MEMMODEL_ACQ_REL);
+    next = DYN_NEXT(range);
+    end = DYN_END(range);
+    if(next < end)
+    {
+      *first = next * grain;
+      *last = (next + chunk < end ? next + chunk : end) * grain;
+      if(*last > popcorn_global.dyn.iters) *last = popcorn_global.dyn.iters;
+      return true;
+    }
+  } while(dyn_steal(nid));
+
+  return false;
+}
+
+/* Claim the next guided chunk of node NID's iterations, [FIRST, LAST): the
+   node's remaining iterations divided between its threads, but no smaller
+   than the node's chunk. */
+static bool dyn_next_guided(int nid,
+                            unsigned long long *first,
+                            unsigned long long *last)
+{
+  dyn_range_t *r = &popcorn_node[nid].dyn;
+  unsigned long long grain = popcorn_global.dyn.grain;
+  unsigned long threads = popcorn_global.threads_per_node[nid];
+  uint64_t range;
+  uint32_t next, end, q;
+
+  range = __atomic_load_n(&r->range, MEMMODEL_ACQUIRE);
+  while(true)
+  {
+    next = DYN_NEXT(range);
+    end = DYN_END(range);
+    if(next >= end)
+    {
+      if(!dyn_steal(nid)) return false;
+      range = __atomic_load_n(&r->range, MEMMODEL_ACQUIRE);
+      continue;
+    }
+
+    q = (end - next + threads - 1) / threads;
+    if(q < r->chunk) q = r->chunk;
+    if(q > end - next) q = end - next;
+    if(__atomic_compare_exchange_n(&r->range, &range,
+                                   DYN_RANGE(next + q, end), false,
+                                   MEMMODEL_ACQ_REL, MEMMODEL_ACQUIRE))
+    {
+      *first = next * grain;
+      *last = (next + q) * grain;
+      if(*last > popcorn_global.dyn.iters) *last = popcorn_global.dyn.iters;
+      return true;
+    }
+  }
+}
+
+/* Set up the iteration space for the loop [NEXT, END) with increment INCR. */
+static void dyn_init_loop(long next, long end, long incr)
+{
+  popcorn_global.dyn.lb = next;
+  popcorn_global.dyn.incr = incr;
+  if(incr > 0) dyn_init_space((end - next + incr - 1) / incr);
+  else dyn_init_space((next - end - incr - 1) / -incr);
+}
+
+/* Same as above but with unsigned long long types */
+static void dyn_init_loop_ull(unsigned long long next,
+                              unsigned long long end,
+                              unsigned long long incr)
+{
+  popcorn_global.dyn.lb_ull = next;
+  popcorn_global.dyn.incr_ull = incr;
+  dyn_init_space((end - next + incr - 1) / incr);
+}
+
+/* Give each node the iterations between its splits (see calculate_splits()),
+   claimed in chunks sized by its core speed rating.  Nodes which shouldn't get
+   any iterations don't steal any either. */
+static void dyn_init_splits(workshare_csr_t *csr, struct gomp_work_share *ws);
+static void dyn_init_splits_ull(workshare_csr_t *csr,
+                                struct gomp_work_share *ws);
+
 /* Calculate iteration splits between nodes for the remaining parallel work.
    This is done by the global leader, as having threads accurately calculating
    boundary conditions on loop iteration counts using floating point numbers is
@@ -661,11 +1344,15 @@ static int calculate_splits(workshare_csr_t *csr, struct gomp_work_share *ws)
       popcorn_global.split[i] = ws->next +
         (split_range / csr->scaled_thread_range) * remaining;
       ROUND_LONG(popcorn_global.split[i], ws->incr);
+      if(csr->core_speed_rating[i-1] > NO_ITER)
+        popcorn_global.split[i] = align_split(popcorn_global.split[i],
+                                              popcorn_global.split[i-1], ws);
       max_node = i;
     }
     else popcorn_global.split[i] = popcorn_global.split[i-1];
   }
   popcorn_global.split[max_node+1] = ws->end;
+  dyn_init_splits(csr, ws);
   ws->next = ws->end;
 
   return max_node;
@@ -696,15 +1383,23 @@ calculate_splits_ull(workshare_csr_t *csr, struct gomp_work_share *ws)
   popcorn_global.split_ull[0] = ws->next_ull;
   for(i = 1; i < MAX_POPCORN_NODES; i++)
   {
-    if(!popcorn_global.threads_per_node[i]) continue;
-    split_range += csr->core_speed_rating[i-1] *
-                   popcorn_global.threads_per_node[i-1];
-    popcorn_global.split_ull[i] = ws->next_ull +
-      (split_range / csr->scaled_thread_range) * remaining;
-    ROUND_ULL(popcorn_global.split_ull[i], ws->incr_ull);
-    max_node = i;
-  }
-  popcorn_global.split[max_node+1] = ws->end_ull;
+    if(popcorn_global.threads_per_node[i])
+    {
+      split_range += csr->core_speed_rating[i-1] *
+                     popcorn_global.threads_per_node[i-1];
+      popcorn_global.split_ull[i] = ws->next_ull +
+        (split_range / csr->scaled_thread_range) * remaining;
+      ROUND_ULL(popcorn_global.split_ull[i], ws->incr_ull);
+      if(csr->core_speed_rating[i-1] > NO_ITER)
+        popcorn_global.split_ull[i] =
+          align_split_ull(popcorn_global.split_ull[i],
+                          popcorn_global.split_ull[i-1], ws);
+      max_node = i;
+    }
+    else popcorn_global.split_ull[i] = popcorn_global.split_ull[i-1];
+  }
+  popcorn_global.split_ull[max_node+1] = ws->end_ull;
+  dyn_init_splits_ull(csr, ws);
   ws->next_ull = ws->end_ull;
 
   return max_node;
@@ -723,9 +1418,57 @@ calc_chunk_from_ratio_ull(int nid,
   return chunk;
 }
 
-/* Signal core speed value indicating that a particular node shouldn't receive
-   any iterations. */
-#define NO_ITER FLT_MIN
+static void dyn_init_splits(workshare_csr_t *csr, struct gomp_work_share *ws)
+{
+  int i;
+  bool steal;
+  unsigned long long first, last;
+
+  dyn_init_loop(ws->next, ws->end, ws->incr);
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    steal = popcorn_global.threads_per_node[i] &&
+            csr->core_speed_rating[i] > NO_ITER;
+    if(popcorn_global.threads_per_node[i])
+    {
+      first = (popcorn_global.split[i] - ws->next) / ws->incr;
+      last = (popcorn_global.split[i+1] - ws->next) / ws->incr;
+      if(last < first) last = first;
+    }
+    else first = last = 0;
+    dyn_init_node(i, first, last,
+                  steal ? calc_chunk_from_ratio(i, ws->incr, csr) / ws->incr
+                        : 1,
+                  steal);
+  }
+}
+
+static void dyn_init_splits_ull(workshare_csr_t *csr,
+                                struct gomp_work_share *ws)
+{
+  int i;
+  bool steal;
+  unsigned long long first, last;
+
+  dyn_init_loop_ull(ws->next_ull, ws->end_ull, ws->incr_ull);
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    steal = popcorn_global.threads_per_node[i] &&
+            csr->core_speed_rating[i] > NO_ITER;
+    if(popcorn_global.threads_per_node[i])
+    {
+      first = (popcorn_global.split_ull[i] - ws->next_ull) / ws->incr_ull;
+      last = (popcorn_global.split_ull[i+1] - ws->next_ull) / ws->incr_ull;
+      if(last < first) last = first;
+    }
+    else first = last = 0;
+    dyn_init_node(i, first, last,
+                  steal ? calc_chunk_from_ratio_ull(i, ws->incr_ull, csr) /
+                          ws->incr_ull
+                        : 1,
+                  steal);
+  }
+}
 
 static void init_workshare_from_splits(int nid,
                                        workshare_csr_t *csr,
@@ -776,11 +1519,13 @@ static char buf[2048];
 #define REMAINING_BUF( buf, ptr ) (sizeof(buf) - ((ptr) - (buf)))
 static void log_hetprobe_results(const char *ident, workshare_csr_t *csr)
 {
-  int i;
+  int i, max;
   char *cur = buf;
 
-  // TODO un-do hardcoding of max 2
-  const int max = 2;
+  /* Log all nodes up to the last one on which the user placed threads */
+  for(max = MAX_POPCORN_NODES; max > 1; max--)
+    if(popcorn_global.node_places[max - 1] ||
+       popcorn_global.subset.node_places[max - 1]) break;
 
   cur += snprintf(cur, sizeof(buf), "%s\nCSR:",
                   ident ? ident : "(no identifier)");
@@ -914,33 +1659,52 @@ void hierarchy_init_workshare_static_ull(int nid,
   thr->ts.work_share = ws;
 }
 
-void hierarchy_init_workshare_dynamic(int nid,
-                                      long long lb,
-                                      long long ub,
-                                      long long incr,
-                                      long long chunk)
+/* Initialize the node's work share for a loop whose iterations are handed out
+   from nodes' ranges, using SCHED's policy for splitting & claiming ranges:
+
+     GFS_HIERARCHY_DYNAMIC: split by thread count, claimed in fixed chunks
+     GFS_HIERARCHY_GUIDED: split by core speed rating, claimed in guided chunks
+     GFS_HIERARCHY_STATIC: split by core speed rating, one share per thread
+
+   Core speed ratings are taken from CSR if it has been probed (see
+   dyn_node_weights()). */
+static void init_workshare_ranges(int nid,
+                                  long long lb,
+                                  long long ub,
+                                  long long incr,
+                                  long long chunk,
+                                  enum gomp_schedule_type sched,
+                                  const workshare_csr_t *csr)
 {
   struct gomp_thread *thr = gomp_thread();
   struct gomp_team *team = thr->ts.team;
   int nthreads = team ? team->nthreads : 1;
   struct gomp_work_share *ws, *global;
+  float weight[MAX_POPCORN_NODES];
+  bool rated = sched != GFS_HIERARCHY_DYNAMIC,
+       share = sched == GFS_HIERARCHY_STATIC;
+
+  /* Statically-scheduled ranges are claimed the same way as dynamic ones */
+  if(share) sched = GFS_HIERARCHY_DYNAMIC;
 
   ws = gomp_ptrlock_get(&popcorn_node[nid].ws_lock);
   if(ws == NULL)
   {
-    /* Note: initialize the local work-share to be finished so threads grab
-       the next batch from the global pool immediately.  This is because we
-       don't know where each node's pool of work starts/ends. */
+    /* Note: the local work-share is empty, threads grab iterations from the
+       node's range which is set up along with the global work-share. */
     ws = &popcorn_node[nid].ws;
     gomp_init_work_share(ws, false, popcorn_global.threads_per_node[nid]);
-    loop_init(ws, lb, lb, incr, GFS_HIERARCHY_DYNAMIC, chunk, nid);
+    loop_init(ws, lb, lb, incr, sched, chunk, nid);
     if(popcorn_log_statistics) init_statistics(nid);
     global = gomp_ptrlock_get(&popcorn_global.ws_lock);
     if(global == NULL)
     {
       global = &popcorn_global.ws;
       gomp_init_work_share(global, false, nthreads);
-      loop_init(global, lb, ub, incr, GFS_HIERARCHY_DYNAMIC, chunk, nid);
+      loop_init(global, lb, ub, incr, sched, chunk, nid);
+      dyn_init_loop(global->next, global->end, incr);
+      dyn_node_weights(weight, rated, csr);
+      dyn_init_weighted(weight, chunk, share);
       gomp_ptrlock_set(&popcorn_global.ws_lock, global);
     }
     gomp_ptrlock_set(&popcorn_node[nid].ws_lock, ws);
@@ -949,31 +1713,42 @@ void hierarchy_init_workshare_dynamic(int nid,
   thr->ts.work_share = ws;
 }
 
-void hierarchy_init_workshare_dynamic_ull(int nid,
-                                          unsigned long long lb,
-                                          unsigned long long ub,
-                                          unsigned long long incr,
-                                          unsigned long long chunk)
+/* Same as above but with unsigned long long types */
+static void init_workshare_ranges_ull(int nid,
+                                      unsigned long long lb,
+                                      unsigned long long ub,
+                                      unsigned long long incr,
+                                      unsigned long long chunk,
+                                      enum gomp_schedule_type sched,
+                                      const workshare_csr_t *csr)
 {
   struct gomp_thread *thr = gomp_thread();
   struct gomp_team *team = thr->ts.team;
   int nthreads = team ? team->nthreads : 1;
   struct gomp_work_share *ws, *global;
+  float weight[MAX_POPCORN_NODES];
+  bool rated = sched != GFS_HIERARCHY_DYNAMIC,
+       share = sched == GFS_HIERARCHY_STATIC;
+
+  /* Statically-scheduled ranges are claimed the same way as dynamic ones */
+  if(share) sched = GFS_HIERARCHY_DYNAMIC;
 
   ws = gomp_ptrlock_get(&popcorn_node[nid].ws_lock);
   if(ws == NULL)
   {
     ws = &popcorn_node[nid].ws;
     gomp_init_work_share(ws, false, popcorn_global.threads_per_node[nid]);
-    loop_init_ull(ws, true, lb, lb, incr, GFS_HIERARCHY_DYNAMIC, chunk, nid);
+    loop_init_ull(ws, true, lb, lb, incr, sched, chunk, nid);
     if(popcorn_log_statistics) init_statistics(nid);
     global = gomp_ptrlock_get(&popcorn_global.ws_lock);
     if(global == NULL)
     {
       global = &popcorn_global.ws;
       gomp_init_work_share(global, false, nthreads);
-      loop_init_ull(global, true, lb, ub, incr, GFS_HIERARCHY_DYNAMIC,
-                    chunk, nid);
+      loop_init_ull(global, true, lb, ub, incr, sched, chunk, nid);
+      dyn_init_loop_ull(global->next_ull, global->end_ull, incr);
+      dyn_node_weights(weight, rated, csr);
+      dyn_init_weighted(weight, chunk, share);
       gomp_ptrlock_set(&popcorn_global.ws_lock, global);
     }
     gomp_ptrlock_set(&popcorn_node[nid].ws_lock, ws);
@@ -982,6 +1757,132 @@ void hierarchy_init_workshare_dynamic_ull(int nid,
   thr->ts.work_share = ws;
 }
 
+int hierarchy_static_node_trips(int gtid,
+                                unsigned long long trips,
+                                long long lb,
+                                long long incr,
+                                unsigned long long *first,
+                                unsigned long long *last)
+{
+  int i, tcount = 0;
+  unsigned long weight, total = 0, before = 0;
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    weight = popcorn_global.threads_per_node[i];
+    if(popcorn_global.het_workshare)
+      weight *= popcorn_global.core_speed_rating[i];
+    total += weight;
+  }
+  if(!total) return -1;
+
+  *last = 0;
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    weight = popcorn_global.threads_per_node[i];
+    if(popcorn_global.het_workshare)
+      weight *= popcorn_global.core_speed_rating[i];
+    before += weight;
+    *first = *last;
+    *last = (trips / total) * before + (trips % total) * before / total;
+    if(weight) *last = align_trip(*last, *first, trips, lb, incr);
+    if(gtid < (int)(tcount + popcorn_global.threads_per_node[i]))
+      return gtid - tcount;
+    tcount += popcorn_global.threads_per_node[i];
+  }
+  return -1;
+}
+
+void hierarchy_init_workshare_dynamic(int nid,
+                                      long long lb,
+                                      long long ub,
+                                      long long incr,
+                                      long long chunk)
+{
+  init_workshare_ranges(nid, lb, ub, incr, chunk, GFS_HIERARCHY_DYNAMIC, NULL);
+}
+
+void hierarchy_init_workshare_dynamic_ull(int nid,
+                                          unsigned long long lb,
+                                          unsigned long long ub,
+                                          unsigned long long incr,
+                                          unsigned long long chunk)
+{
+  init_workshare_ranges_ull(nid, lb, ub, incr, chunk, GFS_HIERARCHY_DYNAMIC,
+                            NULL);
+}
+
+void hierarchy_init_workshare_guided(int nid,
+                                     long long lb,
+                                     long long ub,
+                                     long long incr,
+                                     long long chunk)
+{
+  init_workshare_ranges(nid, lb, ub, incr, chunk, GFS_HIERARCHY_GUIDED, NULL);
+}
+
+void hierarchy_init_workshare_guided_ull(int nid,
+                                         unsigned long long lb,
+                                         unsigned long long ub,
+                                         unsigned long long incr,
+                                         unsigned long long chunk)
+{
+  init_workshare_ranges_ull(nid, lb, ub, incr, chunk, GFS_HIERARCHY_GUIDED,
+                            NULL);
+}
+
+/* Initialize the node's work share for a probing loop once execution has been
+   restricted to a subset of nodes.  Rather than probing, nodes statically
+   split the loop according to the subset's core speed ratings. */
+static void init_workshare_subset(int nid,
+                                  long long lb,
+                                  long long ub,
+                                  long long incr,
+                                  long long chunk)
+{
+  unsigned long long trips = 0, first, last;
+
+  if(incr > 0 && lb < ub) trips = (ub - lb + incr - 1) / incr;
+  else if(incr < 0 && lb > ub) trips = (lb - ub - incr - 1) / -incr;
+  if(hierarchy_static_node_trips(gomp_thread()->ts.team_id, trips, lb, incr,
+                                 &first, &last) < 0)
+    first = last = trips;
+  hierarchy_init_workshare_static(nid,
+                                  first < trips ? lb + first * incr : ub,
+                                  last < trips ? lb + last * incr : ub,
+                                  incr, chunk);
+}
+
+static void init_workshare_subset_ull(int nid,
+                                      unsigned long long lb,
+                                      unsigned long long ub,
+                                      unsigned long long incr,
+                                      unsigned long long chunk)
+{
+  unsigned long long trips = 0, first, last;
+
+  if(lb < ub) trips = (ub - lb + incr - 1) / incr;
+  if(hierarchy_static_node_trips(gomp_thread()->ts.team_id, trips, lb, incr,
+                                 &first, &last) < 0)
+    first = last = trips;
+  hierarchy_init_workshare_static_ull(nid,
+                                      first < trips ? lb + first * incr : ub,
+                                      last < trips ? lb + last * incr : ub,
+                                      incr, chunk);
+}
+
+/* If execution was restricted to a subset of nodes & the restriction expired,
+   re-probe the prime region across all nodes. */
+static inline void check_reprobe(workshare_csr_t *ent)
+{
+  if(popcorn_global.subset.reprobe && popcorn_prime_region &&
+     strcmp(ent->ident, popcorn_prime_region) == 0)
+  {
+    ent->trips = 0;
+    popcorn_global.subset.reprobe = false;
+  }
+}
+
 void hierarchy_init_workshare_hetprobe(int nid,
                                        const void *ident,
                                        long long lb,
@@ -1001,11 +1902,8 @@ void hierarchy_init_workshare_hetprobe(int nid,
   if(popcorn_global.popcorn_killswitch)
   {
     /* Somebody hit the distributed execution killswitch, only give work to the
-       preferred node. */
-    if(nid == popcorn_preferred_node)
-      hierarchy_init_workshare_static(nid, lb, ub, incr, 1);
-    else
-      hierarchy_init_workshare_static(nid, ub + incr, ub, incr, 1);
+       subset of nodes chosen by the probe. */
+    init_workshare_subset(nid, lb, ub, incr, 1);
     thr->ts.static_trip = 0;
     return;
   }
@@ -1025,15 +1923,18 @@ void hierarchy_init_workshare_hetprobe(int nid,
 #ifdef _CACHE_HETPROBE
       ent = get_or_create_entry(ident, &new_ent);
       ent->chunk_size = chunk;
-      if(!new_ent) /* Hey we've seen you before! */
+      if(!new_ent && ent->probed) /* Hey we've seen you before! */
       {
+        check_reprobe(ent);
         if(ent->trips >= popcorn_max_probes)
         {
           calculate_splits(ent, global);
           global->sched = GFS_HIERARCHY_DYNAMIC;
+          if(ent->cached) popcorn_global.cached_ent = ent;
         }
         else ent->trips++;
       }
+      ent->probed = true;
 #endif
       gomp_ptrlock_set(&popcorn_global.ws_lock, global);
     }
@@ -1075,10 +1976,7 @@ void hierarchy_init_workshare_hetprobe_ull(int nid,
 
   if(popcorn_global.popcorn_killswitch)
   {
-    if(nid == popcorn_preferred_node)
-      hierarchy_init_workshare_static_ull(nid, lb, ub, incr, chunk);
-    else
-      hierarchy_init_workshare_static_ull(nid, ub + incr, ub, incr, chunk);
+    init_workshare_subset_ull(nid, lb, ub, incr, chunk);
     thr->ts.static_trip = 0;
     return;
   }
@@ -1098,15 +1996,18 @@ void hierarchy_init_workshare_hetprobe_ull(int nid,
 #ifdef _CACHE_HETPROBE
       ent = get_or_create_entry(ident, &new_ent);
       ent->chunk_size_ull = chunk;
-      if(!new_ent) /* Hey we've seen you before! */
+      if(!new_ent && ent->probed) /* Hey we've seen you before! */
       {
+        check_reprobe(ent);
         if(ent->trips >= popcorn_max_probes)
         {
           calculate_splits_ull(ent, global);
           global->sched = GFS_HIERARCHY_DYNAMIC;
+          if(ent->cached) popcorn_global.cached_ent = ent;
         }
         else ent->trips++;
       }
+      ent->probed = true;
 #endif
       gomp_ptrlock_set(&popcorn_global.ws_lock, global);
     }
@@ -1131,51 +2032,46 @@ void hierarchy_init_workshare_hetprobe_ull(int nid,
 
 bool hierarchy_next_dynamic(int nid, long *start, long *end)
 {
-  bool ret;
-  struct gomp_thread *thr = gomp_thread();
-  struct gomp_work_share *ws = thr->ts.work_share;
-  long chunk;
+  unsigned long long first, last;
 
-  /* *Must* use the locked versions to avoid racing against the leader when
-     replenishing work from the global pool */
-  gomp_mutex_lock(&ws->lock);
-  ret = gomp_iter_dynamic_next_locked_ws(start, end, ws);
-  if(!ret && !ws->threads_completed)
-  {
-    /* Local work share is out of work to distribute; replenish from global */
-    chunk = ws->chunk_size * popcorn_global.threads_per_node[nid];
-    ret = gomp_iter_dynamic_next_raw(&ws->next, &ws->end,
-                                     &popcorn_global.ws, chunk);
-    if(ret) ret = gomp_iter_dynamic_next_locked_ws(start, end, ws);
-    else ws->threads_completed = true;
-  }
-  gomp_mutex_unlock(&ws->lock);
-
-  return ret;
+  if(!dyn_next(nid, &first, &last)) return false;
+  *start = popcorn_global.dyn.lb + (long)first * popcorn_global.dyn.incr;
+  *end = popcorn_global.dyn.lb + (long)last * popcorn_global.dyn.incr;
+  return true;
 }
 
 bool hierarchy_next_dynamic_ull(int nid,
                                 unsigned long long *start,
                                 unsigned long long *end)
 {
-  bool ret;
-  struct gomp_thread *thr = gomp_thread();
-  struct gomp_work_share *ws = thr->ts.work_share;
-  unsigned long long chunk;
+  unsigned long long first, last;
 
-  gomp_mutex_lock(&ws->lock);
-  ret = gomp_iter_ull_dynamic_next_locked_ws(start, end, ws);
-  if(!ret && !ws->threads_completed)
-  {
-    chunk = ws->chunk_size_ull * popcorn_global.threads_per_node[nid];
-    ret = gomp_iter_ull_dynamic_next_raw(&ws->next_ull, &ws->end_ull,
-                                         &popcorn_global.ws, chunk);
-    if(ret) ret = gomp_iter_ull_dynamic_next_locked_ws(start, end, ws);
-    else ws->threads_completed = true;
-  }
-  gomp_mutex_unlock(&ws->lock);
+  if(!dyn_next(nid, &first, &last)) return false;
+  *start = popcorn_global.dyn.lb_ull + first * popcorn_global.dyn.incr_ull;
+  *end = popcorn_global.dyn.lb_ull + last * popcorn_global.dyn.incr_ull;
+  return true;
+}
 
-  return ret;
+bool hierarchy_next_guided(int nid, long *start, long *end)
+{
+  unsigned long long first, last;
+
+  if(!dyn_next_guided(nid, &first, &last)) return false;
+  *start = popcorn_global.dyn.lb + (long)first * popcorn_global.dyn.incr;
+  *end = popcorn_global.dyn.lb + (long)last * popcorn_global.dyn.incr;
+  return true;
+}
+
+bool hierarchy_next_guided_ull(int nid,
+                               unsigned long long *start,
+                               unsigned long long *end)
+{
+  unsigned long long first, last;
+
+  if(!dyn_next_guided(nid, &first, &last)) return false;
+  *start = popcorn_global.dyn.lb_ull + first * popcorn_global.dyn.incr_ull;
+  *end = popcorn_global.dyn.lb_ull + last * popcorn_global.dyn.incr_ull;
+  return true;
 }
 
 static float calc_avg_us_per_pf()
@@ -1207,10 +2103,150 @@ static inline float time_weighted_average(float cur, float prev, bool first)
 
 #define MAX( a, b ) ((a) > (b) ? (a) : (b))
 
+/* Nodes whose threads fault at least once every SUBSET_MIN_USPF microseconds
+   spend too much time faulting for their share of a region to be worth the
+   cross-node traffic.  Nodes whose threads contribute less than
+   SUBSET_MIN_SHARE of the throughput of the nodes executing a region aren't
+   worth the cross-node synchronization. */
+#define SUBSET_MIN_USPF 100.0
+#define SUBSET_MIN_SHARE 0.05
+
+/* Scale for converting probed core speed ratings into the integer global
+   ratings used by the static scheduler. */
+#define SUBSET_RATING_SCALE 10.0
+
+/*
+ * Restrict execution to the nodes in KEEP: flip the killswitch & set the
+ * global core speed ratings to the remaining nodes' probed ratings (zero for
+ * dropped nodes) so that subsequent regions only execute on the subset.
+ * Dropped nodes' CSRs are set to NO_ITER, as the remainder of the current
+ * region still needs to be split.
+ */
+static void apply_node_subset(workshare_csr_t *csr,
+                              const bool keep[MAX_POPCORN_NODES],
+                              size_t kept,
+                              size_t probed);
+
+/*
+ * Choose the subset of nodes on which to execute after probing the prime
+ * region.  Nodes that fault too often or are too slow are dropped, starting
+ * with the slowest; the preferred node is never dropped.
+ */
+static void select_node_subset(workshare_csr_t *csr)
+{
+  int i, slowest;
+  size_t probed = 0, kept = 0;
+  bool keep[MAX_POPCORN_NODES];
+  unsigned long long elapsed;
+  float uspf, throughput, min, total;
+
+  /* Drop nodes that spend their time faulting */
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    keep[i] = false;
+    elapsed = popcorn_global.workshare_time[i];
+    if(!popcorn_global.threads_per_node[i] || !elapsed) continue;
+    probed++;
+    if(i != popcorn_preferred_node && popcorn_global.page_faults[i])
+    {
+      uspf = (float)elapsed / (float)popcorn_global.page_faults[i];
+      if(uspf <= SUBSET_MIN_USPF) continue;
+    }
+    keep[i] = true;
+  }
+
+  /* Drop the slowest remaining nodes until every node contributes enough */
+  do
+  {
+    slowest = -1;
+    min = FLT_MAX;
+    total = 0.0;
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
+      if(keep[i]) total += csr->core_speed_rating[i] *
+                           popcorn_global.threads_per_node[i];
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
+    {
+      if(!keep[i] || i == popcorn_preferred_node) continue;
+      throughput = csr->core_speed_rating[i] *
+                   popcorn_global.threads_per_node[i];
+      if(throughput < SUBSET_MIN_SHARE * total && throughput < min)
+      {
+        min = throughput;
+        slowest = i;
+      }
+    }
+    if(slowest >= 0) keep[slowest] = false;
+  } while(slowest >= 0);
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++) if(keep[i]) kept++;
+  if(kept && kept < probed) apply_node_subset(csr, keep, kept, probed);
+}
+
+static void restore_node_subset(workshare_csr_t *csr)
+{
+  int i;
+  size_t probed = 0, kept = 0;
+  bool keep[MAX_POPCORN_NODES];
+
+  if(popcorn_global.popcorn_killswitch) return;
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    keep[i] = false;
+    if(!popcorn_global.threads_per_node[i]) continue;
+    probed++;
+    if(csr->core_speed_rating[i] > NO_ITER)
+    {
+      keep[i] = true;
+      kept++;
+    }
+  }
+  if(kept && kept < probed) apply_node_subset(csr, keep, kept, probed);
+}
+
+static void apply_node_subset(workshare_csr_t *csr,
+                              const bool keep[MAX_POPCORN_NODES],
+                              size_t kept,
+                              size_t probed)
+{
+  int i;
+
+  /* Save the user's configuration to restore when revisiting the decision */
+  popcorn_global.subset.het_workshare = popcorn_global.het_workshare;
+  popcorn_global.subset.scaled_thread_range =
+    popcorn_global.scaled_thread_range;
+  memcpy(popcorn_global.subset.core_speed_rating,
+         popcorn_global.core_speed_rating,
+         sizeof(unsigned long) * MAX_POPCORN_NODES);
+
+  popcorn_global.popcorn_killswitch = true;
+  popcorn_global.het_workshare = true;
+  popcorn_global.scaled_thread_range = 0;
+  csr->scaled_thread_range = 0.0;
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    if(keep[i])
+      popcorn_global.core_speed_rating[i] =
+        MAX(lroundf(csr->core_speed_rating[i] * SUBSET_RATING_SCALE), 1);
+    else
+    {
+      popcorn_global.core_speed_rating[i] = 0;
+      csr->core_speed_rating[i] = NO_ITER;
+    }
+    popcorn_global.scaled_thread_range +=
+      popcorn_global.core_speed_rating[i] *
+      popcorn_global.threads_per_node[i];
+    csr->scaled_thread_range +=
+      csr->core_speed_rating[i] * popcorn_global.threads_per_node[i];
+  }
+
+  popcorn_log("%s: only executing on %lu of %lu nodes\n",
+              csr->ident, kept, probed);
+}
+
 // TODO this is ugly, refactor
 static void calc_het_probe_workshare(int nid, bool ull, workshare_csr_t *csr)
 {
-  bool leader, calc_csr = true;
+  bool leader;
   size_t i, max_idx;
   unsigned long long cur_elapsed, min = UINT64_MAX, max = 0, sent, recv;
   float scale, cur_rating;
@@ -1230,80 +2266,47 @@ static void calc_het_probe_workshare(int nid, bool ull, workshare_csr_t *csr)
     csr->uspf =
       time_weighted_average(calc_avg_us_per_pf(), csr->uspf, csr->trips);
 
-    /* If we've reached max probes, make a determination -- are we going to run
-       across nodes or not? */
-    if(csr->trips >= popcorn_max_probes && popcorn_prime_region &&
-       strcmp(csr->ident, popcorn_prime_region) == 0)
+    /* Find the min & max values for scaling */
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
     {
-      if(csr->uspf <= 100.0)
+      cur_elapsed = popcorn_global.workshare_time[i];
+      if(cur_elapsed)
       {
-        /* It's not worth it -- use only the preferred node.  Note that we
-           still need to set up the CSR for the remaining iterations in this
-           work-sharing region.  Also set the global core speed rating, as
-           the next hetprobe region will default to the static scheduler. */
-        calc_csr = false;
-        popcorn_global.popcorn_killswitch = true;
-        popcorn_global.het_workshare = true;
-        for(i = 0; i < MAX_POPCORN_NODES; i++)
+        if(cur_elapsed < min) min = cur_elapsed;
+        if(cur_elapsed > max)
         {
-          if(i == popcorn_preferred_node)
-          {
-            popcorn_global.core_speed_rating[i] = 1;
-            popcorn_global.scaled_thread_range =
-              popcorn_global.threads_per_node[i];
-            csr->core_speed_rating[i] = 1.0;
-            csr->scaled_thread_range = popcorn_global.threads_per_node[i];
-          }
-          else
-          {
-            popcorn_global.core_speed_rating[i] = 0;
-            csr->core_speed_rating[i] = 0.0;
-          }
+          max = cur_elapsed;
+          max_idx = i;
         }
-
-        popcorn_log("%s: us per fault < 100, only executing on node %d\n",
-                    csr->ident, popcorn_preferred_node);
       }
     }
 
-    if(calc_csr)
+    /* Calculate core speed ratings based on ratio of each nodes' probe time
+       to the minimum time. Also, accumulate page faults from all nodes. */
+    csr->scaled_thread_range = 0.0;
+    scale = 1.0 / ((float)min / (float)max);
+    for(i = 0; i < MAX_POPCORN_NODES; i++)
     {
-      /* Find the min & max values for scaling */
-      for(i = 0; i < MAX_POPCORN_NODES; i++)
-      {
-        cur_elapsed = popcorn_global.workshare_time[i];
-        if(cur_elapsed)
-        {
-          if(cur_elapsed < min) min = cur_elapsed;
-          if(cur_elapsed > max)
-          {
-            max = cur_elapsed;
-            max_idx = i;
-          }
-        }
-      }
-
-      /* Calculate core speed ratings based on ratio of each nodes' probe time
-         to the minimum time. Also, accumulate page faults from all nodes. */
-      csr->scaled_thread_range = 0.0;
-      scale = 1.0 / ((float)min / (float)max);
-      for(i = 0; i < MAX_POPCORN_NODES; i++)
+      cur_elapsed = popcorn_global.workshare_time[i];
+      if(cur_elapsed)
       {
-        cur_elapsed = popcorn_global.workshare_time[i];
-        if(cur_elapsed)
-        {
-          /* Update CSRs based on an exponentially-weighted moving average */
-          cur_rating = (float)min / (float)cur_elapsed * scale;
-          csr->core_speed_rating[i] =
-            time_weighted_average(cur_rating,
-                                  csr->core_speed_rating[i],
-                                  csr->trips == 0);
-          csr->scaled_thread_range += csr->core_speed_rating[i] *
-                                      popcorn_global.threads_per_node[i];
-        }
+        /* Update CSRs based on an exponentially-weighted moving average */
+        cur_rating = (float)min / (float)cur_elapsed * scale;
+        csr->core_speed_rating[i] =
+          time_weighted_average(cur_rating,
+                                csr->core_speed_rating[i],
+                                csr->trips == 0);
+        csr->scaled_thread_range += csr->core_speed_rating[i] *
+                                    popcorn_global.threads_per_node[i];
       }
     }
 
+    /* If we've reached max probes, make a determination -- which nodes are we
+       going to run across? */
+    if(csr->trips >= popcorn_max_probes && popcorn_prime_region &&
+       strcmp(csr->ident, popcorn_prime_region) == 0)
+      select_node_subset(csr);
+
     if(ull)
     {
       popcorn_global.ws.next_ull += popcorn_global.ws.chunk_size_ull *
@@ -1423,6 +2426,139 @@ bool hierarchy_next_hetprobe_ull(int nid,
   }
 }
 
+/* Number of times the auto scheduler runs a region with each schedule before
+   picking the fastest.  The probing scheduler gets extra runs for probing, up
+   to AUTO_MAX_PROBES (the number of probes may be unlimited). */
+#define AUTO_TRIALS 2
+#define AUTO_MAX_PROBES 8
+
+/* Choose the schedule for the next run of ENT's region.  Try each schedule in
+   turn, then stick with the one with the lowest time per iteration.  The
+   chosen schedule's time keeps being updated, so if it slows down past another
+   schedule's the auto scheduler switches. */
+static int auto_select(workshare_csr_t *ent, bool probe)
+{
+  int i, best = -1;
+  size_t trials;
+
+  /* Distributed execution was deemed not worth it, stay on preferred node */
+  if(popcorn_global.popcorn_killswitch) return AUTO_STATIC;
+
+  for(i = 0; i < AUTO_SCHEDULES; i++)
+  {
+    trials = AUTO_TRIALS;
+    if(i == AUTO_HETPROBE)
+    {
+      if(!probe) continue;
+      trials += popcorn_max_probes < AUTO_MAX_PROBES ? popcorn_max_probes
+                                                     : AUTO_MAX_PROBES;
+    }
+    if(ent->auto_trials[i] < trials) return i;
+    if(best < 0 || ent->auto_us_per_iter[i] < ent->auto_us_per_iter[best])
+      best = i;
+  }
+  return best;
+}
+
+/* Pick the schedule for the current run of the auto-scheduled region IDENT
+   with ITERS iterations.  The first thread to arrive chooses & starts timing
+   the loop, the rest use its choice. */
+static int auto_begin(const void *ident, bool probe, unsigned long long iters)
+{
+  bool new_ent;
+  int *sched;
+
+  sched = gomp_ptrlock_get(&popcorn_global.auto_lock);
+  if(sched == NULL)
+  {
+    popcorn_global.autosched.ent = get_or_create_entry(ident, &new_ent);
+    popcorn_global.autosched.sched =
+      auto_select(popcorn_global.autosched.ent, probe);
+    popcorn_global.autosched.iters = iters ? iters : 1;
+    clock_gettime(CLOCK_MONOTONIC, &popcorn_global.autosched.start);
+    sched = &popcorn_global.autosched.sched;
+    gomp_ptrlock_set(&popcorn_global.auto_lock, sched);
+  }
+  return *sched;
+}
+
+/* Record how long the current run of an auto-scheduled region took.  Must be
+   called by a single thread after all threads have finished the loop. */
+static void auto_end(void)
+{
+  struct timespec end;
+  workshare_csr_t *ent = popcorn_global.autosched.ent;
+  int sched = popcorn_global.autosched.sched;
+  float us;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  us = (float)(ELAPSED(popcorn_global.autosched.start, end) / 1000) /
+       (float)popcorn_global.autosched.iters;
+  ent->auto_us_per_iter[sched] =
+    time_weighted_average(us, ent->auto_us_per_iter[sched],
+                          ent->auto_trials[sched] == 0);
+  ent->auto_trials[sched]++;
+
+  popcorn_global.autosched.ent = NULL;
+  gomp_ptrlock_destroy(&popcorn_global.auto_lock);
+  gomp_ptrlock_init(&popcorn_global.auto_lock, NULL);
+}
+
+void hierarchy_init_workshare_auto(int nid,
+                                   const void *ident,
+                                   long long lb,
+                                   long long ub,
+                                   long long incr,
+                                   long long chunk,
+                                   bool probe)
+{
+  unsigned long long iters;
+
+  if(incr > 0) iters = ub > lb ? (ub - lb + incr - 1) / incr : 0;
+  else iters = lb > ub ? (lb - ub - incr - 1) / -incr : 0;
+
+  switch(auto_begin(ident, probe, iters))
+  {
+  case AUTO_HETPROBE:
+    hierarchy_init_workshare_hetprobe(nid, ident, lb, ub, incr, chunk);
+    break;
+  case AUTO_GUIDED:
+    init_workshare_ranges(nid, lb, ub, incr, 1, GFS_HIERARCHY_GUIDED,
+                          popcorn_global.autosched.ent);
+    break;
+  default:
+    init_workshare_ranges(nid, lb, ub, incr, 1, GFS_HIERARCHY_STATIC,
+                          popcorn_global.autosched.ent);
+    break;
+  }
+}
+
+void hierarchy_init_workshare_auto_ull(int nid,
+                                       const void *ident,
+                                       unsigned long long lb,
+                                       unsigned long long ub,
+                                       unsigned long long incr,
+                                       unsigned long long chunk,
+                                       bool probe)
+{
+  unsigned long long iters = ub > lb ? (ub - lb + incr - 1) / incr : 0;
+
+  switch(auto_begin(ident, probe, iters))
+  {
+  case AUTO_HETPROBE:
+    hierarchy_init_workshare_hetprobe_ull(nid, ident, lb, ub, incr, chunk);
+    break;
+  case AUTO_GUIDED:
+    init_workshare_ranges_ull(nid, lb, ub, incr, 1, GFS_HIERARCHY_GUIDED,
+                              popcorn_global.autosched.ent);
+    break;
+  default:
+    init_workshare_ranges_ull(nid, lb, ub, incr, 1, GFS_HIERARCHY_STATIC,
+                              popcorn_global.autosched.ent);
+    break;
+  }
+}
+
 bool hierarchy_last(long end)
 {
   return end >= popcorn_global.ws.end;
@@ -1433,6 +2569,31 @@ bool hierarchy_last_ull(unsigned long long end)
   return end >= popcorn_global.ws.end_ull;
 }
 
+/* Fraction of a loop's iterations nodes may steal from each other before the
+   persisted ratings used to split the loop are considered stale.  If the
+   ratings still match the nodes' relative speeds, nodes finish their splits at
+   roughly the same time & little is stolen. */
+#define STALE_STOLEN 0.1
+
+/* Check whether the persisted ratings which split the loop that just finished
+   have drifted, & if so re-probe the region.  Must be called by a single
+   thread after all threads have finished the loop. */
+static void check_stale(void)
+{
+  workshare_csr_t *ent = popcorn_global.cached_ent;
+
+  popcorn_global.cached_ent = NULL;
+  if(popcorn_global.dyn.stolen * popcorn_global.dyn.grain >
+     STALE_STOLEN * popcorn_global.dyn.iters)
+  {
+    popcorn_log("%s: persisted probe results are stale, re-probing\n",
+                (const char *)ent->ident);
+    ent->probed = false;
+    ent->cached = false;
+    ent->trips = 0;
+  }
+}
+
 void hierarchy_loop_end(int nid, const void *ident, bool global)
 {
   struct gomp_thread *thr = gomp_thread();
@@ -1486,6 +2647,8 @@ void hierarchy_loop_end(int nid, const void *ident, bool global)
         gomp_fini_work_share(&popcorn_global.ws);
         gomp_ptrlock_destroy(&popcorn_global.ws_lock);
         gomp_ptrlock_init(&popcorn_global.ws_lock, NULL);
+        if(popcorn_global.autosched.ent) auto_end();
+        if(popcorn_global.cached_ent) check_stale();
         hierarchy_leader_cleanup(&popcorn_global.sync);
       }
       gomp_team_barrier_wait_nospin(&popcorn_global.bar);
@@ -13,6 +13,7 @@
 #include <time.h>
 #include "libgomp.h"
 #include "platform.h"
+#include "migrate.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Type definitions & declarations
@@ -40,6 +41,24 @@ typedef struct {
   size_t ALIGN_CACHE remaining;
 } leader_select_t;
 
+/* Per-node iteration range for the hierarchical dynamic scheduler, in units of
+   popcorn_global.dyn.grain iterations from the start of the loop.  The next &
+   end units are packed into a single word so that the node's threads can
+   claim chunks with a fetch-add and idle nodes can steal half of the remaining
+   range with a compare-and-swap, all without locks. */
+#define DYN_MAX_UNITS (1ULL << 31)
+#define DYN_MAX_CHUNK (1UL << 20)
+
+typedef union {
+  struct {
+    uint64_t range; /* Next unit (upper 32 bits) & end unit (lower 32 bits) */
+    unsigned long chunk; /* Units claimed at a time by the node's threads */
+    int stealing; /* A thread on the node is stealing from other nodes */
+    bool done; /* The node ran out of work & there's nothing left to steal */
+  };
+  char padding[64];
+} ALIGN_CACHE dyn_range_t;
+
 /* Global Popcorn execution information.  The read-only/read-mostly data (flags
    & thread placement locations) are placed on the first page, whereas data
    that is meant to be shared across nodes is on subsequent pages. */
@@ -53,7 +72,8 @@ typedef struct {
   bool hybrid_reduce;
   bool het_workshare;
 
-  /* Once flipped, disables distributed execution. */
+  /* Once flipped, restricts execution to the nodes with non-zero core speed
+     ratings (see hierarchy_update_node_subset()). */
   bool popcorn_killswitch;
 
   /* Popcorn nodes available & thread placement across nodes as specified by
@@ -76,9 +96,33 @@ typedef struct {
     unsigned long scaled_thread_range;
   };
 
+  /* The user's thread placement, core speed ratings & work sharing setting,
+     saved while execution is restricted to a subset of nodes, along with the
+     number of parallel regions executed since the restriction.  Once
+     popcorn_reprobe_period regions have executed, all nodes are restored &
+     the prime region is re-probed. */
+  struct {
+    bool active;
+    bool reprobe;
+    bool het_workshare;
+    int nthreads;
+    unsigned long regions;
+    unsigned long node_places[MAX_POPCORN_NODES];
+    unsigned long core_speed_rating[MAX_POPCORN_NODES];
+    unsigned long scaled_thread_range;
+  } subset;
+
   /* Cache of computed core speeds from the probing scheduler */
   htab_t workshare_cache;
 
+  /* Primary array written by work-sharing regions, if declared (see
+     omp_popcorn_page_align()).  Splits between nodes' iterations are rounded
+     to the array's page boundaries. */
+  struct {
+    const void *base;
+    size_t elem_size;
+  } primary;
+
   /* Global node leader selection */
   leader_select_t ALIGN_PAGE sync;
   leader_select_t ALIGN_CACHE opt;
@@ -93,6 +137,38 @@ typedef struct {
   struct gomp_work_share ALIGN_PAGE ws;
   gomp_ptrlock_t ws_lock;
 
+  /* Iteration space of the current hierarchical dynamic loop.  Iteration i
+     of 'iters' is lb + i * incr, and nodes' ranges are tracked in units of
+     'grain' iterations (see dyn_range_t).  'stolen' counts the units nodes
+     stole from other nodes. */
+  struct {
+    union {
+      long lb;
+      unsigned long long lb_ull;
+    };
+    union {
+      long incr;
+      unsigned long long incr_ull;
+    };
+    unsigned long long iters;
+    unsigned long long grain;
+    unsigned long long stolen;
+  } dyn;
+
+  /* The auto scheduler's choice for the current loop, made by the first thread
+     to arrive, along with the region's cache entry & when the loop started. */
+  gomp_ptrlock_t auto_lock;
+  struct {
+    struct workshare_csr *ent;
+    int sched;
+    unsigned long long iters;
+    struct timespec start;
+  } autosched;
+
+  /* Cache entry loaded from the persistent probe cache whose ratings split
+     the current loop, checked for staleness at the end of the loop. */
+  struct workshare_csr *cached_ent;
+
   /* Global timing information for the heterogeneous probing scheduler */
   unsigned long long workshare_time[MAX_POPCORN_NODES];
 
@@ -131,9 +207,12 @@ typedef struct {
   /* Per-node reduction space */
   aligned_void_ptr reductions[REDUCTION_ENTRIES];
 
-  /* Per-node work shares.  Maintains a local view of the work-sharing region
-     which will be replenished dynamically from the global work distribution
-     queue. */
+  /* Per-node iterations for the hierarchical dynamic scheduler.  Read by
+     other nodes only when they steal work. */
+  dyn_range_t dyn;
+
+  /* Per-node work shares.  Maintains a local view of the work-sharing region;
+     dynamically-scheduled iterations are handed out from DYN. */
   struct gomp_work_share ws;
   gomp_ptrlock_t ws_lock;
 
@@ -145,14 +224,20 @@ typedef struct {
      period we *must* use the difference in fault counts from the same node. */
   unsigned long long page_faults;
 
+  /* Per-node migration gang.  Threads newly placed on the node migrate to it
+     together at the start of a parallel region. */
+  migrate_gang_t gang;
+
   char padding[PAGESZ - ROUND_UP(sizeof(node_init_t), 64)
                       - (2 * sizeof(leader_select_t))
                       - sizeof(gomp_barrier_t)
                       - (sizeof(aligned_void_ptr) * REDUCTION_ENTRIES)
+                      - sizeof(dyn_range_t)
                       - sizeof(struct gomp_work_share)
                       - sizeof(gomp_ptrlock_t)
                       - sizeof(unsigned long long)
-                      - sizeof(unsigned long long)];
+                      - sizeof(unsigned long long)
+                      - sizeof(migrate_gang_t)];
 } node_info_t;
 
 _Static_assert((sizeof(node_info_t) & (PAGESZ - 1)) == 0,
@@ -185,6 +270,23 @@ void hierarchy_init_global(int nodes);
  */
 void hierarchy_init_node(int nid);
 
+/*
+ * Set the number of threads which will migrate to a node together, i.e., the
+ * threads newly placed on the node at the start of a parallel region.
+ * @param nid the node ID
+ * @param num the number of threads
+ */
+void hierarchy_init_node_gang(int nid, size_t num);
+
+/*
+ * Migrate the calling thread to a node together with the rest of the node's
+ * gang (see hierarchy_init_node_gang()).  The gang's stacks are rewritten in a
+ * single batch and its threads migrate at the same time.  Falls back to
+ * migrating the thread by itself if the gang couldn't be used.
+ * @param nid the node ID
+ */
+void hierarchy_migrate_node_gang(int nid);
+
 /*
  * Return the node on which a thread should execute given the user's places
  * specification.  Updates internal counters to reflect the placement.
@@ -236,6 +338,15 @@ void hierarchy_init_node_team_state(int nid,
  */
 void hierarchy_clear_node_team_state(int nid);
 
+/*
+ * Apply or expire the subset of nodes chosen by the HetProbe scheduler at the
+ * end of a parallel region.  If the scheduler just restricted execution to a
+ * subset of nodes, only place threads on those nodes (the main thread always
+ * stays on the origin).  After popcorn_reprobe_period parallel regions restore
+ * the user's placement so the decision is revisited.
+ */
+void hierarchy_update_node_subset(void);
+
 /*
  * Initialize thread state to begin execution of parallel region.
  * @param nid the node on which to execute
@@ -312,6 +423,27 @@ void hierarchy_init_workshare_static_ull(int nid,
                                          unsigned long long incr,
                                          unsigned long long chunk);
 
+/*
+ * Calculate the iterations of a statically-scheduled loop for a thread's node.
+ * Nodes get iterations in proportion to their number of threads (scaled by
+ * core speed ratings if heterogeneous work sharing is enabled), & the splits
+ * between nodes are rounded to page boundaries of the primary array.
+ *
+ * @param gtid the thread's ID
+ * @param trips the number of loop iterations
+ * @param lb the lower bound
+ * @param incr the increment
+ * @param first set to the index of the node's first iteration
+ * @param last set to the index after the node's last iteration
+ * @return the thread's index within its node, or -1 if not placed on a node
+ */
+int hierarchy_static_node_trips(int gtid,
+                                unsigned long long trips,
+                                long long lb,
+                                long long incr,
+                                unsigned long long *first,
+                                unsigned long long *last);
+
 /*
  * Initialize work-sharing construct using the hierarchical dynamic scheduler
  * for the node.
@@ -335,6 +467,30 @@ void hierarchy_init_workshare_dynamic_ull(int nid,
                                           unsigned long long incr,
                                           unsigned long long chunk);
 
+/*
+ * Initialize work-sharing construct using the hierarchical guided scheduler
+ * for the node.  Nodes get iterations in proportion to their core speed
+ * ratings, which their threads claim in decreasingly-sized chunks.
+ *
+ * @param nid the node for which to initialize a work-sharing construct
+ * @param lb the lower bound
+ * @param ub the upper bound
+ * @param incr the increment
+ * @param chunk the minimum chunk size
+ */
+void hierarchy_init_workshare_guided(int nid,
+                                     long long lb,
+                                     long long ub,
+                                     long long incr,
+                                     long long chunk);
+
+/* Same as above but with unsigned long long types */
+void hierarchy_init_workshare_guided_ull(int nid,
+                                         unsigned long long lb,
+                                         unsigned long long ub,
+                                         unsigned long long incr,
+                                         unsigned long long chunk);
+
 /*
  * Initialize work-sharing construct using the heterogeneous probing scheduler
  * for the node.
@@ -362,8 +518,39 @@ void hierarchy_init_workshare_hetprobe_ull(int nid,
                                            unsigned long long chunk);
 
 /*
- * Grab the next batch of iterations from the local work share.  Replenish from
- * the global work share if necessary.
+ * Initialize work-sharing construct for the auto scheduler, which chooses
+ * between the heterogeneous probing, hierarchical guided & hierarchical static
+ * schedulers based on how long each previously took to run the region.
+ *
+ * @param nid the node for which to initialize a work-sharing construct
+ * @param ident a pointer uniquely identifying the work-sharing region
+ * @param lb the loop iteration range's lower bound
+ * @param ub the loop iteration range's upper bound
+ * @param st the stride
+ * @param chunk the chunk size for the heterogeneous probing scheduler
+ * @param probe whether the heterogeneous probing scheduler may be chosen
+ */
+void hierarchy_init_workshare_auto(int nid,
+                                   const void *ident,
+                                   long long lb,
+                                   long long ub,
+                                   long long incr,
+                                   long long chunk,
+                                   bool probe);
+
+/* Same as above but with unsigned long long types */
+void hierarchy_init_workshare_auto_ull(int nid,
+                                       const void *ident,
+                                       unsigned long long lb,
+                                       unsigned long long ub,
+                                       unsigned long long incr,
+                                       unsigned long long chunk,
+                                       bool probe);
+
+/*
+ * Grab the next chunk of iterations from the node's range.  If the node has
+ * run out, one of its threads steals half of the remaining range from the node
+ * with the most work left while the others wait for it.
  *
  * Note: should be called for the first iteration by the GFS_HETPROBE scheduler
  * algorithm, after which hierarchy_next_hetprobe() should be called
@@ -380,6 +567,22 @@ bool hierarchy_next_dynamic_ull(int nid,
                                 unsigned long long *start,
                                 unsigned long long *end);
 
+/*
+ * Grab the next guided chunk of iterations from the node's range, stealing
+ * from other nodes if the node has run out (see hierarchy_next_dynamic()).
+ *
+ * @param nid the node for which to grab more work
+ * @param start pointer to variable to be set to the start of range
+ * @param end pointer to variable to be set to the end of range
+ * @return true if there's work remaining to be performed
+ */
+bool hierarchy_next_guided(int nid, long *start, long *end);
+
+/* Same as above but with unsigned long long types */
+bool hierarchy_next_guided_ull(int nid,
+                               unsigned long long *start,
+                               unsigned long long *end);
+
 /*
  * Called *after* the probing period for the heterogeneous probing scheduler.
  * Divides remaining global iterations between nodes according to timing
@@ -420,8 +623,8 @@ bool hierarchy_last_ull(unsigned long long end);
  *
  * @param nid the node for which to (potentially) clean up resources
  * @param ident a pointer uniquely identifying the work-sharing region
- * @param global whether the global workshare was used (dynamic, hetprobe
- *               scheduler) or not (static scheduler)
+ * @param global whether the global workshare was used (dynamic, guided, auto,
+ *               hetprobe scheduler) or not (static scheduler)
  */
 void hierarchy_loop_end(int nid, const void *ident, bool global);
 
@@ -120,26 +120,12 @@ __kmpc_fork_call(ident_t *loc, int32_t argc, kmpc_micro microtask, void *ctx)
 #endif
 
   /*
-   * We've already set the core speed ratios to adjust for single-node
-   * execution, change the configuration so that only threads on the
-   * preferred node execute.
+   * We've already set the core speed ratios if the HetProbe scheduler decided
+   * to only execute on a subset of nodes, change the configuration so that
+   * only threads on those nodes execute (or restore all nodes to revisit the
+   * decision).
    */
-  // TODO hardcoded for 2 nodes
-  if(popcorn_global.popcorn_killswitch)
-  {
-    if(popcorn_preferred_node == 0)
-    {
-      omp_set_num_threads(popcorn_global.node_places[0]);
-      popcorn_global.node_places[1] = 0;
-      hierarchy_clear_node_team_state(1);
-    }
-    else
-    {
-      omp_set_num_threads(popcorn_global.node_places[1] + 1);
-      popcorn_global.node_places[0] = 1;
-      hierarchy_clear_node_team_state(0);
-    }
-  }
+  hierarchy_update_node_subset();
 
   if(argc > 1) free(ctx);
   free(wrapper_data);
@@ -277,6 +263,59 @@ for_static_skewed_init(4u, uint32_t)
 for_static_skewed_init(8, int64_t)
 for_static_skewed_init(8u, uint64_t)
 
+/*
+ * Compute the upper and lower bounds to be used for the set of iterations to
+ * be executed by the current thread from the statically scheduled loop that is
+ * described by the initial values of the bounds & increment.  Split iterations
+ * between nodes so that nodes' iterations start on page boundaries of the
+ * primary array (see omp_popcorn_page_align()), then evenly between threads on
+ * each node.
+ * @param gtid global thread ID of this thread
+ * @param plastiter pointer to the "last iteration" flag
+ * @param plower pointer to the lower bound
+ * @param pupper pointer to the upper bound
+ * @param incr loop increment
+ * @param total_trips total number of loop iterations to be scheduled
+ */
+#define for_static_aligned_init(NAME, TYPE)                                   \
+static void for_static_aligned_init_##NAME(int32_t gtid,                      \
+                                           int32_t *plastiter,                \
+                                           TYPE *plower,                      \
+                                           TYPE *pupper,                      \
+                                           TYPE incr,                         \
+                                           TYPE total_trips)                  \
+{                                                                             \
+  int tid;                                                                    \
+  unsigned long long first, last, chunk, extras, threads;                     \
+                                                                              \
+  tid = hierarchy_static_node_trips(gtid, total_trips, *plower, incr,         \
+                                    &first, &last);                           \
+  if(tid < 0)                                                                 \
+  {                                                                           \
+    *plower = *pupper + incr;                                                 \
+    return;                                                                   \
+  }                                                                           \
+                                                                              \
+  threads = popcorn_global.threads_per_node[gomp_thread()->popcorn_nid];      \
+  chunk = (last - first) / threads;                                           \
+  extras = (last - first) % threads;                                          \
+  first += tid * chunk + (tid < extras ? tid : extras);                       \
+  last = first + chunk + (tid < extras ? 1 : 0);                              \
+  if(first < last)                                                            \
+  {                                                                           \
+    *plower += incr * first;                                                  \
+    *pupper = *plower + incr * (last - first - 1);                            \
+  }                                                                           \
+  else *plower = *pupper + incr;                                              \
+  if(plastiter != NULL) *plastiter = (first < last && last == total_trips);   \
+}                                                                             \
+
+/* Generate the above function for int32_t, uint32_t, int64_t, && uint64_t. */
+for_static_aligned_init(4, int32_t)
+for_static_aligned_init(4u, uint32_t)
+for_static_aligned_init(8, int64_t)
+for_static_aligned_init(8u, uint64_t)
+
 /*
  * Compute the upper and lower bounds and stride to be used for the set of
  * iterations to be executed by the current thread from the statically
@@ -319,6 +358,14 @@ void __kmpc_for_static_init_##NAME(ident_t *loc,                              \
   if(popcorn_log_statistics)                                                  \
     hierarchy_init_statistics(gomp_thread()->popcorn_nid);                    \
                                                                               \
+  if(schedtype == kmp_sch_static && popcorn_global.primary.base &&            \
+     popcorn_distributed())                                                   \
+  {                                                                           \
+    for_static_aligned_init_##NAME(gtid, plastiter, plower, pupper, incr,     \
+                                   total_trips);                              \
+    return;                                                                   \
+  }                                                                           \
+                                                                              \
   if(popcorn_global.het_workshare)                                            \
   {                                                                           \
     for_static_skewed_init_##NAME(nthreads, gtid, schedtype, plastiter,       \
@@ -403,6 +450,8 @@ static inline enum sched_type select_runtime_schedule()
       schedule = kmp_sch_static_chunked;
     break;
   case GFS_DYNAMIC: schedule = kmp_sch_dynamic_chunked; break;
+  case GFS_GUIDED: schedule = kmp_sch_guided_chunked; break;
+  case GFS_AUTO: schedule = kmp_sch_auto; break;
   case GFS_HETPROBE: schedule = kmp_sch_hetprobe; break;
   }
   return schedule;
@@ -457,6 +506,9 @@ static inline unsigned long long calc_chunk_size_ull(unsigned long long lb,
                              STATIC_HIERARCHY_INIT,                           \
                              DYN_INIT,                                        \
                              DYN_HIERARCHY_INIT,                              \
+                             GUIDED_INIT,                                     \
+                             GUIDED_HIERARCHY_INIT,                           \
+                             AUTO_HIERARCHY_INIT,                             \
                              HETPROBE_INIT)                                   \
 void __kmpc_dispatch_init_##NAME(ident_t *loc,                                \
                                  int32_t gtid,                                \
@@ -497,6 +549,14 @@ void __kmpc_dispatch_init_##NAME(ident_t *loc,                                \
     schedule = kmp_sch_dynamic_chunked_hierarchy;                             \
     DEBUG_ONE("Switching to hierarchical dynamic scheduler\n");               \
   }                                                                           \
+  else if(schedule == kmp_sch_guided_chunked && distributed) {                \
+    schedule = kmp_sch_guided_chunked_hierarchy;                              \
+    DEBUG_ONE("Switching to hierarchical guided scheduler\n");                \
+  }                                                                           \
+  else if(schedule == kmp_sch_auto && !distributed) {                         \
+    schedule = kmp_sch_static;                                                \
+    DEBUG_ONE("Reverting to normal static scheduler (not distributed)\n");    \
+  }                                                                           \
   else if(schedule == kmp_sch_hetprobe)                                       \
   {                                                                           \
     if(!distributed) {                                                        \
@@ -536,6 +596,20 @@ void __kmpc_dispatch_init_##NAME(ident_t *loc,                                \
     }                                                                         \
     DYN_HIERARCHY_INIT(thr->popcorn_nid, lb, ub + 1, st, chunk);              \
     break;                                                                    \
+  case kmp_sch_guided_chunked:                                                \
+    GUIDED_INIT(lb, ub + 1, st, chunk);                                       \
+    break;                                                                    \
+  case kmp_sch_guided_chunked_hierarchy:                                      \
+    GUIDED_HIERARCHY_INIT(thr->popcorn_nid, lb, ub + 1, st, chunk);           \
+    break;                                                                    \
+  case kmp_sch_auto: {                                                        \
+    /* Only allow probing if the probe is small enough, see above */          \
+    TYPE probe = calc_chunk_size_##GOMP_TYPE(lb, ub, st, nthreads);           \
+    AUTO_HIERARCHY_INIT(thr->popcorn_nid, loc->psource, lb, ub + 1, st, probe,\
+                        nthreads * probe * st <=                              \
+                        (TYPE)((float)(ub - lb) * 0.25));                     \
+    break;                                                                    \
+  }                                                                           \
   case kmp_sch_hetprobe:                                                      \
     if(chunk <= 1) /* Auto-select probe size */                               \
     {                                                                         \
@@ -555,24 +629,36 @@ __kmpc_dispatch_init(4, int32_t, " %d", long,
                      hierarchy_init_workshare_static,
                      GOMP_loop_dynamic_init,
                      hierarchy_init_workshare_dynamic,
+                     GOMP_loop_guided_init,
+                     hierarchy_init_workshare_guided,
+                     hierarchy_init_workshare_auto,
                      hierarchy_init_workshare_hetprobe)
 __kmpc_dispatch_init(4u, uint32_t, " %u", ull,
                      GOMP_loop_ull_static_init,
                      hierarchy_init_workshare_static_ull,
                      GOMP_loop_ull_dynamic_init,
                      hierarchy_init_workshare_dynamic_ull,
+                     GOMP_loop_ull_guided_init,
+                     hierarchy_init_workshare_guided_ull,
+                     hierarchy_init_workshare_auto_ull,
                      hierarchy_init_workshare_hetprobe_ull)
 __kmpc_dispatch_init(8, int64_t, " %ld", long,
                      GOMP_loop_static_init,
                      hierarchy_init_workshare_static,
                      GOMP_loop_dynamic_init,
                      hierarchy_init_workshare_dynamic,
+                     GOMP_loop_guided_init,
+                     hierarchy_init_workshare_guided,
+                     hierarchy_init_workshare_auto,
                      hierarchy_init_workshare_hetprobe)
 __kmpc_dispatch_init(8u, uint64_t, " %lu", ull,
                      GOMP_loop_ull_static_init,
                      hierarchy_init_workshare_static_ull,
                      GOMP_loop_ull_dynamic_init,
                      hierarchy_init_workshare_dynamic_ull,
+                     GOMP_loop_ull_guided_init,
+                     hierarchy_init_workshare_guided_ull,
+                     hierarchy_init_workshare_auto_ull,
                      hierarchy_init_workshare_hetprobe_ull)
 
 /*
@@ -590,11 +676,13 @@ void __kmpc_dispatch_fini_##NAME(ident_t *loc, int32_t gtid)                  \
   switch(thr->ts.work_share->sched)                                           \
   {                                                                           \
   case GFS_STATIC: /* Fall through */                                         \
-  case GFS_DYNAMIC: GOMP_loop_end(); break;                                   \
+  case GFS_DYNAMIC: /* Fall through */                                        \
+  case GFS_GUIDED: GOMP_loop_end(); break;                                    \
   case GFS_HIERARCHY_STATIC:                                                  \
     hierarchy_loop_end(thr->popcorn_nid, loc->psource, false);                \
     break;                                                                    \
   case GFS_HIERARCHY_DYNAMIC: /* Fall through */                              \
+  case GFS_HIERARCHY_GUIDED: /* Fall through */                               \
   case GFS_HETPROBE:                                                          \
     hierarchy_loop_end(thr->popcorn_nid, loc->psource, true);                 \
     break;                                                                    \
@@ -620,8 +708,9 @@ __kmpc_dispatch_fini(8u)
  * @param p_st (unused)
  */
 #define __kmpc_dispatch_next(NAME, TYPE, GOMP_TYPE, SPEC,                     \
-                             DYN_NEXT, DYN_LAST,                              \
+                             DYN_NEXT, GUIDED_NEXT, DYN_LAST,                 \
                              DYN_HIERARCHY_NEXT,                              \
+                             GUIDED_HIERARCHY_NEXT,                           \
                              HETPROBE_NEXT,                                   \
                              HIERARCHY_LAST)                                  \
 int __kmpc_dispatch_next_##NAME(ident_t *loc,                                 \
@@ -665,10 +754,18 @@ int __kmpc_dispatch_next_##NAME(ident_t *loc,                                 \
     ret = DYN_NEXT(&istart, &iend);                                           \
     *p_last = DYN_LAST(iend);                                                 \
     break;                                                                    \
+  case GFS_GUIDED:                                                            \
+    ret = GUIDED_NEXT(&istart, &iend);                                        \
+    *p_last = DYN_LAST(iend);                                                 \
+    break;                                                                    \
   case GFS_HIERARCHY_DYNAMIC:                                                 \
     ret = DYN_HIERARCHY_NEXT(nid, &istart, &iend);                            \
     *p_last = HIERARCHY_LAST(iend);                                           \
     break;                                                                    \
+  case GFS_HIERARCHY_GUIDED:                                                  \
+    ret = GUIDED_HIERARCHY_NEXT(nid, &istart, &iend);                         \
+    *p_last = HIERARCHY_LAST(iend);                                           \
+    break;                                                                    \
   case GFS_HETPROBE:                                                          \
     ret = HETPROBE_NEXT(nid, loc->psource, &istart, &iend);                   \
     *p_last = HIERARCHY_LAST(iend);                                           \
@@ -695,20 +792,28 @@ int __kmpc_dispatch_next_##NAME(ident_t *loc,                                 \
 }
 
 __kmpc_dispatch_next(4, int32_t, long, " %d",
-                     GOMP_loop_dynamic_next, gomp_iter_is_last,
-                     hierarchy_next_dynamic, hierarchy_next_hetprobe,
+                     GOMP_loop_dynamic_next,
+                     GOMP_loop_guided_next, gomp_iter_is_last,
+                     hierarchy_next_dynamic, hierarchy_next_guided,
+                     hierarchy_next_hetprobe,
                      hierarchy_last)
 __kmpc_dispatch_next(4u, uint32_t, unsigned long long, " %u",
-                     GOMP_loop_ull_dynamic_next, gomp_iter_is_last_ull,
-                     hierarchy_next_dynamic_ull, hierarchy_next_hetprobe_ull,
+                     GOMP_loop_ull_dynamic_next,
+                     GOMP_loop_ull_guided_next, gomp_iter_is_last_ull,
+                     hierarchy_next_dynamic_ull, hierarchy_next_guided_ull,
+                     hierarchy_next_hetprobe_ull,
                      hierarchy_last_ull)
 __kmpc_dispatch_next(8, int64_t, long, " %ld",
-                     GOMP_loop_dynamic_next, gomp_iter_is_last,
-                     hierarchy_next_dynamic, hierarchy_next_hetprobe,
+                     GOMP_loop_dynamic_next,
+                     GOMP_loop_guided_next, gomp_iter_is_last,
+                     hierarchy_next_dynamic, hierarchy_next_guided,
+                     hierarchy_next_hetprobe,
                      hierarchy_last)
 __kmpc_dispatch_next(8u, uint64_t, unsigned long long, " %lu",
-                     GOMP_loop_ull_dynamic_next, gomp_iter_is_last_ull,
-                     hierarchy_next_dynamic_ull, hierarchy_next_hetprobe_ull,
+                     GOMP_loop_ull_dynamic_next,
+                     GOMP_loop_ull_guided_next, gomp_iter_is_last_ull,
+                     hierarchy_next_dynamic_ull, hierarchy_next_guided_ull,
+                     hierarchy_next_hetprobe_ull,
                      hierarchy_last_ull)
 
 /*
@@ -33,11 +33,14 @@ enum sched_type {
   kmp_sch_static_chunked = 33, /* statically chunked algorithm */
   kmp_sch_static = 34, /* static unspecialized */
   kmp_sch_dynamic_chunked = 35, /* dynamically chunked algorithm */
+  kmp_sch_guided_chunked = 36, /* guided unspecialized */
   kmp_sch_runtime = 37, /* runtime chooses from parsing OMP_SCHEDULE */
+  kmp_sch_auto = 38, /* auto */
   kmp_sch_hetprobe = 39, /* probe heterogeneous machines */
   kmp_sch_default = kmp_sch_static, /* default scheduling algorithm */
   kmp_sch_static_hierarchy = 128, /* hierarhical static algorithm */
-  kmp_sch_dynamic_chunked_hierarchy = 129 /* hierarhical dynamic chunked algorithm */
+  kmp_sch_dynamic_chunked_hierarchy = 129, /* hierarhical dynamic chunked algorithm */
+  kmp_sch_guided_chunked_hierarchy = 130 /* hierarchical guided algorithm */
 };
 
 /* Return whether compiler generated fast reduction method for reduce clause. */
@@ -141,6 +141,7 @@ enum gomp_schedule_type
   GFS_HETPROBE,
   GFS_HIERARCHY_STATIC,
   GFS_HIERARCHY_DYNAMIC,
+  GFS_HIERARCHY_GUIDED,
 };
 
 struct gomp_doacross_work_share
@@ -1205,8 +1206,11 @@ extern bool popcorn_log_statistics;
 extern size_t popcorn_max_probes;
 extern const char *popcorn_prime_region;
 extern int popcorn_preferred_node;
+extern size_t popcorn_reprobe_period;
+extern const char *popcorn_hetprobe_cache;
 
 extern void popcorn_init_workshare_cache(size_t);
+extern void popcorn_load_workshare_cache(const char *);
 
 extern bool popcorn_distributed ();
 extern bool popcorn_finished ();
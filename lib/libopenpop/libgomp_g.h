@@ -50,6 +50,7 @@ extern void GOMP_atomic_end (void);
 
 extern void GOMP_loop_static_init (long, long, long, long);
 extern void GOMP_loop_dynamic_init (long, long, long, long);
+extern void GOMP_loop_guided_init (long, long, long, long);
 
 extern bool GOMP_loop_static_start (long, long, long, long, long *, long *);
 extern bool GOMP_loop_dynamic_start (long, long, long, long, long *, long *);
@@ -130,6 +131,10 @@ extern void GOMP_loop_ull_dynamic_init (unsigned long long,
 					unsigned long long,
 					unsigned long long,
 					unsigned long long);
+extern void GOMP_loop_ull_guided_init (unsigned long long,
+				       unsigned long long,
+				       unsigned long long,
+				       unsigned long long);
 
 extern bool GOMP_loop_ull_static_start (bool, unsigned long long,
 					unsigned long long,
@@ -108,6 +108,18 @@ gomp_loop_dynamic_init (long start, long end, long incr, long chunk_size)
     }
 }
 
+static void
+gomp_loop_guided_init (long start, long end, long incr, long chunk_size)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  if (gomp_work_share_start (false))
+    {
+      gomp_loop_init (thr->ts.work_share, start, end, incr,
+		      GFS_GUIDED, chunk_size);
+      gomp_work_share_init_done ();
+    }
+}
+
 /* The *_start routines are called when first encountering a loop construct
    that is not bound directly to a parallel construct.  The first thread 
    that arrives will create the work-share construct; subsequent threads
@@ -746,6 +758,8 @@ extern __typeof(gomp_loop_static_init) GOMP_loop_static_init
   __attribute__((alias ("gomp_loop_static_init")));
 extern __typeof(gomp_loop_dynamic_init) GOMP_loop_dynamic_init
   __attribute__((alias ("gomp_loop_dynamic_init")));
+extern __typeof(gomp_loop_guided_init) GOMP_loop_guided_init
+  __attribute__((alias ("gomp_loop_guided_init")));
 
 extern __typeof(gomp_loop_static_start) GOMP_loop_static_start
 	__attribute__((alias ("gomp_loop_static_start")));
@@ -802,6 +816,12 @@ GOMP_loop_dynamic_init (long start, long end, long incr, long chunk_size)
   gomp_loop_dynamic_init (start, end, incr, chunk_size);
 }
 
+void
+GOMP_loop_guided_init (long start, long end, long incr, long chunk_size)
+{
+  gomp_loop_guided_init (start, end, incr, chunk_size);
+}
+
 bool
 GOMP_loop_static_start (long start, long end, long incr, long chunk_size,
 			long *istart, long *iend)
@@ -112,6 +112,19 @@ gomp_loop_ull_dynamic_init (gomp_ull start, gomp_ull end,
     }
 }
 
+static void
+gomp_loop_ull_guided_init (gomp_ull start, gomp_ull end,
+			   gomp_ull incr, gomp_ull chunk_size)
+{
+  struct gomp_thread *thr = gomp_thread ();
+  if (gomp_work_share_start (false))
+    {
+      gomp_loop_ull_init (thr->ts.work_share, true, start, end, incr,
+			  GFS_GUIDED, chunk_size);
+      gomp_work_share_init_done ();
+    }
+}
+
 /* The *_start routines are called when first encountering a loop construct
    that is not bound directly to a parallel construct.  The first thread
    that arrives will create the work-share construct; subsequent threads
@@ -596,6 +609,8 @@ extern __typeof(gomp_loop_ull_static_init) GOMP_loop_ull_static_init
 	__attribute__((alias ("gomp_loop_ull_static_init")));
 extern __typeof(gomp_loop_ull_dynamic_init) GOMP_loop_ull_dynamic_init
 	__attribute__((alias ("gomp_loop_ull_dynamic_init")));
+extern __typeof(gomp_loop_ull_guided_init) GOMP_loop_ull_guided_init
+	__attribute__((alias ("gomp_loop_ull_guided_init")));
 
 extern __typeof(gomp_loop_ull_static_start) GOMP_loop_ull_static_start
 	__attribute__((alias ("gomp_loop_ull_static_start")));
@@ -654,6 +669,13 @@ GOMP_loop_ull_dynamic_init (gomp_ull start, gomp_ull end,
   gomp_loop_ull_dynamic_init (start, end, inc, chunk_size);
 }
 
+void
+GOMP_loop_ull_guided_init (gomp_ull start, gomp_ull end,
+			   gomp_ull inc, gomp_ull chunk_size)
+{
+  gomp_loop_ull_guided_init (start, end, inc, chunk_size);
+}
+
 bool
 GOMP_loop_ull_static_start (bool up, gomp_ull start, gomp_ull end,
 			    gomp_ull incr, gomp_ull chunk_size,
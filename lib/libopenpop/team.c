@@ -107,17 +107,21 @@ gomp_thread_start (void *xdata)
   if (popcorn_profiling)
     fprintf(popcorn_prof_fp, "%d %d\n", gettid(), thr->popcorn_created_tid);
 
+  /* Reserve migration state now rather than when first migrating.  */
+  if (popcorn_distributed ())
+    migrate_reserve ();
+
   /* Make thread pool local. */
   pool = thr->thread_pool;
 
-  if (popcorn_distributed () && thr->popcorn_nid)
-    migrate (thr->popcorn_nid, NULL, NULL);
-
   if (data->nested)
     {
       struct gomp_team *team = thr->ts.team;
       struct gomp_task *task = thr->task;
 
+      if (popcorn_distributed () && thr->popcorn_nid)
+	migrate (thr->popcorn_nid, NULL, NULL);
+
       gomp_barrier_wait (&team->barrier);
 
       local_fn (local_data);
@@ -130,6 +134,12 @@ gomp_thread_start (void *xdata)
       pool->threads[thr->ts.team_id] = thr;
 
       gomp_simple_barrier_wait_select (&pool->threads_dock);
+
+      /* The main thread sized each node's gang before releasing us, so
+	 migrate together with the other new threads placed on our node. */
+      if (popcorn_distributed () && thr->popcorn_nid)
+	hierarchy_migrate_node_gang (thr->popcorn_nid);
+
       do
 	{
 	  struct gomp_team *team = thr->ts.team;
@@ -144,7 +154,7 @@ gomp_thread_start (void *xdata)
 
 	  if (popcorn_distributed ())
             {
-              if (thr->popcorn_nid != popcorn_getnid())
+              if (thr->popcorn_nid != cached_nid ())
 	        migrate(thr->popcorn_nid, NULL, NULL);
               if (thr->popcorn_nid != 0)
                 hierarchy_init_thread(thr->popcorn_nid);
@@ -158,7 +168,7 @@ gomp_thread_start (void *xdata)
     }
 
   /* Migrate back to origin just in case application migrated us elsewhere */
-  if (popcorn_distributed () && current_nid () > 0)
+  if (popcorn_distributed () && cached_nid () > 0)
     migrate (0, NULL, NULL);
 
   /* If distributed, wait for everybody to get back to origin before exiting */
@@ -294,7 +304,7 @@ gomp_release_pool_threads_final ()
     {
       /* Migrate back to origin just in case application migrated us
 	 elsewhere */
-      if (current_nid() > 0)
+      if (cached_nid () > 0)
 	migrate (0, NULL, NULL);
 
       if (pool && pool->threads_dock.bar.total)
@@ -392,6 +402,7 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   unsigned int affinity_count = 0;
   struct gomp_thread **affinity_thr = NULL;
   unsigned int nodes, nid;
+  unsigned int new_threads_per_node[MAX_POPCORN_NODES];
   bool popcorn_place;
 
   thr = gomp_thread ();
@@ -440,7 +451,10 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
   if (popcorn_place)
     {
       for (nid = 0; nid < MAX_POPCORN_NODES; nid++)
-	popcorn_global.threads_per_node[nid] = 0;
+	{
+	  popcorn_global.threads_per_node[nid] = 0;
+	  new_threads_per_node[nid] = 0;
+	}
       thr->popcorn_nid = hierarchy_assign_node(0);
     }
 
@@ -951,7 +965,10 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
       /* Note: since this thread is new it's data is still on the origin, so
          no need to have per-node leaders initialize it. */
       if (popcorn_place)
-	start_data->popcorn_nid = hierarchy_assign_node(i);
+	{
+	  start_data->popcorn_nid = hierarchy_assign_node(i);
+	  new_threads_per_node[start_data->popcorn_nid]++;
+	}
       gomp_init_task (start_data->task, task, icv);
       team->implicit_task[i].icv.nthreads_var = nthreads_var;
       team->implicit_task[i].icv.bind_var = bind_var;
@@ -977,6 +994,7 @@ gomp_team_start (void (*fn) (void *), void *data, unsigned nthreads,
 	  if (popcorn_global.threads_per_node[nid])
 	    {
 	      hierarchy_init_node(nid);
+	      hierarchy_init_node_gang(nid, new_threads_per_node[nid]);
 	      nodes++;
 	    }
 	}
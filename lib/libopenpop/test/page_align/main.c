@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+#include <omp.h>
+
+/*
+ * Run small loops over a primary array which doesn't start on a page boundary
+ * (so splits between nodes may fall in the array's first page) & check that
+ * every iteration runs exactly once.
+ */
+
+#define PAGESZ 4096
+static size_t nthreads = 8;
+static size_t offset = 800;
+
+void parse_args(int argc, char **argv)
+{
+  int c;
+  while((c = getopt(argc, argv, "ht:o:")) != -1)
+  {
+    switch(c)
+    {
+    case 't': nthreads = atoi(optarg); break;
+    case 'o': offset = atoi(optarg); break;
+    case 'h':
+      printf("Usage: %s -t THREADS -o OFFSET\n", argv[0]);
+      exit(0);
+      break;
+    }
+  }
+  assert(nthreads > 1 && "Please specify > 1 thread");
+  assert(offset % sizeof(long) == 0 && offset < PAGESZ &&
+         "Please specify an element-aligned offset within a page");
+}
+
+static void check(const char *sched, const int *runs, size_t trips)
+{
+  size_t i;
+  for(i = 0; i < trips; i++)
+  {
+    if(runs[i] != 1)
+    {
+      printf("%s: iteration %lu of %lu ran %d time(s)\n",
+             sched, i, trips, runs[i]);
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  char *mem;
+  long *vec;
+  int *runs;
+  size_t trips, max = PAGESZ / sizeof(long) * 2;
+
+  parse_args(argc, argv);
+  omp_set_num_threads(nthreads);
+  mem = aligned_alloc(PAGESZ, PAGESZ * 3);
+  runs = malloc(max * sizeof(int));
+  assert(mem && runs && "Could not allocate memory");
+  vec = (long *)(mem + offset);
+  omp_popcorn_page_align(vec, sizeof(long));
+
+  for(trips = 1; trips <= max; trips = trips < 16 ? trips + 1 : trips * 2)
+  {
+    memset(runs, 0, max * sizeof(int));
+    #pragma omp parallel for schedule(static)
+    for(long i = 0; i < trips; i++)
+    {
+      vec[i] = i;
+      __atomic_add_fetch(&runs[i], 1, __ATOMIC_RELAXED);
+    }
+    check("static", runs, trips);
+
+    memset(runs, 0, max * sizeof(int));
+    #pragma omp parallel for schedule(dynamic)
+    for(long i = 0; i < trips; i++)
+    {
+      vec[i] = i;
+      __atomic_add_fetch(&runs[i], 1, __ATOMIC_RELAXED);
+    }
+    check("dynamic", runs, trips);
+  }
+
+  printf("All loops ran every iteration exactly once\n");
+  free(runs);
+  free(mem);
+  return 0;
+}
@@ -0,0 +1,506 @@
+/*
+ * End-to-end migration latency benchmark.  Threads repeatedly migrate between
+ * two emulated nodes from the bottom of a recursion, sweeping stack depth,
+ * live values per frame, number of threads & migration point density, and
+ * report latency percentiles for each phase of migration.
+ *
+ * Must be linked against a migration library built with type=emulate -- see
+ * README for more details.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <migrate.h>
+#include "emulate.h"
+#include "defer.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Configuration
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Metrics reported for each configuration.  The first are the phases of
+ * migration recorded by the library, followed by:
+ *
+ *   total  : time from calling into the library until it returns
+ *   point  : time per migration point at which no migration is pending
+ *   allocs : heap allocations made while migrating (see below)
+ */
+#define METRICS \
+  MIGRATION_PHASES \
+  X(total) \
+  X(point) \
+  X(allocs)
+
+enum metric {
+#define X( metric ) METRIC_##metric,
+METRICS
+#undef X
+  NUM_METRICS
+};
+
+static const char *metric_names[] = {
+#define X( metric ) #metric,
+METRICS
+#undef X
+};
+
+/* Maximum number of values in a sweep. */
+#define MAX_SWEEP 16
+
+/* Values of a parameter to sweep. */
+typedef struct sweep {
+  size_t num;
+  long vals[MAX_SWEEP];
+} sweep;
+
+/* Default sweeps. */
+static sweep depths = { 4, { 1, 8, 32, 128 } };
+static sweep lives = { 3, { 1, 4, 16 } };
+static sweep threads = { 3, { 1, 2, 4 } };
+static sweep densities = { 3, { 1, 16, 256 } };
+
+/* Number of (recorded) migrations per thread & un-recorded warmup. */
+static long migrations = 1000;
+static long warmup = 10;
+
+/* Print results as CSV rather than a table. */
+static int csv = 0;
+
+/* A single point in the sweep. */
+typedef struct config {
+  long depth;
+  long live;
+  long threads;
+  long density;
+} config;
+
+/* Maximum number of live values per frame. */
+#define MAX_LIVE 16
+
+/* Per-thread benchmark state. */
+typedef struct thread_state {
+  const config *cfg;
+  long iter;
+  long num;
+  long callbacks;
+  unsigned long long *samples[NUM_METRICS];
+  long vals[MAX_LIVE];
+  long sink[MAX_LIVE];
+} thread_state;
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * The benchmark is linked with the allocator's entry points wrapped (see
+ * Makefile), so every heap allocation made by the benchmark, the migration
+ * library or the stack transformation library is counted per thread.  Once
+ * warmed up, migrations shouldn't allocate at all.
+ */
+static __thread unsigned long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_popcorn_malloc_cur(size_t size);
+void *__real_popcorn_realloc_cur(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+  allocations++;
+  return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+
+void *__wrap_popcorn_malloc_cur(size_t size)
+{
+  allocations++;
+  return __real_popcorn_malloc_cur(size);
+}
+
+void *__wrap_popcorn_realloc_cur(void *ptr, size_t size)
+{
+  allocations++;
+  return __real_popcorn_realloc_cur(ptr, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark kernel
+///////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned long long now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void callback(void *data)
+{
+  ((thread_state *)data)->callbacks++;
+}
+
+/*
+ * Execute the configured number of migration points, migrating to the other
+ * node at the last one.  Points are checked inline the same way the compiler
+ * instruments them.
+ */
+static void __attribute__((noinline)) migration_points(thread_state *ts)
+{
+  long i;
+  unsigned long long start, end, point = 0, phases[NUM_PHASES];
+  unsigned long allocs;
+  const long density = ts->cfg->density;
+
+  if(density > 1)
+  {
+    start = now();
+    for(i = 0; i < density - 1; i++)
+      if(migration_pending()) check_migrate(callback, ts);
+    end = now();
+    point = (end - start) / (density - 1);
+  }
+
+  request_migration(cached_nid() ? 0 : 1);
+  allocs = allocations;
+  start = now();
+  if(migration_pending()) check_migrate(callback, ts);
+  end = now();
+  allocs = allocations - allocs;
+
+  if(ts->iter++ < warmup) return;
+  emu_last_migration(phases);
+#define X( phase ) \
+  ts->samples[METRIC_##phase][ts->num] = phases[PHASE_##phase];
+MIGRATION_PHASES
+#undef X
+  ts->samples[METRIC_total][ts->num] = end - start;
+  ts->samples[METRIC_point][ts->num] = point;
+  ts->samples[METRIC_allocs][ts->num] = allocs;
+  ts->num++;
+}
+
+/*
+ * Values are loaded before & consumed after each recursive call, so they're
+ * live across the call & must be rewritten during migration.
+ */
+#define LIVE_4( var, idx ) \
+  long var##0 = ts->vals[idx] + depth, var##1 = ts->vals[idx + 1] + depth, \
+       var##2 = ts->vals[idx + 2] + depth, var##3 = ts->vals[idx + 3] + depth
+
+#define SINK_4( var, idx ) \
+  do { \
+    ts->sink[idx] += var##0; ts->sink[idx + 1] += var##1; \
+    ts->sink[idx + 2] += var##2; ts->sink[idx + 3] += var##3; \
+  } while(0)
+
+static void __attribute__((noinline)) recurse_1(long depth, thread_state *ts)
+{
+  long a = ts->vals[0] + depth;
+  if(depth > 1) recurse_1(depth - 1, ts);
+  else migration_points(ts);
+  ts->sink[0] += a;
+}
+
+static void __attribute__((noinline)) recurse_4(long depth, thread_state *ts)
+{
+  LIVE_4(a, 0);
+  if(depth > 1) recurse_4(depth - 1, ts);
+  else migration_points(ts);
+  SINK_4(a, 0);
+}
+
+static void __attribute__((noinline)) recurse_16(long depth, thread_state *ts)
+{
+  LIVE_4(a, 0);
+  LIVE_4(b, 4);
+  LIVE_4(c, 8);
+  LIVE_4(d, 12);
+  if(depth > 1) recurse_16(depth - 1, ts);
+  else migration_points(ts);
+  SINK_4(a, 0);
+  SINK_4(b, 4);
+  SINK_4(c, 8);
+  SINK_4(d, 12);
+}
+
+typedef void (*recurse_fn)(long, thread_state *);
+
+static recurse_fn get_recurse_fn(long live)
+{
+  switch(live)
+  {
+  case 1: return recurse_1;
+  case 4: return recurse_4;
+  case 16: return recurse_16;
+  default: return NULL;
+  }
+}
+
+static void *bench_thread(void *arg)
+{
+  long i;
+  thread_state *ts = (thread_state *)arg;
+  recurse_fn recurse = get_recurse_fn(ts->cfg->live);
+
+  /* Reserve migration state up front, as a runtime would at thread creation */
+  if(migrate_reserve())
+    fprintf(stderr, "Could not reserve migration state\n");
+
+  for(i = 0; i < warmup + migrations; i++) recurse(ts->cfg->depth, ts);
+
+  /* Return to the origin in case we ended up elsewhere */
+  migrate(0, NULL, NULL);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reporting
+///////////////////////////////////////////////////////////////////////////////
+
+static int compare_samples(const void *a, const void *b)
+{
+  unsigned long long sa = *(const unsigned long long *)a,
+                     sb = *(const unsigned long long *)b;
+  return sa < sb ? -1 : (sa > sb ? 1 : 0);
+}
+
+static inline unsigned long long
+percentile(const unsigned long long *sorted, size_t num, double pct)
+{
+  return sorted[(size_t)(pct / 100.0 * (num - 1) + 0.5)];
+}
+
+static void print_header(void)
+{
+  if(csv) printf("depth,live,threads,density,metric,count,mean,p50,p90,p99,max\n");
+  else printf("%6s %5s %7s %7s %-9s %10s %10s %10s %10s %10s\n",
+              "depth", "live", "threads", "density", "metric",
+              "mean (ns)", "p50", "p90", "p99", "max");
+}
+
+static void report(const config *cfg,
+                   enum metric metric,
+                   unsigned long long *samples,
+                   size_t num)
+{
+  size_t i;
+  unsigned long long sum = 0;
+
+  if(!num) return;
+  qsort(samples, num, sizeof(unsigned long long), compare_samples);
+  for(i = 0; i < num; i++) sum += samples[i];
+
+  if(csv) printf("%ld,%ld,%ld,%ld,%s,%lu,%llu,%llu,%llu,%llu,%llu\n",
+                 cfg->depth, cfg->live, cfg->threads, cfg->density,
+                 metric_names[metric], num, sum / num,
+                 percentile(samples, num, 50), percentile(samples, num, 90),
+                 percentile(samples, num, 99), samples[num - 1]);
+  else printf("%6ld %5ld %7ld %7ld %-9s %10llu %10llu %10llu %10llu %10llu\n",
+              cfg->depth, cfg->live, cfg->threads, cfg->density,
+              metric_names[metric], sum / num,
+              percentile(samples, num, 50), percentile(samples, num, 90),
+              percentile(samples, num, 99), samples[num - 1]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Driver
+///////////////////////////////////////////////////////////////////////////////
+
+static int run_config(const config *cfg)
+{
+  int ret = 0;
+  long i, j;
+  size_t num;
+  pthread_t *tids;
+  thread_state *ts;
+  unsigned long long *merged;
+
+  tids = malloc(sizeof(pthread_t) * cfg->threads);
+  ts = calloc(cfg->threads, sizeof(thread_state));
+  merged = malloc(sizeof(unsigned long long) * cfg->threads * migrations);
+  if(!tids || !ts || !merged)
+  {
+    fprintf(stderr, "Could not allocate benchmark state\n");
+    exit(1);
+  }
+
+  for(i = 0; i < cfg->threads; i++)
+  {
+    ts[i].cfg = cfg;
+    for(j = 0; j < MAX_LIVE; j++) ts[i].vals[j] = i + j;
+    for(j = 0; j < NUM_METRICS; j++)
+    {
+      ts[i].samples[j] = malloc(sizeof(unsigned long long) * migrations);
+      if(!ts[i].samples[j])
+      {
+        fprintf(stderr, "Could not allocate sample buffers\n");
+        exit(1);
+      }
+    }
+    if(pthread_create(&tids[i], NULL, bench_thread, &ts[i]))
+    {
+      fprintf(stderr, "Could not create thread\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < cfg->threads; i++) pthread_join(tids[i], NULL);
+
+  for(i = 0; i < cfg->threads; i++)
+  {
+    if(ts[i].callbacks != warmup + migrations)
+    {
+      fprintf(stderr, "Thread %ld: %ld of %ld migrations completed\n",
+              i, ts[i].callbacks, warmup + migrations);
+      ret = 1;
+    }
+
+    for(j = 0, num = 0; j < ts[i].num; j++)
+      num += ts[i].samples[METRIC_allocs][j];
+    if(num)
+    {
+      fprintf(stderr, "Thread %ld: %lu allocation(s) after warmup\n", i, num);
+      ret = 1;
+    }
+  }
+
+  for(i = 0; i < NUM_METRICS; i++)
+  {
+    for(j = 0, num = 0; j < cfg->threads; j++)
+    {
+      memcpy(&merged[num], ts[j].samples[i],
+             sizeof(unsigned long long) * ts[j].num);
+      num += ts[j].num;
+    }
+    report(cfg, i, merged, num);
+  }
+
+  for(i = 0; i < cfg->threads; i++)
+    for(j = 0; j < NUM_METRICS; j++) free(ts[i].samples[j]);
+  free(merged);
+  free(ts);
+  free(tids);
+  return ret;
+}
+
+static void print_help(const char *bin)
+{
+  printf("%s - end-to-end migration latency benchmark\n\n", bin);
+  printf("Usage: %s [ OPTIONS ]\n", bin);
+  printf("Options:\n");
+  printf("  -h      : print help & exit\n");
+  printf("  -d list : comma-separated stack depths (default: 1,8,32,128)\n");
+  printf("  -l list : comma-separated live values per frame, each one of "
+         "1, 4 or 16 (default: 1,4,16)\n");
+  printf("  -t list : comma-separated thread counts (default: 1,2,4)\n");
+  printf("  -p list : comma-separated migration points per migration "
+         "(default: 1,16,256)\n");
+  printf("  -m num  : migrations per thread per configuration "
+         "(default: 1000)\n");
+  printf("  -w num  : un-recorded warmup migrations per thread (default: 10)\n");
+  printf("  -c      : print results as CSV\n");
+}
+
+static void parse_sweep(const char *bin, char opt, char *arg, sweep *s)
+{
+  char *tok, *save;
+
+  s->num = 0;
+  for(tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+  {
+    if(s->num == MAX_SWEEP)
+    {
+      fprintf(stderr, "Too many values for -%c (max %d)\n", opt, MAX_SWEEP);
+      exit(1);
+    }
+    s->vals[s->num] = atol(tok);
+    if(s->vals[s->num] < 1 || (opt == 'l' && !get_recurse_fn(s->vals[s->num])))
+    {
+      fprintf(stderr, "Invalid value for -%c: %s\n", opt, tok);
+      print_help(bin);
+      exit(1);
+    }
+    s->num++;
+  }
+}
+
+static void parse_args(int argc, char **argv)
+{
+  int arg;
+
+  while((arg = getopt(argc, argv, "hd:l:t:p:m:w:c")) != -1)
+  {
+    switch(arg)
+    {
+    case 'h': print_help(argv[0]); exit(0); break;
+    case 'd': parse_sweep(argv[0], arg, optarg, &depths); break;
+    case 'l': parse_sweep(argv[0], arg, optarg, &lives); break;
+    case 't': parse_sweep(argv[0], arg, optarg, &threads); break;
+    case 'p': parse_sweep(argv[0], arg, optarg, &densities); break;
+    case 'm': migrations = atol(optarg); break;
+    case 'w': warmup = atol(optarg); break;
+    case 'c': csv = 1; break;
+    default: print_help(argv[0]); exit(1); break;
+    }
+  }
+
+  if(migrations < 1 || warmup < 0)
+  {
+    fprintf(stderr, "Invalid number of migrations\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int ret = 0;
+  size_t d, l, t, p;
+  config cfg;
+
+  parse_args(argc, argv);
+
+  // Every migration must happen at the point where it's requested, so don't
+  // let the library defer them unless asked to
+  setenv(ENV_LATENCY_BUDGET, "0", 0);
+
+  if(!node_available(1))
+  {
+    fprintf(stderr, "Need at least 2 emulated nodes (see %s)\n",
+            ENV_EMULATE_NODES);
+    return 1;
+  }
+
+  print_header();
+  for(d = 0; d < depths.num; d++)
+    for(l = 0; l < lives.num; l++)
+      for(t = 0; t < threads.num; t++)
+        for(p = 0; p < densities.num; p++)
+        {
+          cfg.depth = depths.vals[d];
+          cfg.live = lives.vals[l];
+          cfg.threads = threads.vals[t];
+          cfg.density = densities.vals[p];
+          ret |= run_config(&cfg);
+        }
+
+  return ret;
+}
@@ -12,6 +12,9 @@
     READ_REGS_AARCH64(regset.aarch); \
     regset.aarch.pc = get_call_site()
 
+/* Get the stack pointer from a local register set */
+#define REGSET_SP(regset) ((void *)regset.aarch.sp)
+
 /* Get pointer to start of thread local storage region */
 #define GET_TLS_POINTER \
   ({ \
@@ -12,6 +12,9 @@
     READ_REGS_POWERPC64(regset.powerpc); \
     regset.powerpc.pc = get_call_site()
 
+/* Get the stack pointer from a local register set */
+#define REGSET_SP(regset) ((void *)regset.powerpc.r[1])
+
 /* Get pointer to start of thread local storage region */
 #define GET_TLS_POINTER \
   ({ \
@@ -12,6 +12,9 @@
     READ_REGS_X86_64(regset.x86); \
     regset.x86.rip = get_call_site()
 
+/* Get the stack pointer from a local register set */
+#define REGSET_SP(regset) ((void *)regset.x86.rsp)
+
 /* Get pointer to start of thread local storage region */
 #define GET_TLS_POINTER \
   ({ \
@@ -25,24 +25,57 @@
 #define _NATIVE 0
 #endif
 
+/*
+ * Replace Popcorn's node information & migration system calls with user-space
+ * stand-ins (see emulate.h) so the library can be exercised on a single
+ * machine.  Requires _NATIVE.
+ */
+#ifndef _EMULATE_POPCORN
+#define _EMULATE_POPCORN 0
+#endif
+
+#if _EMULATE_POPCORN == 1 && _NATIVE != 1
+# error Emulating Popcorn requires native migration (_NATIVE)!
+#endif
+
 /*
  * Calculate time between when threads are signalled to migrate and when they
- * enter the migration library.
+ * enter the migration library.  Recorded in per-thread histograms (see
+ * timing.h).
  */
 #ifndef _TIME_RESPONSE_DELAY
 #define _TIME_RESPONSE_DELAY 0
 #endif
 
-/* Time how long it takes the stack transformation library to do its thing. */
+/*
+ * Time how long it takes the stack transformation library to do its thing, and
+ * how long post-migration callbacks take.  Recorded in per-thread histograms
+ * (see timing.h).
+ */
 #ifndef _TIME_REWRITE
 #define _TIME_REWRITE 0
 #endif
 
+/* Timings are recorded if any timing is enabled. */
+#define _TIME_MIGRATION (_TIME_RESPONSE_DELAY == 1 || _TIME_REWRITE == 1)
+
 /* Use environment variables to specify at which function to migrate. */
 #ifndef _ENV_SELECT_MIGRATE
 #define _ENV_SELECT_MIGRATE 0
 #endif
 
+/*
+ * When no migration is pending in the thread's pending migration word, ask the
+ * OS whether it has proposed a migration for the thread.  Costs a system call
+ * in every check_migrate() call.  Only disable if migrations are exclusively
+ * requested through the pending migration word, in which case code can be
+ * compiled with "-mllvm -migpoint-inline-check" to skip calling into the
+ * library when no migration is pending.
+ */
+#ifndef _POLL_MIGRATION
+#define _POLL_MIGRATION 1
+#endif
+
 /* Use signals to trigger thread migrations.  If set, which signal to use. */
 #ifndef _SIG_MIGRATION
 #define _SIG_MIGRATION 0
@@ -76,5 +109,31 @@
 #define _CLEAN_CRASH 0
 #endif
 
+/*
+ * Defer migrations requested at expensive migration points to cheaper ones
+ * (see defer.h).  Environment-selected migration points are one-shot, so they
+ * can't be deferred.
+ */
+#ifndef _DEFER_MIGRATION
+# if _ENV_SELECT_MIGRATE == 1
+#  define _DEFER_MIGRATION 0
+# else
+#  define _DEFER_MIGRATION 1
+# endif
+#endif
+
+#if _DEFER_MIGRATION == 1 && _ENV_SELECT_MIGRATE == 1
+# error Cannot defer environment-selected migrations!
+#endif
+
+/*
+ * Prefetch a thread's rewritten stack & registered hot regions to the
+ * destination after migrating (see prefetch.h).  Only takes effect when the
+ * application links the DSM prefetching library.
+ */
+#ifndef _PREFETCH_ON_MIGRATE
+#define _PREFETCH_ON_MIGRATE 1
+#endif
+
 #endif /* _CONFIG_H */
 
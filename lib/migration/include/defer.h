@@ -0,0 +1,57 @@
+/*
+ * Cost-aware migration deferral.  When a migration is requested deep inside a
+ * call chain, rewriting the stack is expensive; if the thread is about to
+ * unwind, migrating a few migration points later is much cheaper.  At each
+ * migration point with a pending migration, the library estimates the cost of
+ * rewriting the stack from its call site metadata (see
+ * st_userspace_estimate()) and defers the migration until it reaches a
+ * migration point that's cheap, or at least half as expensive as where the
+ * migration was requested, or until the latency budget expires.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _DEFER_H
+#define _DEFER_H
+
+/*
+ * Environment variable specifying the latency budget -- the longest a
+ * migration may be deferred, in microseconds.  Zero disables deferral.
+ */
+#define ENV_LATENCY_BUDGET "MIGRATE_LATENCY_BUDGET"
+#define DEFAULT_LATENCY_BUDGET 500
+
+/*
+ * Environment variable specifying the estimated cost, in nanoseconds, below
+ * which migrations are never deferred.
+ */
+#define ENV_COST_THRESHOLD "MIGRATE_COST_THRESHOLD"
+#define DEFAULT_COST_THRESHOLD 50000
+
+/*
+ * Rough costs of rewriting stacks, used to convert call site metadata into
+ * estimated nanoseconds: per frame (unwinding & call site lookups), per live
+ * value (locating & copying the value) and per byte of stack (copying frames).
+ */
+#define COST_FRAME_NS 250
+#define COST_LIVE_NS 25
+#define COST_BYTES_PER_NS 16
+
+/**
+ * Decide whether to defer the calling thread's pending migration.
+ *
+ * @param nid the destination node
+ * @param fp the frame pointer of the migration point's frame (i.e., of
+ *           check_migrate())
+ * @return non-zero if the migration should be deferred, or zero if the thread
+ *         should migrate now
+ */
+int defer_migration(int nid, void *fp);
+
+/**
+ * Forget the calling thread's deferred migration, e.g., if the request was
+ * cancelled.
+ */
+void defer_reset(void);
+
+#endif /* _DEFER_H */
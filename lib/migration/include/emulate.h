@@ -0,0 +1,123 @@
+/*
+ * User-space stand-ins for Popcorn's node information & migration system
+ * calls, so the migration library can be exercised & benchmarked on a single
+ * Linux machine.  Every emulated node has the host's architecture, and a
+ * "migration" is a same-ISA stack rewrite plus a jump onto the rewritten stack
+ * (see _NATIVE).  Enabled by building the library with type=emulate.
+ *
+ * When emulating, the library also times the phases of each migration, which
+ * can be queried per-thread via emu_last_migration().
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _EMULATE_H
+#define _EMULATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable specifying the number of emulated nodes. */
+#define ENV_EMULATE_NODES "POPCORN_EMULATE_NODES"
+
+/* Default number of emulated nodes. */
+#define DEFAULT_EMULATE_NODES 2
+
+/*
+ * Phases of a migration, in the order in which they happen:
+ *
+ *   rewrite  : transforming the stack for the destination
+ *   migrate  : the migration system call & resuming on the rewritten stack
+ *   callback : the user-supplied post-migration callback
+ *
+ * To add a phase, append an X( <phase name> ) to the list and mark the end of
+ * the phase in __migrate_shim_internal() with PHASE_DONE( <phase name> ).
+ */
+#define MIGRATION_PHASES \
+  X(rewrite) \
+  X(migrate) \
+  X(callback)
+
+enum migration_phase {
+#define X( phase ) PHASE_##phase,
+MIGRATION_PHASES
+#undef X
+  NUM_PHASES
+};
+
+struct popcorn_node_status;
+struct popcorn_thread_status;
+
+/**
+ * Stand-in for popcorn_getnid().
+ * @return the emulated node on which the calling thread is executing
+ */
+int emu_getnid(void);
+
+/**
+ * Stand-in for popcorn_getthreadinfo().  No migrations are ever proposed.
+ * @param status the calling thread's emulated status
+ * @return 0
+ */
+int emu_getthreadinfo(struct popcorn_thread_status *status);
+
+/**
+ * Stand-in for popcorn_getnodeinfo().  The number of nodes is read from
+ * ENV_EMULATE_NODES; all are online & have the host's architecture.
+ * @param origin set to the origin node (always 0)
+ * @param status array of MAX_POPCORN_NODES node statuses
+ * @return 0
+ */
+int emu_getnodeinfo(int *origin, struct popcorn_node_status *status);
+
+/**
+ * Stand-in for the migration system call -- move the calling thread to an
+ * emulated node.  The caller is responsible for switching to the rewritten
+ * stack.
+ * @param nid the destination node
+ * @return 0 if the thread was moved, or -1 otherwise (errno is set)
+ */
+int emu_sched_migrate(int nid);
+
+/**
+ * Mark the start of the calling thread's migration.
+ */
+void emu_phase_start(void);
+
+/**
+ * Mark the end of a phase of the calling thread's migration.  The next phase
+ * starts immediately.
+ * @param phase the phase which finished
+ */
+void emu_phase_done(enum migration_phase phase);
+
+/**
+ * Get the elapsed time of each phase of the calling thread's last completed
+ * migration.
+ * @param phases filled with elapsed times, in nanoseconds
+ */
+void emu_last_migration(unsigned long long phases[NUM_PHASES]);
+
+#if _EMULATE_POPCORN == 1
+
+/* Redirect the library's system calls to the stand-ins. */
+# define popcorn_getnid emu_getnid
+# define popcorn_getthreadinfo emu_getthreadinfo
+# define popcorn_getnodeinfo emu_getnodeinfo
+
+# define PHASE_START() emu_phase_start()
+# define PHASE_DONE( phase ) emu_phase_done(PHASE_##phase)
+
+#else
+
+# define PHASE_START()
+# define PHASE_DONE( phase )
+
+#endif /* _EMULATE_POPCORN */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _EMULATE_H */
@@ -6,6 +6,52 @@
 #define _MAPPING_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Users can tell the runtime the name of the file containing the thread
+ * schedule by setting the POPCORN_THREAD_SCHEDULE environment variable.
+ * Otherwise, the runtime will look for the file DEF_THREAD_SCHEDULE.  If
+ * POPCORN_THREAD_SCHEDULE_WATCH is set, the runtime watches the file and
+ * swaps in the new schedule whenever it's rewritten or replaced.
+ */
+#define DEF_THREAD_SCHEDULE "thread-schedule.txt"
+#define ENV_POPCORN_THREAD_SCHEDULE "POPCORN_THREAD_SCHEDULE"
+#define ENV_POPCORN_THREAD_SCHEDULE_WATCH "POPCORN_THREAD_SCHEDULE_WATCH"
+
+/*
+ * Binary thread schedules, which are read in directly rather than parsed.  All
+ * fields are native-endian.  A file contains a header, followed by one
+ * schedule_region per region ID (regions are densely indexed by ID, so region
+ * IDs 0 to num_regions - 1 all have an entry), followed by num_nodes node IDs.
+ * Each region's mappings are the num node IDs starting at offset, indexed by
+ * Popcorn thread ID.  Regions without mappings have num = 0.
+ *
+ * Text schedules (see read_text_schedule() in mapping.c) are converted into
+ * the same layout in memory.  Use util/scripts/compile-thread-schedule.py to
+ * convert text schedules into binary schedules.
+ */
+#define SCHEDULE_MAGIC "PSCH"
+#define SCHEDULE_VERSION 1
+
+/* Maximum region ID, to keep densely-indexed tables reasonably sized. */
+#define SCHEDULE_MAX_REGIONS (1UL << 20)
+
+/* Region ID of the default mapping. */
+#define SCHEDULE_DEFAULT_REGION ((size_t)-1)
+
+struct schedule_region {
+  uint32_t offset;
+  uint32_t num;
+};
+
+struct schedule_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_regions;
+  uint32_t num_nodes;
+  struct schedule_region default_region;
+};
 
 /* The default node on which to execute if no thread schedule is available. */
 void set_default_node(int node);
@@ -20,4 +66,3 @@ void set_default_node(int node);
 int get_node_mapping(size_t region, int ptid);
 
 #endif /* _MAPPING_H */
-
@@ -5,10 +5,59 @@
 # error Unknown/unsupported architecture!
 #endif
 
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Destination node of the calling thread's pending migration, or -1 if no
+ * migration is pending.  Migration points read this word inline and only call
+ * into the migration library when it's set, so checking for a migration
+ * doesn't require a system call.  Use request_migration() to set it.
+ */
+extern __thread volatile int __migrate_pending_nid;
+
+/**
+ * Return whether the calling thread has a pending migration.
+ * @return non-zero if a migration is pending, or zero otherwise
+ */
+static inline int migration_pending(void)
+{
+  return __migrate_pending_nid >= 0;
+}
+
+/**
+ * Request that the calling thread migrate to a node the next time it reaches
+ * a migration point.
+ * @param nid the destination node, or -1 to cancel a pending request
+ */
+void request_migration(int nid);
+
+/**
+ * Request that a thread migrate to a node the next time it reaches a migration
+ * point, without affecting other threads.  Other threads are signalled, so
+ * the library must be built with signal-based triggering (type=signal_trigger).
+ * A request for a thread with a pending migration retargets it.
+ * @param tid the kernel thread ID of the thread, or 0 for the calling thread
+ * @param nid the destination node, or -1 to cancel a pending request
+ * @return 0 if the request was delivered, or -1 otherwise (errno is set)
+ */
+int request_thread_migration(pid_t tid, int nid);
+
+/**
+ * Request that a set of threads migrate to a node the next time each reaches
+ * a migration point.  See request_thread_migration().
+ * @param tids the kernel thread IDs of the threads
+ * @param num the number of threads
+ * @param nid the destination node, or -1 to cancel pending requests
+ * @return 0 if all requests were delivered, or -1 otherwise (errno is set)
+ */
+int request_threads_migration(const pid_t *tids, size_t num, int nid);
+
 /**
  * Return whether a node is available as a migration target.
  * @param nid the node ID
@@ -16,6 +65,29 @@ extern "C" {
  */
 int node_available(int nid);
 
+/**
+ * Node on which the calling thread is executing, or -1 if not yet queried.
+ * Filled on first use & updated after each migration; use cached_nid() rather
+ * than reading it directly.
+ */
+extern __thread int __migrate_cached_nid;
+
+/**
+ * Query the node on which the calling thread is executing & fill the cache.
+ * @return the node id on which this thread is running
+ */
+int __migrate_fill_node_cache(void);
+
+/**
+ * Get the current node id without a system call (after the first query).
+ * @return the node id on which this thread is running
+ */
+static inline int cached_nid(void)
+{
+  int nid = __migrate_cached_nid;
+  return nid >= 0 ? nid : __migrate_fill_node_cache();
+}
+
 /**
  * Get the current architecture.
  * @return the architecture on which we're executing
@@ -31,7 +103,9 @@ int current_nid(void);
 /**
  * Check if thread should migrate, and if so, invoke migration.  The optional
  * callback function will be invoked before execution resumes on destination
- * architecture.
+ * architecture.  Consumes the thread's pending migration request, if any,
+ * unless migrating here would be expensive & the migration is deferred to a
+ * later migration point (see migrate_deferral_query()).
  *
  * @param callback a callback function to be invoked before execution resumes
  *                 on destination architecture
@@ -67,6 +141,255 @@ void migrate_schedule(size_t region,
                       void (*callback)(void*),
                       void *callback_data);
 
+/**
+ * Reserve everything the calling thread needs to migrate: stack bounds,
+ * rewriting contexts & fixup storage, timing histograms and the thread
+ * pointer as seen by each architecture.  Afterwards migrations don't allocate
+ * unless the thread's stack is deeper (or has more pointers into itself) than
+ * any it has previously migrated.  Threads reserve their state on their first
+ * migration; call at thread creation to keep allocation out of the first
+ * migration as well.
+ *
+ * @return 0 if the state was reserved, or -1 otherwise
+ */
+int migrate_reserve(void);
+
+struct migrate_gang_member;
+struct st_stack_desc;
+
+/**
+ * A group of threads which migrate together.  Gang members rendezvous before
+ * migrating so their stacks can be rewritten concurrently in a single batch
+ * and their migration requests issued back-to-back, rather than each thread
+ * paying for its own rewrite setup & migration in isolation.  Members then
+ * rendezvous again at the destination so that the gang's callback is invoked
+ * exactly once, after all members have migrated.
+ *
+ * Gangs must be initialized with migrate_gang_init() (or zero-initialized &
+ * sized with migrate_gang_reset()) before use.  Fields are internal to the
+ * migration library.
+ */
+typedef struct migrate_gang {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t num;              /* Number of threads in the gang */
+  size_t arrived;          /* Members which have arrived before migrating */
+  size_t completed;        /* Members which have finished migrating */
+  unsigned long rendezvous;  /* Generation of the pre-migration rendezvous */
+  unsigned long completion;  /* Generation of the post-migration rendezvous */
+  size_t capacity;         /* Size of the arrays below */
+  struct migrate_gang_member **members;
+  struct st_stack_desc *batch;
+} migrate_gang_t;
+
+/**
+ * Initialize a gang.
+ * @param gang the gang
+ * @param num the number of threads in the gang
+ * @return 0 if successful, or -1 otherwise
+ */
+int migrate_gang_init(migrate_gang_t *gang, size_t num);
+
+/**
+ * Change the number of threads in a gang.  No threads may be migrating with
+ * the gang.  On failure the gang is left empty, i.e., threads migrate
+ * individually.
+ * @param gang the gang
+ * @param num the number of threads in the gang
+ * @return 0 if successful, or -1 otherwise
+ */
+int migrate_gang_reset(migrate_gang_t *gang, size_t num);
+
+/**
+ * Free a gang's resources.  No threads may be migrating with the gang.
+ * @param gang the gang
+ */
+void migrate_gang_destroy(migrate_gang_t *gang);
+
+/**
+ * Migrate the calling thread to a node as part of a gang.  Every member of the
+ * gang must call migrate_gang() with the same destination; members already on
+ * the destination only take part in the rendezvous.  The optional callback is
+ * invoked once, by the last member to finish migrating, before any member
+ * returns.
+ *
+ * @param gang the gang
+ * @param nid the destination node
+ * @param callback a callback function to be invoked after all members have
+ *                 migrated
+ * @param callback_data data to be passed to the callback function
+ * @return 0 if the calling thread is on the destination node, or -1 otherwise
+ */
+int migrate_gang(migrate_gang_t *gang,
+                 int nid,
+                 void (*callback)(void*),
+                 void *callback_data);
+
+/**
+ * Reload the thread schedule used by migrate_schedule() from its file and
+ * atomically swap it in.  Threads looking up mappings concurrently see either
+ * the old or the new schedule.  If POPCORN_THREAD_SCHEDULE_WATCH is set, the
+ * library does this automatically whenever the file changes.
+ *
+ * @return 0 if a new schedule was loaded, or -1 otherwise (the current
+ *         schedule is kept)
+ */
+int migrate_schedule_reload(void);
+
+/**
+ * Return the thread schedule's generation, which is incremented every time a
+ * schedule is loaded.
+ * @return the number of schedules loaded so far
+ */
+unsigned long migrate_schedule_generation(void);
+
+/**
+ * Register a region of memory which the calling thread accesses frequently.
+ * Whenever the thread migrates, the region is prefetched to the destination
+ * along with the thread's stack.  Re-registering a region updates its bounds.
+ * Prefetching requires linking the DSM prefetching library (libdsm-prefetch).
+ *
+ * @param low the lowest address of the region
+ * @param high the highest address of the region
+ * @param write non-zero if the thread writes the region, or zero if it only
+ *              reads it
+ * @return 0 if the region was registered, or -1 otherwise
+ */
+int migrate_prefetch_register(const void *low, const void *high, int write);
+
+/**
+ * Unregister one of the calling thread's hot regions.
+ * @param low the lowest address of the region
+ * @return 0 if the region was unregistered, or -1 if it wasn't registered
+ */
+int migrate_prefetch_unregister(const void *low);
+
+/** Statistics about prefetching after migrations, across all threads. */
+typedef struct migrate_prefetch_stats {
+  unsigned long long migrations; /* Migrations followed by a prefetch */
+  unsigned long long prefetched; /* Pages requested for prefetching */
+  unsigned long long faulted;    /* Page faults taken during each thread's
+                                    warm-up window after migrating */
+} migrate_prefetch_stats;
+
+/**
+ * Query prefetching statistics.
+ * @param stats statistics to populate
+ */
+void migrate_prefetch_query(migrate_prefetch_stats *stats);
+
+/**
+ * Decisions made by cost-aware migration deferral, across all threads.  When
+ * a migration is requested at a migration point where rewriting the stack
+ * would be expensive, check_migrate() defers it to a cheaper migration point
+ * within a latency budget (see MIGRATE_LATENCY_BUDGET in the README).
+ */
+typedef struct migrate_deferral_stats {
+  unsigned long long immediate; /* Migrations at the point first seen */
+  unsigned long long cheaper;   /* Deferred migrations done at a cheaper point */
+  unsigned long long expired;   /* Deferred migrations done when the latency
+                                   budget expired */
+  unsigned long long deferrals; /* Migration points at which a migration was
+                                   deferred */
+} migrate_deferral_stats;
+
+/**
+ * Query migration deferral statistics.
+ * @param stats statistics to populate
+ */
+void migrate_deferral_query(migrate_deferral_stats *stats);
+
+/**
+ * Migration timings, recorded per-thread when the library is built with
+ * type=timing:
+ *
+ *   MIGRATE_TIMING_RESPONSE : from when a thread is signalled to migrate until
+ *                             it enters the migration library
+ *   MIGRATE_TIMING_REWRITE  : transforming the thread's stack
+ *   MIGRATE_TIMING_CALLBACK : the post-migration callback
+ *   MIGRATE_TIMING_ESTIMATE : estimated cost of transforming the thread's
+ *                             stack where check_migrate() decided to migrate
+ *   MIGRATE_TIMING_DEFERRAL : how long check_migrate() deferred migrations
+ */
+enum migrate_timing {
+  MIGRATE_TIMING_RESPONSE,
+  MIGRATE_TIMING_REWRITE,
+  MIGRATE_TIMING_CALLBACK,
+  MIGRATE_TIMING_ESTIMATE,
+  MIGRATE_TIMING_DEFERRAL,
+  MIGRATE_NUM_TIMINGS
+};
+
+/**
+ * Timing histograms are log-linear: values below 2^MIGRATE_HIST_SUB_BITS each
+ * have their own bucket, and every power-of-two range above is split into
+ * 2^MIGRATE_HIST_SUB_BITS equal buckets.  Values at or above
+ * 2^MIGRATE_HIST_MAX_BITS nanoseconds are counted in the last bucket.
+ */
+#define MIGRATE_HIST_SUB_BITS 3
+#define MIGRATE_HIST_MAX_BITS 40
+#define MIGRATE_HIST_BUCKETS \
+  ((MIGRATE_HIST_MAX_BITS - MIGRATE_HIST_SUB_BITS + 1) << MIGRATE_HIST_SUB_BITS)
+
+/** A histogram of timings, in nanoseconds. */
+typedef struct migrate_histogram {
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long min;
+  unsigned long long max;
+  unsigned long long buckets[MIGRATE_HIST_BUCKETS];
+} migrate_histogram;
+
+/**
+ * Return the name of a timing, e.g., "response".
+ * @param timing a timing
+ * @return the timing's name, or NULL if the timing is invalid
+ */
+const char *migrate_timing_name(enum migrate_timing timing);
+
+/**
+ * Merge a timing's histograms across all threads.
+ * @param timing a timing
+ * @param hist histogram to populate
+ * @return 0 if successful, or -1 if the timing is invalid
+ */
+int migrate_timing_query(enum migrate_timing timing, migrate_histogram *hist);
+
+/**
+ * Merge a histogram into another, e.g., to combine histograms from several
+ * queries.
+ * @param dst histogram to merge into
+ * @param src histogram to merge
+ */
+void migrate_histogram_merge(migrate_histogram *dst,
+                             const migrate_histogram *src);
+
+/**
+ * Return the smallest value counted by a histogram bucket.  The bucket counts
+ * values up to, but not including, the smallest value of the next bucket.
+ * @param bucket a bucket index
+ * @return the bucket's lower bound, in nanoseconds
+ */
+unsigned long long migrate_histogram_bucket_low(size_t bucket);
+
+/**
+ * Estimate a percentile from a histogram, accurate to within a bucket.
+ * @param hist a histogram
+ * @param pct a percentile, in [0, 100]
+ * @return the estimated value, in nanoseconds, or 0 if the histogram is empty
+ */
+unsigned long long migrate_histogram_percentile(const migrate_histogram *hist,
+                                                double pct);
+
+/**
+ * Write a summary of all timings & their non-empty buckets in human-readable
+ * form.  Also dumped at exit, and periodically if MIGRATE_TIMING_PERIOD is set
+ * (to MIGRATE_TIMING_FILE, or stdout if not set).
+ * @param fn name of the file to append to, or NULL to write to stdout
+ * @return 0 if successful, or -1 otherwise
+ */
+int migrate_timing_dump(const char *fn);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,56 @@
+/*
+ * Hand off a migrating thread's working set to the DSM prefetching library
+ * (lib/dsm-prefetch).  Before migrating, the library queues prefetch requests
+ * for the thread's rewritten stack & any hot regions the thread registered
+ * with migrate_prefetch_register().  Once the thread arrives, the requests are
+ * executed in a single batch rather than letting every page fault across the
+ * DSM one at a time.
+ *
+ * The DSM prefetching library is referenced weakly, so prefetching is only
+ * enabled for applications which link it.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+/* Maximum number of hot regions per thread. */
+#define MAX_HOT_REGIONS 16
+
+/* Environment variable naming a file to which to print statistics at exit. */
+#define ENV_PREFETCH_STATS "MIGRATE_PREFETCH_STATS"
+
+/*
+ * Environment variable specifying the warm-up window after arriving on a node
+ * over which page faults are counted, in microseconds.
+ */
+#define ENV_PREFETCH_WINDOW "MIGRATE_PREFETCH_WINDOW"
+#define DEFAULT_PREFETCH_WINDOW 10000
+
+/**
+ * Queue prefetch requests for the calling thread's working set on its
+ * destination node.  Must be called before the thread switches its TLS for
+ * the destination.
+ *
+ * @param nid the destination node
+ * @param stack_low the lowest address of the rewritten stack, or NULL if the
+ *                  stack wasn't rewritten
+ * @param stack_high the highest address of the rewritten stack
+ */
+void prefetch_queue(int nid, void *stack_low, void *stack_high);
+
+/**
+ * Execute the calling thread's queued prefetch requests after arriving on a
+ * node.
+ * @param nid the node on which the thread arrived
+ */
+void prefetch_arrived(int nid);
+
+/**
+ * Stop counting the calling thread's page faults if its warm-up window has
+ * elapsed.  Called at migration points.
+ */
+void prefetch_sample(void);
+
+#endif /* _PREFETCH_H */
@@ -0,0 +1,34 @@
+/*
+ * Per-thread migration timing histograms.  Each thread records into its own
+ * histograms without locking, which are only ever written by that thread.
+ * Readers merge them on demand.  When a thread exits, its histograms are
+ * folded into a global histogram for exited threads & freed.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include "config.h"
+#include "migrate.h"
+
+/* Environment variables controlling periodic dumps of timing histograms. */
+#define ENV_TIMING_FILE "MIGRATE_TIMING_FILE"
+#define ENV_TIMING_PERIOD "MIGRATE_TIMING_PERIOD"
+
+/*
+ * Record a timing for the calling thread.
+ *
+ * @param timing a timing
+ * @param ns the elapsed time, in nanoseconds
+ */
+void timing_record(enum migrate_timing timing, unsigned long long ns);
+
+/*
+ * Allocate the calling thread's histograms, if not already allocated, so that
+ * recording timings doesn't allocate.
+ */
+void timing_reserve(void);
+
+#endif /* _TIMING_H */
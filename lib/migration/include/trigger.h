@@ -6,8 +6,8 @@
 #define _TRIGGER_H
 
 /*
- * If triggering a migration via signals, clear flags used to communicate
- * with threads that they should migrate.
+ * If triggering a migration via signals, clear the calling thread's flag used
+ * to communicate that it should migrate.
  */
 void clear_migrate_flag();
 
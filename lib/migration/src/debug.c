@@ -18,6 +18,7 @@
 
 #include "config.h"
 #include "platform.h"
+#include "emulate.h"
 #include "migrate.h"
 #include "debug.h"
 
@@ -0,0 +1,162 @@
+/*
+ * Cost-aware migration deferral.  See defer.h for more details.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <stack_transform.h>
+#include "config.h"
+#include "migrate.h"
+#include "timing.h"
+#include "defer.h"
+
+/* Deferral decisions across all threads. */
+static migrate_deferral_stats stats = { 0, 0, 0, 0 };
+
+#define COUNT( stat ) __atomic_fetch_add(&stats.stat, 1, __ATOMIC_RELAXED)
+
+#if _DEFER_MIGRATION == 1
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/* Latency budget (in nanoseconds) & cost threshold, read on first use. */
+static int initialized = 0;
+static unsigned long long budget = DEFAULT_LATENCY_BUDGET * 1000ULL;
+static unsigned long long threshold = DEFAULT_COST_THRESHOLD;
+
+/*
+ * The calling thread's deferred migration: its destination (or -1 if none is
+ * deferred), when it was first deferred & the estimated cost at that point.
+ */
+static __thread int deferred_nid = -1;
+static __thread unsigned long long deferred_start = 0;
+static __thread unsigned long long deferred_cost = 0;
+
+static void read_config(void)
+{
+  const char *env;
+
+  if((env = getenv(ENV_LATENCY_BUDGET))) budget = atoll(env) * 1000ULL;
+  if((env = getenv(ENV_COST_THRESHOLD))) threshold = atoll(env);
+  __atomic_store_n(&initialized, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Return the current time, in nanoseconds.  Unlike TIMESTAMP(), doesn't
+ * depend on the CPU's frequency, which the budget would otherwise be tied to.
+ */
+static inline unsigned long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Estimate the cost of rewriting the stack, in nanoseconds. */
+static inline int estimate_cost(void *fp, unsigned long long *cost)
+{
+  st_cost est;
+
+  if(st_userspace_estimate(fp, &est)) return 1;
+  *cost = est.frames * COST_FRAME_NS + est.live * COST_LIVE_NS +
+          est.frame_bytes / COST_BYTES_PER_NS;
+  return 0;
+}
+
+/* Record the decision to migrate now. */
+static inline void migrate_now(unsigned long long cost,
+                               unsigned long long elapsed)
+{
+#if _TIME_MIGRATION
+  timing_record(MIGRATE_TIMING_ESTIMATE, cost);
+  if(deferred_nid >= 0) timing_record(MIGRATE_TIMING_DEFERRAL, elapsed);
+#endif
+  deferred_nid = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal deferral API
+///////////////////////////////////////////////////////////////////////////////
+
+int defer_migration(int nid, void *fp)
+{
+  unsigned long long cost, now, elapsed;
+
+  if(!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) read_config();
+  if(!budget || estimate_cost(fp, &cost))
+  {
+    COUNT(immediate);
+    deferred_nid = -1;
+    return 0;
+  }
+
+  // First time seeing this migration -- migrate now if it's cheap enough
+  now = now_ns();
+  if(deferred_nid != nid)
+  {
+    deferred_nid = -1;
+    if(cost <= threshold)
+    {
+      COUNT(immediate);
+      migrate_now(cost, 0);
+      return 0;
+    }
+
+    deferred_nid = nid;
+    deferred_start = now;
+    deferred_cost = cost;
+    COUNT(deferrals);
+    return 1;
+  }
+
+  elapsed = now - deferred_start;
+  if(cost <= threshold || cost <= deferred_cost / 2)
+  {
+    COUNT(cheaper);
+    migrate_now(cost, elapsed);
+    return 0;
+  }
+  else if(elapsed >= budget)
+  {
+    COUNT(expired);
+    migrate_now(cost, elapsed);
+    return 0;
+  }
+
+  COUNT(deferrals);
+  return 1;
+}
+
+void defer_reset(void)
+{
+  deferred_nid = -1;
+}
+
+#else /* _DEFER_MIGRATION */
+
+int defer_migration(int nid, void *fp)
+{
+  COUNT(immediate);
+  return 0;
+}
+
+void defer_reset(void) {}
+
+#endif /* _DEFER_MIGRATION */
+
+///////////////////////////////////////////////////////////////////////////////
+// Public deferral API
+///////////////////////////////////////////////////////////////////////////////
+
+void migrate_deferral_query(migrate_deferral_stats *cur)
+{
+  if(!cur) return;
+  cur->immediate = __atomic_load_n(&stats.immediate, __ATOMIC_RELAXED);
+  cur->cheaper = __atomic_load_n(&stats.cheaper, __ATOMIC_RELAXED);
+  cur->expired = __atomic_load_n(&stats.expired, __ATOMIC_RELAXED);
+  cur->deferrals = __atomic_load_n(&stats.deferrals, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,113 @@
+/*
+ * User-space stand-ins for Popcorn's node information & migration system
+ * calls.  See emulate.h for more details.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "platform.h"
+#include "config.h"
+#include "arch.h"
+#include "emulate.h"
+
+#if _EMULATE_POPCORN == 1
+
+/* Number of emulated nodes. */
+static int num_nodes = DEFAULT_EMULATE_NODES;
+
+/* Emulated node on which the calling thread is executing. */
+static __thread int cur_nid = 0;
+
+/* Per-thread phase timing for the current & last completed migrations. */
+static __thread unsigned long long phase_start = 0;
+static __thread unsigned long long cur_phases[NUM_PHASES];
+static __thread unsigned long long last_phases[NUM_PHASES];
+
+static inline enum arch host_arch(void)
+{
+#ifdef __aarch64__
+  return ARCH_AARCH64;
+#elif defined(__powerpc64__)
+  return ARCH_POWERPC64;
+#else
+  return ARCH_X86_64;
+#endif
+}
+
+static inline unsigned long long now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int emu_getnid(void)
+{
+  return cur_nid;
+}
+
+int emu_getthreadinfo(struct popcorn_thread_status *status)
+{
+  status->current_nid = cur_nid;
+  status->proposed_nid = -1;
+  status->peer_nid = -1;
+  status->peer_pid = 0;
+  return 0;
+}
+
+int emu_getnodeinfo(int *origin, struct popcorn_node_status *status)
+{
+  int i;
+  const char *env = getenv(ENV_EMULATE_NODES);
+
+  if(env) num_nodes = atoi(env);
+  if(num_nodes < 1) num_nodes = 1;
+  else if(num_nodes > MAX_POPCORN_NODES) num_nodes = MAX_POPCORN_NODES;
+
+  for(i = 0; i < MAX_POPCORN_NODES; i++)
+  {
+    status[i].status = i < num_nodes;
+    status[i].arch = i < num_nodes ? host_arch() : ARCH_UNKNOWN;
+    status[i].distance = i ? 1 : 0;
+  }
+  *origin = 0;
+  return 0;
+}
+
+int emu_sched_migrate(int nid)
+{
+  if(nid < 0 || nid >= num_nodes)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  cur_nid = nid;
+  return 0;
+}
+
+void emu_phase_start(void)
+{
+  memset(cur_phases, 0, sizeof(cur_phases));
+  phase_start = now();
+}
+
+void emu_phase_done(enum migration_phase phase)
+{
+  unsigned long long end = now();
+
+  cur_phases[phase] = end - phase_start;
+  phase_start = end;
+  if(phase == NUM_PHASES - 1)
+    memcpy(last_phases, cur_phases, sizeof(last_phases));
+}
+
+void emu_last_migration(unsigned long long phases[NUM_PHASES])
+{
+  memcpy(phases, last_phases, sizeof(last_phases));
+}
+
+#endif /* _EMULATE_POPCORN */
@@ -1,6 +1,15 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 #include "config.h"
+#include "migrate.h"
+#include "mapping.h"
 
 /* Default node ID if no mapping is available. */
 static int default_node = 0;
@@ -13,46 +22,144 @@ typedef struct mapping {
   int *node; // node mappings, use PTID as index
 } mapping_t;
 
-static size_t num_mappings = 0; // Number of mappings parsed from file
-static mapping_t *mappings = NULL; // The guts
+/*
+ * A thread schedule in the binary layout described in mapping.h, either
+ * copied from a binary file or converted from a text file.  Schedules live in
+ * private memory so that rewriting or truncating the file while it's in use
+ * can't tear or fault lookups.
+ */
+typedef struct schedule {
+  const struct schedule_header *hdr;
+  const struct schedule_region *regions;
+  const int32_t *nodes;
+  void *mem; // Backing memory
+  struct schedule *next; // Next retired schedule
+} schedule_t;
+
+/*
+ * The current schedule.  Reloading swaps in a new schedule atomically; old
+ * schedules may still be in use by threads looking up mappings, so they're
+ * retired rather than freed and are only released at exit.  Reloads are rare
+ * & schedules small, and tracking readers would make lookups write shared
+ * memory, which the DSM would bounce between nodes on every lookup.
+ */
+static schedule_t *schedule = NULL;
+static schedule_t *retired = NULL;
+static unsigned long generation = 0;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Name of the thread schedule file. */
+static const char *schedule_fn = DEF_THREAD_SCHEDULE;
+
+/* Free a schedule's memory. */
+static void free_schedule(schedule_t *s)
+{
+  if(!s) return;
+  free(s->mem);
+  free(s);
+}
 
 /* Free any dynamically-allocated data. */
 static void __attribute__((destructor)) cleanup()
 {
-  size_t i;
+  schedule_t *s;
 
-  if(mappings)
+  pthread_mutex_lock(&reload_lock);
+  free_schedule(schedule);
+  schedule = NULL;
+  while((s = retired))
   {
-    for(i = 0; i < num_mappings; i++)
-      if(mappings[i].node) free(mappings[i].node);
-    free(mappings);
+    retired = s->next;
+    free_schedule(s);
   }
+  pthread_mutex_unlock(&reload_lock);
+}
+
+/*
+ * Wrap memory containing a schedule after verifying the layout.  Takes
+ * ownership of the memory, which is released if the layout is invalid.
+ */
+static schedule_t *wrap_schedule(void *mem, size_t size)
+{
+  size_t i, len;
+  schedule_t *s;
+  const struct schedule_header *hdr = mem;
+  const struct schedule_region *r;
+
+  if(size < sizeof(struct schedule_header) ||
+     memcmp(hdr->magic, SCHEDULE_MAGIC, sizeof(hdr->magic)) ||
+     hdr->version != SCHEDULE_VERSION ||
+     hdr->num_regions > SCHEDULE_MAX_REGIONS)
+    goto invalid;
 
-  num_mappings = 0;
-  mappings = NULL;
+  len = sizeof(struct schedule_header) +
+        hdr->num_regions * sizeof(struct schedule_region) +
+        (size_t)hdr->num_nodes * sizeof(int32_t);
+  if(size < len) goto invalid;
+
+  r = (const struct schedule_region *)(hdr + 1);
+  if((size_t)hdr->default_region.offset + hdr->default_region.num >
+     hdr->num_nodes)
+    goto invalid;
+  for(i = 0; i < hdr->num_regions; i++)
+    if((size_t)r[i].offset + r[i].num > hdr->num_nodes) goto invalid;
+
+  if(!(s = malloc(sizeof(schedule_t)))) goto invalid;
+  s->hdr = hdr;
+  s->regions = r;
+  s->nodes = (const int32_t *)(r + hdr->num_regions);
+  s->mem = mem;
+  s->next = NULL;
+  return s;
+
+invalid:
+#if _DEBUG == 1
+  fprintf(stderr, "Invalid thread schedule\n");
+#endif
+  free(mem);
+  return NULL;
 }
 
 /*
- * Users can tell the runtime the name of the file containing the thread
- * schedule by setting the POPCORN_THREAD_SCHEDULE environment variable.
- * Otherwise, the runtime will look for the file DEF_THREAD_SCHEDULE.
+ * Copy a binary schedule into private memory.  Stops at the size observed
+ * when the file was opened; a file truncated underneath us is rejected.
  */
-#define DEF_THREAD_SCHEDULE "thread-schedule.txt"
-#define ENV_POPCORN_THREAD_SCHEDULE "POPCORN_THREAD_SCHEDULE"
+static schedule_t *read_binary_schedule(int fd, size_t size)
+{
+  size_t cur = 0;
+  ssize_t ret;
+  void *mem;
 
-/* Comparison function for sorting by region numbers. */
-int region_compare(const void *a, const void *b)
+  if(!(mem = malloc(size))) return NULL;
+  while(cur < size)
+  {
+    ret = pread(fd, (char *)mem + cur, size - cur, cur);
+    if(ret <= 0)
+    {
+#if _DEBUG == 1
+      if(ret < 0) perror("Could not read thread schedule file");
+      else fprintf(stderr, "Thread schedule file truncated while reading\n");
+#endif
+      free(mem);
+      return NULL;
+    }
+    cur += ret;
+  }
+  return wrap_schedule(mem, size);
+}
+
+/* Free mappings parsed from a text schedule. */
+static void free_mappings(mapping_t *mappings, size_t num_mappings)
 {
-  mapping_t *map_a = (mapping_t *)a;
-  mapping_t *map_b = (mapping_t *)b;
-  if(map_a->region < map_b->region) return -1;
-  else if(map_a->region > map_b->region) return 1;
-  else return 0;
+  size_t i;
+  for(i = 0; i < num_mappings; i++)
+    if(mappings[i].node) free(mappings[i].node);
+  free(mappings);
 }
 
 /*
- * Parse the mapping file, if one is available. Files contain a Popcorn
- * thread ID (PTID) -> node mapping in the following format:
+ * Parse a text schedule & convert it to the binary layout. Files contain a
+ * Popcorn thread ID (PTID) -> node mapping in the following format:
  *
  *  <region #> <# entries> <PTID 0 node> ... <PTID N node>
  *
@@ -68,21 +175,14 @@ int region_compare(const void *a, const void *b)
  * The file may contain multiple lines, one per region.  Regions are
  * implementation-dependent and may be defined by the user or compiler.
  */
-static void __attribute__((constructor)) read_mapping_schedule()
+static schedule_t *read_text_schedule(FILE *fp)
 {
   int c, read;
-  size_t i, j;
-  const char *fn;
-  FILE *fp;
-
-  if(!(fn = getenv(ENV_POPCORN_THREAD_SCHEDULE))) fn = DEF_THREAD_SCHEDULE;
-  if(!(fp = fopen(fn, "r")))
-  {
-#if _DEBUG == 1
-    perror("Could not open thread schedule file");
-#endif
-    return;
-  }
+  size_t i, j, num_mappings, num_regions = 0, num_nodes = 0, size;
+  mapping_t *mappings;
+  struct schedule_header *hdr;
+  struct schedule_region *regions, *r;
+  int32_t *nodes;
 
   // Start by figuring out how many mappings are in the file
   num_mappings = 1;
@@ -91,7 +191,8 @@ static void __attribute__((constructor)) read_mapping_schedule()
   fseek(fp, 0, SEEK_SET);
 
   // Allocate storage & parse file
-  mappings = (mapping_t *)calloc(num_mappings, sizeof(mapping_t));
+  if(!(mappings = (mapping_t *)calloc(num_mappings, sizeof(mapping_t))))
+    return NULL;
   for(i = 0; i < num_mappings; i++)
   {
     // The first few fields are fixed and will tell us the variable parts
@@ -110,8 +211,20 @@ static void __attribute__((constructor)) read_mapping_schedule()
       fprintf(stderr, "Parsing error: invalid thread mapping "
                       "format, line %lu\n", i);
 #endif
-      cleanup();
-      return;
+      free_mappings(mappings, num_mappings);
+      return NULL;
+    }
+
+    // Region IDs index the table directly, so they can't be arbitrarily large
+    if(mappings[i].region != SCHEDULE_DEFAULT_REGION &&
+       mappings[i].region >= SCHEDULE_MAX_REGIONS)
+    {
+#if _DEBUG == 1
+      fprintf(stderr, "Parsing error: region ID %lu too large, line %lu\n",
+              mappings[i].region, i);
+#endif
+      free_mappings(mappings, num_mappings);
+      return NULL;
     }
 
     // Allocate storage & parse node mapping list
@@ -125,46 +238,217 @@ static void __attribute__((constructor)) read_mapping_schedule()
         fprintf(stderr, "Parsing error: not enough node "
                         "mappings, line %lu\n", i);
 #endif
-        cleanup();
-        return;
+        free_mappings(mappings, num_mappings);
+        return NULL;
       }
     }
+
+    if(mappings[i].region != SCHEDULE_DEFAULT_REGION &&
+       mappings[i].region >= num_regions)
+      num_regions = mappings[i].region + 1;
+    num_nodes += mappings[i].num;
+  }
+
+  // Convert to the binary layout, indexing regions densely by ID
+  size = sizeof(struct schedule_header) +
+         num_regions * sizeof(struct schedule_region) +
+         num_nodes * sizeof(int32_t);
+  if(!(hdr = calloc(1, size)))
+  {
+    free_mappings(mappings, num_mappings);
+    return NULL;
   }
+  memcpy(hdr->magic, SCHEDULE_MAGIC, sizeof(hdr->magic));
+  hdr->version = SCHEDULE_VERSION;
+  hdr->num_regions = num_regions;
+  hdr->num_nodes = num_nodes;
+  regions = (struct schedule_region *)(hdr + 1);
+  nodes = (int32_t *)(regions + num_regions);
 
-  // Sort so we can do a binary search based on region ID
-  qsort(mappings, num_mappings, sizeof(mapping_t), region_compare);
+  for(i = 0, num_nodes = 0; i < num_mappings; i++)
+  {
+    if(mappings[i].region == SCHEDULE_DEFAULT_REGION) r = &hdr->default_region;
+    else r = &regions[mappings[i].region];
+    r->offset = num_nodes;
+    r->num = mappings[i].num;
+    for(j = 0; j < mappings[i].num; j++)
+      nodes[num_nodes++] = mappings[i].node[j];
+  }
+  free_mappings(mappings, num_mappings);
 
+  return wrap_schedule(hdr, size);
+}
+
+/* Load a schedule from a binary or text file. */
+static schedule_t *load_schedule(const char *fn)
+{
+  int fd;
+  char magic[sizeof(SCHEDULE_MAGIC) - 1];
+  struct stat st;
+  FILE *fp;
+  schedule_t *s = NULL;
+
+  if((fd = open(fn, O_RDONLY | O_CLOEXEC)) < 0)
+  {
 #if _DEBUG == 1
-  printf("-> Thread schedule <-\n");
-  for(i = 0; i < num_mappings; i++)
+    perror("Could not open thread schedule file");
+#endif
+    return NULL;
+  }
+
+  if(!fstat(fd, &st) && st.st_size >= sizeof(struct schedule_header) &&
+     pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+     !memcmp(magic, SCHEDULE_MAGIC, sizeof(magic)))
+    s = read_binary_schedule(fd, st.st_size);
+  else if((fp = fdopen(fd, "r")))
+  {
+    s = read_text_schedule(fp);
+    fclose(fp);
+    return s;
+  }
+
+  close(fd);
+  return s;
+}
+
+#if _DEBUG == 1
+static void print_schedule(const schedule_t *s)
+{
+  size_t i, j;
+  const struct schedule_region *r;
+
+  printf("-> Thread schedule (generation %lu) <-\n", generation);
+  for(i = 0; i <= s->hdr->num_regions; i++)
   {
-    printf("Region %lu: %lu mappings", mappings[i].region, mappings[i].num);
-    for(j = 0; j < mappings[i].num; j++) printf(" %d", mappings[i].node[j]);
+    r = i < s->hdr->num_regions ? &s->regions[i] : &s->hdr->default_region;
+    if(!r->num) continue;
+    if(i < s->hdr->num_regions) printf("Region %lu: %u mappings", i, r->num);
+    else printf("Default region: %u mappings", r->num);
+    for(j = 0; j < r->num; j++) printf(" %d", s->nodes[r->offset + j]);
     printf("\n");
   }
+}
 #endif
 
-  fclose(fp);
+/*
+ * Swap in a new schedule & retire the old one.  Must be called with
+ * reload_lock held.
+ */
+static void install_schedule(schedule_t *s)
+{
+  schedule_t *old = __atomic_exchange_n(&schedule, s, __ATOMIC_ACQ_REL);
+  if(old)
+  {
+    old->next = retired;
+    retired = old;
+  }
+  __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+#if _DEBUG == 1
+  print_schedule(s);
+#endif
 }
 
-/* Comparison function for finding region. */
-int region_find(const void *k, const void *m)
+/*
+ * Watch the schedule file's directory & reload the schedule whenever the file
+ * is rewritten or replaced (e.g., by renaming a new schedule over it).
+ */
+static void *watch_schedule(void *arg)
 {
-  size_t key = *(size_t *)k;
-  mapping_t *map = (mapping_t *)m;
-  if(key < map->region) return -1;
-  else if(key > map->region) return 1;
-  else return 0;
+  int fd;
+  ssize_t len;
+  const char *base, *slash;
+  char dir[PATH_MAX], buf[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+
+  if((slash = strrchr(schedule_fn, '/')))
+  {
+    snprintf(dir, sizeof(dir), "%.*s",
+             (int)(slash - schedule_fn) ? (int)(slash - schedule_fn) : 1,
+             schedule_fn);
+    base = slash + 1;
+  }
+  else
+  {
+    strcpy(dir, ".");
+    base = schedule_fn;
+  }
+
+  if((fd = inotify_init1(IN_CLOEXEC)) < 0 ||
+     inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+  {
+#if _DEBUG == 1
+    perror("Could not watch thread schedule file");
+#endif
+    if(fd >= 0) close(fd);
+    return NULL;
+  }
+
+  while((len = read(fd, buf, sizeof(buf))) > 0)
+  {
+    for(event = (const struct inotify_event *)buf;
+        (const char *)event < buf + len;
+        event = (const void *)event + sizeof(*event) + event->len)
+    {
+      if(event->len && !strcmp(event->name, base))
+      {
+        migrate_schedule_reload();
+        break;
+      }
+    }
+  }
+
+  close(fd);
+  return NULL;
+}
+
+/* Load the thread schedule, if one is available. */
+static void __attribute__((constructor)) read_mapping_schedule()
+{
+  const char *fn;
+  schedule_t *s;
+  pthread_t watcher;
+
+  if((fn = getenv(ENV_POPCORN_THREAD_SCHEDULE))) schedule_fn = fn;
+  pthread_mutex_lock(&reload_lock);
+  if((s = load_schedule(schedule_fn))) install_schedule(s);
+  pthread_mutex_unlock(&reload_lock);
+
+  if(getenv(ENV_POPCORN_THREAD_SCHEDULE_WATCH))
+  {
+    if(!pthread_create(&watcher, NULL, watch_schedule, NULL))
+      pthread_detach(watcher);
+#if _DEBUG == 1
+    else fprintf(stderr, "Could not start thread schedule watcher\n");
+#endif
+  }
+}
+
+int migrate_schedule_reload(void)
+{
+  schedule_t *s;
+
+  pthread_mutex_lock(&reload_lock);
+  if((s = load_schedule(schedule_fn))) install_schedule(s);
+  pthread_mutex_unlock(&reload_lock);
+  return s ? 0 : -1;
+}
+
+unsigned long migrate_schedule_generation(void)
+{
+  return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
 }
 
 int get_node_mapping(size_t region, int ptid)
 {
-  if(ptid < 0) return default_node;
-  mapping_t *map = bsearch(&region, mappings, num_mappings,
-                           sizeof(mapping_t), region_find);
-  if(!map) return default_node;
+  const schedule_t *s = __atomic_load_n(&schedule, __ATOMIC_ACQUIRE);
+  const struct schedule_region *r;
+
+  if(!s || ptid < 0) return default_node;
+  if(region < s->hdr->num_regions) r = &s->regions[region];
+  else if(region == SCHEDULE_DEFAULT_REGION) r = &s->hdr->default_region;
+  else return default_node;
 
-  if((size_t)ptid < map->num) return map->node[ptid];
+  if((uint32_t)ptid < r->num) return s->nodes[r->offset + ptid];
   return default_node;
 }
-
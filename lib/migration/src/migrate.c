@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
@@ -11,11 +12,16 @@
 #include "internal.h"
 #include "mapping.h"
 #include "debug.h"
+#include "emulate.h"
+#include "prefetch.h"
+#include "defer.h"
 
 #if _SIG_MIGRATION == 1
 #include "trigger.h"
 #endif
 
+#include "timing.h"
+
 #if _TIME_REWRITE == 1
 #include "timer.h"
 #endif
@@ -122,17 +128,36 @@ static inline int do_migrate(void *addr)
 
 #else /* _ENV_SELECT_MIGRATE */
 
-// TODO remove this in future versions
+/*
+ * Read the pending migration word, falling back to asking the OS whether it
+ * has proposed a migration for this thread (unless built without polling).
+ */
 static inline int do_migrate(void __attribute__((unused)) *fn)
 {
-	struct popcorn_thread_status status;
-	int ret = popcorn_getthreadinfo(&status);
-	if (ret) return -1;
-	return status.proposed_nid;
+  int nid = __migrate_pending_nid;
+#if _POLL_MIGRATION == 1
+  if (nid < 0)
+  {
+    struct popcorn_thread_status status;
+    if (popcorn_getthreadinfo(&status)) return -1;
+    nid = status.proposed_nid;
+  }
+#endif
+  return nid;
 }
 
 #endif /* _ENV_SELECT_MIGRATE */
 
+/* Destination of the thread's pending migration, or -1 if none is pending. */
+__thread volatile int __migrate_pending_nid = -1;
+
+/* Request that the calling thread migrate at its next migration point. */
+void request_migration(int nid)
+{
+  if(nid < 0) defer_reset();
+  __migrate_pending_nid = nid;
+}
+
 static struct popcorn_node_status ni[MAX_POPCORN_NODES];
 static int origin_nid = -1;
 
@@ -142,17 +167,39 @@ int node_available(int nid)
   return ni[nid].status;
 }
 
+/*
+ * Node & architecture on which the calling thread is executing, or -1 if not
+ * yet queried.  Threads only change nodes by migrating through
+ * __migrate_shim_internal(), which updates the cache once the migration has
+ * completed.  This avoids a system call every time a thread checks where it's
+ * running.
+ */
+__thread int __migrate_cached_nid = -1;
+static __thread enum arch cached_arch = ARCH_UNKNOWN;
+
+/* Query the kernel for the calling thread's node & fill the cache. */
+int __migrate_fill_node_cache(void)
+{
+  int nid = popcorn_getnid();
+  if (nid < 0 || nid >= MAX_POPCORN_NODES) return nid;
+
+  // Note: node information isn't available until __init_nodes_info() has run,
+  // so leave the architecture to be filled on a later query
+  if (origin_nid >= 0) cached_arch = ni[nid].arch;
+  __migrate_cached_nid = nid;
+  return nid;
+}
+
 enum arch current_arch(void)
 {
-	int nid = popcorn_getnid();
-	if (nid < 0 || nid >= MAX_POPCORN_NODES) return ARCH_UNKNOWN;
-	return ni[nid].arch;
+  if (cached_arch == ARCH_UNKNOWN) __migrate_fill_node_cache();
+  return cached_arch;
 }
 
 // TODO remove this in future versions
 int current_nid(void)
 {
-  return popcorn_getnid();
+  return cached_nid();
 }
 
 // TODO remove this in future versions
@@ -171,8 +218,114 @@ struct shim_data {
   void *callback_data;
   void *regset;
   void *post_syscall;
+  int nid;
 };
 
+/* A gang member's view of its migration, filled in before the rendezvous. */
+struct migrate_gang_member {
+  st_stack_desc stack;  /* Stack to be rewritten by the gang's leader */
+  enum arch src_arch;
+  enum arch dst_arch;
+  int rewrite;          /* Whether the member's stack needs to be rewritten */
+};
+
+/* Gang with which the calling thread is migrating, if any. */
+static __thread migrate_gang_t *cur_gang = NULL;
+
+/*
+ * Rewrite all gang members' stacks, batched by source & destination
+ * architecture.  Called by the last member to arrive while all other members
+ * wait at the rendezvous.
+ */
+static void gang_rewrite_members(migrate_gang_t *gang)
+{
+  size_t i, num;
+  int src, dst;
+  struct migrate_gang_member *member;
+
+  for(src = 0; src < NUM_ARCHES; src++)
+  {
+    for(dst = 0; dst < NUM_ARCHES; dst++)
+    {
+      for(i = 0, num = 0; i < gang->num; i++)
+      {
+        member = gang->members[i];
+        if(member->rewrite && member->src_arch == src &&
+           member->dst_arch == dst)
+          gang->batch[num++] = member->stack;
+      }
+      if(!num) continue;
+
+      st_userspace_rewrite_batch(src, dst, gang->batch, num);
+      for(i = 0, num = 0; i < gang->num; i++)
+      {
+        member = gang->members[i];
+        if(member->rewrite && member->src_arch == src &&
+           member->dst_arch == dst)
+          member->stack.ret = gang->batch[num++].ret;
+      }
+    }
+  }
+}
+
+/*
+ * Wait until all gang members have arrived.  The last member to arrive
+ * rewrites everybody's stacks before releasing the gang.
+ */
+static void gang_rendezvous(migrate_gang_t *gang,
+                            struct migrate_gang_member *member)
+{
+  unsigned long gen;
+
+  pthread_mutex_lock(&gang->lock);
+  gen = gang->rendezvous;
+  gang->members[gang->arrived++] = member;
+  if(gang->arrived == gang->num)
+  {
+    gang_rewrite_members(gang);
+    gang->arrived = 0;
+    gang->rendezvous++;
+    pthread_cond_broadcast(&gang->cond);
+  }
+  else while(gen == gang->rendezvous)
+    pthread_cond_wait(&gang->cond, &gang->lock);
+  pthread_mutex_unlock(&gang->lock);
+}
+
+/*
+ * Prepare the calling thread's stack, rendezvous with the rest of the gang &
+ * collect the result of rewriting the stack.  Replaces REWRITE_STACK for gang
+ * migrations.
+ *
+ * @return non-zero if the stack was rewritten, or zero otherwise
+ */
+static int gang_rewrite(migrate_gang_t *gang,
+                        void *sp,
+                        void *regs_src,
+                        void *regs_dst,
+                        size_t regs_size,
+                        enum arch dst_arch)
+{
+  struct migrate_gang_member member = {
+    .src_arch = current_arch(),
+    .dst_arch = dst_arch,
+    .rewrite = 0,
+  };
+
+  member.stack.ret = 0;
+  if(_NATIVE == 1 || member.src_arch != dst_arch)
+  {
+    if(!st_userspace_prepare(sp, regs_src, regs_dst, &member.stack))
+      member.rewrite = 1;
+    else member.stack.ret = 1;
+  }
+  else memcpy(regs_dst, regs_src, regs_size);
+
+  gang_rendezvous(gang, &member);
+  if(member.rewrite) st_userspace_finish(&member.stack);
+  return !member.stack.ret;
+}
+
 #if _DEBUG == 1
 /*
  * Flag indicating we should spin post-migration in order to wait until a
@@ -203,6 +356,31 @@ static inline void *get_thread_pointer(void *raw_tls, enum arch dest)
   }
 }
 
+/*
+ * The calling thread's thread pointer as seen by each architecture.  The start
+ * of the TLS region is the same on every node, so pointers are translated once
+ * when the thread reserves its migration state rather than on every migration.
+ */
+static __thread void *thread_pointers[NUM_ARCHES];
+static __thread int reserved = 0;
+
+int migrate_reserve(void)
+{
+  int i;
+  void *raw_tls;
+
+  if(reserved) return 0;
+  raw_tls = GET_TLS_POINTER;
+  for(i = 0; i < NUM_ARCHES; i++)
+    thread_pointers[i] = get_thread_pointer(raw_tls, i);
+#if _TIME_MIGRATION
+  timing_reserve();
+#endif
+  if(st_userspace_reserve()) return -1;
+  reserved = 1;
+  return 0;
+}
+
 /* Generate a call site to get rewriting metadata for outermost frame. */
 static void* __attribute__((noinline))
 get_call_site() { return __builtin_return_address(0); };
@@ -220,17 +398,13 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
   int cur_nid = popcorn_getnid();
 #endif
 
-  if(!node_available(nid))
-  {
-    fprintf(stderr, "Destination node is not available!\n");
-    return;
-  }
-
+  // Note: arguments aren't valid after re-entering a heterogeneous migration,
+  // so only check the destination before migrating
   data_ptr = pthread_get_migrate_args();
   if(!data_ptr) // Invoke migration
   {
     unsigned long sp = 0, bp = 0;
-    const enum arch dst_arch = ni[nid].arch;
+    enum arch dst_arch;
     union {
        struct regset_aarch64 aarch;
        struct regset_powerpc64 powerpc;
@@ -239,24 +413,37 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
 #if _TIME_REWRITE == 1
     unsigned long long start, end;
 #endif
+    if(!node_available(nid))
+    {
+      fprintf(stderr, "Destination node is not available!\n");
+      return;
+    }
+    dst_arch = ni[nid].arch;
+#if _SIG_MIGRATION == 1
+    clear_migrate_flag();
+#endif
+    if(!reserved) migrate_reserve();
+
     GET_LOCAL_REGSET(regs_src);
+    PHASE_START();
 
 #if _TIME_REWRITE == 1
     TIMESTAMP(start);
 #endif
-    if(REWRITE_STACK(regs_src, regs_dst, dst_arch))
+    if(cur_gang ? gang_rewrite(cur_gang, REGSET_SP(regs_src), &regs_src,
+                               &regs_dst, sizeof(regs_src), dst_arch)
+                : REWRITE_STACK(regs_src, regs_dst, dst_arch))
     {
 #if _TIME_REWRITE == 1
       TIMESTAMP(end);
-      printf("Stack transformation time: %lluns\n", TIMESTAMP_DIFF(start, end));
+      timing_record(MIGRATE_TIMING_REWRITE, TIMESTAMP_DIFF(start, end));
 #endif
+      PHASE_DONE(rewrite);
       data.callback = callback;
       data.callback_data = callback_data;
       data.regset = &regs_dst;
+      data.nid = nid;
       pthread_set_migrate_args(&data);
-#if _SIG_MIGRATION == 1
-      clear_migrate_flag();
-#endif
 
       switch(dst_arch) {
       case ARCH_AARCH64:
@@ -286,13 +473,19 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
       default: assert(0 && "Unsupported architecture!");
       }
 
+      // Leave room below the rewritten frames for those pushed after resuming
+      if(_NATIVE == 1 || dst_arch != current_arch())
+        prefetch_queue(nid, (void *)(sp - PAGESZ),
+                       st_userspace_rewritten_base());
+      else prefetch_queue(nid, NULL, NULL);
+
 #if _CLEAN_CRASH == 1
       if(cur_nid != origin_nid) remote_debug_cleanup(cur_nid);
 #endif
 
       // Translate between architecture-specific thread descriptors
       // Note: TLS is now invalid until after migration!
-      __set_thread_area(get_thread_pointer(GET_TLS_POINTER, dst_arch));
+      __set_thread_area(thread_pointers[dst_arch]);
 
       // This code has different behavior depending on the type of migration:
       //
@@ -305,7 +498,14 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
       //
       // Note that when migration fails, we resume after the syscall and
       // err is set to 1.
+#if _EMULATE_POPCORN == 1
+      // Stand in for the system call, then switch stacks as in a native
+      // migration
+      err = emu_sched_migrate(nid);
+      if(!err) MIGRATE(err);
+#else
       MIGRATE(err);
+#endif
       if(err)
       {
         perror("Could not migrate to node");
@@ -326,10 +526,26 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
   // Hold until we can attach post-migration
   while(__hold);
 #endif
+  PHASE_DONE(migrate);
+  __migrate_cached_nid = data_ptr->nid;
+  cached_arch = ni[data_ptr->nid].arch;
+  prefetch_arrived(data_ptr->nid);
 #if _CLEAN_CRASH == 1
   if(cur_nid != origin_nid) remote_debug_init(cur_nid);
 #endif
+#if _TIME_REWRITE == 1
+  if(data_ptr->callback)
+  {
+    unsigned long long start, end;
+    TIMESTAMP(start);
+    data_ptr->callback(data_ptr->callback_data);
+    TIMESTAMP(end);
+    timing_record(MIGRATE_TIMING_CALLBACK, TIMESTAMP_DIFF(start, end));
+  }
+#else
   if(data_ptr->callback) data_ptr->callback(data_ptr->callback_data);
+#endif
+  PHASE_DONE(callback);
 
   pthread_set_migrate_args(NULL);
 }
@@ -337,15 +553,26 @@ __migrate_shim_internal(int nid, void (*callback)(void *), void *callback_data)
 /* Check if we should migrate, and invoke migration. */
 void check_migrate(void (*callback)(void *), void *callback_data)
 {
-  int nid = do_migrate(__builtin_return_address(0));
-  if (nid >= 0 && nid != popcorn_getnid())
+  int nid;
+
+  prefetch_sample();
+  nid = do_migrate(__builtin_return_address(0));
+  if (nid < 0) return;
+
+  // Leave the request pending if migrating here would be too expensive
+  if (nid != cached_nid() && defer_migration(nid, __builtin_frame_address(0)))
+    return;
+
+  // Consume the request so a failed migration isn't retried at every point
+  __migrate_pending_nid = -1;
+  if (nid != cached_nid())
     __migrate_shim_internal(nid, callback, callback_data);
 }
 
 /* Invoke migration to a particular node if we're not already there. */
 void migrate(int nid, void (*callback)(void *), void *callback_data)
 {
-  if (nid != popcorn_getnid())
+  if (nid != cached_nid())
     __migrate_shim_internal(nid, callback, callback_data);
 }
 
@@ -356,6 +583,93 @@ void migrate_schedule(size_t region,
                       void *callback_data)
 {
   int nid = get_node_mapping(region, popcorn_tid);
-  if (nid != popcorn_getnid())
+  if (nid != cached_nid())
     __migrate_shim_internal(nid, callback, callback_data);
 }
+
+/* Initialize a gang. */
+int migrate_gang_init(migrate_gang_t *gang, size_t num)
+{
+  if(!gang) return -1;
+  memset(gang, 0, sizeof(migrate_gang_t));
+  pthread_mutex_init(&gang->lock, NULL);
+  pthread_cond_init(&gang->cond, NULL);
+  return migrate_gang_reset(gang, num);
+}
+
+/* Change the number of threads in a gang. */
+int migrate_gang_reset(migrate_gang_t *gang, size_t num)
+{
+  struct migrate_gang_member **members;
+  st_stack_desc *batch;
+
+  if(!gang) return -1;
+  if(num > gang->capacity)
+  {
+    // Leave the gang empty on failure so threads migrate individually
+    members = realloc(gang->members, num * sizeof(*members));
+    if(!members) goto empty;
+    gang->members = members;
+    batch = realloc(gang->batch, num * sizeof(*batch));
+    if(!batch) goto empty;
+    gang->batch = batch;
+    gang->capacity = num;
+  }
+  gang->num = num;
+  gang->arrived = gang->completed = 0;
+  return 0;
+
+empty:
+  gang->num = gang->arrived = gang->completed = 0;
+  return -1;
+}
+
+/* Free a gang's resources. */
+void migrate_gang_destroy(migrate_gang_t *gang)
+{
+  if(!gang) return;
+  free(gang->members);
+  free(gang->batch);
+  pthread_mutex_destroy(&gang->lock);
+  pthread_cond_destroy(&gang->cond);
+  memset(gang, 0, sizeof(migrate_gang_t));
+}
+
+/* Migrate the calling thread to a node as part of a gang. */
+int migrate_gang(migrate_gang_t *gang,
+                 int nid,
+                 void (*callback)(void *),
+                 void *callback_data)
+{
+  unsigned long gen;
+  struct migrate_gang_member member = { .rewrite = 0 };
+
+  if(!gang || !gang->num) return -1;
+
+  // Note: every member must arrive at the rendezvous exactly once, even if it
+  // isn't migrating, or the rest of the gang would wait forever
+  if(nid != cached_nid() && node_available(nid))
+  {
+    cur_gang = gang;
+    __migrate_shim_internal(nid, NULL, NULL);
+    cur_gang = NULL;
+  }
+  else gang_rendezvous(gang, &member);
+
+  // Wait for the rest of the gang to migrate; the last to finish invokes the
+  // callback on everybody's behalf
+  pthread_mutex_lock(&gang->lock);
+  gen = gang->completion;
+  if(++gang->completed == gang->num)
+  {
+    if(callback) callback(callback_data);
+    gang->completed = 0;
+    gang->completion++;
+    pthread_cond_broadcast(&gang->cond);
+  }
+  else while(gen == gang->completion)
+    pthread_cond_wait(&gang->cond, &gang->lock);
+  pthread_mutex_unlock(&gang->lock);
+
+  return nid == cached_nid() ? 0 : -1;
+}
@@ -0,0 +1,270 @@
+/*
+ * Working-set prefetch handoff to the DSM prefetching library.  See
+ * prefetch.h for more details.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "platform.h"
+#include "migrate.h"
+#include "config.h"
+#include "prefetch.h"
+
+#if _PREFETCH_ON_MIGRATE == 1
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * DSM prefetching library API, referenced weakly so that applications which
+ * don't link the library don't need to.  Access types must match
+ * access_type_t in dsm-prefetch.h.
+ */
+enum { PREFETCH_READ = 0, PREFETCH_WRITE = 1 };
+
+void __attribute__((weak))
+popcorn_prefetch_node(int nid, int type, const void *low, const void *high);
+size_t __attribute__((weak)) popcorn_prefetch_execute_node(int nid);
+
+/* A region of memory the thread accesses frequently. */
+struct hot_region {
+  const void *low, *high;
+  int write;
+};
+
+/* The calling thread's hot regions. */
+static __thread struct hot_region hot_regions[MAX_HOT_REGIONS];
+static __thread size_t num_hot_regions = 0;
+
+/* Whether the calling thread queued requests for its current migration. */
+static __thread int queued = 0;
+
+/*
+ * Whether page faults are being counted for the calling thread, the thread's
+ * page fault count when it arrived on its current node & when its warm-up
+ * window ends (in nanoseconds).
+ */
+static __thread int counting = 0;
+static __thread unsigned long long arrival_faults = 0;
+static __thread unsigned long long window_end = 0;
+
+/* Warm-up window (in nanoseconds), read on first use. */
+static unsigned long long window = 0;
+
+/* Key used to count threads' faults up until they exit. */
+static pthread_key_t window_key;
+static pthread_once_t window_key_once = PTHREAD_ONCE_INIT;
+
+/* Statistics across all threads. */
+static migrate_prefetch_stats stats = { 0, 0, 0 };
+
+/* Return whether the DSM prefetching library was linked in. */
+static inline int prefetch_available(void)
+{
+  return popcorn_prefetch_node && popcorn_prefetch_execute_node;
+}
+
+/* Return the number of page faults taken by the calling thread. */
+static unsigned long long thread_faults(void)
+{
+  struct rusage usage;
+  if(getrusage(RUSAGE_THREAD, &usage)) return 0;
+  return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* Return the current time, in nanoseconds. */
+static inline unsigned long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Stop counting the calling thread's faults, attributing those taken since it
+ * arrived to its last migration.
+ */
+static void close_window(void)
+{
+  if(!counting) return;
+  __atomic_fetch_add(&stats.faulted, thread_faults() - arrival_faults,
+                     __ATOMIC_RELAXED);
+  counting = 0;
+}
+
+/* Count a thread's faults up until it exits if its window is still open. */
+static void close_window_at_exit(void *data)
+{
+  close_window();
+}
+
+static void init_window(void)
+{
+  const char *env = getenv(ENV_PREFETCH_WINDOW);
+  long long us = env ? atoll(env) : DEFAULT_PREFETCH_WINDOW;
+
+  window = (us > 0 ? us : DEFAULT_PREFETCH_WINDOW) * 1000ULL;
+  if(pthread_key_create(&window_key, close_window_at_exit))
+    fprintf(stderr, "WARNING: could not create prefetch window key\n");
+}
+
+/* Queue a prefetch request & return the number of pages requested. */
+static unsigned long long
+queue_span(int nid, int write, const void *low, const void *high)
+{
+  uint64_t l = PAGE_ROUND_DOWN((uint64_t)low);
+  uint64_t h = PAGE_ROUND_UP((uint64_t)high);
+
+  if(l >= h) return 0;
+  popcorn_prefetch_node(nid, write ? PREFETCH_WRITE : PREFETCH_READ,
+                        low, high);
+  return (h - l) / PAGESZ;
+}
+
+/* Print statistics at exit if requested. */
+static void __attribute__((destructor)) print_prefetch_stats(void)
+{
+  FILE *out;
+  migrate_prefetch_stats cur;
+  const char *fn = getenv(ENV_PREFETCH_STATS);
+
+  if(!fn || !(out = fopen(fn, "a"))) return;
+  close_window();
+  migrate_prefetch_query(&cur);
+  fprintf(out, "[Migration prefetch] %llu migration(s), %llu page(s) "
+               "prefetched, %llu page(s) faulted\n",
+          cur.migrations, cur.prefetched, cur.faulted);
+  fclose(out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal prefetching API
+///////////////////////////////////////////////////////////////////////////////
+
+/* Queue prefetch requests for the thread's working set on its destination. */
+void prefetch_queue(int nid, void *stack_low, void *stack_high)
+{
+  size_t i;
+  unsigned long long pages = 0;
+
+  queued = 0;
+  if(!prefetch_available()) return;
+
+  // Attribute faults taken since the last migration to that migration, if
+  // the thread is leaving before the end of its warm-up window
+  close_window();
+
+  if(stack_low) pages += queue_span(nid, 1, stack_low, stack_high);
+  for(i = 0; i < num_hot_regions; i++)
+    pages += queue_span(nid, hot_regions[i].write,
+                        hot_regions[i].low, hot_regions[i].high);
+
+  if(pages)
+  {
+    __atomic_fetch_add(&stats.prefetched, pages, __ATOMIC_RELAXED);
+    queued = 1;
+  }
+}
+
+/* Execute the thread's queued prefetch requests after arriving. */
+void prefetch_arrived(int nid)
+{
+  if(!queued) return;
+  popcorn_prefetch_execute_node(nid);
+  __atomic_fetch_add(&stats.migrations, 1, __ATOMIC_RELAXED);
+  queued = 0;
+
+  /* Count faults over the warm-up window, or until the thread leaves */
+  pthread_once(&window_key_once, init_window);
+  pthread_setspecific(window_key, (void *)1);
+  counting = 1;
+  arrival_faults = thread_faults();
+  window_end = now_ns() + window;
+}
+
+/* Stop counting faults once the thread's warm-up window has elapsed. */
+void prefetch_sample(void)
+{
+  if(counting && now_ns() >= window_end) close_window();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public prefetching API
+///////////////////////////////////////////////////////////////////////////////
+
+int migrate_prefetch_register(const void *low, const void *high, int write)
+{
+  size_t i;
+
+  if(!low || low >= high) return -1;
+  for(i = 0; i < num_hot_regions; i++)
+  {
+    if(hot_regions[i].low == low)
+    {
+      hot_regions[i].high = high;
+      hot_regions[i].write = write;
+      return 0;
+    }
+  }
+
+  if(num_hot_regions >= MAX_HOT_REGIONS) return -1;
+  hot_regions[num_hot_regions].low = low;
+  hot_regions[num_hot_regions].high = high;
+  hot_regions[num_hot_regions].write = write;
+  num_hot_regions++;
+  return 0;
+}
+
+int migrate_prefetch_unregister(const void *low)
+{
+  size_t i;
+
+  for(i = 0; i < num_hot_regions; i++)
+  {
+    if(hot_regions[i].low == low)
+    {
+      hot_regions[i] = hot_regions[--num_hot_regions];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void migrate_prefetch_query(migrate_prefetch_stats *cur)
+{
+  if(!cur) return;
+  cur->migrations = __atomic_load_n(&stats.migrations, __ATOMIC_RELAXED);
+  cur->prefetched = __atomic_load_n(&stats.prefetched, __ATOMIC_RELAXED);
+  cur->faulted = __atomic_load_n(&stats.faulted, __ATOMIC_RELAXED);
+}
+
+#else /* _PREFETCH_ON_MIGRATE */
+
+void prefetch_queue(int nid, void *stack_low, void *stack_high) {}
+void prefetch_arrived(int nid) {}
+void prefetch_sample(void) {}
+
+int migrate_prefetch_register(const void *low, const void *high, int write)
+{
+  return -1;
+}
+
+int migrate_prefetch_unregister(const void *low)
+{
+  return -1;
+}
+
+void migrate_prefetch_query(migrate_prefetch_stats *cur)
+{
+  if(cur) cur->migrations = cur->prefetched = cur->faulted = 0;
+}
+
+#endif /* _PREFETCH_ON_MIGRATE */
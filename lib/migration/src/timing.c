@@ -0,0 +1,312 @@
+/*
+ * Per-thread migration timing histograms.  See timing.h for more details.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "timing.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/* A thread's timing histograms. */
+struct thread_timing {
+  struct thread_timing *next;
+  migrate_histogram hists[MIGRATE_NUM_TIMINGS];
+};
+
+/* Timing names, indexed by timing. */
+static const char *timing_names[MIGRATE_NUM_TIMINGS] = {
+  "response", "rewrite", "callback", "estimate", "deferral"
+};
+
+/*
+ * Live threads' histograms & the merged histograms of threads which have
+ * exited.  LOCK protects the list & the exited histograms; each thread updates
+ * its own histograms without locking.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_timing *threads = NULL;
+static migrate_histogram exited[MIGRATE_NUM_TIMINGS];
+
+/* The calling thread's histograms. */
+static __thread struct thread_timing *cur_thread = NULL;
+
+/* Key used to retire threads' histograms when they exit. */
+static pthread_key_t timing_key;
+static pthread_once_t timing_key_once = PTHREAD_ONCE_INIT;
+
+/* Update a value written by a single thread & read by many. */
+#define SET( var, val ) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define GET( var ) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+#define SUB_BUCKETS (1UL << MIGRATE_HIST_SUB_BITS)
+
+/* Merge a thread's histogram into another, reading values atomically. */
+static void hist_merge_live(migrate_histogram *dst,
+                            const migrate_histogram *src)
+{
+  size_t i;
+  unsigned long long min, max;
+
+  if(!GET(src->count)) return;
+  min = GET(src->min);
+  max = GET(src->max);
+  if(!dst->count || min < dst->min) dst->min = min;
+  if(max > dst->max) dst->max = max;
+  dst->count += GET(src->count);
+  dst->sum += GET(src->sum);
+  for(i = 0; i < MIGRATE_HIST_BUCKETS; i++)
+    dst->buckets[i] += GET(src->buckets[i]);
+}
+
+/*
+ * Fold an exiting thread's histograms into the exited threads' histograms &
+ * free them.
+ */
+static void retire_thread_timing(void *data)
+{
+  size_t i;
+  struct thread_timing *t = (struct thread_timing *)data, **prev;
+
+  pthread_mutex_lock(&lock);
+  for(prev = &threads; *prev && *prev != t; prev = &(*prev)->next);
+  if(*prev) *prev = t->next;
+  for(i = 0; i < MIGRATE_NUM_TIMINGS; i++)
+    migrate_histogram_merge(&exited[i], &t->hists[i]);
+  pthread_mutex_unlock(&lock);
+
+  cur_thread = NULL;
+  free(t);
+}
+
+/* Create the key used to retire threads' histograms. */
+static void create_timing_key(void)
+{
+  if(pthread_key_create(&timing_key, retire_thread_timing))
+    fprintf(stderr, "WARNING: could not create timing histogram key\n");
+}
+
+/* Get the calling thread's histograms, allocating them on first use. */
+static struct thread_timing *get_thread_timing(void)
+{
+  struct thread_timing *t;
+
+  if((t = cur_thread)) return t;
+  if(!(t = calloc(1, sizeof(struct thread_timing))))
+  {
+    fprintf(stderr, "WARNING: could not allocate timing histograms\n");
+    return NULL;
+  }
+
+  /* Retire the histograms when the thread exits */
+  pthread_once(&timing_key_once, create_timing_key);
+  if(pthread_setspecific(timing_key, t))
+    fprintf(stderr, "WARNING: could not set timing histogram key\n");
+
+  /* Publish the histograms to readers */
+  pthread_mutex_lock(&lock);
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock(&lock);
+  cur_thread = t;
+  return t;
+}
+
+/* Get the bucket counting a value. */
+static inline size_t bucket_index(unsigned long long val)
+{
+  unsigned exp;
+
+  if(val < SUB_BUCKETS) return val;
+  exp = 63 - __builtin_clzll(val);
+  if(exp >= MIGRATE_HIST_MAX_BITS) return MIGRATE_HIST_BUCKETS - 1;
+  return ((exp - MIGRATE_HIST_SUB_BITS + 1) << MIGRATE_HIST_SUB_BITS) +
+         ((val >> (exp - MIGRATE_HIST_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* Add a value to a histogram.  Must only be called by the histogram's owner. */
+static inline void hist_add(migrate_histogram *hist, unsigned long long val)
+{
+  size_t bucket = bucket_index(val);
+
+  if(!hist->count || val < hist->min) SET(hist->min, val);
+  if(val > hist->max) SET(hist->max, val);
+  SET(hist->sum, hist->sum + val);
+  SET(hist->buckets[bucket], hist->buckets[bucket] + 1);
+  SET(hist->count, hist->count + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal timing API
+///////////////////////////////////////////////////////////////////////////////
+
+/* Record a timing for the calling thread. */
+void timing_record(enum migrate_timing timing, unsigned long long ns)
+{
+  struct thread_timing *t = get_thread_timing();
+  if(t && timing < MIGRATE_NUM_TIMINGS) hist_add(&t->hists[timing], ns);
+}
+
+/* Allocate the calling thread's histograms up front. */
+void timing_reserve(void)
+{
+  get_thread_timing();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public timing API
+///////////////////////////////////////////////////////////////////////////////
+
+const char *migrate_timing_name(enum migrate_timing timing)
+{
+  if(timing >= MIGRATE_NUM_TIMINGS) return NULL;
+  return timing_names[timing];
+}
+
+int migrate_timing_query(enum migrate_timing timing, migrate_histogram *hist)
+{
+  const struct thread_timing *t;
+
+  if(timing >= MIGRATE_NUM_TIMINGS || !hist) return -1;
+
+  pthread_mutex_lock(&lock);
+  memcpy(hist, &exited[timing], sizeof(migrate_histogram));
+  for(t = threads; t; t = t->next) hist_merge_live(hist, &t->hists[timing]);
+  pthread_mutex_unlock(&lock);
+
+  return 0;
+}
+
+void migrate_histogram_merge(migrate_histogram *dst,
+                             const migrate_histogram *src)
+{
+  size_t i;
+
+  if(!dst || !src || !src->count) return;
+  if(!dst->count || src->min < dst->min) dst->min = src->min;
+  if(src->max > dst->max) dst->max = src->max;
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for(i = 0; i < MIGRATE_HIST_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+}
+
+unsigned long long migrate_histogram_bucket_low(size_t bucket)
+{
+  unsigned exp;
+
+  if(bucket < SUB_BUCKETS) return bucket;
+  exp = (bucket >> MIGRATE_HIST_SUB_BITS) + MIGRATE_HIST_SUB_BITS - 1;
+  return (1ULL << exp) +
+         ((bucket & (SUB_BUCKETS - 1)) << (exp - MIGRATE_HIST_SUB_BITS));
+}
+
+unsigned long long migrate_histogram_percentile(const migrate_histogram *hist,
+                                                double pct)
+{
+  size_t i;
+  unsigned long long target, seen = 0, val;
+
+  if(!hist || !hist->count) return 0;
+  if(pct <= 0.0) return hist->min;
+  if(pct >= 100.0) return hist->max;
+
+  target = (unsigned long long)(pct / 100.0 * hist->count + 0.5);
+  if(!target) target = 1;
+  for(i = 0; i < MIGRATE_HIST_BUCKETS; i++)
+  {
+    seen += hist->buckets[i];
+    if(seen >= target) break;
+  }
+
+  /* Report the top of the bucket, clamped to the observed range */
+  if(i >= MIGRATE_HIST_BUCKETS - 1) return hist->max;
+  val = migrate_histogram_bucket_low(i + 1) - 1;
+  if(val > hist->max) val = hist->max;
+  if(val < hist->min) val = hist->min;
+  return val;
+}
+
+int migrate_timing_dump(const char *fn)
+{
+  size_t timing, i;
+  migrate_histogram hist;
+  FILE *fp = stdout;
+
+  if(fn && !(fp = fopen(fn, "a"))) return -1;
+
+  fprintf(fp, "[Migration timing] Migration timings (PID %d)\n", getpid());
+  for(timing = 0; timing < MIGRATE_NUM_TIMINGS; timing++)
+  {
+    migrate_timing_query(timing, &hist);
+    if(!hist.count) continue;
+    fprintf(fp, "[Migration timing]   %s (ns) - %llu sample(s), min %llu, "
+            "avg %.1f, p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+            timing_names[timing], hist.count, hist.min,
+            (double)hist.sum / (double)hist.count,
+            migrate_histogram_percentile(&hist, 50),
+            migrate_histogram_percentile(&hist, 90),
+            migrate_histogram_percentile(&hist, 99), hist.max);
+    for(i = 0; i < MIGRATE_HIST_BUCKETS; i++)
+    {
+      if(!hist.buckets[i]) continue;
+      if(i < MIGRATE_HIST_BUCKETS - 1)
+        fprintf(fp, "[Migration timing]     [%llu, %llu): %llu\n",
+                migrate_histogram_bucket_low(i),
+                migrate_histogram_bucket_low(i + 1), hist.buckets[i]);
+      else fprintf(fp, "[Migration timing]     [%llu, inf): %llu\n",
+                   migrate_histogram_bucket_low(i), hist.buckets[i]);
+    }
+  }
+
+  if(fn) fclose(fp);
+  else fflush(fp);
+  return 0;
+}
+
+#if _TIME_MIGRATION
+
+/* Dump timings every PERIOD seconds. */
+static void *dump_thread(void *arg)
+{
+  unsigned period = (unsigned)(unsigned long)arg;
+
+  while(1)
+  {
+    sleep(period);
+    migrate_timing_dump(getenv(ENV_TIMING_FILE));
+  }
+  return NULL;
+}
+
+/* Start periodically dumping timings, if requested. */
+static void __attribute__((constructor)) __start_timing_dump(void)
+{
+  pthread_t tid;
+  pthread_attr_t attr;
+  const char *env = getenv(ENV_TIMING_PERIOD);
+  long period = env ? atol(env) : 0;
+
+  if(period <= 0) return;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if(pthread_create(&tid, &attr, dump_thread, (void *)period))
+    perror("Could not start timing dump thread");
+  pthread_attr_destroy(&attr);
+}
+
+/* Output timings at exit. */
+// Note: destructor should only be called by one thread and is therefore
+// thread-safe.
+static void __attribute__((destructor)) __print_timing(void)
+{
+  migrate_timing_dump(getenv(ENV_TIMING_FILE));
+}
+
+#endif /* _TIME_MIGRATION */
@@ -4,45 +4,65 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
 #include <assert.h>
+#include <sys/syscall.h>
 #include "config.h"
+#include "migrate.h"
+#include "defer.h"
+
+/*
+ * Request that a thread migrate.  Requests for other threads are delivered via
+ * the migration trigger signal, whose handler sets the target thread's pending
+ * migration word (see __migrate_pending_nid in migrate.h).
+ */
+int request_thread_migration(pid_t tid, int nid)
+{
+  if(!tid || tid == syscall(SYS_gettid))
+  {
+    request_migration(nid);
+    return 0;
+  }
 
 #if _SIG_MIGRATION == 1
+  siginfo_t info;
+  memset(&info, 0, sizeof(siginfo_t));
+  info.si_signo = MIGRATE_SIGNAL;
+  info.si_code = SI_QUEUE;
+  info.si_pid = getpid();
+  info.si_uid = getuid();
+  info.si_value.sival_int = nid;
+  return syscall(SYS_rt_tgsigqueueinfo, getpid(), tid, MIGRATE_SIGNAL, &info);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Request that a set of threads migrate. */
+int request_threads_migration(const pid_t *tids, size_t num, int nid)
+{
+  size_t i;
+  int ret = 0;
 
-/* Flag set by signal handler indicating a thread should migrate. */
-// TODO this should be thread-specific
-volatile int __migrate_flag = -1;
+  for(i = 0; i < num; i++)
+    if(request_thread_migration(tids[i], nid)) ret = -1;
+  return ret;
+}
+
+#if _SIG_MIGRATION == 1
 
 #if _TIME_RESPONSE_DELAY == 1
 
 #include "timer.h"
-
-/*
- * Statistics about number of times a migration was signalled and the time
- * between when the migration was signalled and when the thread reached the
- * migration library.
- */
-// Note: we don't expect to be signalled *that* much during a single
-// application's execution, so only maintain 1024 timings.
-static volatile unsigned long num_triggers = 0;
-static unsigned long long response_timings[1024] = { 0L }; // In nanoseconds
+#include "timing.h"
 
 /*
  * Starting (architecture-specific) timestamp set when a thread executes the
- * migration request signal handler.
+ * migration request signal handler.  Response times are recorded in the
+ * thread's timing histograms (see timing.h).
  */
-// TODO needs to be thread-specific
-static unsigned long long start = UINT64_MAX;
-
-/* Output response time statistics. */
-// Note: destructor should only be called by one thread and is therefore
-// thread-safe.
-static void __attribute__((destructor)) __print_response_timing()
-{
-  unsigned long i;
-  printf("Number of migration triggers: %lu\nResponse times:\n", num_triggers);
-  for(i = 0; i < num_triggers; i++) printf("  %llu ns\n", response_timings[i]);
-}
+static __thread unsigned long long start = UINT64_MAX;
 
 #endif /* _TIME_RESPONSE_DELAY */
 
@@ -53,19 +73,18 @@ static void __attribute__((destructor)) __print_response_timing()
 void clear_migrate_flag()
 {
 #if _TIME_RESPONSE_DELAY == 1
-  unsigned long end, idx;
+  unsigned long long end;
+
+  // Note: migrations not triggered by the signal don't have a response time
   if(start != UINT64_MAX)
   {
     TIMESTAMP(end);
-    idx = __sync_fetch_and_add(&num_triggers, 1);
-    if(idx >= 1024) fprintf(stderr, "WARNING: too many response timings!\n");
-    else response_timings[idx] = TIMESTAMP_DIFF(start, end);
+    timing_record(MIGRATE_TIMING_RESPONSE, TIMESTAMP_DIFF(start, end));
     start = UINT64_MAX;
   }
-  else fprintf(stderr, "WARNING: no starting time stamp");
 #endif
 
-  __migrate_flag = -1;
+  __migrate_pending_nid = -1;
 }
 
 /*
@@ -74,23 +93,38 @@ void clear_migrate_flag()
  */
 static void __migrate_sighandler(int sig, siginfo_t *info, void *args)
 {
+  // Signals queued by request_thread_migration() carry the destination node,
+  // while the OS' signals currently always target node 1.
+  int nid = (info->si_code == SI_QUEUE ? info->si_value.sival_int : 1);
+
+  // Cancel the pending migration, including any deferral in progress
+  if(nid < 0)
+  {
+    defer_reset();
+    __migrate_pending_nid = -1;
+    return;
+  }
+
   // Avoid accidentally triggering this again, which can screw up calculating
-  // migration response time.
-  if(__migrate_flag >= 0) return;
+  // migration response time.  OS re-signals carry no new target & are
+  // dropped, but requests retargeting a pending migration are accepted
+  // (keeping the original request's start time).
+  if(__migrate_pending_nid >= 0 &&
+     (info->si_code != SI_QUEUE || __migrate_pending_nid == nid)) return;
 
 #if _TIME_RESPONSE_DELAY == 1
-  TIMESTAMP(start);
+  if(start == UINT64_MAX) TIMESTAMP(start);
 #endif
-  // The compiler can instrument code so that threads check this flag during
-  // execution to decide whether to call into the migration library.
-  // TODO this needs to be set according to the what the OS tells us (maybe in
-  // the args argument?)
-  __migrate_flag = 1;
+
+  // The compiler instruments code so that threads check this (thread-local)
+  // flag during execution to decide whether to call into the migration
+  // library.
+  __migrate_pending_nid = nid;
 
   // Tell the OS we're requesting this thread migrate.
   // TODO in the real version, the OS should *know* that the thread is to be
   // migrated and does not need to be told.
-  if(syscall(SYS_propose_migration, 0, 1))
+  if(syscall(SYS_propose_migration, 0, nid))
     perror("Could not propose the migration destination for the thread");
 }
 
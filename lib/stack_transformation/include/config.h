@@ -24,13 +24,26 @@
 //#define _CHECKS 1
 
 /*
- * Enable timing of operations to determine hotspots.  Fine-grained timing
- * provides further details about individual operations (with more overhead).
+ * Telemetry (timing of operations to determine hotspots, see telemetry.h) is
+ * always compiled in and is enabled at runtime by setting ST_TELEMETRY in the
+ * environment or by calling st_telemetry_enable().
  */
 // Note: many functions use print statements in debugging, so in order to get
 // more accurate timing information disable debugging information.
-//#define _TIMING 1
-//#define _FINE_GRAINED_TIMING 1
+#define ENV_TELEMETRY "ST_TELEMETRY"
+
+/*
+ * Environment variable naming the file to which telemetry is dumped at exit,
+ * and the default file if not set.
+ */
+#define ENV_TELEMETRY_FILE "ST_TELEMETRY_FILE"
+#define TELEMETRY_FILE "/tmp/stack-transform-telemetry.log"
+
+/*
+ * Number of call sites for which rewriting costs are tracked per thread (must
+ * be a power of 2).  Call sites beyond this are not tracked.
+ */
+#define TELEMETRY_SITES 256
 
 /*
  * Select the function used to measure time.  This may cause performance
@@ -52,14 +65,49 @@
 #define PER_NODE_MALLOC 1
 #ifdef PER_NODE_MALLOC
 # define MALLOC popcorn_malloc_cur
+# define REALLOC popcorn_realloc_cur
 #else
 # define MALLOC malloc
+# define REALLOC realloc
 #endif
 
 /*
- * Maximum number of frames that can be rewritten.
+ * Number of activations stored inline in each rewriting context.  Activations
+ * for deeper stacks spill to an arena on the heap, which grows as needed.
+ */
+#define INLINE_ACTS 32
+
+/*
+ * Maximum number of rewrite plans cached per handle (must be a power of 2),
+ * and the number of cache slots probed before giving up on caching a plan.
+ */
+#define PLAN_CACHE_SIZE 1024
+#define PLAN_CACHE_PROBES 8
+
+/*
+ * Maximum number of idle rewrite contexts kept for reuse.  Each rewrite uses
+ * two contexts (source & destination); contexts released when the pool is
+ * full are freed.
+ */
+#define CONTEXT_POOL_SIZE 32
+
+/*
+ * Number of stack pointer fixups each thread's reserved rewriting contexts
+ * have room for up front (see st_reserve_thread()).
+ */
+#define RESERVED_FIXUPS 64
+
+/*
+ * Default & maximum number of worker threads (in addition to the calling
+ * thread) used to rewrite stacks in st_rewrite_stacks().
+ */
+#define DEFAULT_REWRITE_WORKERS 3
+#define MAX_REWRITE_WORKERS 15
+
+/*
+ * Maximum number of metadata sections mapped per handle.
  */
-#define MAX_FRAMES 512
+#define MAX_SECTION_MAPS 16
 
 /*
  * Default character buffer size.
@@ -76,6 +124,13 @@
 #define SECTION_ST_ADDR SECTION_PREFIX "." SECTION_ADDR
 #define SECTION_ST_LIVE SECTION_PREFIX "." SECTION_LIVE
 #define SECTION_ST_ARCH_LIVE SECTION_PREFIX "." SECTION_ARCH
+#define SECTION_ST_INDEX SECTION_PREFIX "." SECTION_INDEX
+#define SECTION_ST_VERSION SECTION_PREFIX "." SECTION_VERSION
+#define SECTION_ST_SITE_ADDR SECTION_PREFIX "." SECTION_SITE_ADDR
+#define SECTION_ST_SITE_ID SECTION_PREFIX "." SECTION_SITE_ID
+#define SECTION_ST_SITE_ID_MAP SECTION_PREFIX "." SECTION_SITE_ID_MAP
+#define SECTION_ST_SITE SECTION_PREFIX "." SECTION_SITE
+#define SECTION_ST_FUNC SECTION_PREFIX "." SECTION_FUNC
 
 ///////////////////////////////////////////////////////////////////////////////
 // Userspace rewriting configuration
@@ -89,10 +144,48 @@
 #define ENV_X86_64_BIN "ST_X86_64_BIN"
 
 /*
- * Stack limits -- Linux defaults to 8MB.
+ * Environment variable which, if set, enables on-demand rewriting, i.e., only
+ * the outermost frames are rewritten at migration time & the rest are
+ * rewritten as the thread returns into them.
  */
-#define MAX_STACK_SIZE (8UL * 1024UL * 1024UL)
-#define B_STACK_OFFSET (4 * 1024 * 1024)
+#define ENV_ONDEMAND "ST_ONDEMAND"
+
+/*
+ * Environment variable which, if set, builds rewrite plans for all call sites
+ * at startup rather than on first use.
+ */
+#define ENV_PREBUILD_PLANS "ST_PREBUILD_PLANS"
+
+/*
+ * Environment variable specifying the number of worker threads used to
+ * rewrite stacks in st_rewrite_stacks().
+ */
+#define ENV_REWRITE_WORKERS "ST_REWRITE_WORKERS"
+
+/*
+ * Size of stack regions into which threads are rewritten for user-space
+ * rewriting, including the guard page -- Linux defaults to 8MB stacks.
+ */
+#define STACK_REGION_SIZE (8UL * 1024UL * 1024UL)
+
+/*
+ * Number of bytes pre-faulted at the top of stack regions beyond the largest
+ * stack rewritten so far, for frames called after resuming on the region.
+ */
+#define STACK_REGION_PREFAULT (64UL * 1024UL)
+
+/*
+ * Maximum number of free stack regions kept per node & the number of nodes
+ * with pools (should match MAX_POPCORN_NODES).
+ */
+#define STACK_REGION_POOL_SIZE 16
+#define STACK_REGION_NODES 32
+
+/*
+ * Maximum number of frames walked by st_userspace_estimate().  Deeper stacks
+ * are reported as having this many frames.
+ */
+#define ST_ESTIMATE_MAX_FRAMES 4096
 
 #endif /* _CONFIG_H */
 
@@ -104,7 +197,3 @@
 # error Must define _DEBUG to enable logging (_LOG)!
 #endif
 
-#if defined(_FINE_GRAINED_TIMING) && !defined(_TIMING)
-# error Must define _TIMING to enable fine-grained timing (_FINE_GRAINED_TIMING)!
-#endif
-
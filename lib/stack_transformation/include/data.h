@@ -31,6 +31,20 @@ void put_val(rewrite_context src,
              rewrite_context dest,
              const live_value* dest_val);
 
+/*
+ * Copy a value as described by a rewrite plan's operation.  Like put_val(),
+ * but the checks for constants & callee-saved registers were resolved when the
+ * plan was built.  This function implicitly uses the current stack frame in
+ * the source & destination rewriting context.
+ *
+ * @param src the source rewriting context
+ * @param dest the destination rewriting context
+ * @param op a rewrite plan operation with OP_COPY set
+ */
+void put_val_op(rewrite_context src,
+                rewrite_context dest,
+                const rewrite_op* op);
+
 /*
  * Put an architecture-specific constant value into a location.  This function
  * implicitly uses the current stack frame in the rewriting context.
@@ -67,23 +81,22 @@ void* points_to_stack(const rewrite_context ctx,
                       const live_value* val);
 
 /*
- * Return whether or not a pointer refers to the specified live value in the
- * rewriting context.  If so, return the pointer's translated value for the
- * destination context.  If not, return NULL.
+ * Resolve all outstanding pointers to the specified live value in the
+ * rewriting context.  Pointers which refer to the source value are set to the
+ * translated address in the destination value and their fixups are removed
+ * from the destination context.  This function implicitly uses the current
+ * stack frame in the source & destination rewriting context.
  *
  * @param src the source rewriting context
  * @param src_val the pointed-to live value on the source stack
  * @param dest the destination rewriting context
  * @param dest_val the pointed-to live value on the destination stack
- * @param src_ptr the source pointer which refers to the source stack
- * @return the translated pointer for the destination if src_ptr points to
- *         src_val, or NULL otherwise
+ * @return the number of pointers resolved
  */
-void* points_to_data(const rewrite_context src,
-                     const live_value* src_val,
-                     const rewrite_context dest,
-                     const live_value* dest_val,
-                     void* src_ptr);
+size_t resolve_pointers_to_data(const rewrite_context src,
+                                const live_value* src_val,
+                                rewrite_context dest,
+                                const live_value* dest_val);
 
 /*
  * Set the return address in the current stack frame of a rewriting context.
@@ -21,7 +21,7 @@
 #include "retvals.h"
 #include "bitmap.h"
 #include "list.h"
-#include "timer.h"
+#include "telemetry.h"
 #include "regs.h"
 #include "properties.h"
 #include "call_site.h"
@@ -137,8 +137,15 @@ typedef struct fixup {
   const live_value* dest_loc; // pointer to reify on destination stack
 } fixup;
 
-/* List of fixup records. */
-define_list_type(fixup);
+/*
+ * Fixup records, sorted by pointed-to address so that all fixups for a
+ * stack allocation can be found with a range query (see fixup.h).
+ */
+typedef struct fixup_set {
+  size_t size; // number of fixups
+  size_t capacity; // number of fixups storage is allocated for
+  fixup* data; // fixups, sorted by src_addr
+} fixup_set;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Rewriting metadata
@@ -153,6 +160,42 @@ typedef struct activation
   bitmap callee_saved; /* callee-saved registers stored in prologue */
 } activation;
 
+/* A read-only mapping of an ELF section's file contents. */
+typedef struct section_map
+{
+  void* addr; /* page-aligned start of mapping */
+  size_t len; /* length of mapping */
+} section_map;
+
+/* What to do for a value when applying a rewrite plan. */
+#define OP_COPY 0x1 /* copy the value (destination is not a constant) */
+#define OP_MAY_POINT 0x2 /* value may be a pointer to the stack */
+#define OP_CALLEE_SAVED 0x4 /* destination is a callee-saved register */
+#define OP_POINTED_TO 0x8 /* value may be pointed to by other values */
+
+/*
+ * A single value copy between a pair of call sites.  The location records are
+ * copied into the op so plans don't refer to either handle's metadata.
+ */
+typedef struct rewrite_op
+{
+  live_value src; /* value's location in the source frame */
+  live_value dest; /* value's location in the destination frame */
+  uint8_t flags; /* what to do for the value (OP_*) */
+} rewrite_op;
+
+/*
+ * A rewrite plan -- the values copied from a source call site to the
+ * equivalent destination call site, in order.
+ */
+typedef struct rewrite_plan
+{
+  uint64_t id; /* call site ID */
+  uint64_t dest_uid; /* destination handle's unique ID */
+  uint32_t num_ops; /* number of value copies */
+  rewrite_op ops[]; /* value copies */
+} rewrite_plan;
+
 /*
  * Stack transformation handle, holds information required to do transform.
  * Instantiated once for each binary.
@@ -163,14 +206,16 @@ struct _st_handle
   // Descriptors
   /////////////////////////////////////////////////////////////////////////////
 
-  int fd; /* OS file descriptor */
-  Elf* elf; /* libELF descriptor */
+  /* Metadata sections mapped from the file (see map_section_data()) */
+  size_t num_maps;
+  section_map maps[MAX_SECTION_MAPS];
 
   /////////////////////////////////////////////////////////////////////////////
   // Binary & architecture information
   /////////////////////////////////////////////////////////////////////////////
 
   const char* fn; /* ELF file name */
+  uint64_t uid; /* unique handle ID, never reused */
   uint16_t arch; /* target architecture for the binary */
   uint16_t ptr_size; /* size of pointers on the architecture */
 
@@ -189,10 +234,21 @@ struct _st_handle
   uint64_t unwind_count;
   const unwind_loc* unwind_locs;
 
-  /* Call site records */
+  /* Call site metadata format version (see call_site.h) */
+  uint32_t version;
+
+  /* Call site records -- use the accessors in util.h rather than these */
   uint64_t sites_count;
-  const call_site* sites_id; /* sorted by ID */
-  const call_site* sites_addr; /* sorted by return address */
+  const call_site* sites_id; /* v1: sorted by ID */
+  const call_site* sites_addr; /* v1: sorted by return address */
+  const uint64_t* site_addrs; /* v2: sorted return addresses */
+  const uint64_t* site_ids; /* v2: sorted IDs */
+  const uint32_t* site_id_map; /* v2: ID order -> address order */
+  const call_site_v2* sites; /* v2: sorted by return address */
+
+  /* Per-function frame size & unwinding information (v2 only, parallel to
+   * unwind_addrs) */
+  const function_info* funcs;
 
   /* Call site live value records */
   uint64_t live_vals_count;
@@ -201,6 +257,14 @@ struct _st_handle
   /* Architecture-specific call site live value records */
   uint64_t arch_live_vals_count;
   const arch_live_value* arch_live_vals;
+
+  /* Call site lookup index (optional, 0 slots if not available) */
+  uint64_t site_index_count; /* always a power of 2 */
+  const site_index_slot* site_index;
+
+  /* Rewrite plans from this binary's call sites (see plan.h) */
+  rewrite_plan* plans[PLAN_CACHE_SIZE];
+  uint64_t plan_hits, plan_misses;
 };
 
 typedef struct _st_handle* st_handle;
@@ -223,12 +287,25 @@ struct rewrite_context
   /* Meta-data for stack activations. */
   int num_acts; /* number of activations */
   int act; /* current activation */
-  activation acts[MAX_FRAMES]; /* all activations currently processed */
-  list_t(fixup) stack_pointers; /* pointers to the stack, to be resolved */
+  int outermost; /* outermost live activation (non-zero for on-demand) */
+  int max_acts; /* number of activations which fit in the current storage */
+  activation* acts; /* all activations currently processed */
+  fixup_set stack_pointers; /* pointers to the stack, to be resolved */
+  int arena_slot; /* slot in the owning thread's arena, or -1 if pooled */
+  struct context_arena* arena; /* owning thread's arena, or NULL if pooled */
+  struct ondemand_state* owner; /* rewriting state of the stack's thread */
 
   /* Pools for constant-time allocation of per-frame/runtime-dependent data */
   void* regset_pool; /* Register sets */
   void* callee_saved_pool; /* Callee-saved registers (bitmaps) */
+
+  /*
+   * Inline storage for the first INLINE_ACTS activations & their register
+   * sets/callee-saved bitmaps (sized for any architecture).  ACTS & the pools
+   * point here until a deeper stack spills them to the heap.
+   */
+  activation inline_acts[INLINE_ACTS];
+  char inline_pools[] __attribute__((aligned(16)));
 };
 
 typedef struct rewrite_context* rewrite_context;
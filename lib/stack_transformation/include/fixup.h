@@ -0,0 +1,93 @@
+/*
+ * Sorted set of stack pointer fixups.  Fixups are kept sorted by the source
+ * stack address they point to, so all fixups pointing into a stack allocation
+ * are contiguous and can be found with a binary search.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _FIXUP_H
+#define _FIXUP_H
+
+#include "definitions.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Fixup set operations
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Initialize an empty fixup set.
+ *
+ * @param set a fixup set
+ */
+void fixup_set_init(fixup_set* set);
+
+/*
+ * Free a fixup set's storage.
+ *
+ * @param set a fixup set
+ */
+void fixup_set_free(fixup_set* set);
+
+/*
+ * Remove all fixups from the set, keeping its storage for reuse.
+ *
+ * @param set a fixup set
+ */
+static inline void fixup_set_clear(fixup_set* set)
+{
+  ASSERT(set, "invalid argument to fixup_set_clear()\n");
+  set->size = 0;
+}
+
+/*
+ * Make room for at least CAPACITY fixups so they can be added without
+ * allocating.
+ *
+ * @param set a fixup set
+ * @param capacity the number of fixups
+ * @return true if the set has room for CAPACITY fixups, false otherwise
+ */
+bool fixup_set_reserve(fixup_set* set, size_t capacity);
+
+/*
+ * Get the number of fixups in the set.
+ *
+ * @param set a fixup set
+ * @return the number of fixups
+ */
+static inline size_t fixup_set_size(const fixup_set* set)
+{
+  ASSERT(set, "invalid argument to fixup_set_size()\n");
+  return set->size;
+}
+
+/*
+ * Add a fixup to the set, maintaining sorted order.
+ *
+ * @param set a fixup set
+ * @param data the fixup to add
+ */
+void fixup_add(fixup_set* set, fixup data);
+
+/*
+ * Find the first fixup which points to an address greater than or equal to
+ * ADDR.
+ *
+ * @param set a fixup set
+ * @param addr a source stack address
+ * @return the index of the first fixup pointing at or above ADDR, or the
+ *         number of fixups in the set if there is no such fixup
+ */
+size_t fixup_lower_bound(const fixup_set* set, const void* addr);
+
+/*
+ * Remove NUM consecutive fixups starting at index START.
+ *
+ * @param set a fixup set
+ * @param start index of the first fixup to remove
+ * @param num the number of fixups to remove
+ */
+void fixup_remove(fixup_set* set, size_t start, size_t num);
+
+#endif /* _FIXUP_H */
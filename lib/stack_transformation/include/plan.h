@@ -0,0 +1,55 @@
+/*
+ * APIs for building & caching rewrite plans.  A rewrite plan is the flattened
+ * list of live value copies between a source call site and the equivalent
+ * destination call site, with duplicate location records expanded and values
+ * which are never copied (temporaries, mismatched va_lists) removed.  Each
+ * copy carries its own location records & resolved flags, so applying a plan
+ * doesn't re-examine the call site metadata.  Plans are built on first use &
+ * cached in the source handle, keyed by call site ID and the destination
+ * handle's unique ID.  Plans don't refer to the destination handle, so they
+ * remain safe (although unreachable) after it is destroyed.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include "definitions.h"
+
+/*
+ * Return whether a pair of source & destination location records should be
+ * skipped when rewriting, i.e., the destination value is a temporary or the
+ * value is a va_list (which has different sizes on different architectures).
+ * Also sanity checks that the pair describe the same value.
+ *
+ * @param val_src a value's location record in the source call site
+ * @param val_dest a value's location record in the destination call site
+ * @return true if the value should not be rewritten, false otherwise
+ */
+bool skip_val(const live_value* val_src, const live_value* val_dest);
+
+/*
+ * Get the rewrite plan for the call site pair, building & caching it if this
+ * is the first time the pair has been rewritten.
+ *
+ * @param src the source handle
+ * @param src_site the call site in the source binary
+ * @param dest the destination handle
+ * @param dest_site the equivalent call site in the destination binary
+ * @return the rewrite plan, or NULL if it could not be built or cached (e.g.,
+ *         the cache is full)
+ */
+const rewrite_plan* get_rewrite_plan(st_handle src,
+                                     const call_site* src_site,
+                                     st_handle dest,
+                                     const call_site* dest_site);
+
+/*
+ * Free all rewrite plans cached in a handle.
+ *
+ * @param handle a stack transformation handle
+ */
+void free_rewrite_plans(st_handle handle);
+
+#endif /* _PLAN_H */
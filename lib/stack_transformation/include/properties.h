@@ -33,6 +33,9 @@ struct properties_t
   /* Offset of CFA from SP upon function entry */
   const int32_t cfa_offset_funcentry;
 
+  /* Trampoline installed as a return address for on-demand rewriting */
+  const void* ondemand_trampoline;
+
   /////////////////////////////////////////////////////////////////////////////
   // Functions
   /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,76 @@
+/*
+ * APIs for managing stack regions for user-space rewriting.  Rather than
+ * splitting a thread's stack in half, stacks are rewritten into separately
+ * mapped regions drawn from per-node pools.  The topmost pages of each region
+ * are pre-faulted so that rewriting & resuming on the region doesn't take page
+ * faults.  Regions are returned to the pool of the node releasing them, so
+ * recycled regions are already resident on that node.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _STACK_REGION_H
+#define _STACK_REGION_H
+
+#include <sys/types.h>
+
+#include "definitions.h"
+
+/* A separately-mapped stack region, spanning [low, high). */
+typedef struct stack_region {
+  void* low;
+  void* high;
+  size_t faulted; /* Number of bytes below HIGH known to be faulted in */
+  pid_t tid; /* Exiting thread still executing on a retired region */
+  struct stack_region* next;
+} stack_region;
+
+/*
+ * Get a stack region from the current node's pool, mapping a new region if
+ * the pool is empty.  The top of the region is pre-faulted to cover the
+ * largest stack rewritten so far.
+ *
+ * @return a stack region, or NULL if one could not be mapped
+ */
+stack_region* stack_region_get(void);
+
+/*
+ * Return a stack region to the current node's pool.  The region is unmapped
+ * if the pool is full.
+ *
+ * @param region a stack region which is no longer in use
+ */
+void stack_region_put(stack_region* region);
+
+/*
+ * Retire the stack region an exiting thread is executing on.  The region
+ * can't be recycled until the thread has finished exiting, so it's kept on a
+ * list of zombie regions which are returned to the pool by a later
+ * stack_region_get() once their threads are gone.
+ *
+ * @param region the calling thread's current stack region, or NULL
+ */
+void stack_region_retire(stack_region* region);
+
+/*
+ * Record the size of a rewritten stack, which determines how much of each
+ * region is pre-faulted.
+ *
+ * @param size the size of a rewritten stack, in bytes
+ */
+void stack_region_note_size(size_t size);
+
+/*
+ * Return whether an address lies within a stack region.
+ *
+ * @param region a stack region, or NULL
+ * @param addr an address
+ * @return true if ADDR is in REGION, false otherwise
+ */
+static inline bool stack_region_contains(const stack_region* region,
+                                         const void* addr)
+{
+  return region && region->low <= addr && addr < region->high;
+}
+
+#endif /* _STACK_REGION_H */
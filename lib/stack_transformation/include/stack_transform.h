@@ -8,6 +8,7 @@
 #ifndef _ST_H
 #define _ST_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -30,6 +31,38 @@ typedef struct stack_bounds {
   void* low;
 } stack_bounds;
 
+/* Number of buckets in telemetry histograms */
+#define ST_HIST_BUCKETS 64
+
+/*
+ * Telemetry histogram.  Bucket 0 counts zero values, while bucket i counts
+ * values in [2^(i-1), 2^i).  Timers are recorded in nanoseconds.
+ */
+typedef struct st_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[ST_HIST_BUCKETS];
+} st_histogram;
+
+/* Accumulated cost of rewriting frames at a call site */
+typedef struct st_site_cost {
+  uint64_t id; /* call site ID */
+  uint64_t count; /* number of frames rewritten */
+  uint64_t total_ns; /* total time spent rewriting the frames */
+} st_site_cost;
+
+/* A single stack to be rewritten by st_rewrite_stacks() */
+typedef struct st_stack_desc {
+  void* regset_src; /* filled register set representing the thread's state */
+  void* sp_base_src; /* source stack base, i.e., highest stack address */
+  void* regset_dest; /* register set to be filled with destination state */
+  void* sp_base_dest; /* destination stack base, i.e., highest stack address */
+  void* owner; /* owning thread's rewriting state (see st_stack_owner()) */
+  int ret; /* set to 0 if the stack was rewritten, or 1 otherwise */
+} st_stack_desc;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Initialization & teardown
 ///////////////////////////////////////////////////////////////////////////////
@@ -51,6 +84,27 @@ st_handle st_init(const char* fn);
  */
 void st_destroy(st_handle handle);
 
+/*
+ * Build the rewrite plans for every call site when rewriting from SRC to DEST,
+ * rather than building them lazily the first time each call site is
+ * rewritten.  Plans are cached in SRC up to a fixed limit.
+ *
+ * @param src a stack transformation handle for the source binary
+ * @param dest a stack transformation handle for the destination binary
+ * @return 0 if successful, or 1 otherwise
+ */
+int st_prebuild_plans(st_handle src, st_handle dest);
+
+/*
+ * Get the number of times rewriting from HANDLE's call sites found (hits) or
+ * did not find (misses) a cached rewrite plan.
+ *
+ * @param handle a stack transformation handle
+ * @param hits number of rewrite plan cache hits
+ * @param misses number of rewrite plan cache misses
+ */
+void st_plan_cache_stats(st_handle handle, uint64_t* hits, uint64_t* misses);
+
 ///////////////////////////////////////////////////////////////////////////////
 // Performing stack transformation
 ///////////////////////////////////////////////////////////////////////////////
@@ -73,6 +127,115 @@ int st_userspace_rewrite(void* sp,
                          enum arch dest_arch,
                          void* dest_regs);
 
+/*
+ * Prepare the calling thread's stack to be rewritten from user-space as part
+ * of a batch, e.g., for a group of threads migrating together.  Fills STACK
+ * with the thread's current stack & the stack region into which it will be
+ * rewritten.  STACK can then be rewritten by any thread via
+ * st_userspace_rewrite_batch(), after which the calling thread must call
+ * st_userspace_finish().
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @param sp the current stack pointer
+ * @param src_regs the current register set
+ * @param dest_regs the register set to be filled with destination state
+ * @param stack the stack descriptor to fill
+ * @return 0 if the stack was successfully prepared, 1 otherwise
+ */
+int st_userspace_prepare(void* sp,
+                         void* src_regs,
+                         void* dest_regs,
+                         st_stack_desc* stack);
+
+/*
+ * Rewrite a batch of stacks prepared by st_userspace_prepare() concurrently
+ * (see st_rewrite_stacks()).  The threads owning the stacks must not run
+ * until the call returns.
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @param src_arch the source ISA of all stacks
+ * @param dest_arch the destination ISA of all stacks
+ * @param stacks stacks to rewrite, each stack's ret field is set to the result
+ *               of rewriting it
+ * @param num number of stacks
+ * @return 0 if all stacks were successfully rewritten, or 1 otherwise
+ */
+int st_userspace_rewrite_batch(enum arch src_arch,
+                               enum arch dest_arch,
+                               st_stack_desc* stacks,
+                               size_t num);
+
+/*
+ * Finish a batched rewrite of the calling thread's stack, releasing stack
+ * regions which are no longer needed if the stack was successfully rewritten.
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @param stack the calling thread's stack descriptor
+ */
+void st_userspace_finish(const st_stack_desc* stack);
+
+/* Estimated cost of rewriting a stack, from its call site metadata */
+typedef struct st_cost {
+  size_t frames; /* number of frames which would be rewritten */
+  size_t live; /* number of live values across all frames */
+  size_t frame_bytes; /* total size of all frames */
+} st_cost;
+
+/*
+ * Cheaply estimate how expensive it would be to rewrite the calling thread's
+ * stack, by walking the frame pointer chain & summing each frame's call site
+ * metadata.  No registers or live values are read or transformed.  Walks at
+ * most ST_ESTIMATE_MAX_FRAMES frames.
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @param fp the frame pointer of the innermost frame to include, e.g.,
+ *           __builtin_frame_address(0)
+ * @param cost filled with the estimate
+ * @return 0 if the stack was walked, 1 otherwise
+ */
+int st_userspace_estimate(void* fp, st_cost* cost);
+
+/*
+ * Return the base (highest address) of the stack into which the calling
+ * thread's stack was most recently rewritten from user-space, i.e., the stack
+ * on which it resumes after migrating.  The rewritten frames occupy the stack
+ * from the destination stack pointer up to the base.
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @return the base of the rewritten stack, or NULL if the thread's stack
+ *         hasn't been rewritten
+ */
+void* st_userspace_rewritten_base(void);
+
+/*
+ * Reserve the calling thread's user-space rewriting state up front: the
+ * thread's stack bounds plus everything reserved by st_reserve_thread().
+ * Afterwards, rewriting the thread's stack from user-space only allocates for
+ * stacks deeper or with more stack pointers than previously seen.
+ *
+ * Note: specific to Popcorn Compiler/the migration wrapper.
+ *
+ * @return 0 if the state was reserved, 1 otherwise
+ */
+int st_userspace_reserve(void);
+
+/*
+ * Reserve the calling thread's rewriting state up front, i.e., a source &
+ * destination rewriting context with room for RESERVED_FIXUPS stack pointer
+ * fixups.  Threads otherwise reserve their state the first time they rewrite
+ * a stack.  Reserved state is kept for the thread's lifetime (including
+ * storage grown for deep stacks), so subsequent rewrites by the thread don't
+ * touch the allocator or any shared pool.
+ *
+ * @return 0 if the state was reserved, 1 otherwise
+ */
+int st_reserve_thread(void);
+
 /*
  * Rewrite the stack in its entirety from its current form (source) to the
  * requested form (destination).
@@ -99,7 +262,12 @@ int st_rewrite_stack(st_handle src,
 
 /*
  * Rewrite only the top frame of the stack.  Previous frames will be
- * re-written on-demand as the thread unwinds the call stack.
+ * re-written on-demand as the thread unwinds the call stack.  Frames which are
+ * pointed to by pointers in already-rewritten frames are rewritten eagerly.
+ *
+ * The rewriting state is kept per-thread until all frames have been rewritten.
+ * Starting another rewrite on the same thread (i.e., migrating again) first
+ * rewrites any remaining frames.  Handles must remain valid until then.
  *
  * @param src a stack transformation handle which has transformation metadata
  *            for the source binary
@@ -114,7 +282,6 @@ int st_rewrite_stack(st_handle src,
  *                     (will fill downwards with activation records)
  * @return 0 if succesful, or 1 otherwise
  */
-// TODO not yet implemented
 int st_rewrite_ondemand(st_handle src,
                         void* regset_src,
                         void* sp_base_src,
@@ -123,7 +290,101 @@ int st_rewrite_ondemand(st_handle src,
                         void* sp_base_dest);
 
 /*
- * Return the current thread's stack bounds.
+ * Get the calling thread's rewriting state, to be stored in the owner field of
+ * its stack's descriptor for st_rewrite_stacks().  Rewriting a stack from
+ * another thread finishes the owner's in-progress on-demand rewrite, if any,
+ * just as the owner would have when rewriting its own stack.
+ *
+ * @return an opaque pointer to the calling thread's rewriting state
+ */
+void* st_stack_owner(void);
+
+/*
+ * Rewrite many stacks in their entirety, e.g., for all threads in a team
+ * which are migrating together.  Stacks are rewritten concurrently by the
+ * calling thread & a small pool of internal worker threads (started on first
+ * use, sized by ST_REWRITE_WORKERS).  The threads owning the stacks must not
+ * run until the call returns.  Batches from multiple threads are serialized.
+ *
+ * @param src a stack transformation handle which has transformation metadata
+ *            for the source binary
+ * @param dest a stack transformation handle which has transformation metadata
+ *             for the destination binary
+ * @param stacks stacks to rewrite, each stack's ret field is set to the result
+ *               of rewriting it; a NULL owner means the owning thread has no
+ *               on-demand rewrite in progress
+ * @param num number of stacks
+ * @return 0 if all stacks were successfully rewritten, or 1 otherwise
+ */
+int st_rewrite_stacks(st_handle src,
+                      st_handle dest,
+                      st_stack_desc* stacks,
+                      size_t num);
+
+///////////////////////////////////////////////////////////////////////////////
+// Telemetry
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Set the telemetry level.  Level 0 disables telemetry, level 1 records
+ * per-phase latencies (initialization, unwinding, rewriting frames, fixing up
+ * pointers), per-migration frame & live value counts and per-call site frame
+ * rewriting costs, and level 2 additionally records fine-grained operations
+ * (e.g., copying individual values).  The level can also be set by setting
+ * ST_TELEMETRY in the environment, in which case telemetry is dumped at exit
+ * to the file named by ST_TELEMETRY_FILE.
+ *
+ * @param level the telemetry level
+ * @return 0 if successful, or 1 if the level is invalid
+ */
+int st_telemetry_enable(int level);
+
+/*
+ * Return the number of telemetry metrics.
+ *
+ * @return the number of metrics
+ */
+size_t st_telemetry_num_metrics(void);
+
+/*
+ * Return the name of a telemetry metric, e.g., "rewrite_frame" or "frames".
+ *
+ * @param metric a metric number, less than st_telemetry_num_metrics()
+ * @return the metric's name, or NULL if the metric is invalid
+ */
+const char* st_telemetry_metric_name(size_t metric);
+
+/*
+ * Merge the histograms for a metric across all threads.
+ *
+ * @param name the metric's name
+ * @param hist histogram to populate
+ * @return 0 if successful, or 1 if there's no metric named NAME
+ */
+int st_telemetry_query(const char* name, st_histogram* hist);
+
+/*
+ * Get the call sites with the largest accumulated frame rewriting costs
+ * across all threads, sorted by decreasing cost.
+ *
+ * @param sites array to populate with call site costs
+ * @param num maximum number of call sites to return
+ * @return the number of call sites returned
+ */
+size_t st_telemetry_top_sites(st_site_cost* sites, size_t num);
+
+/*
+ * Write all telemetry in human-readable form.
+ *
+ * @param fn name of the file to write, or NULL to write to stdout
+ * @return 0 if successful, or 1 otherwise
+ */
+int st_telemetry_dump(const char* fn);
+
+/*
+ * Return the current thread's stack bounds for rewriting, i.e., the base of the
+ * stack on which the thread is currently executing (high) and the base of the
+ * stack region into which it should be rewritten (low).
  *
  * @return this thread's stack bounds information
  */
@@ -0,0 +1,161 @@
+/*
+ * Telemetry infrastructure -- per-phase latency histograms, per-migration
+ * statistics & per-call site rewriting costs, collected into lock-free
+ * per-thread buffers when enabled at runtime.
+ *
+ * Date: 10/16/2026
+ */
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Declarations & macros
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Runtime timers.  Coarse-grained timers are meant for timing of high-level
+ * operations (e.g. unwinding the stack), while fine-grained timers are meant
+ * for timing lower-level operations (e.g. copying a single live value).
+ *
+ * Coarse-grained timers are recorded at telemetry level 1 (TELEMETRY_COARSE)
+ * & above, while fine-grained timers are only recorded at level 2
+ * (TELEMETRY_FINE).  Each timer records a histogram of elapsed nanoseconds.
+ *
+ * To add a timer to the system, append an X( <timer name> ) to either of the
+ * lists.
+ */
+
+/* Coarse-grained timers for high-level operations */
+#define COARSE_TIMERS \
+  X(st_init) \
+  X(st_destroy) \
+  X(st_rewrite_stack) \
+  X(st_rewrite_ondemand) \
+  X(st_prebuild_plans) \
+  X(st_rewrite_stacks) \
+  X(init_src_context) \
+  X(init_dest_context) \
+  X(unwind_and_size) \
+  X(rewrite_stack) \
+  X(rewrite_frame) \
+  X(fixup_local_pointers) \
+  X(free_context)
+
+/* Fine-grained timers for timing of individual operations */
+#define FINE_TIMERS \
+  X(pop_frame) \
+  X(put_val) \
+  X(get_site_by_addr) \
+  X(get_site_by_id) \
+  X(get_unwind_offset_by_addr)
+
+/*
+ * Per-migration counters, recorded once a thread's stack has been completely
+ * rewritten.  Each counter records a histogram of values.
+ */
+#define MIGRATION_COUNTERS \
+  X(frames) \
+  X(live_values)
+
+/* All metrics available to the runtime, in the order they're reported. */
+#define ALL_METRICS COARSE_TIMERS FINE_TIMERS MIGRATION_COUNTERS
+
+enum metric {
+#define X( metric_name ) METRIC_##metric_name,
+ALL_METRICS
+#undef X
+  NUM_METRICS
+};
+
+/* Telemetry levels. */
+#define TELEMETRY_OFF 0
+#define TELEMETRY_COARSE 1
+#define TELEMETRY_FINE 2
+
+/* Current telemetry level -- read directly to keep disabled checks cheap. */
+extern int __st_telemetry_level;
+
+/* Macros to control recording of timers & counters. */
+#define TIMER_START( timer_name ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_COARSE) \
+      telemetry_start(METRIC_##timer_name); \
+  } while(0)
+#define TIMER_STOP( timer_name ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_COARSE) \
+      telemetry_stop(METRIC_##timer_name, NULL); \
+  } while(0)
+#define TIMER_STOP_SITE( timer_name, site_id ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_COARSE) \
+    { \
+      uint64_t __id = (site_id); \
+      telemetry_stop(METRIC_##timer_name, &__id); \
+    } \
+  } while(0)
+
+#define TIMER_FG_START( timer_name ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_FINE) \
+      telemetry_start(METRIC_##timer_name); \
+  } while(0)
+#define TIMER_FG_STOP( timer_name ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_FINE) \
+      telemetry_stop(METRIC_##timer_name, NULL); \
+  } while(0)
+
+#define TELEMETRY_COUNT_LIVE( num ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_COARSE) telemetry_count_live(num); \
+  } while(0)
+#define TELEMETRY_MIGRATION_DONE( num_frames ) \
+  do { \
+    if(__st_telemetry_level >= TELEMETRY_COARSE) \
+      telemetry_migration_done(num_frames); \
+  } while(0)
+
+///////////////////////////////////////////////////////////////////////////////
+// Telemetry API
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Initialize telemetry from the environment (see ENV_TELEMETRY).
+ */
+void telemetry_init(void);
+
+/*
+ * Record the start time of a timer for the calling thread.
+ *
+ * @param metric a timer
+ */
+void telemetry_start(enum metric metric);
+
+/*
+ * Record the elapsed time of a timer for the calling thread.  If SITE_ID is
+ * non-NULL, also attribute the elapsed time to the call site.
+ *
+ * @param metric a timer
+ * @param site_id a call site ID, or NULL
+ */
+void telemetry_stop(enum metric metric, const uint64_t* site_id);
+
+/*
+ * Count live values rewritten for the calling thread's current migration.
+ *
+ * @param num number of live values
+ */
+void telemetry_count_live(uint64_t num);
+
+/*
+ * Record per-migration counters for the calling thread's current migration.
+ *
+ * @param num_frames number of frames rewritten
+ */
+void telemetry_migration_done(uint64_t num_frames);
+
+#endif /* _TELEMETRY_H */
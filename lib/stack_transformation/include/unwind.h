@@ -14,6 +14,17 @@
 // Stack unwinding
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Make sure the context has room for at least NUM activations.  Moves the
+ * activations & their register sets/callee-saved bitmaps to a larger arena on
+ * the heap if needed, so any pointers into them are invalidated.
+ *
+ * @param ctx a rewriting context
+ * @param num the number of activations
+ * @return true if there is room for NUM activations, false otherwise
+ */
+bool reserve_acts(rewrite_context ctx, int num);
+
 /*
  * Return whether or not the specified call site record corresponds to one of
  * the starting functions, either for the main or spawned threads.
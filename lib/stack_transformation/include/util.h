@@ -58,13 +58,29 @@ Elf_Scn* get_section(Elf* e, const char* sec);
 int64_t get_num_entries(Elf* e, const char* sec);
 
 /*
- * Return the section data encoded in section SEC_NAME in ELF E.
+ * Map the section data encoded in section SEC_NAME in ELF E read-only from
+ * the file.  Mapping the data straight from the file (rather than reading it
+ * through libELF) allows the page cache to share it between all processes
+ * running the binary.  The mapping is recorded in HANDLE and is released by
+ * unmap_section_data().
  *
+ * @param handle a stack transformation handle
  * @param e an ELF descriptor
+ * @param fd file descriptor from which E was opened
  * @param sec name of the ELF section
  * @return a pointer to data in the section, or NULL if an error occurred
  */
-const void* get_section_data(Elf* e, const char* sec);
+const void* map_section_data(st_handle handle,
+                             Elf* e,
+                             int fd,
+                             const char* sec);
+
+/*
+ * Release all section data mapped by map_section_data().
+ *
+ * @param handle a stack transformation handle
+ */
+void unmap_section_data(st_handle handle);
 
 /*
  * Return the call site information for the specified return address.
@@ -86,6 +102,16 @@ bool get_site_by_addr(st_handle handle, void* ret_addr, call_site* site);
  */
 bool get_site_by_id(st_handle handle, uint64_t csid, call_site* site);
 
+/*
+ * Return the call site information for the call site at the specified index
+ * when call sites are sorted by ID, regardless of the metadata format.
+ *
+ * @param handle a stack transformation handle
+ * @param idx index of the call site, less than the number of call sites
+ * @param site pointer to call_site structure to populate with information
+ */
+void get_site_at(st_handle handle, uint64_t idx, call_site* site);
+
 /*
  * Return the address of the function containing the specified program
  * location.  This is used to bootstrap in the outer frame, where we have an
@@ -33,6 +33,9 @@ static void* align_sp_aarch64(void* sp);
 static bool is_callee_saved_aarch64(uint16_t reg);
 static uint16_t callee_reg_size_aarch64(uint16_t reg);
 
+/* On-demand rewriting trampoline (defined in trampoline.S) */
+extern void __st_ondemand_trampoline_aarch64(void);
+
 /* aarch64 properties */
 const struct properties_t properties_aarch64 = {
   .num_callee_saved = sizeof(callee_saved_aarch64) / sizeof(uint16_t),
@@ -40,6 +43,7 @@ const struct properties_t properties_aarch64 = {
   .callee_saved_size = callee_saved_size_aarch64,
   .ra_offset = AARCH64_RA_OFFSET,
   .cfa_offset_funcentry = AARCH64_CFA_OFFSET_FUNCENTRY,
+  .ondemand_trampoline = (const void*)__st_ondemand_trampoline_aarch64,
 
   .align_sp = align_sp_aarch64,
   .is_callee_saved = is_callee_saved_aarch64,
@@ -38,6 +38,9 @@ static void* align_sp_powerpc64(void* sp);
 static bool is_callee_saved_powerpc64(uint16_t reg);
 static uint16_t callee_reg_size_powerpc64(uint16_t reg);
 
+/* On-demand rewriting trampoline (defined in trampoline.S) */
+extern void __st_ondemand_trampoline_powerpc64(void);
+
 /* powerpc64 properties */
 const struct properties_t properties_powerpc64 = {
   .num_callee_saved = sizeof(callee_saved_powerpc64) / sizeof(uint16_t),
@@ -45,6 +48,7 @@ const struct properties_t properties_powerpc64 = {
   .callee_saved_size = callee_saved_size_powerpc64,
   .ra_offset = POWERPC64_RA_OFFSET,
   .cfa_offset_funcentry = POWERPC64_CFA_OFFSET_FUNCENTRY,
+  .ondemand_trampoline = (const void*)__st_ondemand_trampoline_powerpc64,
 
   .align_sp = align_sp_powerpc64,
   .is_callee_saved = is_callee_saved_powerpc64,
@@ -28,6 +28,9 @@ static void* align_sp_x86_64(void* sp);
 static bool is_callee_saved_x86_64(uint16_t reg);
 static uint16_t callee_reg_size_x86_64(uint16_t reg);
 
+/* On-demand rewriting trampoline (defined in trampoline.S) */
+extern void __st_ondemand_trampoline_x86_64(void);
+
 /* x86-64 properties. */
 const struct properties_t properties_x86_64 = {
   .num_callee_saved = sizeof(callee_saved_x86_64) / sizeof(uint16_t),
@@ -35,6 +38,7 @@ const struct properties_t properties_x86_64 = {
   .callee_saved_size = callee_saved_size_x86_64,
   .ra_offset = X86_64_RA_OFFSET,
   .cfa_offset_funcentry = X86_64_CFA_OFFSET_FUNCENTRY,
+  .ondemand_trampoline = (const void*)__st_ondemand_trampoline_x86_64,
 
   .align_sp = align_sp_x86_64,
   .is_callee_saved = is_callee_saved_x86_64,
@@ -0,0 +1,199 @@
+/*
+ * Rewriting many stacks concurrently, e.g., when an entire team of threads
+ * migrates together.  Stacks are handed out to the calling thread & a small
+ * pool of persistent worker threads, which are started on first use.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <signal.h>
+
+#include "stack_transform.h"
+#include "definitions.h"
+#include "util.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Worker pool state.  BATCH_LOCK serializes batches; LOCK protects the
+ * remaining fields, which workers wait on for a new batch (i.e., a new
+ * generation) or the caller waits on for the batch to finish.
+ */
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_done = PTHREAD_COND_INITIALIZER;
+static bool workers_started = false;
+static size_t num_workers = 0;
+static size_t num_active = 0;
+static uint64_t generation = 0;
+
+/* The batch currently being rewritten */
+static st_handle batch_src, batch_dest;
+static st_stack_desc* batch_stacks;
+static size_t batch_num;
+static size_t batch_next;
+
+/*
+ * Rewrite a stack on behalf of its owning thread (see rewrite.c).
+ */
+extern int __st_rewrite_stack_for(void* owner,
+                                  st_handle handle_src,
+                                  void* regset_src,
+                                  void* sp_base_src,
+                                  st_handle handle_dest,
+                                  void* regset_dest,
+                                  void* sp_base_dest);
+
+/*
+ * Start the worker threads, the number of which is read from the environment.
+ */
+static void start_workers(void);
+
+/*
+ * Worker thread main loop -- wait for a batch & help rewrite it.
+ */
+static void* worker(void* arg);
+
+/*
+ * Rewrite stacks from the current batch until there are none left.
+ */
+static void rewrite_batch(void);
+
+///////////////////////////////////////////////////////////////////////////////
+// Batch rewriting
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Rewrite many stacks concurrently.
+ */
+int st_rewrite_stacks(st_handle src,
+                      st_handle dest,
+                      st_stack_desc* stacks,
+                      size_t num)
+{
+  size_t i;
+  int ret = 0;
+
+  if(!src || !dest || (!stacks && num))
+  {
+    ST_WARN("invalid arguments\n");
+    return 1;
+  }
+
+  TIMER_START(st_rewrite_stacks);
+  ST_INFO("--> Rewriting %lu stacks (%s -> %s) <--\n",
+          num, arch_name(src->arch), arch_name(dest->arch));
+
+  pthread_mutex_lock(&batch_lock);
+  if(!workers_started) start_workers();
+
+  batch_src = src;
+  batch_dest = dest;
+  batch_stacks = stacks;
+  batch_num = num;
+  batch_next = 0;
+
+  /* Only wake up workers if there's something for them to do */
+  if(num > 1 && num_workers)
+  {
+    pthread_mutex_lock(&lock);
+    num_active = num_workers;
+    generation++;
+    pthread_cond_broadcast(&batch_start);
+    pthread_mutex_unlock(&lock);
+
+    rewrite_batch();
+
+    pthread_mutex_lock(&lock);
+    while(num_active) pthread_cond_wait(&batch_done, &lock);
+    pthread_mutex_unlock(&lock);
+  }
+  else rewrite_batch();
+
+  batch_stacks = NULL;
+  pthread_mutex_unlock(&batch_lock);
+
+  for(i = 0; i < num; i++)
+    if(stacks[i].ret) ret = 1;
+
+  TIMER_STOP(st_rewrite_stacks);
+
+  return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API (implementation)
+///////////////////////////////////////////////////////////////////////////////
+
+static void start_workers(void)
+{
+  size_t i, requested = DEFAULT_REWRITE_WORKERS;
+  const char* env;
+  pthread_attr_t attr;
+  pthread_t thread;
+  sigset_t all, old;
+
+  workers_started = true;
+  if((env = getenv(ENV_REWRITE_WORKERS))) requested = atol(env);
+  if(requested > MAX_REWRITE_WORKERS) requested = MAX_REWRITE_WORKERS;
+
+  /* Workers should never handle the application's signals */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for(i = 0; i < requested; i++)
+  {
+    if(pthread_create(&thread, &attr, worker, NULL))
+    {
+      ST_WARN("could not start stack rewriting worker %lu\n", i);
+      break;
+    }
+  }
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  num_workers = i;
+  ST_INFO("Started %lu stack rewriting workers\n", num_workers);
+}
+
+static void* worker(void* arg)
+{
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&lock);
+  while(true)
+  {
+    while(generation == seen) pthread_cond_wait(&batch_start, &lock);
+    seen = generation;
+    pthread_mutex_unlock(&lock);
+
+    rewrite_batch();
+
+    pthread_mutex_lock(&lock);
+    if(!--num_active) pthread_cond_signal(&batch_done);
+  }
+
+  return NULL;
+}
+
+static void rewrite_batch(void)
+{
+  size_t i;
+  st_stack_desc* stack;
+
+  while((i = __atomic_fetch_add(&batch_next, 1, __ATOMIC_RELAXED)) < batch_num)
+  {
+    stack = &batch_stacks[i];
+    stack->ret = __st_rewrite_stack_for(stack->owner,
+                                        batch_src,
+                                        stack->regset_src,
+                                        stack->sp_base_src,
+                                        batch_dest,
+                                        stack->regset_dest,
+                                        stack->sp_base_dest);
+  }
+}
@@ -7,6 +7,7 @@
  */
 
 #include "data.h"
+#include "fixup.h"
 #include "unwind.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -114,6 +115,42 @@ void put_val(rewrite_context src,
   TIMER_FG_STOP(put_val);
 }
 
+/*
+ * Copy a value as described by rewrite plan operation OP.
+ */
+void put_val_op(rewrite_context src,
+                rewrite_context dest,
+                const rewrite_op* op)
+{
+  const void* src_addr;
+  void* dest_addr, *callee_addr = NULL;
+
+  TIMER_FG_START(put_val);
+  ASSERT(src->act == dest->act, "non-matching activations (%u vs. %u)\n",
+         src->act, dest->act);
+  ASSERT(op->flags & OP_COPY, "invalid rewrite operation\n");
+
+  ST_INFO("Getting source value: ");
+  if(op->src.type == SM_CONSTANT)
+  {
+    ST_RAW_INFO("constant live value: %d\n", op->src.offset_or_constant);
+    src_addr = &op->src.offset_or_constant;
+  }
+  else src_addr = get_val_loc(src, op->src.type, op->src.regnum,
+                              op->src.offset_or_constant, src->act);
+  ST_INFO("Putting destination value (size=%u): ", VAL_SIZE((&op->dest)));
+  dest_addr = get_val_loc(dest, op->dest.type, op->dest.regnum,
+                          op->dest.offset_or_constant, dest->act);
+  if(op->flags & OP_CALLEE_SAVED)
+    callee_addr = callee_saved_loc(dest, op->dest.regnum, dest->act);
+
+  ASSERT(dest_addr, "invalid destination location\n");
+  memcpy(dest_addr, src_addr, VAL_SIZE((&op->dest)));
+  if(callee_addr) memcpy(callee_addr, src_addr, VAL_SIZE((&op->dest)));
+
+  TIMER_FG_STOP(put_val);
+}
+
 /*
  * Evaluate architecture-specific location record VAL and set the appropriate
  * value in CTX.
@@ -122,7 +159,7 @@ void put_val_arch(rewrite_context ctx, const arch_live_value* val)
 {
   void* dest_addr, *callee_addr = NULL;
 
-  TIMER_FG_START(put_val)
+  TIMER_FG_START(put_val);
   ASSERT(val->type == SM_REGISTER || val->type == SM_INDIRECT,
          "Invalid architecture-specific value type (%u)\n", val->type);
 
@@ -229,35 +266,49 @@ void* points_to_stack(const rewrite_context ctx,
 }
 
 /*
- * Return whether or not a pointer refers to the specified live value.
+ * Resolve all pointers which refer to the specified live value.
  */
-void* points_to_data(const rewrite_context src,
-                     const live_value* src_val,
-                     const rewrite_context dest,
-                     const live_value* dest_val,
-                     void* src_ptr)
+size_t resolve_pointers_to_data(const rewrite_context src,
+                                const live_value* src_val,
+                                rewrite_context dest,
+                                const live_value* dest_val)
 {
+  size_t start, end;
   void* src_addr, *dest_addr = NULL;
+  fixup* cur;
 
   ASSERT(src_val->type == SM_DIRECT && dest_val->type == SM_DIRECT,
          "invalid value types (must be allocas for pointed-to analysis)\n");
 
-  ST_INFO("Checking if %p points to: ", src_ptr);
+  if(!fixup_set_size(&dest->stack_pointers)) return 0;
+
+  /* Fixups are sorted by address, find those inside of the value */
+  ST_INFO("Checking for pointers to: ");
   src_addr = get_val_loc(src, src_val->type,
                          src_val->regnum,
                          src_val->offset_or_constant,
                          src->act);
-  if(src_addr <= src_ptr && src_ptr < (src_addr + src_val->alloca_size))
+  start = fixup_lower_bound(&dest->stack_pointers, src_addr);
+  end = fixup_lower_bound(&dest->stack_pointers,
+                          src_addr + src_val->alloca_size);
+  if(start == end) return 0;
+
+  ST_INFO("Reifying address of source value %p to: ", src_addr);
+  dest_addr = get_val_loc(dest, dest_val->type,
+                          dest_val->regnum,
+                          dest_val->offset_or_constant,
+                          dest->act);
+  for(cur = &dest->stack_pointers.data[start];
+      cur < &dest->stack_pointers.data[end];
+      cur++)
   {
-    ST_INFO("Reifying address of source value %p to: ", src_addr);
-    dest_addr = get_val_loc(dest, dest_val->type,
-                            dest_val->regnum,
-                            dest_val->offset_or_constant,
-                            dest->act);
-    dest_addr += (src_ptr - src_addr);
+    ST_INFO("Found fixup for %p (in frame %d)\n", cur->src_addr, cur->act);
+    put_val_data(dest, cur->dest_loc, cur->act,
+                 (uint64_t)(dest_addr + (cur->src_addr - src_addr)));
   }
+  fixup_remove(&dest->stack_pointers, start, end - start);
 
-  return dest_addr;
+  return end - start;
 }
 
 /*
@@ -391,10 +442,10 @@ static void* callee_saved_loc(rewrite_context ctx,
   void* saved_addr;
 
   /* Nothing to propagate from outermost frame */
-  if(act <= 0) return NULL;
+  if(act <= ctx->outermost) return NULL;
 
   /* Walk call chain to check if register has been saved. */
-  for(act--; act >= 0; act--)
+  for(act--; act >= ctx->outermost; act--)
   {
     if(bitmap_is_set(ctx->acts[act].callee_saved, regnum))
     {
@@ -408,7 +459,7 @@ static void* callee_saved_loc(rewrite_context ctx,
 
   /* Register is still live in outermost frame. */
   ST_INFO("Callee-saved register %u live in outer-most frame\n", regnum);
-  return REGOPS(ctx)->reg(ctx->acts[0].regs, regnum);
+  return REGOPS(ctx)->reg(ctx->acts[ctx->outermost].regs, regnum);
 }
 
 static void apply_arch_operation(rewrite_context ctx,
@@ -0,0 +1,95 @@
+/*
+ * Implements a set of stack pointer fixups sorted by pointed-to address.
+ *
+ * Date: 10/16/2026
+ */
+
+#include "definitions.h"
+#include "fixup.h"
+
+/* Initial number of fixups allocated when the first fixup is added. */
+#define INITIAL_CAPACITY 64
+
+///////////////////////////////////////////////////////////////////////////////
+// Fixup set operations
+///////////////////////////////////////////////////////////////////////////////
+
+void fixup_set_init(fixup_set* set)
+{
+  ASSERT(set, "invalid argument to fixup_set_init()\n");
+  set->size = 0;
+  set->capacity = 0;
+  set->data = NULL;
+}
+
+void fixup_set_free(fixup_set* set)
+{
+  ASSERT(set, "invalid argument to fixup_set_free()\n");
+  if(set->data) free(set->data);
+  fixup_set_init(set);
+}
+
+bool fixup_set_reserve(fixup_set* set, size_t capacity)
+{
+  fixup* data;
+
+  ASSERT(set, "invalid argument to fixup_set_reserve()\n");
+
+  if(capacity <= set->capacity) return true;
+  if(set->data) data = (fixup*)REALLOC(set->data, sizeof(fixup) * capacity);
+  else data = (fixup*)MALLOC(sizeof(fixup) * capacity);
+  if(!data) return false;
+  set->data = data;
+  set->capacity = capacity;
+  return true;
+}
+
+void fixup_add(fixup_set* set, fixup data)
+{
+  size_t idx;
+
+  ASSERT(set, "invalid argument to fixup_add()\n");
+
+  if(set->size == set->capacity &&
+     !fixup_set_reserve(set, set->capacity ? set->capacity * 2
+                                           : INITIAL_CAPACITY))
+    ST_ERR(1, "could not allocate fixup storage\n");
+
+  /*
+   * Insert after any fixups for the same address to preserve the order in
+   * which they were added.
+   */
+  idx = fixup_lower_bound(set, data.src_addr + 1);
+  if(idx < set->size)
+    memmove(&set->data[idx + 1], &set->data[idx],
+            sizeof(fixup) * (set->size - idx));
+  set->data[idx] = data;
+  set->size++;
+}
+
+size_t fixup_lower_bound(const fixup_set* set, const void* addr)
+{
+  size_t min = 0, max = set->size, mid;
+
+  ASSERT(set, "invalid argument to fixup_lower_bound()\n");
+
+  while(min < max)
+  {
+    mid = (min + max) / 2;
+    if(set->data[mid].src_addr < addr) min = mid + 1;
+    else max = mid;
+  }
+  return min;
+}
+
+void fixup_remove(fixup_set* set, size_t start, size_t num)
+{
+  ASSERT(set && start + num <= set->size,
+         "invalid arguments to fixup_remove()\n");
+
+  if(!num) return;
+  if(start + num < set->size)
+    memmove(&set->data[start], &set->data[start + num],
+            sizeof(fixup) * (set->size - start - num));
+  set->size -= num;
+}
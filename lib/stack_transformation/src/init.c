@@ -11,6 +11,7 @@
 #include <fcntl.h>
 
 #include "stack_transform.h"
+#include "plan.h"
 #include "unwind.h"
 #include "util.h"
 
@@ -19,6 +20,12 @@
 FILE* __log = NULL;
 #endif
 
+/*
+ * Next handle ID.  Rewrite plans are keyed by the destination handle's ID
+ * rather than its address, which may be reused after st_destroy().
+ */
+static uint64_t next_uid = 1;
+
 /* Userspace constructors & destructors */
 extern void __st_userspace_ctor(void);
 extern void __st_userspace_dtor(void);
@@ -36,6 +43,7 @@ __st_ctor(void)
   ST_INFO("PID: %u\n", getpid());
 #endif
 
+  telemetry_init();
   __st_userspace_ctor();
 }
 
@@ -63,7 +71,11 @@ __st_dtor(void)
  */
 st_handle st_init(const char* fn)
 {
+  int fd;
+  Elf* elf;
   const char* id;
+  int64_t num_slots;
+  const uint32_t* version;
   Elf64_Ehdr* ehdr;
   st_handle handle;
 
@@ -74,23 +86,34 @@ st_handle st_init(const char* fn)
 
   if(!(handle = (st_handle)MALLOC(sizeof(struct _st_handle)))) goto return_null;
   handle->fn = fn;
+  handle->uid = __atomic_fetch_add(&next_uid, 1, __ATOMIC_RELAXED);
+  handle->num_maps = 0;
+  handle->sites_id = handle->sites_addr = NULL;
+  handle->site_addrs = handle->site_ids = NULL;
+  handle->site_id_map = NULL;
+  handle->sites = NULL;
+  handle->funcs = NULL;
+  memset(handle->plans, 0, sizeof(handle->plans));
+  handle->plan_hits = handle->plan_misses = 0;
 
-  /* Initialize libelf data */
-  if((handle->fd = open(fn, O_RDONLY, 0)) < 0) goto free_handle;
-  if(!(handle->elf = elf_begin(handle->fd, ELF_C_READ, NULL))) goto close_file;
+  /*
+   * Initialize libelf data.  libELF is only used to find the metadata
+   * sections, which are mapped directly from the file.
+   */
+  if((fd = open(fn, O_RDONLY, 0)) < 0) goto free_handle;
+  if(!(elf = elf_begin(fd, ELF_C_READ, NULL))) goto close_file;
 
   /* Get architecture-specific information */
-  if(!(ehdr = elf64_getehdr(handle->elf))) goto close_elf;
+  if(!(ehdr = elf64_getehdr(elf))) goto close_elf;
   handle->arch = ehdr->e_machine;
-  if(!(id = elf_getident(handle->elf, NULL))) goto close_elf;
+  if(!(id = elf_getident(elf, NULL))) goto close_elf;
   handle->ptr_size = (id[EI_CLASS] == ELFCLASS64 ? 8 : 4);
 
   /* Read unwinding addresses */
-  handle->unwind_addr_count = get_num_entries(handle->elf,
-                                              SECTION_ST_UNWIND_ADDR);
+  handle->unwind_addr_count = get_num_entries(elf, SECTION_ST_UNWIND_ADDR);
   if(handle->unwind_addr_count > 0)
   {
-    handle->unwind_addrs = get_section_data(handle->elf,
+    handle->unwind_addrs = map_section_data(handle, elf, fd,
                                             SECTION_ST_UNWIND_ADDR);
     if(!handle->unwind_addrs) goto close_elf;
     ST_INFO("Found %lu per-function unwinding metadata entries\n",
@@ -103,10 +126,10 @@ st_handle st_init(const char* fn)
   }
 
   /* Read unwinding information */
-  handle->unwind_count = get_num_entries(handle->elf, SECTION_ST_UNWIND);
+  handle->unwind_count = get_num_entries(elf, SECTION_ST_UNWIND);
   if(handle->unwind_count > 0)
   {
-    handle->unwind_locs = get_section_data(handle->elf, SECTION_ST_UNWIND);
+    handle->unwind_locs = map_section_data(handle, elf, fd, SECTION_ST_UNWIND);
     if(!handle->unwind_locs ) goto close_elf;
     ST_INFO("Found %lu callee-saved frame unwinding entries\n",
             handle->unwind_count);
@@ -118,25 +141,73 @@ st_handle st_init(const char* fn)
   }
 
   /* Read call site metadata */
-  handle->sites_count = get_num_entries(handle->elf, SECTION_ST_ID);
-  if(handle->sites_count > 0)
+  // Note: binaries without a version section use the original format
+  if(get_num_entries(elf, SECTION_ST_VERSION) == 1)
+  {
+    if(!(version = map_section_data(handle, elf, fd, SECTION_ST_VERSION)))
+      goto close_elf;
+    handle->version = *version;
+  }
+  else handle->version = METADATA_V1;
+
+  if(handle->version == METADATA_V2)
+  {
+    handle->sites_count = get_num_entries(elf, SECTION_ST_SITE);
+    if(handle->sites_count > 0)
+    {
+      if(get_num_entries(elf, SECTION_ST_SITE_ADDR) != handle->sites_count ||
+         get_num_entries(elf, SECTION_ST_SITE_ID) != handle->sites_count ||
+         get_num_entries(elf, SECTION_ST_SITE_ID_MAP) != handle->sites_count ||
+         get_num_entries(elf, SECTION_ST_FUNC) != handle->unwind_addr_count)
+      {
+        ST_WARN("mismatched call site metadata sections\n");
+        goto close_elf;
+      }
+      handle->sites = map_section_data(handle, elf, fd, SECTION_ST_SITE);
+      handle->site_addrs = map_section_data(handle, elf, fd,
+                                            SECTION_ST_SITE_ADDR);
+      handle->site_ids = map_section_data(handle, elf, fd, SECTION_ST_SITE_ID);
+      handle->site_id_map = map_section_data(handle, elf, fd,
+                                             SECTION_ST_SITE_ID_MAP);
+      handle->funcs = map_section_data(handle, elf, fd, SECTION_ST_FUNC);
+      if(!handle->sites || !handle->site_addrs || !handle->site_ids ||
+         !handle->site_id_map || !handle->funcs) goto close_elf;
+      ST_INFO("Found %lu call sites (version 2 metadata)\n",
+              handle->sites_count);
+    }
+    else
+    {
+      ST_WARN("no call site information\n");
+      goto close_elf;
+    }
+  }
+  else if(handle->version == METADATA_V1)
   {
-    handle->sites_id = get_section_data(handle->elf, SECTION_ST_ID);
-    handle->sites_addr = get_section_data(handle->elf, SECTION_ST_ADDR);
-    if(!handle->sites_id || !handle->sites_addr) goto close_elf;
-    ST_INFO("Found %lu call sites\n", handle->sites_count);
+    handle->sites_count = get_num_entries(elf, SECTION_ST_ID);
+    if(handle->sites_count > 0)
+    {
+      handle->sites_id = map_section_data(handle, elf, fd, SECTION_ST_ID);
+      handle->sites_addr = map_section_data(handle, elf, fd, SECTION_ST_ADDR);
+      if(!handle->sites_id || !handle->sites_addr) goto close_elf;
+      ST_INFO("Found %lu call sites\n", handle->sites_count);
+    }
+    else
+    {
+      ST_WARN("no call site information\n");
+      goto close_elf;
+    }
   }
   else
   {
-    ST_WARN("no call site information\n");
+    ST_WARN("unsupported call site metadata version %u\n", handle->version);
     goto close_elf;
   }
 
   /* Read live value location records */
-  handle->live_vals_count = get_num_entries(handle->elf, SECTION_ST_LIVE);
+  handle->live_vals_count = get_num_entries(elf, SECTION_ST_LIVE);
   if(handle->live_vals_count > 0)
   {
-    handle->live_vals = get_section_data(handle->elf, SECTION_ST_LIVE);
+    handle->live_vals = map_section_data(handle, elf, fd, SECTION_ST_LIVE);
     if(!handle->live_vals) goto close_elf;
     ST_INFO("Found %lu live value location records\n",
             handle->live_vals_count);
@@ -147,11 +218,10 @@ st_handle st_init(const char* fn)
   /* Read architecture-specific live value location records */
   // Note: unlike other sections, we may not have any architecture-specific
   // live value records
-  handle->arch_live_vals_count = get_num_entries(handle->elf,
-                                                 SECTION_ST_ARCH_LIVE);
+  handle->arch_live_vals_count = get_num_entries(elf, SECTION_ST_ARCH_LIVE);
   if(handle->arch_live_vals_count > 0)
   {
-    handle->arch_live_vals = get_section_data(handle->elf,
+    handle->arch_live_vals = map_section_data(handle, elf, fd,
                                               SECTION_ST_ARCH_LIVE);
     if(!handle->arch_live_vals) goto close_elf;
     ST_INFO("Found %lu architecture-specific live value location records\n",
@@ -160,18 +230,42 @@ st_handle st_init(const char* fn)
   else
     ST_INFO("no architecture-specific live value location records\n");
 
+  /* Read call site lookup index */
+  // Note: binaries generated by older tools may not have an index, in which
+  // case lookups fall back to binary searching the sorted call site sections
+  num_slots = get_num_entries(elf, SECTION_ST_INDEX);
+  if(num_slots > 0 && !(num_slots & (num_slots - 1)) &&
+     num_slots >= handle->sites_count)
+  {
+    handle->site_index = map_section_data(handle, elf, fd, SECTION_ST_INDEX);
+    if(!handle->site_index) goto close_elf;
+    handle->site_index_count = num_slots;
+    ST_INFO("Found call site lookup index with %lu slots\n", num_slots);
+  }
+  else
+  {
+    handle->site_index_count = 0;
+    handle->site_index = NULL;
+    ST_INFO("no call site lookup index, falling back to binary search\n");
+  }
+
   /* Get architecture-specific register operations & stack properties. */
   if(!(handle->regops = get_regops(handle->arch))) goto close_elf;
   if(!(handle->props = get_properties(handle->arch))) goto close_elf;
 
+  /* Mappings remain valid after closing the file. */
+  elf_end(elf);
+  close(fd);
+
   TIMER_STOP(st_init);
 
   return handle;
 
 close_elf:
-  elf_end(handle->elf);
+  unmap_section_data(handle);
+  elf_end(elf);
 close_file:
-  close(handle->fd);
+  close(fd);
 free_handle:
   free(handle);
 return_null:
@@ -189,8 +283,8 @@ void st_destroy(st_handle handle)
   TIMER_START(st_destroy);
   ST_INFO("Cleaning up handle for '%s'\n", handle->fn);
 
-  elf_end(handle->elf);
-  close(handle->fd);
+  free_rewrite_plans(handle);
+  unmap_section_data(handle);
   free(handle);
 
   TIMER_STOP(st_destroy);
@@ -0,0 +1,338 @@
+/*
+ * Building & caching of rewrite plans, i.e., the flattened list of value
+ * copies between a pair of call sites.
+ *
+ * Date: 10/16/2026
+ */
+
+#include "stack_transform.h"
+#include "plan.h"
+#include "util.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Resolve what needs to be done to copy a value into OP.
+ */
+static void build_op(st_handle dest,
+                     const live_value* val_src,
+                     const live_value* val_dest,
+                     rewrite_op* op);
+
+/*
+ * Walk the location records of a pair of call sites & record the values to be
+ * copied in OPS.  If OPS is NULL, only count the values.
+ */
+static uint32_t build_ops(st_handle src,
+                          const call_site* src_site,
+                          st_handle dest,
+                          const call_site* dest_site,
+                          rewrite_op* ops);
+
+/*
+ * Build a rewrite plan for a pair of call sites.
+ */
+static rewrite_plan* build_plan(st_handle src,
+                                const call_site* src_site,
+                                st_handle dest,
+                                const call_site* dest_site);
+
+/*
+ * Look up (and if INSERT is non-NULL, try to insert) a plan in the cache.
+ * Sets HAS_ROOM, if non-NULL, to whether there's an empty slot for the plan.
+ */
+static rewrite_plan* cache_lookup(st_handle src,
+                                  uint64_t id,
+                                  uint64_t dest_uid,
+                                  rewrite_plan* insert,
+                                  bool* has_room);
+
+/* Starting cache slot for a call site ID & destination handle ID. */
+#define PLAN_SLOT( id, uid ) \
+  (site_index_hash((id) ^ ((uid) << 48), PLAN_CACHE_SIZE))
+
+///////////////////////////////////////////////////////////////////////////////
+// Rewrite plans
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Check if a pair of values should be skipped during rewriting.
+ */
+bool skip_val(const live_value* val_src, const live_value* val_dest)
+{
+  ASSERT(val_src && val_dest, "invalid values\n");
+
+  if(val_dest->is_temporary)
+  {
+    ST_INFO("Skipping temporary value");
+    return true;
+  }
+
+  // TODO hack -- va_list is implemented with different sizes for different
+  // architectures.  Need to handle more gracefully.
+  //   x86_64:    24
+  //   aarch64:   32
+  //   powerpc64:  8
+  if(val_src->is_alloca && val_dest->is_alloca &&
+     ((VAL_SIZE(val_src) == 24 && VAL_SIZE(val_dest) == 32) ||
+      (VAL_SIZE(val_src) == 32 && VAL_SIZE(val_dest) == 24) ||
+      (VAL_SIZE(val_src) == 24 && VAL_SIZE(val_dest) == 8) ||
+      (VAL_SIZE(val_src) == 8 && VAL_SIZE(val_dest) == 24)))
+  {
+    ST_INFO("Skipping va_list (different size for aarch64/x86-64)\n");
+    return true;
+  }
+
+  ASSERT(VAL_SIZE(val_src) == VAL_SIZE(val_dest),
+         "value has different size (%u vs. %u)\n",
+         VAL_SIZE(val_src), VAL_SIZE(val_dest));
+  ASSERT(!(val_src->is_ptr ^ val_dest->is_ptr),
+         "value does not have same type (%s vs. %s)\n",
+         (val_src->is_ptr ? "pointer" : "non-pointer"),
+         (val_dest->is_ptr ? "pointer" : "non-pointer"));
+  ASSERT(!(val_src->is_alloca ^ val_dest->is_alloca) || val_src->is_temporary,
+         "value does not have same type (%s vs. %s)\n",
+         (val_src->is_alloca ? "alloca" : "non-alloca"),
+         (val_dest->is_alloca ? "alloca" : "non-alloca"));
+
+  return false;
+}
+
+/*
+ * Get a cached rewrite plan or build & cache a new one.
+ */
+const rewrite_plan* get_rewrite_plan(st_handle src,
+                                     const call_site* src_site,
+                                     st_handle dest,
+                                     const call_site* dest_site)
+{
+  bool has_room;
+  rewrite_plan* plan, *cached;
+
+  ASSERT(src && src_site && dest && dest_site,
+         "invalid arguments to get_rewrite_plan()\n");
+
+  if((plan = cache_lookup(src, src_site->id, dest->uid, NULL, &has_room)))
+  {
+    __atomic_fetch_add(&src->plan_hits, 1, __ATOMIC_RELAXED);
+    return plan;
+  }
+
+  /* Don't bother building plans that can't be cached */
+  __atomic_fetch_add(&src->plan_misses, 1, __ATOMIC_RELAXED);
+  if(!has_room) return NULL;
+  if(!(plan = build_plan(src, src_site, dest, dest_site))) return NULL;
+
+  /* Another thread may have raced us to insert the same plan */
+  cached = cache_lookup(src, src_site->id, dest->uid, plan, NULL);
+  if(cached != plan) free(plan);
+  return cached;
+}
+
+/*
+ * Free all plans cached in the handle.
+ */
+void free_rewrite_plans(st_handle handle)
+{
+  size_t i;
+
+  for(i = 0; i < PLAN_CACHE_SIZE; i++)
+  {
+    if(handle->plans[i]) free(handle->plans[i]);
+    handle->plans[i] = NULL;
+  }
+}
+
+/*
+ * Build rewrite plans for all call sites in SRC.
+ */
+int st_prebuild_plans(st_handle src, st_handle dest)
+{
+  size_t i, num = 0;
+  call_site src_site, dest_site;
+  uint64_t prev_id = 0;
+
+  if(!src || !dest) return 1;
+
+  TIMER_START(st_prebuild_plans);
+  ST_INFO("Building rewrite plans for %s -> %s\n",
+          arch_name(src->arch), arch_name(dest->arch));
+
+  for(i = 0; i < src->sites_count; i++)
+  {
+    get_site_at(src, i, &src_site);
+    if(i && src_site.id == prev_id) continue;
+    prev_id = src_site.id;
+    if(!get_site_by_id(dest, src_site.id, &dest_site))
+    {
+      ST_WARN("no destination call site for ID %lu\n", src_site.id);
+      continue;
+    }
+    if(get_rewrite_plan(src, &src_site, dest, &dest_site)) num++;
+  }
+
+  ST_INFO("Built %lu rewrite plans\n", num);
+
+  /* Don't count building the plans as cache misses */
+  __atomic_store_n(&src->plan_misses, 0, __ATOMIC_RELAXED);
+
+  TIMER_STOP(st_prebuild_plans);
+
+  return 0;
+}
+
+/*
+ * Return rewrite plan cache statistics.
+ */
+void st_plan_cache_stats(st_handle handle, uint64_t* hits, uint64_t* misses)
+{
+  if(!handle) return;
+  if(hits) *hits = __atomic_load_n(&handle->plan_hits, __ATOMIC_RELAXED);
+  if(misses) *misses = __atomic_load_n(&handle->plan_misses, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API (implementation)
+///////////////////////////////////////////////////////////////////////////////
+
+static void build_op(st_handle dest,
+                     const live_value* val_src,
+                     const live_value* val_dest,
+                     rewrite_op* op)
+{
+  op->src = *val_src;
+  op->dest = *val_dest;
+  op->flags = 0;
+
+  /* Mirrors the checks done by rewrite_val() & put_val() without a plan */
+  if(val_src->is_ptr || val_src->is_temporary) op->flags |= OP_MAY_POINT;
+  if(val_dest->type != SM_CONSTANT && val_dest->type != SM_CONST_IDX)
+  {
+    if(val_src->type == SM_CONST_IDX)
+      ST_ERR(1, "constant pool entries not supported\n");
+    op->flags |= OP_COPY;
+    if(val_dest->type == SM_REGISTER &&
+       dest->props->is_callee_saved(val_dest->regnum))
+      op->flags |= OP_CALLEE_SAVED;
+  }
+  if(val_src->is_alloca && !val_src->is_temporary) op->flags |= OP_POINTED_TO;
+}
+
+static uint32_t build_ops(st_handle src,
+                          const call_site* src_site,
+                          st_handle dest,
+                          const call_site* dest_site,
+                          rewrite_op* ops)
+{
+  size_t i, j, src_offset, dest_offset;
+  const live_value* val_src, *val_dest;
+  uint32_t num_ops = 0;
+
+  /* Mirrors the traversal done by rewrite_frame() without a plan */
+  src_offset = src_site->live_offset;
+  dest_offset = dest_site->live_offset;
+  for(i = 0, j = 0; j < dest_site->num_live; i++, j++)
+  {
+    ASSERT(i < src->live_vals_count,
+           "out-of-bounds live value record access in source handle\n");
+    ASSERT(j < dest->live_vals_count,
+           "out-of-bounds live value record access in destination handle\n");
+
+    val_src = &src->live_vals[i + src_offset];
+    val_dest = &dest->live_vals[j + dest_offset];
+
+    ASSERT(!val_src->is_duplicate, "invalid duplicate location record\n");
+    ASSERT(!val_dest->is_duplicate, "invalid duplicate location record\n");
+
+    /* Apply to first location record */
+    if(!skip_val(val_src, val_dest))
+    {
+      if(ops) build_op(dest, val_src, val_dest, &ops[num_ops]);
+      num_ops++;
+    }
+
+    /* Apply to all duplicate location records */
+    while((j + 1 + dest_offset) < dest->live_vals_count &&
+          dest->live_vals[j + 1 + dest_offset].is_duplicate)
+    {
+      j++;
+      val_dest = &dest->live_vals[j + dest_offset];
+      ASSERT(!val_dest->is_alloca, "invalid duplicate location record\n");
+      if(!skip_val(val_src, val_dest))
+      {
+        if(ops) build_op(dest, val_src, val_dest, &ops[num_ops]);
+        num_ops++;
+      }
+    }
+
+    /* Advance source value past duplicates location records */
+    while((i + 1 + src_offset) < src->live_vals_count &&
+          src->live_vals[i + 1 + src_offset].is_duplicate) i++;
+  }
+  ASSERT(i == src_site->num_live && j == dest_site->num_live,
+        "did not handle all live values\n");
+
+  return num_ops;
+}
+
+static rewrite_plan* build_plan(st_handle src,
+                                const call_site* src_site,
+                                st_handle dest,
+                                const call_site* dest_site)
+{
+  uint32_t num_ops;
+  rewrite_plan* plan;
+
+  ASSERT(src_site->id == dest_site->id, "non-matching call sites\n");
+
+  num_ops = build_ops(src, src_site, dest, dest_site, NULL);
+  plan = (rewrite_plan*)MALLOC(sizeof(rewrite_plan) +
+                               sizeof(rewrite_op) * num_ops);
+  if(!plan)
+  {
+    ST_WARN("could not allocate rewrite plan\n");
+    return NULL;
+  }
+
+  plan->id = src_site->id;
+  plan->dest_uid = dest->uid;
+  plan->num_ops = build_ops(src, src_site, dest, dest_site, plan->ops);
+  ST_INFO("Built rewrite plan for call site %lu (%u copies)\n",
+          plan->id, plan->num_ops);
+
+  return plan;
+}
+
+static rewrite_plan* cache_lookup(st_handle src,
+                                  uint64_t id,
+                                  uint64_t dest_uid,
+                                  rewrite_plan* insert,
+                                  bool* has_room)
+{
+  size_t i, slot = PLAN_SLOT(id, dest_uid);
+  rewrite_plan* cur;
+
+  if(has_room) *has_room = false;
+
+  // Note: plans are never evicted, so once a slot is filled it can be read
+  // without any further synchronization
+  for(i = 0; i < PLAN_CACHE_PROBES; i++, slot = (slot + 1) % PLAN_CACHE_SIZE)
+  {
+    cur = __atomic_load_n(&src->plans[slot], __ATOMIC_ACQUIRE);
+    if(!cur)
+    {
+      if(has_room) *has_room = true;
+      if(!insert) return NULL;
+      if(__atomic_compare_exchange_n(&src->plans[slot], &cur, insert, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return insert;
+      // Note: on failure cur holds the plan that was inserted instead
+    }
+    if(cur->id == id && cur->dest_uid == dest_uid) return cur;
+  }
+
+  if(insert) ST_INFO("Rewrite plan cache full for call site %lu\n", id);
+  return NULL;
+}
@@ -7,6 +7,9 @@
 
 #include "stack_transform.h"
 #include "data.h"
+#include "fixup.h"
+#include "plan.h"
+#include "stack_region.h"
 #include "unwind.h"
 #include "util.h"
 
@@ -14,29 +17,131 @@
 // File-local API & definitions
 ///////////////////////////////////////////////////////////////////////////////
 
-#if _TLS_IMPL == COMPILER_TLS
-
 #include "arch_regs.h"
 
-#define REGSET_POOL (MAX_REGSET_SIZE * MAX_FRAMES)
-#define CALLEE_POOL (MAX_CALLEE_SIZE * MAX_FRAMES)
+#define INLINE_REGSETS (MAX_REGSET_SIZE * INLINE_ACTS)
+#define INLINE_CALLEE (MAX_CALLEE_SIZE * INLINE_ACTS)
+
+/*
+ * Idle rewriting contexts.  Contexts (& their data pools, which are sized for
+ * any architecture) are allocated the first time they're needed and recycled
+ * afterwards to avoid malloc whenever possible.  Unlike per-thread contexts,
+ * any thread (e.g., st_rewrite_stacks() workers) can rewrite using them.
+ */
+static rewrite_context ctx_pool[CONTEXT_POOL_SIZE];
+static size_t ctx_pool_count = 0;
+static pthread_mutex_t ctx_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Get a context from the calling thread's arena, reserving the arena on first
+ * use.  Falls back to the pool if both of the thread's contexts are in use.
+ */
+static rewrite_context get_context(void);
+
+/*
+ * Return a context to its owning thread's arena, or to the pool if it came
+ * from the pool.
+ */
+static void put_context(rewrite_context ctx);
+
+/*
+ * Get a context from the pool, allocating a new one if the pool is empty.
+ */
+static rewrite_context get_pooled_context(void);
 
 /*
- * Declare all rewriting space at compile time to avoid malloc whenever
- * possible.  We only need to declare a pair of each as each thread will only
- * ever use 2 at a time.
+ * Return a context to the pool, freeing it if the pool is full.
  */
-static __thread struct rewrite_context src_ctx, dest_ctx;
-static __thread char src_regs[REGSET_POOL], dest_regs[REGSET_POOL];
-static __thread char src_callee[CALLEE_POOL], dest_callee[CALLEE_POOL];
+static void put_pooled_context(rewrite_context ctx);
 
+/*
+ * Point a context's activations back at its inline storage, freeing any
+ * activations spilled to the heap.
+ */
+static void reset_acts(rewrite_context ctx);
+
+/*
+ * Per-thread context arena.  Each thread reserves a source & destination
+ * context, which it reuses for every rewrite without taking the pool's lock.
+ * Unlike pooled contexts, arena contexts keep activations spilled by deep
+ * stacks & grown fixup storage, so a thread only allocates when its stack is
+ * deeper than any it has previously rewritten.  Arena contexts are returned
+ * to the pool when the thread exits.
+ */
+#define ARENA_CONTEXTS 2
+
+typedef struct context_arena
+{
+  bool reserved; /* whether the contexts have been reserved */
+  rewrite_context ctx[ARENA_CONTEXTS];
+  bool busy[ARENA_CONTEXTS];
+} context_arena;
+
+/*
+ * Per-thread rewriting state.  For on-demand rewriting, contexts are kept
+ * alive between trampoline calls so frames can be rewritten as the thread
+ * returns into them.  If the thread begins another rewrite before all frames
+ * have been rewritten, the remaining frames are rewritten immediately
+ * ("flushed") and the register set for the oldest rewritten frame is saved
+ * until the thread returns through the trampoline.
+ */
+typedef struct ondemand_state
+{
+  rewrite_context src, dest; /* contexts for rewrite in progress, if any */
+  void* flushed_sp; /* stack pointer at which flushed registers are restored */
+  regops_t flushed_regops; /* register operations for flushed registers */
+  char flushed_regs[MAX_REGSET_SIZE] __attribute__((aligned(16)));
+  context_arena arena; /* the thread's reserved contexts */
+} ondemand_state;
+
+/*
+ * The key's destructor releases the thread's arena (and with PTHREAD_TLS,
+ * frees the state itself) when the thread exits.
+ */
+#if _TLS_IMPL == COMPILER_TLS
+static __thread ondemand_state ondemand;
 #endif
+static pthread_key_t ondemand_key;
+static pthread_once_t ondemand_key_once = PTHREAD_ONCE_INIT;
+static void create_ondemand_key(void);
+static void release_ondemand_state(void* data);
+
+/*
+ * Get the calling thread's rewriting state.
+ */
+static ondemand_state* get_ondemand_state(void);
+
+/*
+ * Reserve the contexts in the calling thread's arena.  Returns true if both
+ * contexts were reserved.
+ */
+static bool reserve_arena(ondemand_state* state);
+
+/*
+ * Called by the architecture-specific trampoline when the thread returns into
+ * a frame which has not yet been rewritten.  SP is the frame's stack pointer.
+ * Fills REGSET with the frame's register state.
+ */
+void __st_ondemand_resume(void* sp, void* regset);
+
+/*
+ * Rewrite a stack in its entirety on behalf of the thread whose rewriting
+ * state is OWNER (which may be a different thread than the caller).
+ */
+static int rewrite_stack(ondemand_state* owner,
+                         st_handle handle_src,
+                         void* regset_src,
+                         void* sp_base_src,
+                         st_handle handle_dest,
+                         void* regset_dest,
+                         void* sp_base_dest);
 
 /*
  * Initialize an architecture-specific (source) context using previously
- * initialized REGSET and HANDLE.
+ * initialized REGSET and HANDLE for the stack of the thread owning OWNER.
  */
-static rewrite_context init_src_context(st_handle handle,
+static rewrite_context init_src_context(ondemand_state* owner,
+                                        st_handle handle,
                                         void* regset,
                                         void* sp_base);
 
@@ -45,25 +150,16 @@ static rewrite_context init_src_context(st_handle handle,
  * stack SP_BASE.  Store destination REGSET pointer to be filled with
  * destination thread's resultant register state.
  */
-static rewrite_context init_dest_context(st_handle handle,
+static rewrite_context init_dest_context(ondemand_state* owner,
+                                         st_handle handle,
                                          void* regset,
                                          void* sp_base);
 
-/*
- * Initialize data pools for constant-time allocation.
- */
-static void init_data_pools(rewrite_context ctx);
-
 /*
  * Free previously-allocated context information.
  */
 static void free_context(rewrite_context ctx);
 
-/*
- * Free a context's data pools.
- */
-static void free_data_pools(rewrite_context ctx);
-
 /*
  * Unwind the source stack to find all live stack frames & determine
  * destination stack size.
@@ -71,19 +167,83 @@ static void free_data_pools(rewrite_context ctx);
 static void unwind_and_size(rewrite_context src,
                             rewrite_context dest);
 
+/*
+ * Walk the source stack using only call site metadata (i.e., without restoring
+ * callee-saved registers) to find all live stack frames & determine
+ * destination stack size.  Used for on-demand rewriting, where source frames
+ * are popped as they are rewritten.
+ */
+static void walk_and_size(rewrite_context src,
+                          rewrite_context dest);
+
+/*
+ * Set up the destination stack of size STACK_SIZE & the outermost frame after
+ * finding all live source frames.
+ */
+static void setup_dest_stack(rewrite_context src,
+                             rewrite_context dest,
+                             size_t stack_size);
+
+/*
+ * If the thread returned through an on-demand trampoline whose frames have
+ * been flushed, restore the saved register set into CTX's current frame.
+ */
+static inline void restore_flushed_frame(rewrite_context ctx);
+
+/*
+ * Rewrite frames starting at the current activation, popping both source &
+ * destination frames along the way.  If LAZY, stop after the first frame for
+ * which there are no outstanding stack pointer fixups & install the
+ * trampoline as its return address.  Returns true if all frames, including
+ * the starting function, have been rewritten.
+ */
+static bool rewrite_frames(rewrite_context src,
+                           rewrite_context dest,
+                           bool lazy);
+
+/*
+ * Rewrite all remaining frames of an in-progress on-demand rewrite & save the
+ * register set for the oldest rewritten frame.
+ */
+static void flush_ondemand(ondemand_state* state);
+
 /*
  * Rewrite an individual value from the source to destination call frame.
- * Returns true if there's a fixup needed within this stack frame.
+ * Returns true if there's a fixup needed within this stack frame.  Values
+ * must have already been filtered with skip_val().
  */
 static bool rewrite_val(rewrite_context src, const live_value* val_src,
                         rewrite_context dest, const live_value* val_dest);
 
+/*
+ * Record a fixup for a pointer-to-stack value.  Returns true if it points
+ * within the current frame.
+ */
+static bool add_stack_fixup(rewrite_context src,
+                            void* stack_addr,
+                            rewrite_context dest,
+                            const live_value* val_dest);
+
 /*
  * Fix up pointers to same-frame data.
  */
 static inline void
 fixup_local_pointers(rewrite_context src, rewrite_context dest);
 
+/*
+ * Copy live values between the current frames using a rewrite plan.  Returns
+ * true if there's a fixup needed within this stack frame.
+ */
+static bool rewrite_planned_vals(rewrite_context src,
+                                 rewrite_context dest,
+                                 const rewrite_plan* plan);
+
+/*
+ * Copy live values between the current frames without a rewrite plan.
+ * Returns true if there's a fixup needed within this stack frame.
+ */
+static bool rewrite_live_vals(rewrite_context src, rewrite_context dest);
+
 /*
  * Re-write an individual frame from the source to destination stack.
  */
@@ -93,6 +253,22 @@ static void rewrite_frame(rewrite_context src, rewrite_context dest);
 // Perform stack transformation
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Reserve the calling thread's rewriting contexts.
+ */
+int st_reserve_thread(void)
+{
+  return reserve_arena(get_ondemand_state()) ? 0 : 1;
+}
+
+/*
+ * Get the calling thread's rewriting state.
+ */
+void* st_stack_owner(void)
+{
+  return get_ondemand_state();
+}
+
 /*
  * Perform stack transformation in its entirety, from source to destination.
  */
@@ -102,6 +278,37 @@ int st_rewrite_stack(st_handle handle_src,
                      st_handle handle_dest,
                      void* regset_dest,
                      void* sp_base_dest)
+{
+  return rewrite_stack(get_ondemand_state(), handle_src, regset_src,
+                       sp_base_src, handle_dest, regset_dest, sp_base_dest);
+}
+
+/*
+ * Perform stack transformation in its entirety on behalf of another thread,
+ * used by st_rewrite_stacks() workers.
+ */
+int __st_rewrite_stack_for(void* owner,
+                           st_handle handle_src,
+                           void* regset_src,
+                           void* sp_base_src,
+                           st_handle handle_dest,
+                           void* regset_dest,
+                           void* sp_base_dest)
+{
+  return rewrite_stack((ondemand_state*)owner, handle_src, regset_src,
+                       sp_base_src, handle_dest, regset_dest, sp_base_dest);
+}
+
+/*
+ * Perform stack transformation in its entirety for OWNER's stack.
+ */
+static int rewrite_stack(ondemand_state* owner,
+                         st_handle handle_src,
+                         void* regset_src,
+                         void* sp_base_src,
+                         st_handle handle_dest,
+                         void* regset_dest,
+                         void* sp_base_dest)
 {
   rewrite_context src, dest;
   uint64_t* saved_fbp;
@@ -115,12 +322,15 @@ int st_rewrite_stack(st_handle handle_src,
 
   TIMER_START(st_rewrite_stack);
 
+  /* Finish any in-progress on-demand rewrite before clobbering its source. */
+  if(owner && owner->src) flush_ondemand(owner);
+
   ST_INFO("--> Initializing rewrite (%s -> %s) <--\n",
           arch_name(handle_src->arch), arch_name(handle_dest->arch));
 
   /* Initialize rewriting contexts. */
-  src = init_src_context(handle_src, regset_src, sp_base_src);
-  dest = init_dest_context(handle_dest, regset_dest, sp_base_dest);
+  src = init_src_context(owner, handle_src, regset_src, sp_base_src);
+  dest = init_dest_context(owner, handle_dest, regset_dest, sp_base_dest);
 
   if(!src || !dest)
   {
@@ -171,13 +381,13 @@ int st_rewrite_stack(st_handle handle_src,
 
   /* Copy out register state for destination & clean up. */
   REGOPS(dest)->regset_copyout(dest->acts[0].regs, dest->regs);
+  TELEMETRY_MIGRATION_DONE(src->num_acts);
   free_context(dest);
   free_context(src);
 
   ST_INFO("Finished rewrite!\n");
 
   TIMER_STOP(st_rewrite_stack);
-  TIMER_PRINT;
 
 #ifdef _LOG
 #ifndef _PER_LOG_OPEN
@@ -189,8 +399,9 @@ int st_rewrite_stack(st_handle handle_src,
 }
 
 /*
- * Perform stack transformation for the top frame.  Replace return address so
- * that we can intercept and transform frames on demand.
+ * Perform stack transformation for the outermost frames.  Replace the return
+ * address of the last rewritten frame so that we can intercept and transform
+ * the remaining frames on demand.
  */
 int st_rewrite_ondemand(st_handle handle_src,
                         void* regset_src,
@@ -199,13 +410,149 @@ int st_rewrite_ondemand(st_handle handle_src,
                         void* regset_dest,
                         void* sp_base_dest)
 {
-  ST_ERR(1, "on-demand rewriting not yet supported\n");
+  rewrite_context src, dest;
+  ondemand_state* state;
+  bool done;
+
+  if(!handle_src || !regset_src || !sp_base_src ||
+     !handle_dest || !regset_dest || !sp_base_dest)
+  {
+    ST_WARN("invalid arguments\n");
+    return 1;
+  }
+
+  TIMER_START(st_rewrite_ondemand);
+
+  /* Finish any in-progress on-demand rewrite before clobbering its source. */
+  state = get_ondemand_state();
+  if(state->src) flush_ondemand(state);
+
+  ST_INFO("--> Initializing on-demand rewrite (%s -> %s) <--\n",
+          arch_name(handle_src->arch), arch_name(handle_dest->arch));
+
+  /* Initialize rewriting contexts. */
+  src = init_src_context(state, handle_src, regset_src, sp_base_src);
+  dest = init_dest_context(state, handle_dest, regset_dest, sp_base_dest);
+
+  if(!src || !dest)
+  {
+    if(src) free_context(src);
+    if(dest) free_context(dest);
+    return 1;
+  }
+
+  ST_INFO("--> Walking source stack to find live activations <--\n");
+
+  /* Walk source stack to determine destination stack size. */
+  walk_and_size(src, dest);
+
+  ST_INFO("--> Rewriting from source to destination stack <--\n");
+
+  TIMER_START(rewrite_stack);
+
+  /* Rewrite outer-most frame. */
+  ST_INFO("--> Rewriting outermost frame <--\n");
+
+  set_return_address_funcentry(dest, (void*)NEXT_ACT(dest).site.addr);
+  pop_frame_funcentry(dest);
+  pop_frame(src, false);
+  restore_flushed_frame(src);
+
+  /* Rewrite frames until there are no pointers into older frames. */
+  done = rewrite_frames(src, dest, true);
+
+  TIMER_STOP(rewrite_stack);
+
+  /* Copy out register state for destination. */
+  REGOPS(dest)->regset_copyout(dest->acts[0].regs, dest->regs);
+
+  // Note: don't clean up if there are frames left, as we'll need the contexts
+  // when the thread returns into the next frame
+  if(done)
+  {
+    TELEMETRY_MIGRATION_DONE(src->num_acts);
+    free_context(dest);
+    free_context(src);
+    ST_INFO("Finished rewrite!\n");
+  }
+  else
+  {
+    state->src = src;
+    state->dest = dest;
+    ST_INFO("Deferring rewrite of frames %d - %d\n",
+            src->act, src->num_acts - 1);
+  }
+
+  TIMER_STOP(st_rewrite_ondemand);
+
+#ifdef _LOG
+#ifndef _PER_LOG_OPEN
+  fflush(__log);
+#endif
+#endif
 
-  // Note: don't clean up, as we'll need the contexts when the thread needs to
-  // re-write the next frame
   return 0;
 }
 
+/*
+ * Rewrite the frame the thread is returning into (and any older frames it
+ * points to) & set up the trampoline for the next frame.
+ */
+void __st_ondemand_resume(void* sp, void* regset)
+{
+  ondemand_state* state = get_ondemand_state();
+  rewrite_context src = state->src, dest = state->dest;
+  int outermost;
+  bool done;
+
+  /* Remaining frames were rewritten by a flush, restore saved registers. */
+  if(sp == state->flushed_sp)
+  {
+    ST_INFO("Restoring flushed registers (SP=%p)\n", sp);
+    state->flushed_regops->regset_copyout(state->flushed_regs, regset);
+    state->flushed_sp = NULL;
+    return;
+  }
+
+  if(!src || !dest) ST_ERR(1, "no on-demand rewrite in progress\n");
+  ASSERT(sp == REGOPS(dest)->sp(ACT(dest).regs),
+         "unexpected stack pointer for on-demand rewrite (%p vs. %p)\n",
+         sp, REGOPS(dest)->sp(ACT(dest).regs));
+
+  TIMER_START(rewrite_stack);
+  ST_INFO("--> Resuming on-demand rewrite at frame %d <--\n", dest->act);
+
+  /*
+   * All younger frames have returned, so the current frame is now the
+   * outermost live frame.  Callee-saved registers which aren't saved by
+   * frames we're rewriting must be live in its register set.
+   */
+  outermost = dest->outermost = dest->act;
+  done = rewrite_frames(src, dest, true);
+
+  /* Copy out register state, returning to the frame's call site. */
+  REGOPS(dest)->set_pc(dest->acts[outermost].regs,
+                       (void*)dest->acts[outermost].site.addr);
+  REGOPS(dest)->regset_copyout(dest->acts[outermost].regs, regset);
+
+  if(done)
+  {
+    TELEMETRY_MIGRATION_DONE(src->num_acts);
+    free_context(dest);
+    free_context(src);
+    state->src = state->dest = NULL;
+    ST_INFO("Finished rewrite!\n");
+  }
+
+  TIMER_STOP(rewrite_stack);
+
+#ifdef _LOG
+#ifndef _PER_LOG_OPEN
+  fflush(__log);
+#endif
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // File-local API implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -214,7 +561,8 @@ int st_rewrite_ondemand(st_handle handle_src,
  * Initialize an architecture-specific (source) context using previously
  * initialized REGSET and HANDLE.
  */
-static rewrite_context init_src_context(st_handle handle,
+static rewrite_context init_src_context(ondemand_state* owner,
+                                        st_handle handle,
                                         void* regset,
                                         void* sp_base)
 {
@@ -222,23 +570,16 @@ static rewrite_context init_src_context(st_handle handle,
 
   TIMER_START(init_src_context);
 
-#if _TLS_IMPL == COMPILER_TLS
-  ctx = &src_ctx;
-  ctx->regset_pool = src_regs;
-  ctx->callee_saved_pool = src_callee;
-#else
-  ctx = (rewrite_context)MALLOC(sizeof(struct rewrite_context));
-#endif
+  if(!(ctx = get_context())) return NULL;
+  ctx->owner = owner;
   ctx->handle = handle;
   ctx->num_acts = 1;
   ctx->act = 0;
+  ctx->outermost = 0;
   ctx->regs = regset;
   ctx->stack_base = sp_base;
 
-#if _TLS_IMPL != COMPILER_TLS
-  init_data_pools(ctx);
-#endif
-  list_init(fixup, &ctx->stack_pointers);
+  fixup_set_clear(&ctx->stack_pointers);
   bootstrap_first_frame(ctx, regset); // Sets up initial register set
   ctx->stack = REGOPS(ctx)->sp(ACT(ctx).regs);
   ASSERT(ctx->stack, "invalid stack pointer\n");
@@ -262,7 +603,8 @@ static rewrite_context init_src_context(st_handle handle,
  * stack SP_BASE and program location PC.  Store destination REGSET pointer
  * to be filled with destination thread's resultant register state.
  */
-static rewrite_context init_dest_context(st_handle handle,
+static rewrite_context init_dest_context(ondemand_state* owner,
+                                         st_handle handle,
                                          void* regset,
                                          void* sp_base)
 {
@@ -270,23 +612,16 @@ static rewrite_context init_dest_context(st_handle handle,
 
   TIMER_START(init_dest_context);
 
-#if _TLS_IMPL == COMPILER_TLS
-  ctx = &dest_ctx;
-  ctx->regset_pool = dest_regs;
-  ctx->callee_saved_pool = dest_callee;
-#else
-  ctx = (rewrite_context)MALLOC(sizeof(struct rewrite_context));
-#endif
+  if(!(ctx = get_context())) return NULL;
+  ctx->owner = owner;
   ctx->handle = handle;
   ctx->num_acts = 1;
   ctx->act = 0;
+  ctx->outermost = 0;
   ctx->regs = regset;
   ctx->stack_base = sp_base;
 
-#if _TLS_IMPL != COMPILER_TLS
-  init_data_pools(ctx);
-#endif
-  list_init(fixup, &ctx->stack_pointers);
+  fixup_set_clear(&ctx->stack_pointers);
 
   // Note: cannot setup frame information because CFA will be invalid, need to
   // set up SP & find call site information
@@ -296,15 +631,112 @@ static rewrite_context init_dest_context(st_handle handle,
 }
 
 /*
- * Initialize the context's data pools.
+ * Get a context from the calling thread's arena.
  */
-static void init_data_pools(rewrite_context ctx)
+static rewrite_context get_context(void)
 {
-  size_t num_regs = REGOPS(ctx)->num_regs;
-  ctx->regset_pool = MALLOC(REGOPS(ctx)->regset_size * MAX_FRAMES);
-  ctx->callee_saved_pool = MALLOC(bitmap_size(num_regs) * MAX_FRAMES);
-  ASSERT(ctx->callee_saved_pool && ctx->regset_pool,
-         "could not initialize data pools");
+  size_t i;
+  ondemand_state* state = get_ondemand_state();
+  context_arena* arena = &state->arena;
+
+  if(!arena->reserved) reserve_arena(state);
+  for(i = 0; i < ARENA_CONTEXTS; i++)
+  {
+    if(arena->ctx[i] && !arena->busy[i])
+    {
+      arena->busy[i] = true;
+      return arena->ctx[i];
+    }
+  }
+
+  // Note: shouldn't happen, as in-progress rewrites are flushed first
+  ST_INFO("Arena contexts in use, falling back to the pool\n");
+  return get_pooled_context();
+}
+
+/*
+ * Return a context to its owning thread's arena.
+ */
+static void put_context(rewrite_context ctx)
+{
+  // Note: may be called by a thread other than the arena's owner, e.g., when
+  // a worker flushes the stack owner's on-demand rewrite
+  if(!ctx->arena)
+  {
+    put_pooled_context(ctx);
+    return;
+  }
+
+  ASSERT(ctx->arena->ctx[ctx->arena_slot] == ctx,
+         "context returned to an arena which doesn't own it\n");
+  ctx->arena->busy[ctx->arena_slot] = false;
+}
+
+/*
+ * Get a context from the pool, allocating a new one if the pool is empty.
+ */
+static rewrite_context get_pooled_context(void)
+{
+  rewrite_context ctx = NULL;
+
+  pthread_mutex_lock(&ctx_pool_lock);
+  if(ctx_pool_count) ctx = ctx_pool[--ctx_pool_count];
+  pthread_mutex_unlock(&ctx_pool_lock);
+  if(ctx) return ctx;
+
+  ctx = (rewrite_context)MALLOC(sizeof(struct rewrite_context) +
+                               INLINE_REGSETS + INLINE_CALLEE);
+  if(!ctx)
+  {
+    ST_WARN("could not allocate rewriting context\n");
+    return NULL;
+  }
+  ctx->acts = ctx->inline_acts;
+  ctx->arena_slot = -1;
+  ctx->arena = NULL;
+  memset(ctx->inline_pools, 0, INLINE_REGSETS + INLINE_CALLEE);
+  fixup_set_init(&ctx->stack_pointers);
+  reset_acts(ctx);
+  return ctx;
+}
+
+/*
+ * Return a context to the pool, freeing it if the pool is full.
+ */
+static void put_pooled_context(rewrite_context ctx)
+{
+  // Note: deep stacks are rare, don't keep their arenas around in the pool
+  reset_acts(ctx);
+  ctx->arena_slot = -1;
+  ctx->arena = NULL;
+
+  pthread_mutex_lock(&ctx_pool_lock);
+  if(ctx_pool_count < CONTEXT_POOL_SIZE)
+  {
+    ctx_pool[ctx_pool_count++] = ctx;
+    ctx = NULL;
+  }
+  pthread_mutex_unlock(&ctx_pool_lock);
+
+  if(ctx)
+  {
+    fixup_set_free(&ctx->stack_pointers);
+    free(ctx);
+  }
+}
+
+static void reset_acts(rewrite_context ctx)
+{
+  if(ctx->acts != ctx->inline_acts)
+  {
+    free(ctx->acts);
+    free(ctx->regset_pool);
+    free(ctx->callee_saved_pool);
+  }
+  ctx->acts = ctx->inline_acts;
+  ctx->max_acts = INLINE_ACTS;
+  ctx->regset_pool = ctx->inline_pools;
+  ctx->callee_saved_pool = ctx->inline_pools + INLINE_REGSETS;
 }
 
 /*
@@ -312,42 +744,114 @@ static void init_data_pools(rewrite_context ctx)
  */
 static void free_context(rewrite_context ctx)
 {
-  node_t(fixup)* node;
+  size_t i;
 
   TIMER_START(free_context);
 
-  node = list_begin(fixup, &ctx->stack_pointers);
-  while(node)
-  {
+  for(i = 0; i < fixup_set_size(&ctx->stack_pointers); i++)
     ST_WARN("could not find stack pointer fixup for %p (in activation %d)\n",
-            node->data.src_addr, node->data.act);
-    node = list_remove(fixup, &ctx->stack_pointers, node);
-  }
+            ctx->stack_pointers.data[i].src_addr,
+            ctx->stack_pointers.data[i].act);
+  fixup_set_clear(&ctx->stack_pointers);
 
 #ifdef _CHECKS
-  int i;
-  for(i = 0; i < ctx->num_acts; i++)
+  for(i = 0; i < (size_t)ctx->num_acts; i++)
     clear_activation(ctx->handle, &ctx->acts[i]);
 #endif
-#if _TLS_IMPL != COMPILER_TLS
-  free_data_pools(ctx);
-  free(ctx);
-#endif
+  put_context(ctx);
 
   TIMER_STOP(free_context);
 }
 
 /*
- * Free a rewrite context's data pools.
+ * Get the calling thread's rewriting state.
+ */
+static ondemand_state* get_ondemand_state(void)
+{
+#if _TLS_IMPL == COMPILER_TLS
+  return &ondemand;
+#else /* PTHREAD_TLS */
+  ondemand_state* state;
+
+  pthread_once(&ondemand_key_once, create_ondemand_key);
+  if(!(state = pthread_getspecific(ondemand_key)))
+  {
+    state = (ondemand_state*)MALLOC(sizeof(ondemand_state));
+    ASSERT(state, "could not allocate on-demand rewriting state\n");
+    memset(state, 0, sizeof(ondemand_state));
+    if(pthread_setspecific(ondemand_key, state))
+      ST_ERR(1, "could not set TLS data for thread\n");
+  }
+  return state;
+#endif
+}
+
+/*
+ * Create the TLS key for per-thread rewriting state.
+ */
+static void create_ondemand_key(void)
+{
+  if(pthread_key_create(&ondemand_key, release_ondemand_state))
+    ST_ERR(1, "could not create TLS key for on-demand rewriting\n");
+}
+
+/*
+ * Return an exiting thread's arena contexts to the pool.
+ */
+static void release_ondemand_state(void* data)
+{
+  size_t i;
+  ondemand_state* state = (ondemand_state*)data;
+
+  // Note: an unfinished on-demand rewrite can no longer be resumed
+  state->src = state->dest = NULL;
+  for(i = 0; i < ARENA_CONTEXTS; i++)
+  {
+    if(!state->arena.ctx[i]) continue;
+    put_pooled_context(state->arena.ctx[i]);
+    state->arena.ctx[i] = NULL;
+    state->arena.busy[i] = false;
+  }
+  state->arena.reserved = false;
+#if _TLS_IMPL == PTHREAD_TLS
+  free(state);
+#endif
+}
+
+/*
+ * Reserve the contexts in the calling thread's arena.
  */
-static void free_data_pools(rewrite_context ctx)
+static bool reserve_arena(ondemand_state* state)
 {
-  free(ctx->regset_pool);
-  free(ctx->callee_saved_pool);
-#ifdef _DEBUG
-  ctx->regset_pool = NULL;
-  ctx->callee_saved_pool = NULL;
+  size_t i;
+  context_arena* arena = &state->arena;
+
+  if(arena->reserved) return true;
+
+#if _TLS_IMPL == COMPILER_TLS
+  /* Register the state so the arena is released when the thread exits */
+  pthread_once(&ondemand_key_once, create_ondemand_key);
+  if(pthread_setspecific(ondemand_key, state))
+  {
+    ST_WARN("could not set TLS data for thread\n");
+    return false;
+  }
 #endif
+
+  for(i = 0; i < ARENA_CONTEXTS; i++)
+  {
+    if(!arena->ctx[i] && !(arena->ctx[i] = get_pooled_context()))
+      return false;
+    arena->ctx[i]->arena_slot = i;
+    arena->ctx[i]->arena = arena;
+    arena->busy[i] = false;
+    if(!fixup_set_reserve(&arena->ctx[i]->stack_pointers, RESERVED_FIXUPS))
+      ST_WARN("could not reserve stack pointer fixups\n");
+  }
+  arena->reserved = true;
+
+  ST_INFO("Reserved rewriting contexts for thread\n");
+  return true;
 }
 
 /*
@@ -358,16 +862,18 @@ static void unwind_and_size(rewrite_context src,
                             rewrite_context dest)
 {
   size_t stack_size = 8; // Account for possible already-pushed return address
-  void* fn;
 
   TIMER_START(unwind_and_size);
 
   do
   {
     pop_frame(src, false);
+    restore_flushed_frame(src);
     src->num_acts++;
     dest->num_acts++;
     dest->act++;
+    if(!reserve_acts(dest, dest->num_acts))
+      ST_ERR(1, "could not allocate storage for activation %d\n", dest->act);
 
     ST_INFO("Stack Activation Number = %d\n", ACT(src).site.id);
 
@@ -392,10 +898,80 @@ static void unwind_and_size(rewrite_context src,
   }
   while(!first_frame(ACT(src).site.id));
 
-  ASSERT(stack_size < MAX_STACK_SIZE / 2, "invalid stack size\n");
+  setup_dest_stack(src, dest, stack_size);
+
+  TIMER_STOP(unwind_and_size);
+}
+
+/*
+ * Walk source stack to find live frames & size destination stack.  Only reads
+ * return addresses from the stack, callee-saved registers are restored when
+ * frames are popped during rewriting.
+ */
+static void walk_and_size(rewrite_context src,
+                          rewrite_context dest)
+{
+  size_t stack_size = 8; // Account for possible already-pushed return address
+  ondemand_state* state;
+  void* ret_addr;
+
+  TIMER_START(unwind_and_size);
+
+  do
+  {
+    ret_addr = *(void**)(ACT(src).cfa + PROPS(src)->ra_offset);
+    if(ret_addr == PROPS(src)->ondemand_trampoline)
+    {
+      state = src->owner;
+      ASSERT(state->flushed_sp == ACT(src).cfa,
+             "no flushed registers for on-demand trampoline\n");
+      ret_addr = state->flushed_regops->pc(state->flushed_regs);
+    }
+
+    src->act++;
+    src->num_acts++;
+    dest->act++;
+    dest->num_acts++;
+    if(!reserve_acts(src, src->num_acts) || !reserve_acts(dest, dest->num_acts))
+      ST_ERR(1, "could not allocate storage for activation %d\n", src->act);
+
+    if(!get_site_by_addr(src->handle, ret_addr, &ACT(src).site))
+      ST_ERR(1, "could not get source call site information (address=%p)\n",
+             ret_addr);
+
+    ST_INFO("Stack Activation Number = %lu\n", ACT(src).site.id);
+
+    if(!get_site_by_id(dest->handle, ACT(src).site.id, &ACT(dest).site))
+      ST_ERR(1, "could not get destination call site information (address=%p, ID=%ld)\n",
+             ret_addr, ACT(src).site.id);
+
+    /* Update stack size with newly discovered stack frame's size */
+    stack_size += ACT(dest).site.frame_size;
+
+    /* The previous frame's CFA is this frame's SP */
+    ACT(src).cfa = PREV_ACT(src).cfa + ACT(src).site.frame_size;
+  }
+  while(!first_frame(ACT(src).site.id));
+
+  setup_dest_stack(src, dest, stack_size);
+
+  TIMER_STOP(unwind_and_size);
+}
+
+/*
+ * Set up the destination stack & the outermost destination frame.
+ */
+static void setup_dest_stack(rewrite_context src,
+                             rewrite_context dest,
+                             size_t stack_size)
+{
+  void* fn;
+
+  ASSERT(stack_size < STACK_REGION_SIZE, "invalid stack size\n");
 
   ST_INFO("Number of live activations: %d\n", src->num_acts);
   ST_INFO("Destination stack size: %lu\n", stack_size);
+  stack_region_note_size(stack_size);
 
   /* Reset to outer-most frame. */
   src->act = 0;
@@ -414,8 +990,105 @@ static void unwind_and_size(rewrite_context src,
   /* Clear the callee-saved bitmaps for all destination frames. */
   memset(dest->callee_saved_pool, 0, bitmap_size(REGOPS(dest)->num_regs) *
                                      dest->num_acts);
+}
 
-  TIMER_STOP(unwind_and_size);
+/*
+ * If the frame's return address is the on-demand trampoline, the frame's
+ * registers were saved when flushing the remaining frames.
+ */
+static inline void restore_flushed_frame(rewrite_context ctx)
+{
+  ondemand_state* state;
+
+  if(REGOPS(ctx)->pc(ACT(ctx).regs) != PROPS(ctx)->ondemand_trampoline)
+    return;
+
+  if(!(state = ctx->owner))
+    ST_ERR(1, "no rewriting state for on-demand trampoline\n");
+  ASSERT(state->flushed_sp == REGOPS(ctx)->sp(ACT(ctx).regs),
+         "no flushed registers for on-demand trampoline\n");
+  ST_INFO("Restoring flushed registers for frame %d\n", ctx->act);
+  REGOPS(ctx)->regset_clone(state->flushed_regs, ACT(ctx).regs);
+}
+
+/*
+ * Rewrite frames starting at the current activation.
+ */
+static bool rewrite_frames(rewrite_context src,
+                           rewrite_context dest,
+                           bool lazy)
+{
+  bool stop;
+  void* ret_addr;
+  uint64_t* saved_fbp;
+
+  // Note: like the main loop in st_rewrite_stack(), this has to happen in this
+  // *exact* order.  Modify with care!
+  while(src->act < src->num_acts - 1)
+  {
+    ST_INFO("--> Rewriting frame %d <--\n", src->act);
+
+    rewrite_frame(src, dest);
+
+    /*
+     * Pointers to the stack can only point to older frames, so we can't stop
+     * until they've all been resolved.
+     */
+    stop = lazy && !fixup_set_size(&dest->stack_pointers);
+    if(stop) ret_addr = (void*)PROPS(dest)->ondemand_trampoline;
+    else ret_addr = (void*)NEXT_ACT(dest).site.addr;
+
+    set_return_address(dest, ret_addr);
+    saved_fbp = get_savedfbp_loc(dest);
+    ASSERT(saved_fbp, "invalid saved frame pointer location\n");
+    pop_frame(dest, true);
+    *saved_fbp = (uint64_t)REGOPS(dest)->fbp(ACT(dest).regs);
+    ST_INFO("Old FP saved to %p\n", saved_fbp);
+
+    pop_frame(src, false);
+    restore_flushed_frame(src);
+
+    if(stop)
+    {
+      ST_INFO("Installed on-demand trampoline for frame %d\n", dest->act);
+      return false;
+    }
+  }
+
+  ST_INFO("--> Rewriting frame %d (starting function) <--\n", src->act);
+  rewrite_frame(src, dest);
+  return true;
+}
+
+/*
+ * Rewrite all remaining frames of an in-progress on-demand rewrite.
+ */
+static void flush_ondemand(ondemand_state* state)
+{
+  rewrite_context src = state->src, dest = state->dest;
+  int outermost = dest->act;
+
+  ST_INFO("--> Flushing on-demand rewrite (frames %d - %d) <--\n",
+          outermost, dest->num_acts - 1);
+
+  /*
+   * The thread may have executed arbitrary code since the rewrite began, so
+   * the registers for the oldest rewritten frame are restored by the
+   * trampoline (or the unwinder, if the thread migrates again before
+   * returning into the frame).
+   */
+  dest->outermost = outermost;
+  rewrite_frames(src, dest, false);
+  REGOPS(dest)->set_pc(dest->acts[outermost].regs,
+                       (void*)dest->acts[outermost].site.addr);
+  REGOPS(dest)->regset_clone(dest->acts[outermost].regs, state->flushed_regs);
+  state->flushed_regops = REGOPS(dest);
+  state->flushed_sp = REGOPS(dest)->sp(dest->acts[outermost].regs);
+
+  TELEMETRY_MIGRATION_DONE(src->num_acts);
+  free_context(dest);
+  free_context(src);
+  state->src = state->dest = NULL;
 }
 
 /*
@@ -424,104 +1097,53 @@ static void unwind_and_size(rewrite_context src,
 static bool rewrite_val(rewrite_context src, const live_value* val_src,
                         rewrite_context dest, const live_value* val_dest)
 {
-  bool skip = false, needs_local_fixup = false;
+  bool needs_local_fixup = false;
   void* stack_addr;
-  fixup fixup_data;
-  node_t(fixup)* fixup_node;
 
   ASSERT(val_src && val_dest, "invalid values\n");
 
-  if(val_dest->is_temporary)
-  {
-    ST_INFO("Skipping temporary value");
-    return false;
-  }
-
-  // TODO hack -- va_list is implemented with different sizes for different
-  // architectures.  Need to handle more gracefully.
-  //   x86_64:    24
-  //   aarch64:   32
-  //   powerpc64:  8
-  if(val_src->is_alloca && VAL_SIZE(val_src) == 24 &&
-     val_dest->is_alloca && VAL_SIZE(val_dest) == 32)
-    skip = true;
-  else if(val_src->is_alloca && VAL_SIZE(val_src) == 32 &&
-          val_dest->is_alloca && VAL_SIZE(val_dest) == 24)
-    skip = true;
-  else if(val_src->is_alloca && VAL_SIZE(val_src) == 24 &&
-          val_dest->is_alloca && VAL_SIZE(val_dest) == 8)
-    skip = true;
-  else if(val_src->is_alloca && VAL_SIZE(val_src) == 8 &&
-          val_dest->is_alloca && VAL_SIZE(val_dest) == 24)
-    skip = true;
-
-  if(skip)
-  {
-    ST_INFO("Skipping va_list (different size for aarch64/x86-64)\n");
-    return false;
-  }
-
-  ASSERT(VAL_SIZE(val_src) == VAL_SIZE(val_dest),
-         "value has different size (%u vs. %u)\n",
-         VAL_SIZE(val_src), VAL_SIZE(val_dest));
-  ASSERT(!(val_src->is_ptr ^ val_dest->is_ptr),
-         "value does not have same type (%s vs. %s)\n",
-         (val_src->is_ptr ? "pointer" : "non-pointer"),
-         (val_dest->is_ptr ? "pointer" : "non-pointer"));
-  ASSERT(!(val_src->is_alloca ^ val_dest->is_alloca) || val_src->is_temporary,
-         "value does not have same type (%s vs. %s)\n",
-         (val_src->is_alloca ? "alloca" : "non-alloca"),
-         (val_dest->is_alloca ? "alloca" : "non-alloca"));
-
   /*
    * If value is a pointer to the stack, record a fixup.  Otherwise, copy
    * the value into the destination frame.
    */
   if((stack_addr = points_to_stack(src, val_src)))
-  {
-    if(stack_addr >= PREV_ACT(src).cfa || src->act == 0)
-    {
-      ST_INFO("Adding fixup for pointer-to-stack %p\n", stack_addr);
-      fixup_data.src_addr = stack_addr;
-      fixup_data.act = dest->act;
-      fixup_data.dest_loc = val_dest;
-      list_add(fixup, &dest->stack_pointers, fixup_data);
-
-      /* Are we pointing to a value within the same frame? */
-      if(stack_addr < ACT(src).cfa) needs_local_fixup = true;
-    }
-    // Note: it's an error for a pointer to point to frames down the call
-    // chain, this is most likely uninitialized pointer data
-    else
-      ST_WARN("Pointer-to-stack points to called functions\n");
-  }
+    needs_local_fixup = add_stack_fixup(src, stack_addr, dest, val_dest);
   else put_val(src, val_src, dest, val_dest);
 
   /* Check if value is pointed to by other values & fix up if so. */
   // Note: can only be pointed to if value is in memory, i.e., allocas
   if(val_src->is_alloca && !val_src->is_temporary)
+    resolve_pointers_to_data(src, val_src, dest, val_dest);
+
+  return needs_local_fixup;
+}
+
+/*
+ * Record a fixup for a pointer-to-stack value.
+ */
+static bool add_stack_fixup(rewrite_context src,
+                            void* stack_addr,
+                            rewrite_context dest,
+                            const live_value* val_dest)
+{
+  fixup fixup_data;
+
+  // Note: it's an error for a pointer to point to frames down the call
+  // chain, this is most likely uninitialized pointer data
+  if(src->act != 0 && stack_addr < PREV_ACT(src).cfa)
   {
-    fixup_node = list_begin(fixup, &dest->stack_pointers);
-    while(fixup_node)
-    {
-      if((stack_addr = points_to_data(src, val_src,
-                                      dest, val_dest,
-                                      fixup_node->data.src_addr)))
-      {
-        ST_INFO("Found fixup for %p (in frame %d)\n",
-                fixup_node->data.src_addr, fixup_node->data.act);
-
-        put_val_data(dest,
-                     fixup_node->data.dest_loc,
-                     fixup_node->data.act,
-                     (uint64_t)stack_addr);
-        fixup_node = list_remove(fixup, &dest->stack_pointers, fixup_node);
-      }
-      else fixup_node = list_next(fixup, fixup_node);
-    }
+    ST_WARN("Pointer-to-stack points to called functions\n");
+    return false;
   }
 
-  return needs_local_fixup;
+  ST_INFO("Adding fixup for pointer-to-stack %p\n", stack_addr);
+  fixup_data.src_addr = stack_addr;
+  fixup_data.act = dest->act;
+  fixup_data.dest_loc = val_dest;
+  fixup_add(&dest->stack_pointers, fixup_data);
+
+  /* Are we pointing to a value within the same frame? */
+  return stack_addr < ACT(src).cfa;
 }
 
 /*
@@ -531,89 +1153,69 @@ static inline void
 fixup_local_pointers(rewrite_context src, rewrite_context dest)
 {
   size_t i, j, src_offset, dest_offset;
-  bool found_fixup;
-  void* stack_addr;
   const live_value* val_src, *val_dest;
-  node_t(fixup)* fixup_node;
+  const fixup* cur;
 
+  TIMER_START(fixup_local_pointers);
   ST_INFO("Resolving local fix-ups\n");
 
-  // Search over all fix-ups
-  fixup_node = list_begin(fixup, &dest->stack_pointers);
-  while(fixup_node)
+  // Note: we should have resolved all fixups for this frame from frames down
+  // the call chain by this point.  If not, the fixup may be pointing to
+  // garbage data (e.g. uninitialized local values)
+  for(i = 0; i < fixup_set_size(&dest->stack_pointers); i++)
   {
-    // TODO If the code creates a pointer to an argument, is LLVM forced to
-    // create an alloca and copy the argument into the local stack space?
-    // Otherwise, how does LLVM understand argument/register conventions?
-    if(fixup_node->data.src_addr <= ACT(src).cfa) // Is fixup in this frame?
-    {
-      // Note: we should have resolved all fixups for this frame from frames
-      // down the call chain by this point.  If not, the fixup may be
-      // pointing to garbage data (e.g. uninitialized local values)
-      if(fixup_node->data.act != src->act)
-      {
-        ST_WARN("unresolved fixup for %p (frame %d)\n",
-                fixup_node->data.src_addr, fixup_node->data.act);
-        fixup_node = list_next(fixup, fixup_node);
-        continue;
-      }
-
-      // Find the same-frame data which corresponds to the fixup
-      found_fixup = false;
-      src_offset = ACT(src).site.live_offset;
-      dest_offset = ACT(dest).site.live_offset;
-      for(i = 0, j = 0; j < ACT(dest).site.num_live; i++, j++)
-      {
-        val_src = &src->handle->live_vals[i + src_offset];
-        val_dest = &dest->handle->live_vals[j + dest_offset];
-
-        ASSERT(!val_src->is_duplicate, "invalid duplicate location record\n");
-        ASSERT(!val_dest->is_duplicate, "invalid duplicate location record\n");
-
-        /*
-         * Advance past duplicate location records, which can never be
-         * pointed-to (these are spilled values, not stack allocations).
-         */
-        while(src->handle->live_vals[i + 1 + src_offset].is_duplicate) i++;
-        while(dest->handle->live_vals[j + 1 + dest_offset].is_duplicate) j++;
-
-        /* Can only have stack pointers to allocas */
-        if(!val_src->is_alloca || !val_dest->is_alloca) continue;
-
-        if((stack_addr = points_to_data(src, val_src,
-                                        dest, val_dest,
-                                        fixup_node->data.src_addr)))
-        {
-          ST_INFO("Found local fixup for %p\n", fixup_node->data.src_addr);
-
-          put_val_data(dest,
-                       fixup_node->data.dest_loc,
-                       fixup_node->data.act,
-                       (uint64_t)stack_addr);
-          fixup_node = list_remove(fixup, &dest->stack_pointers, fixup_node);
-          found_fixup = true;
-          break;
-        }
-      }
-    }
+    cur = &dest->stack_pointers.data[i];
+    if(cur->src_addr > ACT(src).cfa) break; // Sorted, rest are older frames
+    if(cur->act != src->act)
+      ST_WARN("unresolved fixup for %p (frame %d)\n", cur->src_addr, cur->act);
+  }
+
+  // TODO If the code creates a pointer to an argument, is LLVM forced to
+  // create an alloca and copy the argument into the local stack space?
+  // Otherwise, how does LLVM understand argument/register conventions?
+
+  // Search over same-frame data, resolving fixups which point into each
+  src_offset = ACT(src).site.live_offset;
+  dest_offset = ACT(dest).site.live_offset;
+  for(i = 0, j = 0;
+      j < ACT(dest).site.num_live && fixup_set_size(&dest->stack_pointers);
+      i++, j++)
+  {
+    val_src = &src->handle->live_vals[i + src_offset];
+    val_dest = &dest->handle->live_vals[j + dest_offset];
 
-    if(!found_fixup) fixup_node = list_next(fixup, fixup_node);
+    ASSERT(!val_src->is_duplicate, "invalid duplicate location record\n");
+    ASSERT(!val_dest->is_duplicate, "invalid duplicate location record\n");
+
+    /*
+     * Advance past duplicate location records, which can never be
+     * pointed-to (these are spilled values, not stack allocations).
+     */
+    while((i + 1 + src_offset) < src->handle->live_vals_count &&
+          src->handle->live_vals[i + 1 + src_offset].is_duplicate) i++;
+    while((j + 1 + dest_offset) < dest->handle->live_vals_count &&
+          dest->handle->live_vals[j + 1 + dest_offset].is_duplicate) j++;
+
+    /* Can only have stack pointers to allocas */
+    if(!val_src->is_alloca || !val_dest->is_alloca) continue;
+
+    if(resolve_pointers_to_data(src, val_src, dest, val_dest))
+      ST_INFO("Resolved local fixups for value %lu\n", i);
   }
+
+  TIMER_STOP(fixup_local_pointers);
 }
 
 /*
- * Transform an individual frame from the source to destination stack.
+ * Copy live values between the current frames by walking the location records
+ * directly, used when a rewrite plan is not available.
  */
-static void rewrite_frame(rewrite_context src, rewrite_context dest)
+static bool rewrite_live_vals(rewrite_context src, rewrite_context dest)
 {
   size_t i, j, src_offset, dest_offset;
   const live_value* val_src, *val_dest;
   bool needs_local_fixup = false;
 
-  TIMER_FG_START(rewrite_frame);
-  ST_INFO("Rewriting frame (CFA: %p -> %p)\n", ACT(src).cfa, ACT(dest).cfa);
-
-  /* Copy live values */
   src_offset = ACT(src).site.live_offset;
   dest_offset = ACT(dest).site.live_offset;
   for(i = 0, j = 0; j < ACT(dest).site.num_live; i++, j++)
@@ -630,7 +1232,8 @@ static void rewrite_frame(rewrite_context src, rewrite_context dest)
     ASSERT(!val_dest->is_duplicate, "invalid duplicate location record\n");
 
     /* Apply to first location record */
-    needs_local_fixup |= rewrite_val(src, val_src, dest, val_dest);
+    if(!skip_val(val_src, val_dest))
+      needs_local_fixup |= rewrite_val(src, val_src, dest, val_dest);
 
     /* Apply to all duplicate location records */
     while((j + 1 + dest_offset) < dest->handle->live_vals_count &&
@@ -640,7 +1243,8 @@ static void rewrite_frame(rewrite_context src, rewrite_context dest)
       val_dest = &dest->handle->live_vals[j + dest_offset];
       ASSERT(!val_dest->is_alloca, "invalid duplicate location record\n");
       ST_INFO("Applying to duplicate location record\n");
-      needs_local_fixup |= rewrite_val(src, val_src, dest, val_dest);
+      if(!skip_val(val_src, val_dest))
+        needs_local_fixup |= rewrite_val(src, val_src, dest, val_dest);
     }
 
     /* Advance source value past duplicates location records */
@@ -650,6 +1254,57 @@ static void rewrite_frame(rewrite_context src, rewrite_context dest)
   ASSERT(i == ACT(src).site.num_live && j == ACT(dest).site.num_live,
         "did not handle all live values\n");
 
+  return needs_local_fixup;
+}
+
+/*
+ * Copy live values between the current frames using a rewrite plan.
+ */
+static bool rewrite_planned_vals(rewrite_context src,
+                                 rewrite_context dest,
+                                 const rewrite_plan* plan)
+{
+  size_t i;
+  void* stack_addr;
+  const rewrite_op* op;
+  bool needs_local_fixup = false;
+
+  for(i = 0; i < plan->num_ops; i++)
+  {
+    op = &plan->ops[i];
+
+    // Note: fixups refer to the plan's copy of the destination location
+    // record, which lives as long as the source handle
+    if((op->flags & OP_MAY_POINT) &&
+       (stack_addr = points_to_stack(src, &op->src)))
+      needs_local_fixup |= add_stack_fixup(src, stack_addr, dest, &op->dest);
+    else if(op->flags & OP_COPY) put_val_op(src, dest, op);
+
+    if(op->flags & OP_POINTED_TO)
+      resolve_pointers_to_data(src, &op->src, dest, &op->dest);
+  }
+
+  return needs_local_fixup;
+}
+
+/*
+ * Transform an individual frame from the source to destination stack.
+ */
+static void rewrite_frame(rewrite_context src, rewrite_context dest)
+{
+  size_t i, dest_offset;
+  const rewrite_plan* plan;
+  bool needs_local_fixup = false;
+
+  TIMER_START(rewrite_frame);
+  ST_INFO("Rewriting frame (CFA: %p -> %p)\n", ACT(src).cfa, ACT(dest).cfa);
+
+  /* Copy live values, using the call site pair's rewrite plan if available */
+  if((plan = get_rewrite_plan(src->handle, &ACT(src).site,
+                              dest->handle, &ACT(dest).site)))
+    needs_local_fixup = rewrite_planned_vals(src, dest, plan);
+  else needs_local_fixup = rewrite_live_vals(src, dest);
+
   /* Set architecture-specific live values */
   dest_offset = ACT(dest).site.arch_live_offset;
   for(i = 0; i < ACT(dest).site.num_arch_live; i++)
@@ -658,6 +1313,7 @@ static void rewrite_frame(rewrite_context src, rewrite_context dest)
   /* Fix up pointers to local values */
   if(needs_local_fixup) fixup_local_pointers(src, dest);
 
-  TIMER_FG_STOP(rewrite_frame);
+  TELEMETRY_COUNT_LIVE(ACT(dest).site.num_live);
+  TIMER_STOP_SITE(rewrite_frame, ACT(src).site.id);
 }
 
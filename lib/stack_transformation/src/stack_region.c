@@ -0,0 +1,270 @@
+/*
+ * Per-node pools of pre-faulted stack regions, used as destination stacks for
+ * user-space rewriting.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "platform.h"
+#include "stack_region.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/* A node's pool of free stack regions */
+typedef struct region_pool {
+  pthread_mutex_t lock;
+  stack_region* free;
+  size_t num_free;
+} region_pool;
+
+static region_pool pools[STACK_REGION_NODES] = {
+  [0 ... STACK_REGION_NODES - 1] = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .free = NULL, .num_free = 0
+  }
+};
+
+/* Regions retired by exiting threads, waiting for the threads to finish */
+static pthread_mutex_t zombie_lock = PTHREAD_MUTEX_INITIALIZER;
+static stack_region* zombies = NULL;
+
+/* Largest stack rewritten so far, in bytes */
+static size_t max_stack_size = 0;
+
+/* System page size */
+static size_t page_size = 0;
+
+/*
+ * Get the pool for the node on which the calling thread is executing.
+ */
+static region_pool* cur_pool(void);
+
+/*
+ * Return the number of bytes to pre-fault at the top of each region.
+ */
+static size_t prefault_size(void);
+
+/*
+ * Touch the pages in the top SIZE bytes of a region so that they're faulted
+ * in before being used as a stack.
+ */
+static void prefault(stack_region* region, size_t size);
+
+/*
+ * Return zombie regions whose threads have exited to the pool.
+ */
+static void reap_zombies(void);
+
+/*
+ * Map a new stack region, with a guard page below the stack.
+ */
+static stack_region* map_region(void);
+
+/*
+ * Unmap a stack region.
+ */
+static void unmap_region(stack_region* region);
+
+///////////////////////////////////////////////////////////////////////////////
+// Stack regions
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Get a pre-faulted stack region from the current node's pool.
+ */
+stack_region* stack_region_get(void)
+{
+  size_t size;
+  region_pool* pool = cur_pool();
+  stack_region* region;
+
+  reap_zombies();
+
+  pthread_mutex_lock(&pool->lock);
+  if((region = pool->free))
+  {
+    pool->free = region->next;
+    pool->num_free--;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if(!region && !(region = map_region())) return NULL;
+  region->next = NULL;
+
+  size = prefault_size();
+  if(region->faulted < size) prefault(region, size);
+
+  ST_INFO("Using stack region %p -> %p (%lu bytes pre-faulted)\n",
+          region->low, region->high, region->faulted);
+
+  return region;
+}
+
+/*
+ * Return a stack region to the current node's pool.
+ */
+void stack_region_put(stack_region* region)
+{
+  region_pool* pool;
+
+  if(!region) return;
+
+  pool = cur_pool();
+  pthread_mutex_lock(&pool->lock);
+  if(pool->num_free < STACK_REGION_POOL_SIZE)
+  {
+    region->next = pool->free;
+    pool->free = region;
+    pool->num_free++;
+    region = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if(region) unmap_region(region);
+}
+
+/*
+ * Retire an exiting thread's current stack region.
+ */
+void stack_region_retire(stack_region* region)
+{
+  if(!region) return;
+
+  region->tid = syscall(SYS_gettid);
+  ST_INFO("Retiring stack region %p -> %p (thread %d)\n",
+          region->low, region->high, region->tid);
+
+  pthread_mutex_lock(&zombie_lock);
+  region->next = zombies;
+  __atomic_store_n(&zombies, region, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&zombie_lock);
+}
+
+/*
+ * Record the size of a rewritten stack.
+ */
+void stack_region_note_size(size_t size)
+{
+  size_t cur = __atomic_load_n(&max_stack_size, __ATOMIC_RELAXED);
+
+  while(size > cur &&
+        !__atomic_compare_exchange_n(&max_stack_size, &cur, size, true,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API (implementation)
+///////////////////////////////////////////////////////////////////////////////
+
+static region_pool* cur_pool(void)
+{
+  int nid = popcorn_getnid();
+
+  // Note: outside of Popcorn (or if the node can't be queried), everything
+  // lives in the first pool
+  if(nid < 0 || nid >= STACK_REGION_NODES) nid = 0;
+  return &pools[nid];
+}
+
+static size_t prefault_size(void)
+{
+  size_t size = __atomic_load_n(&max_stack_size, __ATOMIC_RELAXED);
+
+  /* Leave room for the frames called after resuming on the new stack */
+  size += STACK_REGION_PREFAULT;
+  size = (size + page_size - 1) & ~(page_size - 1);
+  if(size > STACK_REGION_SIZE - page_size) size = STACK_REGION_SIZE - page_size;
+  return size;
+}
+
+static void prefault(stack_region* region, size_t size)
+{
+  volatile char* page;
+
+  for(page = (volatile char*)region->high - region->faulted - page_size;
+      page >= (volatile char*)region->high - size;
+      page -= page_size)
+    *page = 0;
+  region->faulted = size;
+}
+
+static stack_region* map_region(void)
+{
+  void* mem;
+  stack_region* region;
+
+  if(!page_size) page_size = sysconf(_SC_PAGESIZE);
+
+  mem = mmap(NULL, STACK_REGION_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+  if(mem == MAP_FAILED)
+  {
+    ST_WARN("could not map stack region\n");
+    return NULL;
+  }
+
+  /* Catch overflows rather than silently corrupting neighboring memory */
+  if(mprotect(mem, page_size, PROT_NONE))
+    ST_WARN("could not install stack region guard page\n");
+
+  if(!(region = (stack_region*)MALLOC(sizeof(stack_region))))
+  {
+    ST_WARN("could not allocate stack region\n");
+    munmap(mem, STACK_REGION_SIZE);
+    return NULL;
+  }
+
+  region->low = mem + page_size;
+  region->high = mem + STACK_REGION_SIZE;
+  region->faulted = 0;
+  region->tid = 0;
+  region->next = NULL;
+
+  return region;
+}
+
+static void reap_zombies(void)
+{
+  stack_region* cur, **prev, *reaped = NULL;
+  pid_t pid;
+
+  if(!__atomic_load_n(&zombies, __ATOMIC_ACQUIRE)) return;
+
+  // Note: the kernel removes the thread from the thread group after it has
+  // left its stack for good, so a thread which can't be signaled is done with
+  // its region.  A recycled TID only delays reclaiming the region.
+  pid = getpid();
+  pthread_mutex_lock(&zombie_lock);
+  for(prev = &zombies, cur = zombies; cur; cur = *prev)
+  {
+    if(syscall(SYS_tgkill, pid, cur->tid, 0) && errno == ESRCH)
+    {
+      *prev = cur->next;
+      cur->next = reaped;
+      reaped = cur;
+    }
+    else prev = &cur->next;
+  }
+  pthread_mutex_unlock(&zombie_lock);
+
+  while((cur = reaped))
+  {
+    reaped = cur->next;
+    ST_INFO("Reclaiming stack region %p -> %p (thread %d exited)\n",
+            cur->low, cur->high, cur->tid);
+    cur->tid = 0;
+    stack_region_put(cur);
+  }
+}
+
+static void unmap_region(stack_region* region)
+{
+  munmap(region->low - page_size, STACK_REGION_SIZE);
+  free(region);
+}
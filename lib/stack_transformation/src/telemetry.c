@@ -0,0 +1,501 @@
+/*
+ * Telemetry implementation.  Each thread records into its own buffer, which
+ * is only ever written by that thread.  When a thread exits its buffer is
+ * merged into the exited threads' aggregate & freed.
+ *
+ * Date: 10/16/2026
+ */
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "stack_transform.h"
+#include "definitions.h"
+
+#if _TIMER_SRC == CLOCK_GETTIME
+# include <time.h>
+#elif _TIMER_SRC == GETTIMEOFDAY
+# include <sys/time.h>
+#else
+# error Unknown timer source!
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API & definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/* Per-thread rewriting cost for a call site, keyed by call site ID + 1 */
+typedef struct site_cost
+{
+  uint64_t key;
+  uint64_t count;
+  uint64_t total_ns;
+} site_cost;
+
+/* Per-thread telemetry buffer */
+typedef struct thread_telemetry
+{
+  struct thread_telemetry* next;
+  uint64_t start[NUM_METRICS];
+  uint64_t cur_live; /* live values rewritten in the current migration */
+  st_histogram hists[NUM_METRICS];
+  site_cost sites[TELEMETRY_SITES];
+} thread_telemetry;
+
+/* Metric names, indexed by metric */
+static const char* metric_names[NUM_METRICS] = {
+#define X( metric_name ) #metric_name,
+ALL_METRICS
+#undef X
+};
+
+int __st_telemetry_level = TELEMETRY_OFF;
+
+/*
+ * Live threads' buffers & the merged telemetry of threads which have exited.
+ * LOCK protects the list & the exited threads' telemetry; each thread updates
+ * its own buffer without locking.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_telemetry* threads = NULL;
+static thread_telemetry exited;
+
+/*
+ * The key's destructor retires the thread's buffer when the thread exits (and
+ * with PTHREAD_TLS, the key also stores the buffer).
+ */
+#if _TLS_IMPL == COMPILER_TLS
+static __thread thread_telemetry* cur_thread = NULL;
+#endif
+static pthread_key_t telemetry_key;
+static pthread_once_t telemetry_key_once = PTHREAD_ONCE_INIT;
+static void create_telemetry_key(void);
+static void retire_thread_telemetry(void* data);
+
+/*
+ * Get the calling thread's buffer, allocating it on first use.
+ */
+static thread_telemetry* get_thread_telemetry(void);
+
+/*
+ * Merge a histogram into another.  SRC may be updated concurrently by its
+ * owner.
+ */
+static void hist_merge(st_histogram* dst, const st_histogram* src);
+
+/*
+ * Find the slot for a call site in a buffer's call site table, or NULL if the
+ * call site isn't in the table & the table is full.
+ */
+static inline site_cost* find_site(thread_telemetry* t, uint64_t key);
+
+/*
+ * Current time, in nanoseconds.
+ */
+static inline uint64_t now(void);
+
+/*
+ * Add a value to a histogram.  Must only be called by the histogram's owner.
+ */
+static inline void hist_add(st_histogram* hist, uint64_t val);
+
+/*
+ * Dump telemetry at exit.
+ */
+static void dump_at_exit(void);
+
+/* Update a value written by a single thread & read by many. */
+#define SET( var, val ) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define GET( var ) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+///////////////////////////////////////////////////////////////////////////////
+// Internal telemetry API
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Initialize telemetry from the environment.
+ */
+void telemetry_init(void)
+{
+  const char* env;
+
+  if(!(env = getenv(ENV_TELEMETRY))) return;
+  if(st_telemetry_enable(*env ? atoi(env) : TELEMETRY_COARSE))
+  {
+    ST_WARN("invalid telemetry level '%s'\n", env);
+    return;
+  }
+  if(__st_telemetry_level > TELEMETRY_OFF) atexit(dump_at_exit);
+}
+
+/*
+ * Record the start time of a timer.
+ */
+void telemetry_start(enum metric metric)
+{
+  thread_telemetry* t = get_thread_telemetry();
+  if(t) t->start[metric] = now();
+}
+
+/*
+ * Record the elapsed time of a timer, optionally attributing it to a call
+ * site.
+ */
+void telemetry_stop(enum metric metric, const uint64_t* site_id)
+{
+  uint64_t elapsed;
+  thread_telemetry* t = get_thread_telemetry();
+  site_cost* site;
+
+  // Note: telemetry may have been enabled between starting & stopping
+  if(!t || !t->start[metric]) return;
+  elapsed = now() - t->start[metric];
+  t->start[metric] = 0;
+  hist_add(&t->hists[metric], elapsed);
+
+  if(site_id && (site = find_site(t, *site_id + 1)))
+  {
+    SET(site->count, site->count + 1);
+    SET(site->total_ns, site->total_ns + elapsed);
+  }
+}
+
+/*
+ * Count live values rewritten in the current migration.
+ */
+void telemetry_count_live(uint64_t num)
+{
+  thread_telemetry* t = get_thread_telemetry();
+  if(t) t->cur_live += num;
+}
+
+/*
+ * Record per-migration counters.
+ */
+void telemetry_migration_done(uint64_t num_frames)
+{
+  thread_telemetry* t = get_thread_telemetry();
+  if(!t) return;
+  hist_add(&t->hists[METRIC_frames], num_frames);
+  hist_add(&t->hists[METRIC_live_values], t->cur_live);
+  t->cur_live = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public telemetry API
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Set the telemetry level.
+ */
+int st_telemetry_enable(int level)
+{
+  if(level < TELEMETRY_OFF || level > TELEMETRY_FINE) return 1;
+  __atomic_store_n(&__st_telemetry_level, level, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * Return the number of metrics.
+ */
+size_t st_telemetry_num_metrics(void)
+{
+  return NUM_METRICS;
+}
+
+/*
+ * Return the name of a metric.
+ */
+const char* st_telemetry_metric_name(size_t metric)
+{
+  if(metric >= NUM_METRICS) return NULL;
+  return metric_names[metric];
+}
+
+/*
+ * Merge a metric's histograms across all threads.
+ */
+int st_telemetry_query(const char* name, st_histogram* hist)
+{
+  size_t metric;
+  const thread_telemetry* t;
+
+  if(!name || !hist) return 1;
+  for(metric = 0; metric < NUM_METRICS; metric++)
+    if(!strcmp(name, metric_names[metric])) break;
+  if(metric == NUM_METRICS) return 1;
+
+  memset(hist, 0, sizeof(st_histogram));
+  pthread_mutex_lock(&lock);
+  hist_merge(hist, &exited.hists[metric]);
+  for(t = threads; t; t = t->next) hist_merge(hist, &t->hists[metric]);
+  pthread_mutex_unlock(&lock);
+
+  return 0;
+}
+
+/* Sort call site costs by ID */
+static int sort_id(const void* a, const void* b)
+{
+  const st_site_cost* sa = (const st_site_cost*)a;
+  const st_site_cost* sb = (const st_site_cost*)b;
+  if(sa->id < sb->id) return -1;
+  else if(sa->id > sb->id) return 1;
+  else return 0;
+}
+
+/* Sort call site costs by decreasing total time */
+static int sort_cost(const void* a, const void* b)
+{
+  const st_site_cost* sa = (const st_site_cost*)a;
+  const st_site_cost* sb = (const st_site_cost*)b;
+  if(sa->total_ns > sb->total_ns) return -1;
+  else if(sa->total_ns < sb->total_ns) return 1;
+  else return 0;
+}
+
+/*
+ * Get the call sites with the largest accumulated frame rewriting costs.
+ */
+size_t st_telemetry_top_sites(st_site_cost* sites, size_t num)
+{
+  size_t i, j, num_all = 0, num_bufs = 1;
+  uint64_t key;
+  const thread_telemetry* t;
+  st_site_cost* all;
+
+  if(!sites || !num) return 0;
+
+  /* Gather the exited & live threads' call sites */
+  pthread_mutex_lock(&lock);
+  for(t = threads; t; t = t->next) num_bufs++;
+  all = (st_site_cost*)malloc(sizeof(st_site_cost) * TELEMETRY_SITES *
+                              num_bufs);
+  if(!all)
+  {
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+
+  for(t = &exited; t; t = (t == &exited ? threads : t->next))
+  {
+    for(i = 0; i < TELEMETRY_SITES; i++)
+    {
+      if(!(key = GET(t->sites[i].key))) continue;
+      all[num_all].id = key - 1;
+      all[num_all].count = GET(t->sites[i].count);
+      all[num_all].total_ns = GET(t->sites[i].total_ns);
+      num_all++;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  /* Merge costs for the same call site from different threads */
+  qsort(all, num_all, sizeof(st_site_cost), sort_id);
+  for(i = 0, j = 0; i < num_all; i++)
+  {
+    if(j && all[j - 1].id == all[i].id)
+    {
+      all[j - 1].count += all[i].count;
+      all[j - 1].total_ns += all[i].total_ns;
+    }
+    else all[j++] = all[i];
+  }
+  num_all = j;
+
+  qsort(all, num_all, sizeof(st_site_cost), sort_cost);
+  if(num > num_all) num = num_all;
+  memcpy(sites, all, sizeof(st_site_cost) * num);
+  free(all);
+
+  return num;
+}
+
+/*
+ * Write all telemetry in human-readable form.
+ */
+int st_telemetry_dump(const char* fn)
+{
+  size_t metric, i, num_sites;
+  st_histogram hist;
+  st_site_cost sites[16];
+  FILE* fp = stdout;
+
+  if(fn && !(fp = fopen(fn, "a"))) return 1;
+
+  fprintf(fp, "[Telemetry] Stack transformation telemetry (PID %d)\n",
+          getpid());
+  for(metric = 0; metric < NUM_METRICS; metric++)
+  {
+    st_telemetry_query(metric_names[metric], &hist);
+    if(!hist.count) continue;
+    fprintf(fp, "[Telemetry]   %s%s - %lu sample(s), min %lu, avg %.1f, "
+            "max %lu\n", metric_names[metric],
+            (metric < METRIC_frames ? " (ns)" : ""), hist.count, hist.min,
+            (double)hist.sum / (double)hist.count, hist.max);
+    for(i = 0; i < ST_HIST_BUCKETS; i++)
+    {
+      if(!hist.buckets[i]) continue;
+      fprintf(fp, "[Telemetry]     [%lu, %lu): %lu\n",
+              (i ? 1UL << (i - 1) : 0UL), (i ? 1UL << i : 1UL),
+              hist.buckets[i]);
+    }
+  }
+
+  num_sites = st_telemetry_top_sites(sites, sizeof(sites) / sizeof(*sites));
+  if(num_sites) fprintf(fp, "[Telemetry]   Top call sites by rewrite cost:\n");
+  for(i = 0; i < num_sites; i++)
+    fprintf(fp, "[Telemetry]     call site %lu - %lu frame(s), %lu ns total, "
+            "%.1f ns average\n", sites[i].id, sites[i].count,
+            sites[i].total_ns, (double)sites[i].total_ns / sites[i].count);
+
+  if(fn) fclose(fp);
+  else fflush(fp);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// File-local API (implementation)
+///////////////////////////////////////////////////////////////////////////////
+
+static thread_telemetry* get_thread_telemetry(void)
+{
+  thread_telemetry* t;
+
+#if _TLS_IMPL == COMPILER_TLS
+  if((t = cur_thread)) return t;
+#else /* PTHREAD_TLS */
+  pthread_once(&telemetry_key_once, create_telemetry_key);
+  if((t = pthread_getspecific(telemetry_key))) return t;
+#endif
+
+  if(!(t = (thread_telemetry*)MALLOC(sizeof(thread_telemetry))))
+  {
+    ST_WARN("could not allocate telemetry buffer\n");
+    return NULL;
+  }
+  memset(t, 0, sizeof(thread_telemetry));
+
+#if _TLS_IMPL == COMPILER_TLS
+  /* Register the buffer so it's retired when the thread exits */
+  pthread_once(&telemetry_key_once, create_telemetry_key);
+#endif
+  if(pthread_setspecific(telemetry_key, t))
+  {
+    ST_WARN("could not set TLS data for thread\n");
+    free(t);
+    return NULL;
+  }
+
+  /* Publish the buffer to readers */
+  pthread_mutex_lock(&lock);
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock(&lock);
+
+#if _TLS_IMPL == COMPILER_TLS
+  cur_thread = t;
+#endif
+  return t;
+}
+
+/*
+ * Create the TLS key for telemetry buffers.
+ */
+static void create_telemetry_key(void)
+{
+  if(pthread_key_create(&telemetry_key, retire_thread_telemetry))
+    ST_ERR(1, "could not create TLS key for telemetry\n");
+}
+
+/*
+ * Merge an exiting thread's buffer into the exited threads' telemetry & free
+ * it.  Call sites which don't fit in the exited threads' table are dropped,
+ * as they are for a thread's own table.
+ */
+static void retire_thread_telemetry(void* data)
+{
+  size_t i;
+  thread_telemetry* t = (thread_telemetry*)data, **prev;
+  site_cost* site;
+
+  pthread_mutex_lock(&lock);
+  for(prev = &threads; *prev && *prev != t; prev = &(*prev)->next);
+  if(*prev) *prev = t->next;
+  for(i = 0; i < NUM_METRICS; i++) hist_merge(&exited.hists[i], &t->hists[i]);
+  for(i = 0; i < TELEMETRY_SITES; i++)
+  {
+    if(!t->sites[i].key || !(site = find_site(&exited, t->sites[i].key)))
+      continue;
+    SET(site->count, site->count + t->sites[i].count);
+    SET(site->total_ns, site->total_ns + t->sites[i].total_ns);
+  }
+  pthread_mutex_unlock(&lock);
+
+#if _TLS_IMPL == COMPILER_TLS
+  cur_thread = NULL;
+#endif
+  free(t);
+}
+
+static void hist_merge(st_histogram* dst, const st_histogram* src)
+{
+  size_t i;
+  uint64_t min, max;
+
+  if(!GET(src->count)) return;
+  min = GET(src->min);
+  max = GET(src->max);
+  if(!dst->count || min < dst->min) dst->min = min;
+  if(max > dst->max) dst->max = max;
+  dst->count += GET(src->count);
+  dst->sum += GET(src->sum);
+  for(i = 0; i < ST_HIST_BUCKETS; i++)
+    dst->buckets[i] += GET(src->buckets[i]);
+}
+
+static inline site_cost* find_site(thread_telemetry* t, uint64_t key)
+{
+  uint64_t i, slot = site_index_hash(key - 1, TELEMETRY_SITES);
+  site_cost* site;
+
+  for(i = 0; i < TELEMETRY_SITES; i++, slot = (slot + 1) % TELEMETRY_SITES)
+  {
+    site = &t->sites[slot];
+    if(!site->key) SET(site->key, key);
+    if(site->key == key) return site;
+  }
+  return NULL;
+}
+
+static inline uint64_t now(void)
+{
+#if _TIMER_SRC == CLOCK_GETTIME
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000UL + time.tv_nsec;
+#else
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec * 1000000000UL + time.tv_usec * 1000UL;
+#endif
+}
+
+static inline void hist_add(st_histogram* hist, uint64_t val)
+{
+  size_t bucket = val ? 64 - __builtin_clzl(val) : 0;
+
+  if(bucket >= ST_HIST_BUCKETS) bucket = ST_HIST_BUCKETS - 1;
+  if(!hist->count || val < hist->min) SET(hist->min, val);
+  if(val > hist->max) SET(hist->max, val);
+  SET(hist->sum, hist->sum + val);
+  SET(hist->buckets[bucket], hist->buckets[bucket] + 1);
+  SET(hist->count, hist->count + 1);
+}
+
+static void dump_at_exit(void)
+{
+  const char* fn = getenv(ENV_TELEMETRY_FILE);
+  if(st_telemetry_dump(fn ? fn : TELEMETRY_FILE))
+    ST_WARN("could not dump telemetry\n");
+}
@@ -11,6 +11,56 @@
 // File-local API
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Move activations & their per-frame data to a new arena with room for MAX
+ * activations.  Register sets & callee-saved bitmaps are laid out at the same
+ * stride in the new arena, so activations are re-pointed at their copies.
+ */
+static bool grow_acts(rewrite_context ctx, int max)
+{
+  int i, old = ctx->max_acts;
+  size_t regset_size = REGOPS(ctx)->regset_size;
+  size_t callee_size = bitmap_size(REGOPS(ctx)->num_regs);
+  activation* acts;
+  void* regset_pool, *callee_saved_pool;
+
+  acts = (activation*)MALLOC(sizeof(activation) * max);
+  regset_pool = MALLOC(regset_size * max);
+  callee_saved_pool = MALLOC(callee_size * max);
+  if(!acts || !regset_pool || !callee_saved_pool)
+  {
+    free(acts);
+    free(regset_pool);
+    free(callee_saved_pool);
+    return false;
+  }
+
+  memcpy(acts, ctx->acts, sizeof(activation) * old);
+  memcpy(regset_pool, ctx->regset_pool, regset_size * old);
+  memset(regset_pool + regset_size * old, 0, regset_size * (max - old));
+  memcpy(callee_saved_pool, ctx->callee_saved_pool, callee_size * old);
+  memset(callee_saved_pool + callee_size * old, 0, callee_size * (max - old));
+  for(i = 0; i < old; i++)
+  {
+    acts[i].regs = regset_pool + regset_size * i;
+    acts[i].callee_saved.bits = callee_saved_pool + callee_size * i;
+  }
+
+  if(ctx->acts != ctx->inline_acts)
+  {
+    free(ctx->acts);
+    free(ctx->regset_pool);
+    free(ctx->callee_saved_pool);
+  }
+  ctx->acts = acts;
+  ctx->regset_pool = regset_pool;
+  ctx->callee_saved_pool = callee_saved_pool;
+  ctx->max_acts = max;
+
+  ST_INFO("Spilled activations to arena with room for %d frames\n", max);
+  return true;
+}
+
 /*
  * Set up the register set for activation ACT (copies initial registers from
  * ACT - 1).
@@ -107,6 +157,18 @@ static inline void setup_frame_bounds(rewrite_context ctx, int act)
 // Stack unwinding
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Make sure the context has room for at least NUM activations.
+ */
+bool reserve_acts(rewrite_context ctx, int num)
+{
+  int max;
+
+  if(num <= ctx->max_acts) return true;
+  for(max = ctx->max_acts * 2; max < num; max *= 2);
+  return grow_acts(ctx, max);
+}
+
 /*
  * Return whether or not the call site record is for a starting function.
  */
@@ -167,6 +229,9 @@ void pop_frame(rewrite_context ctx, bool setup_bounds)
 {
   int next_frame = ctx->act + 1;
 
+  if(!reserve_acts(ctx, next_frame + 1))
+    ST_ERR(1, "could not allocate storage for activation %d\n", next_frame);
+
   TIMER_FG_START(pop_frame);
   ST_INFO("Popping frame (CFA = %p)\n", ACT(ctx).cfa);
 
@@ -183,7 +248,6 @@ void pop_frame(rewrite_context ctx, bool setup_bounds)
 
   /* Advance to next frame. */
   ctx->act++;
-  ASSERT(ctx->act < MAX_FRAMES, "too many frames on stack\n");
 
   TIMER_FG_STOP(pop_frame);
 }
@@ -197,6 +261,9 @@ void pop_frame_funcentry(rewrite_context ctx)
 {
   int next_frame = ctx->act + 1;
 
+  if(!reserve_acts(ctx, next_frame + 1))
+    ST_ERR(1, "could not allocate storage for activation %d\n", next_frame);
+
   TIMER_FG_START(pop_frame);
   ST_INFO("Popping frame (CFA = %p)\n", ACT(ctx).cfa);
 
@@ -224,7 +291,6 @@ void pop_frame_funcentry(rewrite_context ctx)
 
   /* Advance to next frame. */
   ctx->act++;
-  ASSERT(ctx->act < MAX_FRAMES, "too many frames on stack\n");
 
   TIMER_FG_STOP(pop_frame);
 }
@@ -15,6 +15,8 @@
 
 #include "stack_transform.h"
 #include "definitions.h"
+#include "stack_region.h"
+#include "unwind.h"
 #include "util.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -24,12 +26,32 @@
 static st_handle aarch64_handle = NULL;
 static st_handle powerpc64_handle = NULL;
 static st_handle x86_64_handle = NULL;
+
+/*
+ * A thread's stacks -- the stack it was created with & the stack regions into
+ * which it has been rewritten.
+ */
+typedef struct thread_stacks {
+  stack_bounds native; /* Stack the thread was created with */
+  stack_region* cur;   /* Region the thread is executing on, NULL if native */
+  stack_region* prev;  /* Region executed on before CUR, may still contain
+                          frames waiting to be rewritten on-demand */
+  stack_region* next;  /* Region into which to rewrite the stack */
+} thread_stacks;
+
 #if _TLS_IMPL == COMPILER_TLS
-static __thread stack_bounds bounds = { .high = NULL, .low = NULL };
-#else /* PTHREAD_TLS */
-static pthread_key_t stack_bounds_key = 0;
+static __thread thread_stacks stacks = {
+  .native = { .high = NULL, .low = NULL },
+  .cur = NULL, .prev = NULL, .next = NULL
+};
 #endif
 
+/*
+ * Key used to release threads' stack regions when they exit (and with
+ * PTHREAD_TLS, to store the thread's stacks).
+ */
+static pthread_key_t stacks_key = 0;
+
 /*
  * Set inside of musl at __libc_start_main() to point to where environment
  * variables begin on the stack.
@@ -37,12 +59,27 @@ static pthread_key_t stack_bounds_key = 0;
 extern void* __popcorn_stack_base;
 
 /*
- * Touch stack pages up to the OS-defined stack size limit, so that the OS
- * allocates them and we can divide the stack in half for rewriting.  Also,
- * calculate stack bounds for main thread.
+ * Calculate stack bounds for the main thread & create the key used to release
+ * threads' stack regions when they exit.
  */
 static bool prep_stack(void);
 
+/*
+ * Get the calling thread's stacks, resolving its stack bounds on first use.
+ */
+static thread_stacks* get_thread_stacks(void);
+
+/*
+ * Track which stack the thread is executing on.  If the thread has resumed on
+ * the region into which it was last rewritten, that region becomes current.
+ */
+static void sync_stacks(thread_stacks* ts, void* sp);
+
+/*
+ * Release a thread's stack regions when it exits.
+ */
+static void release_stacks(void* data);
+
 /*
  * Get main thread's stack information from procfs.
  */
@@ -53,6 +90,25 @@ static bool get_main_stack(stack_bounds* bounds);
  */
 static bool get_thread_stack(stack_bounds* bounds);
 
+/*
+ * Get the handle for an architecture, initializing it on first use.
+ */
+static st_handle get_handle(enum arch arch);
+
+/*
+ * Prepare to rewrite the calling thread's stack: resolve which stack the
+ * thread is executing on (CUR_STACK) & the region into which it should be
+ * rewritten (NEW_STACK).
+ */
+static thread_stacks* prepare_rewrite(void* sp,
+                                      void** cur_stack,
+                                      void** new_stack);
+
+/*
+ * Finish a successful rewrite of the calling thread's stack.
+ */
+static void finish_rewrite(thread_stacks* ts);
+
 /*
  * Rewrite from the current stack (metadata provided by src_handle) to a
  * transformed stack (dest_handle).
@@ -85,8 +141,26 @@ char* __attribute__((weak)) x86_64_fn = NULL;
 static bool alloc_x86_64_fn = false;
 
 /*
- * Initialize rewriting meta-data on program startup.  Users *must* set the
- * names of binaries using one of the three methods described below.
+ * Whether we've tried to initialize the handle for each architecture.
+ */
+static bool tried_aarch64 = false;
+static bool tried_powerpc64 = false;
+static bool tried_x86_64 = false;
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Build rewrite plans for all call sites when initializing handles.
+ */
+static bool prebuild_plans = false;
+
+/*
+ * Rewrite frames on-demand rather than the entire stack at once.
+ */
+static bool ondemand = false;
+
+/*
+ * Prepare for rewriting on program startup.  Users *must* set the names of
+ * binaries using one of the three methods described in get_handle().
  */
 void __st_userspace_ctor(void)
 {
@@ -97,6 +171,9 @@ void __st_userspace_ctor(void)
     return;
   }
 
+  ondemand = (getenv(ENV_ONDEMAND) != NULL);
+  prebuild_plans = (getenv(ENV_PREBUILD_PLANS) != NULL);
+
   /* Prepare libELF. */
   if(elf_version(EV_CURRENT) == EV_NONE)
   {
@@ -104,44 +181,8 @@ void __st_userspace_ctor(void)
     return;
   }
 
-  /*
-   * Initialize ST handles - tries the following approaches to finding the
-   * binaries:
-   *
-   * 1. Check environment variables (defined in config.h)
-   * 2. Check if application has overridden file name symbols (defined above)
-   * 3. Add architecture suffixes to current binary name (defined by libc)
-   */
-  if(getenv(ENV_AARCH64_BIN)) aarch64_handle = st_init(getenv(ENV_AARCH64_BIN));
-  else if(aarch64_fn) aarch64_handle = st_init(aarch64_fn);
-  else {
-    aarch64_fn = (char*)MALLOC(sizeof(char) * BUF_SIZE);
-    snprintf(aarch64_fn, BUF_SIZE, "%s_aarch64", __progname);
-  }
-  aarch64_handle = st_init(aarch64_fn);
-  if(aarch64_handle) alloc_aarch64_fn = true;
-  else { ST_WARN("could not initialize aarch64 handle\n"); }
-
-  if(getenv(ENV_POWERPC64_BIN))
-    powerpc64_handle = st_init(getenv(ENV_POWERPC64_BIN));
-  else if(powerpc64_fn) powerpc64_handle = st_init(powerpc64_fn);
-  else {
-    powerpc64_fn = (char*)MALLOC(sizeof(char) * BUF_SIZE);
-    snprintf(powerpc64_fn, BUF_SIZE, "%s_powerpc64", __progname);
-  }
-  powerpc64_handle = st_init(powerpc64_fn);
-  if(powerpc64_handle) alloc_powerpc64_fn = true;
-  else { ST_WARN("could not initialize powerpc64 handle\n"); }
-
-  if(getenv(ENV_X86_64_BIN)) x86_64_handle = st_init(getenv(ENV_X86_64_BIN));
-  else if(x86_64_fn) x86_64_handle = st_init(x86_64_fn);
-  else {
-    x86_64_fn = (char*)MALLOC(sizeof(char) * BUF_SIZE);
-    snprintf(x86_64_fn, BUF_SIZE, "%s_x86-64", __progname);
-  }
-  x86_64_handle = st_init(x86_64_fn);
-  if(x86_64_handle) alloc_x86_64_fn = true;
-  else { ST_WARN("could not initialize x86-64 handle\n"); }
+  // Note: handles are initialized on the first rewrite to/from each
+  // architecture (see get_handle()), as most processes never migrate
 }
 
 /*
@@ -149,55 +190,29 @@ void __st_userspace_ctor(void)
  */
 void __st_userspace_dtor(void)
 {
-  if(aarch64_handle)
-  {
-    st_destroy(aarch64_handle);
-    if(alloc_aarch64_fn) free(aarch64_fn);
-  }
+  if(aarch64_handle) st_destroy(aarch64_handle);
+  if(alloc_aarch64_fn) free(aarch64_fn);
 
-  if(powerpc64_handle)
-  {
-    st_destroy(powerpc64_handle);
-    if(alloc_powerpc64_fn) free(powerpc64_fn);
-  }
+  if(powerpc64_handle) st_destroy(powerpc64_handle);
+  if(alloc_powerpc64_fn) free(powerpc64_fn);
 
-  if(x86_64_handle)
-  {
-    st_destroy(x86_64_handle);
-    if(alloc_x86_64_fn) free(x86_64_fn);
-  }
+  if(x86_64_handle) st_destroy(x86_64_handle);
+  if(alloc_x86_64_fn) free(x86_64_fn);
 }
 
 /*
- * Get stack bounds for a thread.
+ * Get stack bounds for a thread, i.e., the base of the stack it's executing on
+ * and the base of the region into which it should be rewritten.
  */
 stack_bounds get_stack_bounds()
 {
   void* cur_stack;
+  thread_stacks* ts;
   stack_bounds cur_bounds = {NULL, NULL};
 
-  /* If not already resolved, get stack limits for thread. */
-#if _TLS_IMPL == COMPILER_TLS
-  if(bounds.high == NULL)
-    if(!get_thread_stack(&bounds)) return cur_bounds;
-  cur_bounds = bounds;
-#else /* PTHREAD_TLS */
-  stack_bounds* bounds_ptr;
-  if(!(bounds_ptr = pthread_getspecific(stack_bounds_key)))
-  {
-    bounds_ptr = (stack_bounds*)MALLOC(sizeof(stack_bounds));
-    ASSERT(bounds_ptr, "could not allocate memory for stack bounds\n");
-    int retval = pthread_setspecific(stack_bounds_key, bounds_ptr);
-    if(retval) {
-      ASSERT(!retval, "could not set TLS data for thread\n");
-      return cur_bounds;
-    }
-    if(!get_thread_stack(bounds_ptr)) return cur_bounds;
-  }
-  cur_bounds = *bounds_ptr;
-#endif
+  if(!(ts = get_thread_stacks())) return cur_bounds;
 
-  /* Determine which half of stack we're currently using. */
+  /* Determine which stack we're currently using. */
 #ifdef __aarch64__
   asm volatile("mov %0, sp" : "=r"(cur_stack) ::);
 #elif defined __powerpc64__
@@ -205,10 +220,11 @@ stack_bounds get_stack_bounds()
 #elif defined __x86_64__
   asm volatile("movq %%rsp, %0" : "=g"(cur_stack) ::);
 #endif
-  if(cur_stack >= cur_bounds.low + B_STACK_OFFSET)
-    cur_bounds.low += B_STACK_OFFSET;
-  else cur_bounds.high = cur_bounds.low + B_STACK_OFFSET;
+  sync_stacks(ts, cur_stack);
+  if(!ts->next && !(ts->next = stack_region_get())) return cur_bounds;
 
+  cur_bounds.high = ts->cur ? ts->cur->high : ts->native.high;
+  cur_bounds.low = ts->next->high;
   return cur_bounds;
 }
 
@@ -223,36 +239,160 @@ int st_userspace_rewrite(void* sp,
 {
   st_handle src_handle, dest_handle;
 
-  switch(src_arch)
+  if(!(src_handle = get_handle(src_arch)))
   {
-  case ARCH_AARCH64: src_handle = aarch64_handle; break;
-  case ARCH_POWERPC64: src_handle = powerpc64_handle; break;
-  case ARCH_X86_64: src_handle = x86_64_handle; break;
-  default: ST_WARN("Unsupported source architecture!\n"); return 1;
+    ST_WARN("Could not load rewriting information for source!\n");
+    return 1;
   }
 
-  if(!src_handle)
+  if(!(dest_handle = get_handle(dest_arch)))
   {
-    ST_WARN("Could not load rewriting information for source!\n");
+    ST_WARN("Could not rewriting information for destination!\n");
     return 1;
   }
 
-  switch(dest_arch)
+  return userspace_rewrite_internal(sp, src_regs, dest_regs,
+                                    src_handle, dest_handle);
+}
+
+/*
+ * Prepare the calling thread's stack to be rewritten as part of a batch.
+ */
+int st_userspace_prepare(void* sp,
+                         void* src_regs,
+                         void* dest_regs,
+                         st_stack_desc* stack)
+{
+  void* cur_stack, *new_stack;
+
+  if(!sp || !src_regs || !dest_regs || !stack)
   {
-  case ARCH_AARCH64: dest_handle = aarch64_handle; break;
-  case ARCH_POWERPC64: dest_handle = powerpc64_handle; break;
-  case ARCH_X86_64: dest_handle = x86_64_handle; break;
-  default: ST_WARN("Unsupported destination architecture!\n"); return 1;
+    ST_WARN("invalid arguments\n");
+    return 1;
   }
 
-  if(!dest_handle)
+  if(!prepare_rewrite(sp, &cur_stack, &new_stack)) return 1;
+  stack->regset_src = src_regs;
+  stack->sp_base_src = cur_stack;
+  stack->regset_dest = dest_regs;
+  stack->sp_base_dest = new_stack;
+  stack->owner = st_stack_owner();
+  stack->ret = 1;
+  return 0;
+}
+
+/*
+ * Rewrite a batch of prepared stacks concurrently.
+ */
+int st_userspace_rewrite_batch(enum arch src_arch,
+                               enum arch dest_arch,
+                               st_stack_desc* stacks,
+                               size_t num)
+{
+  st_handle src_handle, dest_handle;
+
+  if(!(src_handle = get_handle(src_arch)))
+  {
+    ST_WARN("Could not load rewriting information for source!\n");
+    return 1;
+  }
+
+  if(!(dest_handle = get_handle(dest_arch)))
   {
     ST_WARN("Could not rewriting information for destination!\n");
     return 1;
   }
 
-  return userspace_rewrite_internal(sp, src_regs, dest_regs,
-                                    src_handle, dest_handle);
+  return st_rewrite_stacks(src_handle, dest_handle, stacks, num);
+}
+
+/*
+ * Finish a batched rewrite of the calling thread's stack.
+ */
+void st_userspace_finish(const st_stack_desc* stack)
+{
+  thread_stacks* ts;
+
+  if(!stack || stack->ret || !(ts = get_thread_stacks())) return;
+  finish_rewrite(ts);
+}
+
+/*
+ * Frame records: each frame pointer points to the caller's frame pointer &
+ * the return address into the caller.  On PowerPC the frame pointer is the
+ * stack pointer, and the return address is saved in the caller's frame.
+ */
+#if defined __aarch64__ || defined __x86_64__
+# define FRAME_NEXT( fp ) (((void**)(fp))[0])
+# define FRAME_RET( fp ) (((void**)(fp))[1])
+#elif defined __powerpc64__
+# define FRAME_NEXT( fp ) (((void**)(fp))[0])
+# define FRAME_RET( fp ) (((void**)FRAME_NEXT(fp))[2])
+#endif
+
+#ifdef __aarch64__
+static const enum arch local_arch = ARCH_AARCH64;
+#elif defined __powerpc64__
+static const enum arch local_arch = ARCH_POWERPC64;
+#else
+static const enum arch local_arch = ARCH_X86_64;
+#endif
+
+/*
+ * Estimate the cost of rewriting the calling thread's stack.
+ */
+int st_userspace_estimate(void* fp, st_cost* cost)
+{
+  void* next, *high;
+  call_site site;
+  st_handle handle;
+  thread_stacks* ts;
+
+  if(!fp || !cost) return 1;
+  cost->frames = cost->live = cost->frame_bytes = 0;
+
+  if(!(handle = get_handle(local_arch)) || !(ts = get_thread_stacks()))
+    return 1;
+  high = ts->cur && stack_region_contains(ts->cur, fp) ? ts->cur->high
+                                                        : ts->native.high;
+
+  while(cost->frames < ST_ESTIMATE_MAX_FRAMES && fp < high)
+  {
+    if(!get_site_by_addr(handle, FRAME_RET(fp), &site)) break;
+    cost->frames++;
+    cost->live += site.num_live;
+    cost->frame_bytes += site.frame_size;
+    if(first_frame(site.id)) break;
+
+    /* Frames only ever get older moving up the stack */
+    next = FRAME_NEXT(fp);
+    if(next <= fp) break;
+    fp = next;
+  }
+
+  return 0;
+}
+
+/*
+ * Reserve the calling thread's user-space rewriting state.
+ */
+int st_userspace_reserve(void)
+{
+  if(!get_thread_stacks())
+  {
+    ST_WARN("could not get stack bounds for thread\n");
+    return 1;
+  }
+  return st_reserve_thread();
+}
+
+/*
+ * Return the base of the stack into which the thread was last rewritten.
+ */
+void* st_userspace_rewritten_base(void)
+{
+  thread_stacks* ts = get_thread_stacks();
+  return ts && ts->next ? ts->next->high : NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -260,71 +400,195 @@ int st_userspace_rewrite(void* sp,
 ///////////////////////////////////////////////////////////////////////////////
 
 /*
- * Touch stack pages up to the OS-defined stack size limit, so that the OS
- * allocates them and we can divide the stack in half for rewriting.  Also,
- * calculate stack bounds for main thread.
+ * Get the handle for an architecture, initializing it on first use.  Tries
+ * the following approaches to finding the binary:
+ *
+ * 1. Check environment variables (defined in config.h)
+ * 2. Check if application has overridden file name symbols (defined above)
+ * 3. Add architecture suffixes to current binary name (defined by libc)
+ */
+static st_handle get_handle(enum arch arch)
+{
+  size_t i;
+  st_handle* handle, new;
+  st_handle* all[] = { &aarch64_handle, &powerpc64_handle, &x86_64_handle };
+  char** fn;
+  bool* alloc_fn, *tried;
+  const char* env, *suffix, *name;
+
+  switch(arch)
+  {
+  case ARCH_AARCH64:
+    handle = &aarch64_handle;
+    fn = &aarch64_fn;
+    alloc_fn = &alloc_aarch64_fn;
+    tried = &tried_aarch64;
+    env = ENV_AARCH64_BIN;
+    suffix = "aarch64";
+    break;
+  case ARCH_POWERPC64:
+    handle = &powerpc64_handle;
+    fn = &powerpc64_fn;
+    alloc_fn = &alloc_powerpc64_fn;
+    tried = &tried_powerpc64;
+    env = ENV_POWERPC64_BIN;
+    suffix = "powerpc64";
+    break;
+  case ARCH_X86_64:
+    handle = &x86_64_handle;
+    fn = &x86_64_fn;
+    alloc_fn = &alloc_x86_64_fn;
+    tried = &tried_x86_64;
+    env = ENV_X86_64_BIN;
+    suffix = "x86-64";
+    break;
+  default:
+    ST_WARN("Unsupported architecture!\n");
+    return NULL;
+  }
+
+  /* Fast path -- already initialized */
+  if((new = __atomic_load_n(handle, __ATOMIC_ACQUIRE))) return new;
+
+  pthread_mutex_lock(&handle_lock);
+  if(!*handle && !*tried)
+  {
+    *tried = true;
+    if((name = getenv(env)) == NULL)
+    {
+      if(!*fn)
+      {
+        *fn = (char*)MALLOC(sizeof(char) * BUF_SIZE);
+        snprintf(*fn, BUF_SIZE, "%s_%s", __progname, suffix);
+        *alloc_fn = true;
+      }
+      name = *fn;
+    }
+
+    if((new = st_init(name)))
+    {
+      if(prebuild_plans)
+      {
+        for(i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+        {
+          if(!*all[i]) continue;
+          st_prebuild_plans(new, *all[i]);
+          st_prebuild_plans(*all[i], new);
+        }
+      }
+      __atomic_store_n(handle, new, __ATOMIC_RELEASE);
+    }
+    else ST_WARN("could not initialize %s handle\n", suffix);
+  }
+  pthread_mutex_unlock(&handle_lock);
+
+  return *handle;
+}
+
+/*
+ * Calculate stack bounds for the main thread & create the key used to release
+ * threads' stack regions when they exit.
  */
 static bool prep_stack(void)
 {
   long ret;
   size_t offset;
   struct rlimit rlim;
-#if _TLS_IMPL == PTHREAD_TLS
-  stack_bounds bounds;
-  stack_bounds* bounds_ptr;
+  thread_stacks* ts;
 
-  bounds_ptr = (stack_bounds*)MALLOC(sizeof(stack_bounds));
-  ASSERT(bounds_ptr, "could not allocate memory for stack bounds\n");
-  ret = pthread_key_create(&stack_bounds_key, free);
-  ret |= pthread_setspecific(stack_bounds_key, bounds_ptr);
-  ASSERT(!ret, "could not allocate TLS data for main thread\n");
-#endif
+  ret = pthread_key_create(&stacks_key, release_stacks);
+  ASSERT(!ret, "could not create TLS key for stack regions\n");
+  if(ret) return false;
 
-  if(!get_main_stack(&bounds)) return false;
-  if((ret = getrlimit(RLIMIT_STACK, &rlim)) < 0) return false;
-  if(!ret)
-  {
-    // Note: the Linux kernel grows the stack automatically, but some versions
-    // check to ensure that the stack pointer is near the page being accessed.
-    // To grow the stack:
-    //   1. Save the current stack pointer
-    //   2. Move stack pointer to lowest stack address (according to rlimit)
-    //   3. Touch the page using the stack pointer
-    //   4. Restore the original stack pointer
-    bounds.low = bounds.high - rlim.rlim_cur;
-#ifdef __aarch64__
-    asm volatile("mov x27, sp;"
-                 "mov sp, %0;"
-                 "ldr x28, [sp];"
-                 "mov sp, x27" : : "r" (bounds.low) : "x27", "x28");
-#elif defined(__powerpc64__)
-    asm volatile("mr 28, 1;"
-                 "mr 1, %0;"
-                 "ld 29, 0(1);"
-                 "mr 1, 28" : : "r" (bounds.low) : "r28", "r29");
-#elif defined(__x86_64__)
-    asm volatile("mov %%rsp, %%r14;"
-                 "mov %0, %%rsp;"
-                 "mov (%%rsp), %%r15;"
-                 "mov %%r14, %%rsp" : : "g" (bounds.low) : "r14", "r15");
+#if _TLS_IMPL == COMPILER_TLS
+  ts = &stacks;
+#else /* PTHREAD_TLS */
+  ts = (thread_stacks*)MALLOC(sizeof(thread_stacks));
+  ASSERT(ts, "could not allocate memory for stack bounds\n");
+  memset(ts, 0, sizeof(thread_stacks));
 #endif
-  }
+
+  if(!get_main_stack(&ts->native)) return false;
+  if(getrlimit(RLIMIT_STACK, &rlim) < 0) return false;
+
+  // Note: threads are rewritten into separate stack regions, so the main
+  // thread's stack no longer needs to be grown up-front.  The lower bound is
+  // only used to sanity check stack pointers.
+  if(rlim.rlim_cur != RLIM_INFINITY &&
+     rlim.rlim_cur < (uint64_t)ts->native.high)
+    ts->native.low = ts->native.high - rlim.rlim_cur;
+  else ts->native.low = NULL;
 
   ST_INFO("Prepped stack for main thread, addresses %p -> %p\n",
-          bounds.low, bounds.high);
+          ts->native.low, ts->native.high);
 
   /*
    * Get offset of main thread's stack pointer from stack base so we can avoid
    * clobbering argv & environment variables.
    */
   ASSERT(__popcorn_stack_base, "Stack base not correctly set by musl\n");
-  offset = (uint64_t)(bounds.high - __popcorn_stack_base);
+  offset = (uint64_t)(ts->native.high - __popcorn_stack_base);
   offset += (offset % 0x10 ? 0x10 - (offset % 0x10) : 0);
-  bounds.high -= offset;
+  ts->native.high -= offset;
+
+  ret = pthread_setspecific(stacks_key, ts);
+  ASSERT(!ret, "could not allocate TLS data for main thread\n");
+  return true;
+}
+
+static thread_stacks* get_thread_stacks(void)
+{
+  thread_stacks* ts;
+
+#if _TLS_IMPL == COMPILER_TLS
+  ts = &stacks;
+  if(ts->native.high) return ts;
+#else /* PTHREAD_TLS */
+  if((ts = pthread_getspecific(stacks_key))) return ts;
+  ts = (thread_stacks*)MALLOC(sizeof(thread_stacks));
+  ASSERT(ts, "could not allocate memory for stack bounds\n");
+  memset(ts, 0, sizeof(thread_stacks));
+#endif
+
+  if(!get_thread_stack(&ts->native))
+  {
 #if _TLS_IMPL == PTHREAD_TLS
-  *bounds_ptr = bounds;
+    free(ts);
+#endif
+    return NULL;
+  }
+
+  if(pthread_setspecific(stacks_key, ts))
+    ST_WARN("could not set TLS data for thread\n");
+  return ts;
+}
+
+static void sync_stacks(thread_stacks* ts, void* sp)
+{
+  if(!stack_region_contains(ts->next, sp)) return;
+
+  ST_INFO("Resumed on stack region %p -> %p\n", ts->next->low, ts->next->high);
+
+  // Note: any frames left in PREV were flushed by the previous rewrite
+  stack_region_put(ts->prev);
+  ts->prev = ts->cur;
+  ts->cur = ts->next;
+  ts->next = NULL;
+}
+
+static void release_stacks(void* data)
+{
+  thread_stacks* ts = (thread_stacks*)data;
+
+  // Note: the thread is still executing on CUR, so it can't be recycled until
+  // the thread has finished exiting
+  stack_region_put(ts->prev);
+  stack_region_put(ts->next);
+  stack_region_retire(ts->cur);
+  ts->cur = ts->prev = ts->next = NULL;
+#if _TLS_IMPL == PTHREAD_TLS
+  free(ts);
 #endif
-  return true;
 }
 
 /* Read stack information for the main thread from the procfs. */
@@ -385,15 +649,7 @@ static bool get_thread_stack(stack_bounds* bounds)
   ret |= pthread_attr_getstack(&attr, &bounds->low, &stack_size);
   if(ret == 0)
   {
-    // Note: due to rounding the size of the pthread data & TLS, the stack size
-    // may not be exactly 8MB
     bounds->high = bounds->low + stack_size;
-    if(stack_size != MAX_STACK_SIZE)
-    {
-      ST_INFO("unexpected stack size: expected %lx, got %lx\n",
-              MAX_STACK_SIZE, stack_size);
-      bounds->low = bounds->high - MAX_STACK_SIZE;
-    }
     retval = true;
   }
   else
@@ -407,9 +663,48 @@ static bool get_thread_stack(stack_bounds* bounds)
   return retval;
 }
 
+static thread_stacks* prepare_rewrite(void* sp,
+                                      void** cur_stack,
+                                      void** new_stack)
+{
+  thread_stacks* ts;
+
+  /* If not already resolved, get stack limits for thread. */
+  if(!(ts = get_thread_stacks())) return NULL;
+  sync_stacks(ts, sp);
+
+  if(ts->cur ? !stack_region_contains(ts->cur, sp)
+             : (sp < ts->native.low || ts->native.high <= sp))
+  {
+    ST_WARN("invalid stack pointer\n");
+    return NULL;
+  }
+
+  if(!ts->next && !(ts->next = stack_region_get()))
+  {
+    ST_WARN("could not get stack region for rewriting\n");
+    return NULL;
+  }
+
+  *cur_stack = ts->cur ? ts->cur->high : ts->native.high;
+  *new_stack = ts->next->high;
+  return ts;
+}
+
+static void finish_rewrite(thread_stacks* ts)
+{
+  if(ts->prev)
+  {
+    /* Any frames left on the previous region were flushed by the rewrite */
+    stack_region_put(ts->prev);
+    ts->prev = NULL;
+  }
+}
+
 /*
- * Rewrite from source to destination stack.  Logically, divides 8MB stack in
- * half, detects which half we're currently using and rewrites to the other.
+ * Rewrite from source to destination stack.  Rewrites from the stack the
+ * thread is currently executing on into a pre-faulted stack region; the thread
+ * switches to the region when it resumes.
  */
 static int userspace_rewrite_internal(void* sp,
                                       void* src_regs,
@@ -418,11 +713,8 @@ static int userspace_rewrite_internal(void* sp,
                                       st_handle dest_handle)
 {
   int retval = 0;
-  void* stack_a, *stack_b, *cur_stack, *new_stack;
-#if _TLS_IMPL == PTHREAD_TLS
-  stack_bounds bounds;
-  stack_bounds* bounds_ptr;
-#endif
+  void* cur_stack, *new_stack;
+  thread_stacks* ts;
 
   if(!sp || !src_regs || !dest_regs || !src_handle || !dest_handle)
   {
@@ -430,45 +722,21 @@ static int userspace_rewrite_internal(void* sp,
     return 1;
   }
 
-  /* If not already resolved, get stack limits for thread. */
-#if _TLS_IMPL == COMPILER_TLS
-  if(bounds.high == NULL)
-    if(!get_thread_stack(&bounds)) return 1;
-#else /* PTHREAD_TLS */
-  if(!(bounds_ptr = pthread_getspecific(stack_bounds_key)))
-  {
-    bounds_ptr = (stack_bounds*)MALLOC(sizeof(stack_bounds));
-    ASSERT(bounds_ptr, "could not allocate memory for stack bounds\n");
-    retval = pthread_setspecific(stack_bounds_key, bounds_ptr);
-    ASSERT(!retval, "could not set TLS data for thread\n");
-    if(!get_thread_stack(bounds_ptr)) return 1;
-  }
-  bounds = *bounds_ptr;
-#endif
-
-  if(sp < bounds.low || bounds.high <= sp)
-  {
-    ST_WARN("invalid stack pointer\n");
-    return 1;
-  }
+  if(!(ts = prepare_rewrite(sp, &cur_stack, &new_stack))) return 1;
 
   ST_INFO("Thread %ld beginning re-write\n", syscall(SYS_gettid));
-
-  /* Divide stack into two halves. */
-  stack_a = bounds.high;
-  stack_b = bounds.low + B_STACK_OFFSET;
-
-  /* Find which half the current stack uses and rewrite to other. */
-  cur_stack = (sp >= stack_b) ? stack_a : stack_b;
-  new_stack = (sp >= stack_b) ? stack_b : stack_a;
   ST_INFO("On stack %p, rewriting to %p\n", cur_stack, new_stack);
-  if(st_rewrite_stack(src_handle, src_regs, cur_stack,
-                      dest_handle, dest_regs, new_stack))
+  if(ondemand) retval = st_rewrite_ondemand(src_handle, src_regs, cur_stack,
+                                            dest_handle, dest_regs, new_stack);
+  else retval = st_rewrite_stack(src_handle, src_regs, cur_stack,
+                                 dest_handle, dest_regs, new_stack);
+  if(retval)
   {
     ST_WARN("stack transformation failed (%s -> %s)\n",
             arch_name(src_handle->arch), arch_name(dest_handle->arch));
     retval = 1;
   }
+  else finish_rewrite(ts);
 
   return retval;
 }
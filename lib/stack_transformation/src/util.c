@@ -5,6 +5,8 @@
  * Date: 11/11/2015
  */
 
+#include <unistd.h>
+#include <sys/mman.h>
 #include <libelf/gelf.h>
 
 #include "definitions.h"
@@ -97,16 +99,118 @@ int64_t get_num_entries(Elf* e, const char* sec)
 }
 
 /*
- * Return the start of the section SEC in Elf data E.
+ * Map the section SEC in Elf data E from file FD.
  */
-const void* get_section_data(Elf* e, const char* sec)
+const void* map_section_data(st_handle handle,
+                             Elf* e,
+                             int fd,
+                             const char* sec)
 {
   Elf_Scn* scn;
-  Elf_Data* data = NULL;
+  GElf_Shdr shdr;
+  long page_size;
+  off_t offset;
+  size_t len;
+  void* map;
+
+  if(handle->num_maps >= MAX_SECTION_MAPS)
+  {
+    ST_WARN("too many mapped sections\n");
+    return NULL;
+  }
 
   if(!(scn = get_section(e, sec))) return NULL;
-  if(!(data = elf_getdata(scn, data))) return NULL;
-  return data->d_buf;
+  if(gelf_getshdr(scn, &shdr) != &shdr) return NULL;
+  if(shdr.sh_type == SHT_NOBITS || !shdr.sh_size) return NULL;
+
+  /* mmap requires page-aligned file offsets */
+  if((page_size = sysconf(_SC_PAGESIZE)) <= 0) return NULL;
+  offset = shdr.sh_offset & ~(page_size - 1);
+  len = shdr.sh_size + (shdr.sh_offset - offset);
+  map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, offset);
+  if(map == MAP_FAILED) return NULL;
+
+  handle->maps[handle->num_maps].addr = map;
+  handle->maps[handle->num_maps].len = len;
+  handle->num_maps++;
+  return map + (shdr.sh_offset - offset);
+}
+
+/*
+ * Unmap all section data mapped for HANDLE.
+ */
+void unmap_section_data(st_handle handle)
+{
+  size_t i;
+
+  for(i = 0; i < handle->num_maps; i++)
+    munmap(handle->maps[i].addr, handle->maps[i].len);
+  handle->num_maps = 0;
+}
+
+/* Key of the I'th call site in address or ID order */
+#define SITE_ADDR( handle, i ) \
+  ((handle)->version == METADATA_V2 ? \
+   (handle)->site_addrs[i] : (handle)->sites_addr[i].addr)
+#define SITE_ID( handle, i ) \
+  ((handle)->version == METADATA_V2 ? \
+   (handle)->site_ids[i] : (handle)->sites_id[i].id)
+
+/*
+ * Expand the compact call site record at index I in address order.
+ */
+static inline void decode_site(st_handle handle, uint64_t i, call_site* cs)
+{
+  const call_site_v2* site = &handle->sites[i];
+  const function_info* func = &handle->funcs[site->func];
+
+  cs->id = site->id;
+  cs->addr = handle->site_addrs[i];
+  cs->frame_size = func->frame_size;
+  cs->num_unwind = func->num_unwind;
+  cs->unwind_offset = func->unwind_offset;
+  cs->num_live = site->num_live;
+  cs->live_offset = site->live_offset;
+  cs->num_arch_live = site->num_arch_live;
+  cs->arch_live_offset = site->arch_live_offset;
+}
+
+/*
+ * Populate CS with the call site at index I in address order.
+ */
+static inline void site_by_addr_idx(st_handle handle, uint64_t i, call_site* cs)
+{
+  if(handle->version == METADATA_V2) decode_site(handle, i, cs);
+  else *cs = handle->sites_addr[i];
+}
+
+/*
+ * Populate CS with the call site at index I in ID order.
+ */
+static inline void site_by_id_idx(st_handle handle, uint64_t i, call_site* cs)
+{
+  if(handle->version == METADATA_V2)
+    decode_site(handle, handle->site_id_map[i], cs);
+  else *cs = handle->sites_id[i];
+}
+
+/*
+ * Probe the call site lookup index for the address-sorted call site with
+ * return address RETADDR.  Returns the index into the address-sorted call site
+ * section + 1, or 0 if not found.
+ */
+static inline uint32_t index_by_addr(st_handle handle, uint64_t retaddr)
+{
+  uint64_t i, slot, mask = handle->site_index_count - 1;
+  uint32_t site;
+
+  slot = site_index_hash(retaddr, handle->site_index_count);
+  for(i = 0; i < handle->site_index_count; i++, slot = (slot + 1) & mask)
+  {
+    if(!(site = handle->site_index[slot].addr_site)) break;
+    if(SITE_ADDR(handle, site - 1) == retaddr) return slot + 1;
+  }
+  return 0;
 }
 
 /*
@@ -119,19 +223,33 @@ bool get_site_by_addr(st_handle handle, void* ret_addr, call_site* cs)
   long max = (handle->sites_count - 1);
   long mid;
   uint64_t retaddr = (uint64_t)ret_addr;
+  uint32_t slot;
 
   TIMER_FG_START(get_site_by_addr);
   ASSERT(cs, "invalid arguments to get_site_by_addr()\n");
 
+  /* The index, if available, contains every call site */
+  if(handle->site_index_count)
+  {
+    if((slot = index_by_addr(handle, retaddr)))
+    {
+      site_by_addr_idx(handle, handle->site_index[slot - 1].addr_site - 1, cs);
+      found = true;
+    }
+    max = -1;
+  }
+
   while(max >= min)
   {
     mid = (max + min) / 2;
-    if(handle->sites_addr[mid].addr == retaddr) {
-      *cs = handle->sites_addr[mid];
+    if(SITE_ADDR(handle, mid) == retaddr) {
+      /* Use the first of duplicate records, as does the index */
+      while(mid && SITE_ADDR(handle, mid - 1) == retaddr) mid--;
+      site_by_addr_idx(handle, mid, cs);
       found = true;
       break;
     }
-    else if(retaddr > handle->sites_addr[mid].addr)
+    else if(retaddr > SITE_ADDR(handle, mid))
       min = mid + 1;
     else
       max = mid - 1;
@@ -150,19 +268,40 @@ bool get_site_by_id(st_handle handle, uint64_t csid, call_site* cs)
   long min = 0;
   long max = (handle->sites_count - 1);
   long mid;
+  uint64_t i, slot, mask;
+  uint32_t site;
 
   TIMER_FG_START(get_site_by_id);
   ASSERT(cs, "invalid arguments to get_site_by_id()\n");
 
+  /* The index, if available, contains every call site */
+  if(handle->site_index_count)
+  {
+    mask = handle->site_index_count - 1;
+    slot = site_index_hash(csid, handle->site_index_count);
+    for(i = 0; i < handle->site_index_count; i++, slot = (slot + 1) & mask)
+    {
+      if(!(site = handle->site_index[slot].id_site)) break;
+      if(SITE_ID(handle, site - 1) == csid)
+      {
+        site_by_id_idx(handle, site - 1, cs);
+        found = true;
+        break;
+      }
+    }
+    max = -1;
+  }
+
   while(max >= min)
   {
     mid = (max + min) / 2;
-    if(handle->sites_id[mid].id == csid) {
-      *cs = handle->sites_id[mid];
+    if(SITE_ID(handle, mid) == csid) {
+      while(mid && SITE_ID(handle, mid - 1) == csid) mid--;
+      site_by_id_idx(handle, mid, cs);
       found = true;
       break;
     }
-    else if(csid > handle->sites_id[mid].id)
+    else if(csid > SITE_ID(handle, mid))
       min = mid + 1;
     else
       max = mid - 1;
@@ -172,6 +311,16 @@ bool get_site_by_id(st_handle handle, uint64_t csid, call_site* cs)
   return found;
 }
 
+/*
+ * Return the call site at the specified index in ID order.
+ */
+void get_site_at(st_handle handle, uint64_t idx, call_site* cs)
+{
+  ASSERT(cs && idx < handle->sites_count,
+         "invalid arguments to get_site_at()\n");
+  site_by_id_idx(handle, idx, cs);
+}
+
 /* Check if an address is within the range of a function unwinding record */
 #define IN_RANGE( idx, _addr ) \
   (handle->unwind_addrs[idx].addr <= _addr && \
@@ -187,10 +336,29 @@ bool get_unwind_offset_by_addr(st_handle handle, void* addr, unwind_addr* meta)
   long max = (handle->unwind_addr_count - 1);
   long mid;
   uint64_t addr_int = (uint64_t)addr;
+  uint32_t slot;
 
   TIMER_FG_START(get_unwind_offset_by_addr);
   ASSERT(meta, "invalid arguments to get_unwind_offset_by_addr()\n");
 
+  /*
+   * Program counters of all but the innermost frame are return addresses, so
+   * the index usually maps directly to the enclosing function.  Other
+   * addresses (e.g., function entry) fall back to the binary search.
+   */
+  if(handle->site_index_count && (slot = index_by_addr(handle, addr_int)))
+  {
+    mid = handle->site_index[slot - 1].addr_func;
+    if(mid < handle->unwind_addr_count &&
+       (mid == handle->unwind_addr_count - 1 ?
+        handle->unwind_addrs[mid].addr <= addr_int : IN_RANGE(mid, addr_int)))
+    {
+      *meta = handle->unwind_addrs[mid];
+      found = true;
+      max = -1;
+    }
+  }
+
   while(max >= min)
   {
     mid = (max + min) / 2;
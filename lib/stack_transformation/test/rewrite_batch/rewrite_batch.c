@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <stack_transform.h>
+#include "stack_transform_timing.h"
+
+static int num_threads = 10;
+static int max_depth = 10;
+static st_handle handle = NULL;
+static __thread int post_transform = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static st_stack_desc** submitted;
+static int num_submitted = 0;
+static int batch_done = 0;
+
+/*
+ * Add a thread's stack to the batch.  The last thread to arrive rewrites all
+ * stacks at once.
+ */
+void submit(st_stack_desc* desc)
+{
+  int i, ret;
+  st_stack_desc* stacks;
+
+  pthread_mutex_lock(&lock);
+  submitted[num_submitted++] = desc;
+  if(num_submitted == num_threads - 1)
+  {
+    printf("--> Rewriting %d stacks <--\n", num_submitted);
+    stacks = (st_stack_desc*)malloc(sizeof(st_stack_desc) * num_submitted);
+    for(i = 0; i < num_submitted; i++) stacks[i] = *submitted[i];
+    ret = st_rewrite_stacks(handle, handle, stacks, num_submitted);
+    for(i = 0; i < num_submitted; i++) submitted[i]->ret = stacks[i].ret;
+    free(stacks);
+    if(ret) fprintf(stderr, "Couldn't re-write all stacks\n");
+    batch_done = 1;
+    pthread_cond_broadcast(&done);
+  }
+  else while(!batch_done) pthread_cond_wait(&done, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+int outer_frame()
+{
+  int tid = syscall(SYS_gettid);
+  if(!post_transform)
+  {
+    TEST_BATCH_REWRITE(outer_frame, submit);
+  }
+  else
+    printf("--> Child %d finished re-write <--\n", tid);
+  return 1;
+}
+
+int recurse(int depth)
+{
+  if(depth < max_depth) return recurse(depth + 1) + 1;
+  else return outer_frame();
+}
+
+void* thread_main(void* args)
+{
+  *(int*)args = recurse(1);
+  return NULL;
+}
+
+int main(int argc, char** argv)
+{
+  int i, sum = 0;
+  int* rets;
+  pthread_t* children;
+
+  if(!(handle = st_init(argv[0]))) {
+    printf("Couldn't initialize stack transformation handle\n");
+    exit(1);
+  }
+
+  if(argc > 1) max_depth = atoi(argv[1]);
+  if(argc > 2) num_threads = atoi(argv[2]);
+  children = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  rets = (int*)calloc(num_threads, sizeof(int));
+  submitted = (st_stack_desc**)malloc(sizeof(st_stack_desc*) * num_threads);
+
+  for(i = 1; i < num_threads; i++) {
+    if(pthread_create(&children[i], NULL, thread_main, &rets[i])) {
+      printf("Couldn't spawn child thread\n");
+      exit(1);
+    }
+  }
+
+  for(i = 1; i < num_threads; i++) {
+    if(pthread_join(children[i], NULL)) {
+      printf("Couldn't join child thread\n");
+      exit(1);
+    }
+    sum += rets[i];
+  }
+
+  printf("Sum of return values: %d\n", sum);
+
+  free(submitted);
+  free(rets);
+  free(children);
+  st_destroy(handle);
+  return 0;
+}
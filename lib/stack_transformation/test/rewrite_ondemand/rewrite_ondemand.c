@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TEST_REWRITE_FN st_rewrite_ondemand
+#include <stack_transform.h>
+#include "stack_transform_timing.h"
+
+static int max_depth = 20;
+static int post_transform = 0;
+static st_handle handle = NULL;
+
+int outer_frame()
+{
+  if(!post_transform)
+  {
+    TIME_AND_TEST_NO_INIT(handle, outer_frame);
+  }
+  return 0;
+}
+
+int recurse(int depth, int* sum)
+{
+  int local = 0, ret;
+
+  /* Odd frames point to their own local, even frames pass along the pointer */
+  if(depth < max_depth)
+    ret = recurse(depth + 1, (depth % 2 ? &local : sum)) + depth * 2;
+  else ret = outer_frame();
+
+  *sum += depth;
+  return ret + local;
+}
+
+int main(int argc, char** argv)
+{
+  int sum = 0, ret;
+
+  if(argc > 1) max_depth = atoi(argv[1]);
+
+  if(!(handle = st_init(argv[0]))) {
+    printf("Couldn't initialize stack transformation handle\n");
+    exit(1);
+  }
+
+  ret = recurse(1, &sum);
+  printf("Calculated %d, sum %d\n", ret, sum);
+
+  st_destroy(handle);
+  return 0;
+}
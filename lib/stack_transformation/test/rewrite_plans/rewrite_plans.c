@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <stack_transform.h>
+#include "stack_transform_timing.h"
+
+static int max_depth = 10;
+static int iterations = 10;
+static int post_transform = 0;
+static st_handle handle = NULL;
+
+int outer_frame()
+{
+  if(!post_transform)
+  {
+    TIME_AND_TEST_NO_INIT(handle, outer_frame);
+  }
+  return 0;
+}
+
+int recurse(int depth)
+{
+  int ret;
+
+  if(depth < max_depth) ret = recurse(depth + 1) + depth;
+  else ret = outer_frame() + depth;
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  int i, ret = 0;
+  uint64_t hits, misses, first_misses = 0;
+
+  if(argc > 1) max_depth = atoi(argv[1]);
+  if(argc > 2) iterations = atoi(argv[2]);
+
+  if(!(handle = st_init(argv[0]))) {
+    printf("Couldn't initialize stack transformation handle\n");
+    exit(1);
+  }
+
+  for(i = 0; i < iterations; i++)
+  {
+    post_transform = 0;
+    ret += recurse(1);
+    st_plan_cache_stats(handle, &hits, &misses);
+    if(!i) first_misses = misses;
+  }
+
+  printf("Calculated %d over %d rewrites, plans %s\n", ret, iterations,
+         (misses == first_misses && hits ? "reused" : "NOT reused"));
+
+  st_destroy(handle);
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <stack_transform.h>
+#include "stack_transform_timing.h"
+
+/* Must stay below the runtime's maximum number of frames */
+static int max_depth = 400;
+static int post_transform = 0;
+
+void outer_frame()
+{
+  if(!post_transform)
+  {
+#ifdef __aarch64__
+    TIME_AND_TEST_REWRITE("./stack_pointer_many_aarch64", outer_frame);
+#elif defined(__powerpc64__)
+    TIME_AND_TEST_REWRITE("./stack_pointer_many_powerpc64", outer_frame);
+#elif defined(__x86_64__)
+    TIME_AND_TEST_REWRITE("./stack_pointer_many_x86-64", outer_frame);
+#endif
+  }
+}
+
+/*
+ * Keep 8 pointers to the stack live across every call: even pointers refer
+ * to this frame's locals, odd pointers are forwarded from the caller.
+ */
+void recurse(int depth, int* p0, int* p1, int* p2, int* p3,
+                        int* p4, int* p5, int* p6, int* p7)
+{
+  int l0 = 0, l2 = 0, l4 = 0, l6 = 0;
+
+  if(depth < max_depth)
+    recurse(depth + 1, &l0, p1, &l2, p3, &l4, p5, &l6, p7);
+  else outer_frame();
+
+  /* Pointers must have been reified to the rewritten stack */
+  *p0 += depth + l0;
+  *p1 += 1;
+  *p2 += depth + l2;
+  *p3 += 1;
+  *p4 += depth + l4;
+  *p5 += 1;
+  *p6 += depth + l6;
+  *p7 += 1;
+}
+
+int main(int argc, char** argv)
+{
+  int v[8] = { 0 }, i, sum = 0;
+
+  if(argc > 1) max_depth = atoi(argv[1]);
+
+  recurse(1, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+  for(i = 0; i < 8; i++) sum += v[i];
+  printf("sum = %d\n", sum);
+  return 0;
+}
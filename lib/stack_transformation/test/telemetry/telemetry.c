@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <stack_transform.h>
+#include "stack_transform_timing.h"
+
+static int max_depth = 10;
+static int iterations = 10;
+static int post_transform = 0;
+static st_handle handle = NULL;
+
+int outer_frame()
+{
+  if(!post_transform)
+  {
+    TIME_AND_TEST_NO_INIT(handle, outer_frame);
+  }
+  return 0;
+}
+
+int recurse(int depth)
+{
+  int ret;
+
+  if(depth < max_depth) ret = recurse(depth + 1) + depth;
+  else ret = outer_frame() + depth;
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  int i, ret = 0;
+  size_t num_sites;
+  st_histogram rewrites, frames;
+  st_site_cost sites[4];
+
+  if(argc > 1) max_depth = atoi(argv[1]);
+  if(argc > 2) iterations = atoi(argv[2]);
+
+  if(!(handle = st_init(argv[0]))) {
+    printf("Couldn't initialize stack transformation handle\n");
+    exit(1);
+  }
+
+  st_telemetry_enable(1);
+  for(i = 0; i < iterations; i++)
+  {
+    post_transform = 0;
+    ret += recurse(1);
+  }
+  st_telemetry_enable(0);
+
+  if(st_telemetry_query("st_rewrite_stack", &rewrites) ||
+     st_telemetry_query("frames", &frames)) {
+    printf("Couldn't query telemetry\n");
+    exit(1);
+  }
+  num_sites = st_telemetry_top_sites(sites, 4);
+
+  printf("Calculated %d over %lu rewrites\n", ret, rewrites.count);
+  printf("Frames per rewrite %s\n",
+         (frames.count == rewrites.count && frames.min == frames.max ?
+          "consistent" : "NOT consistent"));
+  printf("Top call site rewritten %s\n",
+         (num_sites && sites[0].count >= iterations ?
+          "every migration" : "NOT every migration"));
+  st_telemetry_dump(NULL);
+
+  st_destroy(handle);
+  return 0;
+}
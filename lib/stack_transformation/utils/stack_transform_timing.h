@@ -7,6 +7,15 @@
 
 #include <time.h>
 
+/*
+ * Rewriting function used by TIME_AND_TEST_NO_INIT.  Tests can define this to
+ * st_rewrite_ondemand before including this header to test on-demand
+ * rewriting.
+ */
+#ifndef TEST_REWRITE_FN
+# define TEST_REWRITE_FN st_rewrite_stack
+#endif
+
 /* Generate a call site to get rewriting metadata for outermost frame. */
 static void* __attribute__((noinline))
 get_call_site() { return __builtin_return_address(0); }
@@ -128,8 +137,8 @@ get_call_site() { return __builtin_return_address(0); }
     if(aarch64_handle) \
     { \
       clock_gettime(CLOCK_MONOTONIC, &start); \
-      ret = st_rewrite_stack(aarch64_handle, &regset, bounds.high, \
-                             aarch64_handle, &regset_dest, bounds.low); \
+      ret = TEST_REWRITE_FN(aarch64_handle, &regset, bounds.high, \
+                            aarch64_handle, &regset_dest, bounds.low); \
       if(ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
       else \
       { \
@@ -146,6 +155,34 @@ get_call_site() { return __builtin_return_address(0); }
     else fprintf(stderr, "Invalid stack transformation handle\n"); \
   })
 
+/*
+ * Test rewriting as part of a batch.  SUBMIT adds the thread's stack to the
+ * batch & returns once the batch has been rewritten by st_rewrite_stacks().
+ */
+#define TEST_BATCH_REWRITE( func, submit ) \
+  ({ \
+    struct regset_aarch64 regset, regset_dest; \
+    stack_bounds bounds = get_stack_bounds(); \
+    st_stack_desc desc; \
+    READ_REGS_AARCH64(regset); \
+    regset.pc = get_call_site(); \
+    desc.regset_src = &regset; \
+    desc.sp_base_src = bounds.high; \
+    desc.regset_dest = &regset_dest; \
+    desc.sp_base_dest = bounds.low; \
+    desc.owner = st_stack_owner(); \
+    desc.ret = 1; \
+    submit(&desc); \
+    if(desc.ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
+    else \
+    { \
+      post_transform = 1; \
+      SET_REGS_AARCH64(regset_dest); \
+      SET_FRAME_AARCH64(regset_dest.x[29], regset_dest.sp); \
+      SET_PC_IMM(func); \
+    } \
+  })
+
 #elif defined(__powerpc64__)
 
 /*
@@ -268,8 +305,8 @@ get_call_site() { return __builtin_return_address(0); }
     if(powerpc64_handle) \
     { \
       clock_gettime(CLOCK_MONOTONIC, &start); \
-      ret = st_rewrite_stack(powerpc64_handle, &regset, bounds.high, \
-                             powerpc64_handle, &regset_dest, bounds.low); \
+      ret = TEST_REWRITE_FN(powerpc64_handle, &regset, bounds.high, \
+                            powerpc64_handle, &regset_dest, bounds.low); \
       if(ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
       else \
       { \
@@ -287,6 +324,34 @@ get_call_site() { return __builtin_return_address(0); }
       fprintf(stderr, "Invalid stack transformation handle\n"); \
   })
 
+/*
+ * Test rewriting as part of a batch.  SUBMIT adds the thread's stack to the
+ * batch & returns once the batch has been rewritten by st_rewrite_stacks().
+ */
+#define TEST_BATCH_REWRITE( func, submit ) \
+  ({ \
+    struct regset_powerpc64 regset, regset_dest; \
+    stack_bounds bounds = get_stack_bounds(); \
+    st_stack_desc desc; \
+    READ_REGS_POWERPC64(regset); \
+    regset.pc = get_call_site(); \
+    desc.regset_src = &regset; \
+    desc.sp_base_src = bounds.high; \
+    desc.regset_dest = &regset_dest; \
+    desc.sp_base_dest = bounds.low; \
+    desc.owner = st_stack_owner(); \
+    desc.ret = 1; \
+    submit(&desc); \
+    if(desc.ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
+    else \
+    { \
+      post_transform = 1; \
+      SET_REGS_POWERPC64(regset_dest); \
+      SET_FRAME_POWERPC64(regset_dest.r[31], regset_dest.r[1]); \
+      SET_PC_IMM(func); \
+    } \
+  })
+
 #elif defined __x86_64__
 
 /* Times rewriting the entire stack (x86-64) */
@@ -405,8 +470,8 @@ get_call_site() { return __builtin_return_address(0); }
     if(x86_64_handle) \
     { \
       clock_gettime(CLOCK_MONOTONIC, &start); \
-      ret = st_rewrite_stack(x86_64_handle, &regset, bounds.high, \
-                             x86_64_handle, &regset_dest, bounds.low); \
+      ret = TEST_REWRITE_FN(x86_64_handle, &regset, bounds.high, \
+                            x86_64_handle, &regset_dest, bounds.low); \
       if(ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
       else \
       { \
@@ -423,6 +488,34 @@ get_call_site() { return __builtin_return_address(0); }
     else fprintf(stderr, "Invalid stack transformation handle\n"); \
   })
 
+/*
+ * Test rewriting as part of a batch.  SUBMIT adds the thread's stack to the
+ * batch & returns once the batch has been rewritten by st_rewrite_stacks().
+ */
+#define TEST_BATCH_REWRITE( func, submit ) \
+  ({ \
+    struct regset_x86_64 regset, regset_dest; \
+    stack_bounds bounds = get_stack_bounds(); \
+    st_stack_desc desc; \
+    READ_REGS_X86_64(regset); \
+    regset.rip = get_call_site(); \
+    desc.regset_src = &regset; \
+    desc.sp_base_src = bounds.high; \
+    desc.regset_dest = &regset_dest; \
+    desc.sp_base_dest = bounds.low; \
+    desc.owner = st_stack_owner(); \
+    desc.ret = 1; \
+    submit(&desc); \
+    if(desc.ret) fprintf(stderr, "Couldn't re-write the stack\n"); \
+    else \
+    { \
+      post_transform = 1; \
+      SET_REGS_X86_64(regset_dest); \
+      SET_FRAME_X86_64(regset_dest.rbp, regset_dest.rsp); \
+      SET_RIP_IMM(func); \
+    } \
+  })
+
 #else
 
 # error Unsupported architecture!
@@ -20,6 +20,7 @@
 #include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/PopcornUtil.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
@@ -28,7 +29,7 @@
 using namespace llvm;
 
 #define DEBUG_TYPE "migration-points"
-#define MIGRATE_FLAG_NAME "__migrate_flag"
+#define MIGRATE_FLAG_NAME "__migrate_pending_nid"
 
 /// Disable rollback-only transactions for PowerPC.
 const static cl::opt<bool>
@@ -36,6 +37,15 @@ NoROTPPC("htm-ppc-no-rot", cl::Hidden, cl::init(false),
   cl::desc("Disable rollback-only transactions in HTM instrumentation "
            "(PowerPC only)"));
 
+/// Check the thread's pending migration word inline at migration points and
+/// only call into the migration library when a migration is pending.  Requires
+/// a migration library which doesn't poll the OS for migration requests, as
+/// the OS can't set the word.
+const static cl::opt<bool>
+InlineCheck("migpoint-inline-check", cl::Hidden, cl::init(false),
+  cl::desc("Only call the migration library at migration points when the "
+           "inline check finds a pending migration"));
+
 /// Add counters to abort handlers for the specified function.  Allows in-depth
 /// profiling of which HTM sections added to the function are causing aborts.
 const static cl::opt<std::string>
@@ -72,17 +82,17 @@ public:
     CallbackType = PointerType::get(FuncPtrTy, 0);
     std::vector<Type *> ArgTy = { CallbackType, VoidPtrTy };
     FunctionType *FuncTy = FunctionType::get(VoidTy, ArgTy, false);
-    if(DoHTM) {
-      MigrateAPI = M.getOrInsertFunction("migrate", FuncTy);
+    MigrateAPI = M.getOrInsertFunction("check_migrate", FuncTy);
+
+    // The migration library keeps the destination of a pending migration (or
+    // -1 if there is none) in a per-thread word, which HTM abort handlers &
+    // (if enabled) migration points check before calling into the library.
+    if(DoHTM || InlineCheck) {
       MigrateFlag = cast<GlobalValue>(
         M.getOrInsertGlobal(MIGRATE_FLAG_NAME, Type::getInt32Ty(C)));
-      // TODO this needs to be thread-local storage
-      //MigrateFlag->setThreadLocal(true);
-    }
-    else {
-      MigrateAPI = M.getOrInsertFunction("check_migrate", FuncTy);
-      MigrateFlag = nullptr;
+      MigrateFlag->setThreadLocal(true);
     }
+    else MigrateFlag = nullptr;
   }
 
   virtual bool doInitialization(Module &M) {
@@ -281,15 +291,59 @@ private:
     }
   }
 
-  /// Add a migration point directly before an instruction.
+  /// Add a migration point directly before an instruction.  If enabled, the
+  /// call into the migration library is guarded by an inline check of the
+  /// thread's pending migration word so that threads only leave the fast path
+  /// when a migration has actually been requested.
   void addMigrationPoint(Instruction *I) {
     LLVMContext &C = I->getContext();
-    IRBuilder<> Worker(I);
     std::vector<Value *> Args = {
       ConstantPointerNull::get(CallbackType),
       ConstantPointerNull::get(Type::getInt8PtrTy(C, 0))
     };
-    Worker.CreateCall(MigrateAPI, Args);
+
+    if(!InlineCheck) {
+      IRBuilder<> Worker(I);
+      Worker.CreateCall(MigrateAPI, Args);
+      return;
+    }
+
+    // Splitting the entry block must not move its static allocas into the
+    // successor, where they'd become dynamic allocas & break the frame layout
+    // (and stack transformation metadata).  Check after any leading PHIs &
+    // allocas, and keep any later static allocas in the entry block.
+    BasicBlock *CurBB = I->getParent(), *NewSuccBB, *MigPointBB;
+    bool IsEntry = CurBB == &CurBB->getParent()->getEntryBlock();
+    while(isa<PHINode>(I) || (IsEntry && isa<AllocaInst>(I)))
+      I = I->getNextNode();
+
+    NewSuccBB =
+      CurBB->splitBasicBlock(I, "migpointsucc" + std::to_string(NumMigPoints));
+    if(IsEntry) {
+      for(BasicBlock::iterator It = NewSuccBB->begin(), E = NewSuccBB->end();
+          It != E;) {
+        AllocaInst *AI = dyn_cast<AllocaInst>(&*It++);
+        if(AI && isa<Constant>(AI->getArraySize()))
+          AI->moveBefore(CurBB->getTerminator());
+      }
+    }
+    MigPointBB =
+      BasicBlock::Create(C, "migpoint" + std::to_string(NumMigPoints),
+                         CurBB->getParent(), NewSuccBB);
+
+    // Check the pending migration word, which is set asynchronously (e.g., by
+    // a signal handler) & therefore must be re-read at every migration point.
+    IRBuilder<> CheckWorker(CurBB->getTerminator());
+    Value *Pending = CheckWorker.CreateLoad(MigrateFlag, true, "migpending");
+    Value *Zero = ConstantInt::get(Type::getInt32Ty(C), 0, true);
+    Value *Cmp = CheckWorker.CreateICmpSLT(Pending, Zero);
+    MDNode *Weights = MDBuilder(C).createBranchWeights(1 << 20, 1);
+    CheckWorker.CreateCondBr(Cmp, NewSuccBB, MigPointBB, Weights);
+    CurBB->getTerminator()->eraseFromParent();
+
+    IRBuilder<> MigPointWorker(MigPointBB);
+    MigPointWorker.CreateCall(MigrateAPI, Args);
+    MigPointWorker.CreateBr(NewSuccBB);
   }
 
   // Note: because we're only supporting 2 architectures for now, we're not
@@ -29,6 +29,7 @@ ret_t update_function_addr(bin *b, const char *sec);
  * @param sec prefix of sections to be added
  * @param start_id beginning call site ID
  * @param unwind_sec name of function unwinding metadata section
+ * @param version metadata format version to emit
  * @return 0 if the sections were added, an error code otherwise
  */
 ret_t add_sections(bin *b,
@@ -36,7 +37,8 @@ ret_t add_sections(bin *b,
                    size_t num_sm,
                    const char *sec,
                    uint64_t start_id,
-                   const char *unwind_sec);
+                   const char *unwind_sec,
+                   int version);
 
 #endif /* _WRITE_H */
 
@@ -18,7 +18,7 @@
 // Configuration
 ///////////////////////////////////////////////////////////////////////////////
 
-static const char *args = "hf:s:i:v";
+static const char *args = "hf:s:i:m:v";
 static const char *help =
 "gen-stackinfo -- post-process object files (and their LLVM-generated stack \
 maps) to tag call-sites with globally-unique identifiers & generate stack \
@@ -30,6 +30,7 @@ Options:\n\
 \t-f name : object file or executable to post-process\n\
 \t-s name : section name prefix added to object file (default is '" SECTION_PREFIX "')\n\
 \t-i num  : number at which to begin generating call site IDs\n\
+\t-m num  : metadata format version to emit, 1 or 2 (default is 2)\n\
 \t-v      : be verbose\n\n\
 \
 Note: this tool *must* be run after symbol alignment!";
@@ -38,6 +39,7 @@ static const char *file = NULL;
 static char unwind_addr_name[512];
 static const char *section_name = SECTION_PREFIX;
 static uint64_t start_id = 0;
+static int version = METADATA_VERSION;
 bool verbose = false;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -70,6 +72,9 @@ static void parse_args(int argc, char **argv)
     case 'i':
       start_id = atol(optarg);
       break;
+    case 'm':
+      version = atoi(optarg);
+      break;
     case 'v':
       verbose = true;
       break;
@@ -80,10 +85,12 @@ static void parse_args(int argc, char **argv)
   }
 
   if(!file) die("please specify a file to post-process", INVALID_ARGUMENT);
+  if(version != METADATA_V1 && version != METADATA_V2)
+    die("unsupported metadata format version", INVALID_ARGUMENT);
 
   if(verbose)
-    printf("Processing file '%s', adding section '%s.*', beginning IDs at %lu\n",
-           file, section_name, start_id);
+    printf("Processing file '%s', adding section '%s.*', beginning IDs at %lu, "
+           "metadata version %d\n", file, section_name, start_id, version);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -116,7 +123,7 @@ int main(int argc, char **argv)
 
   /* Add stack transformation sections. */
   if((ret = add_sections(b, sm, num_sm, section_name, start_id,
-                         unwind_addr_name)))
+                         unwind_addr_name, version)))
     die("could not add stack transformation sections", ret);
 
   free_stackmaps(sm, num_sm);
@@ -63,6 +63,63 @@ static int sort_id(const void *a, const void *b);
  */
 static int sort_addr(const void *a, const void *b);
 
+/**
+ * Add a section, or update it if it already exists.
+ * @param e an ELF object
+ * @param name the section name
+ * @param num_entries number of entries in the section
+ * @param entry_size size of each entry, in bytes
+ * @param buf data comprising the section
+ * @return 0 if it was added or updated, an error code otherwise
+ */
+static ret_t put_section(Elf *e,
+                         const char *name,
+                         size_t num_entries,
+                         size_t entry_size,
+                         void *buf);
+
+/**
+ * Add version 2 call site sections, i.e., lookup keys, call site records in
+ * address order and per-function information.
+ * @param b a binary descriptor
+ * @param sec prefix of sections to be added
+ * @param num_sites number of call sites
+ * @param id_sites call sites sorted by ID
+ * @param addr_sites call sites sorted by address
+ * @param num_addrs number of function unwinding information entries
+ * @param addrs function unwinding information address ranges
+ * @param added incremented for every section added
+ * @return 0 if the sections were added, an error code otherwise
+ */
+static ret_t add_v2_sections(bin *b,
+                             const char *sec,
+                             size_t num_sites,
+                             const call_site *id_sites,
+                             const call_site *addr_sites,
+                             size_t num_addrs,
+                             const unwind_addr *addrs,
+                             size_t *added);
+
+/**
+ * Generate the call site lookup index.  Call sites must already be sorted by
+ * ID & address, and unwinding address ranges must already be sorted by
+ * address.
+ * @param num_sites number of call sites
+ * @param id_sites call sites sorted by ID
+ * @param addr_sites call sites sorted by address
+ * @param num_addrs number of function unwinding information entries
+ * @param addrs function unwinding information address ranges
+ * @param num_slots number of index slots allocated
+ * @return the index, or NULL if it could not be created
+ */
+static site_index_slot *
+create_site_index(size_t num_sites,
+                  const call_site *id_sites,
+                  const call_site *addr_sites,
+                  size_t num_addrs,
+                  const unwind_addr *addrs,
+                  size_t *num_slots);
+
 ///////////////////////////////////////////////////////////////////////////////
 // Public API
 ///////////////////////////////////////////////////////////////////////////////
@@ -104,12 +161,14 @@ ret_t add_sections(bin *b,
                    size_t num_sm,
                    const char *sec,
                    uint64_t start_id,
-                   const char *unwind_sec)
+                   const char *unwind_sec,
+                   int version)
 {
   size_t num_shdr, i, added = 0, cur_offset, num_sites,
-         num_live, num_arch_live, num_unwind;
+         num_live, num_arch_live, num_unwind, num_slots;
   char sec_name[BUF_SIZE];
   call_site *id_sites, *addr_sites;
+  site_index_slot *index;
   live_value *live_vals;
   arch_live_value *archlive;
   Elf64_Ehdr *ehdr;
@@ -131,27 +190,34 @@ ret_t add_sections(bin *b,
                                 num_unwind, unwind))
     return CREATE_METADATA_FAILED;
 
-  /* Add call site section sorted by ID */
+  /* Sort call sites by ID & by address */
   qsort(id_sites, num_sites, sizeof(call_site), sort_id);
-  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_ID);
-  if((scn = get_section_by_name(b->e, sec_name)))
-    ret = update_section(b->e, scn, num_sites, sizeof(call_site), id_sites);
-  else
-    ret = add_section(b->e, sec_name, num_sites, sizeof(call_site), id_sites);
-  if(ret) return ret;
-  added++;
-
-  /* Add call site section sorted by address */
   addr_sites = malloc(sizeof(call_site) * num_sites);
   memcpy(addr_sites, id_sites, sizeof(call_site) * num_sites);
   qsort(addr_sites, num_sites, sizeof(call_site), sort_addr);
-  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_ADDR);
-  if((scn = get_section_by_name(b->e, sec_name)))
-    ret = update_section(b->e, scn, num_sites, sizeof(call_site), addr_sites);
+
+  if(version == METADATA_V2)
+  {
+    if((ret = add_v2_sections(b, sec, num_sites, id_sites, addr_sites,
+                              num_unwind, unwind, &added)))
+      return ret;
+  }
   else
-    ret = add_section(b->e, sec_name, num_sites, sizeof(call_site), addr_sites);
-  if(ret) return ret;
-  added++;
+  {
+    /* Add call site section sorted by ID */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_ID);
+    if((ret = put_section(b->e, sec_name, num_sites, sizeof(call_site),
+                          id_sites)))
+      return ret;
+    added++;
+
+    /* Add call site section sorted by address */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_ADDR);
+    if((ret = put_section(b->e, sec_name, num_sites, sizeof(call_site),
+                          addr_sites)))
+      return ret;
+    added++;
+  }
 
   /* Add live-value location section. */
   snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_LIVE);
@@ -171,6 +237,18 @@ ret_t add_sections(bin *b,
   if(ret) return ret;
   added++;
 
+  /* Add call site lookup index. */
+  if(!(index = create_site_index(num_sites, id_sites, addr_sites,
+                                 num_unwind, unwind, &num_slots)))
+    return CREATE_METADATA_FAILED;
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_INDEX);
+  if((scn = get_section_by_name(b->e, sec_name)))
+    ret = update_section(b->e, scn, num_slots, sizeof(site_index_slot), index);
+  else
+    ret = add_section(b->e, sec_name, num_slots, sizeof(site_index_slot), index);
+  if(ret) return ret;
+  added++;
+
   /* Calculate offset of last non-stack-transform section */
   if(elf_getshdrnum(b->e, &num_shdr) == -1) return READ_ELF_FAILED;
   if(!(scn = elf_getscn(b->e, num_shdr - (added + 1)))) return READ_ELF_FAILED;
@@ -320,3 +398,192 @@ static int sort_addr(const void *a, const void *b)
   else return 1;
 }
 
+static site_index_slot *
+create_site_index(size_t num_sites,
+                  const call_site *id_sites,
+                  const call_site *addr_sites,
+                  size_t num_addrs,
+                  const unwind_addr *addrs,
+                  size_t *num_slots)
+{
+  size_t i, slot, slots = 1, max_probe = 0, probe;
+  const unwind_addr *ua;
+  site_index_slot *index;
+
+  if(!num_slots || !id_sites || !addr_sites || !addrs) return NULL;
+  if(num_sites >= UINT32_MAX) return NULL;
+
+  /* Keep the load factor at or below 50% so probe sequences stay short */
+  while(slots < num_sites * 2) slots <<= 1;
+  if(!(index = calloc(slots, sizeof(site_index_slot)))) return NULL;
+
+  for(i = 0; i < num_sites; i++)
+  {
+    /*
+     * Multiple records may exist for the same return address -- keep the
+     * first.  The runtime's binary search fallback also returns the first
+     * duplicate so lookups agree whether or not the index is used.
+     */
+    if(i && addr_sites[i].addr == addr_sites[i - 1].addr) continue;
+    ua = get_func_unwind_data(addr_sites[i].addr, num_addrs, addrs);
+    if(!ua)
+    {
+      free(index);
+      return NULL;
+    }
+
+    slot = site_index_hash(addr_sites[i].addr, slots);
+    for(probe = 0; index[slot].addr_site; probe++)
+      slot = (slot + 1) & (slots - 1);
+    index[slot].addr_site = i + 1;
+    index[slot].addr_func = ua - addrs;
+    if(probe > max_probe) max_probe = probe;
+  }
+
+  for(i = 0; i < num_sites; i++)
+  {
+    if(i && id_sites[i].id == id_sites[i - 1].id) continue;
+    slot = site_index_hash(id_sites[i].id, slots);
+    for(probe = 0; index[slot].id_site; probe++)
+      slot = (slot + 1) & (slots - 1);
+    index[slot].id_site = i + 1;
+    if(probe > max_probe) max_probe = probe;
+  }
+
+  if(verbose)
+    printf("Created call site index with %lu slots (longest probe: %lu)\n",
+           slots, max_probe);
+
+  *num_slots = slots;
+  return index;
+}
+
+static ret_t put_section(Elf *e,
+                         const char *name,
+                         size_t num_entries,
+                         size_t entry_size,
+                         void *buf)
+{
+  Elf_Scn *scn;
+
+  if((scn = get_section_by_name(e, name)))
+    return update_section(e, scn, num_entries, entry_size, buf);
+  else return add_section(e, name, num_entries, entry_size, buf);
+}
+
+static ret_t add_v2_sections(bin *b,
+                             const char *sec,
+                             size_t num_sites,
+                             const call_site *id_sites,
+                             const call_site *addr_sites,
+                             size_t num_addrs,
+                             const unwind_addr *addrs,
+                             size_t *added)
+{
+  size_t i, min, max, mid;
+  char sec_name[BUF_SIZE];
+  uint32_t *version, *id_map;
+  uint64_t *addr_keys, *id_keys;
+  call_site_v2 *sites;
+  function_info *funcs;
+  const unwind_addr *ua;
+  ret_t ret;
+
+  version = malloc(sizeof(uint32_t));
+  addr_keys = malloc(sizeof(uint64_t) * num_sites);
+  id_keys = malloc(sizeof(uint64_t) * num_sites);
+  id_map = malloc(sizeof(uint32_t) * num_sites);
+  sites = malloc(sizeof(call_site_v2) * num_sites);
+  funcs = calloc(num_addrs, sizeof(function_info));
+  if(!version || !addr_keys || !id_keys || !id_map || !sites || !funcs)
+    return CREATE_METADATA_FAILED;
+
+  /* Per-function information */
+  for(i = 0; i < num_addrs; i++)
+  {
+    funcs[i].unwind_offset = addrs[i].unwind_offset;
+    funcs[i].num_unwind = addrs[i].num_unwind;
+  }
+
+  /* Call site records & return address keys, in address order */
+  for(i = 0; i < num_sites; i++)
+  {
+    if(addr_sites[i].live_offset > UINT32_MAX ||
+       addr_sites[i].arch_live_offset > UINT32_MAX)
+    {
+      warn("live value offsets too large for version 2 metadata");
+      return CREATE_METADATA_FAILED;
+    }
+    if(!(ua = get_func_unwind_data(addr_sites[i].addr, num_addrs, addrs)))
+      return CREATE_METADATA_FAILED;
+
+    addr_keys[i] = addr_sites[i].addr;
+    sites[i].id = addr_sites[i].id;
+    sites[i].func = ua - addrs;
+    sites[i].live_offset = addr_sites[i].live_offset;
+    sites[i].arch_live_offset = addr_sites[i].arch_live_offset;
+    sites[i].num_live = addr_sites[i].num_live;
+    sites[i].num_arch_live = addr_sites[i].num_arch_live;
+    funcs[sites[i].func].frame_size = addr_sites[i].frame_size;
+  }
+
+  /* ID keys & map from ID order to address order */
+  for(i = 0; i < num_sites; i++)
+  {
+    id_keys[i] = id_sites[i].id;
+
+    min = 0;
+    max = num_sites;
+    while(min < max)
+    {
+      mid = (min + max) / 2;
+      if(addr_sites[mid].addr < id_sites[i].addr) min = mid + 1;
+      else max = mid;
+    }
+    while(min < num_sites && addr_sites[min].id != id_sites[i].id &&
+          addr_sites[min].addr == id_sites[i].addr) min++;
+    if(min == num_sites || addr_sites[min].id != id_sites[i].id)
+      return CREATE_METADATA_FAILED;
+    id_map[i] = min;
+  }
+
+  *version = METADATA_V2;
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_VERSION);
+  if((ret = put_section(b->e, sec_name, 1, sizeof(uint32_t), version)))
+    return ret;
+  (*added)++;
+
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_FUNC);
+  if((ret = put_section(b->e, sec_name, num_addrs, sizeof(function_info),
+                        funcs)))
+    return ret;
+  (*added)++;
+
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_SITE_ADDR);
+  if((ret = put_section(b->e, sec_name, num_sites, sizeof(uint64_t),
+                        addr_keys)))
+    return ret;
+  (*added)++;
+
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_SITE_ID);
+  if((ret = put_section(b->e, sec_name, num_sites, sizeof(uint64_t), id_keys)))
+    return ret;
+  (*added)++;
+
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_SITE_ID_MAP);
+  if((ret = put_section(b->e, sec_name, num_sites, sizeof(uint32_t), id_map)))
+    return ret;
+  (*added)++;
+
+  snprintf(sec_name, BUF_SIZE, "%s.%s", sec, SECTION_SITE);
+  if((ret = put_section(b->e, sec_name, num_sites, sizeof(call_site_v2),
+                        sites)))
+    return ret;
+  (*added)++;
+
+  if(verbose)
+    printf("Added version 2 call site metadata (%lu bytes per call site)\n",
+           2 * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(call_site_v2));
+
+  return SUCCESS;
+}
@@ -146,6 +146,84 @@ bool dump_callsite_section(Elf_Scn *scn)
   return true;
 }
 
+bool dump_func_section(Elf_Scn *scn)
+{
+  uint64_t num_funcs, i;
+  Elf_Data *data = NULL;
+  GElf_Shdr shdr;
+  function_info *funcs;
+
+  if(gelf_getshdr(scn, &shdr) != &shdr) return false;
+  if(shdr.sh_size != 0 && shdr.sh_entsize == 0) return false;
+  if(!(data = elf_getdata(scn, data))) return false;
+
+  num_funcs = shdr.sh_size / shdr.sh_entsize;
+  funcs = (function_info *)data->d_buf;
+  printf("found %lu entries\n", num_funcs);
+  for(i = 0; i < num_funcs; i++)
+    printf("%lu: %u, %u unwind entries (offset=%u)\n", i,
+           funcs[i].frame_size, funcs[i].num_unwind, funcs[i].unwind_offset);
+  printf("\n");
+
+  return true;
+}
+
+bool dump_v2_callsite_section(Elf_Scn *addr_scn, Elf_Scn *site_scn)
+{
+  uint64_t num_sites, i;
+  Elf_Data *addr_data = NULL, *site_data = NULL;
+  GElf_Shdr addr_shdr, site_shdr;
+  uint64_t *addrs;
+  call_site_v2 *sites;
+
+  if(gelf_getshdr(addr_scn, &addr_shdr) != &addr_shdr) return false;
+  if(gelf_getshdr(site_scn, &site_shdr) != &site_shdr) return false;
+  if(site_shdr.sh_size != 0 && site_shdr.sh_entsize == 0) return false;
+  if(!(addr_data = elf_getdata(addr_scn, addr_data))) return false;
+  if(!(site_data = elf_getdata(site_scn, site_data))) return false;
+
+  num_sites = site_shdr.sh_size / site_shdr.sh_entsize;
+  if(addr_shdr.sh_size != num_sites * sizeof(uint64_t)) return false;
+  addrs = (uint64_t *)addr_data->d_buf;
+  sites = (call_site_v2 *)site_data->d_buf;
+  printf("found %lu entries\n", num_sites);
+  for(i = 0; i < num_sites; i++)
+    printf("%lu: 0x%lx, function %u, "
+           "%u live value(s) (offset=%u), "
+           "%u arch-specific live value(s) (offset=%u)\n",
+      sites[i].id, addrs[i], sites[i].func,
+      sites[i].num_live, sites[i].live_offset,
+      sites[i].num_arch_live, sites[i].arch_live_offset);
+  printf("\n");
+
+  return true;
+}
+
+bool dump_id_map_section(Elf_Scn *id_scn, Elf_Scn *map_scn)
+{
+  uint64_t num_sites, i;
+  Elf_Data *id_data = NULL, *map_data = NULL;
+  GElf_Shdr id_shdr, map_shdr;
+  uint64_t *ids;
+  uint32_t *map;
+
+  if(gelf_getshdr(id_scn, &id_shdr) != &id_shdr) return false;
+  if(gelf_getshdr(map_scn, &map_shdr) != &map_shdr) return false;
+  if(!(id_data = elf_getdata(id_scn, id_data))) return false;
+  if(!(map_data = elf_getdata(map_scn, map_data))) return false;
+
+  num_sites = map_shdr.sh_size / sizeof(uint32_t);
+  if(id_shdr.sh_size != num_sites * sizeof(uint64_t)) return false;
+  ids = (uint64_t *)id_data->d_buf;
+  map = (uint32_t *)map_data->d_buf;
+  printf("found %lu entries\n", num_sites);
+  for(i = 0; i < num_sites; i++)
+    printf("%lu: ID %lu -> site %u\n", i, ids[i], map[i]);
+  printf("\n");
+
+  return true;
+}
+
 bool print_loc_record(live_value *record)
 {
   switch(record->type) {
@@ -285,10 +363,40 @@ bool dump_archlive_section(Elf_Scn *scn)
   return true;
 }
 
+bool dump_index_section(Elf_Scn *scn)
+{
+  uint64_t num_slots, i;
+  Elf_Data *data = NULL;
+  GElf_Shdr shdr;
+  site_index_slot *slots;
+
+  if(gelf_getshdr(scn, &shdr) != &shdr) return false;
+  if(shdr.sh_size != 0 && shdr.sh_entsize == 0) return false;
+  if(!(data = elf_getdata(scn, data))) return false;
+
+  num_slots = shdr.sh_size / shdr.sh_entsize;
+  slots = (site_index_slot *)data->d_buf;
+  printf("found %lu entries\n", num_slots);
+  for(i = 0; i < num_slots; i++)
+  {
+    if(!slots[i].addr_site && !slots[i].id_site) continue;
+    printf("%lu:", i);
+    if(slots[i].addr_site)
+      printf(" address -> site %u (function %u)",
+             slots[i].addr_site - 1, slots[i].addr_func);
+    if(slots[i].id_site)
+      printf(" ID -> site %u", slots[i].id_site - 1);
+    printf("\n");
+  }
+  printf("\n");
+
+  return true;
+}
+
 ret_t dump_metadata(bin *thebin)
 {
   char sec_name[BUF_SIZE];
-  Elf_Scn *scn;
+  Elf_Scn *scn, *key_scn;
 
   /* Function unwinding metadata */
   snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_UNWIND_ADDR);
@@ -316,31 +424,85 @@ ret_t dump_metadata(bin *thebin)
   }
   else return FIND_SECTION_FAILED;
 
-  /* Call sites, sorted by ID */
-  snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_ID);
-  if((scn = get_section_by_name(thebin->e, sec_name)))
+  /* Version 2 metadata, denoted by the version section */
+  snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_VERSION);
+  if(get_section_by_name(thebin->e, sec_name))
   {
-    printf("Reading section %s: ", sec_name);
-    if(!dump_callsite_section(scn))
+    printf("Found version 2 call site metadata\n\n");
+
+    /* Per-function information */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_FUNC);
+    if((scn = get_section_by_name(thebin->e, sec_name)))
     {
-      printf("failed.\n");
-      return READ_ELF_FAILED;
+      printf("Reading section %s: ", sec_name);
+      if(!dump_func_section(scn))
+      {
+        printf("failed.\n");
+        return READ_ELF_FAILED;
+      }
+    }
+    else return FIND_SECTION_FAILED;
+
+    /* Call sites & their return addresses, sorted by address */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_SITE_ADDR);
+    if(!(key_scn = get_section_by_name(thebin->e, sec_name)))
+      return FIND_SECTION_FAILED;
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_SITE);
+    if((scn = get_section_by_name(thebin->e, sec_name)))
+    {
+      printf("Reading section %s: ", sec_name);
+      if(!dump_v2_callsite_section(key_scn, scn))
+      {
+        printf("failed.\n");
+        return READ_ELF_FAILED;
+      }
+    }
+    else return FIND_SECTION_FAILED;
+
+    /* Call site IDs & their mapping to call sites */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_SITE_ID);
+    if(!(key_scn = get_section_by_name(thebin->e, sec_name)))
+      return FIND_SECTION_FAILED;
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_SITE_ID_MAP);
+    if((scn = get_section_by_name(thebin->e, sec_name)))
+    {
+      printf("Reading section %s: ", sec_name);
+      if(!dump_id_map_section(key_scn, scn))
+      {
+        printf("failed.\n");
+        return READ_ELF_FAILED;
+      }
     }
+    else return FIND_SECTION_FAILED;
   }
-  else return FIND_SECTION_FAILED;
-
-  /* Call sites, sorted by address */
-  snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_ADDR);
-  if((scn = get_section_by_name(thebin->e, sec_name)))
+  else
   {
-    printf("Reading section %s: ", sec_name);
-    if(!dump_callsite_section(scn))
+    /* Call sites, sorted by ID */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_ID);
+    if((scn = get_section_by_name(thebin->e, sec_name)))
     {
-      printf("failed.\n");
-      return READ_ELF_FAILED;
+      printf("Reading section %s: ", sec_name);
+      if(!dump_callsite_section(scn))
+      {
+        printf("failed.\n");
+        return READ_ELF_FAILED;
+      }
+    }
+    else return FIND_SECTION_FAILED;
+
+    /* Call sites, sorted by address */
+    snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_ADDR);
+    if((scn = get_section_by_name(thebin->e, sec_name)))
+    {
+      printf("Reading section %s: ", sec_name);
+      if(!dump_callsite_section(scn))
+      {
+        printf("failed.\n");
+        return READ_ELF_FAILED;
+      }
     }
+    else return FIND_SECTION_FAILED;
   }
-  else return FIND_SECTION_FAILED;
 
   /* Live value location records */
   snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_LIVE);
@@ -368,6 +530,18 @@ ret_t dump_metadata(bin *thebin)
   }
   else return FIND_SECTION_FAILED;
 
+  /* Call site lookup index (optional) */
+  snprintf(sec_name, BUF_SIZE, "%s.%s", st_section_name, SECTION_INDEX);
+  if((scn = get_section_by_name(thebin->e, sec_name)))
+  {
+    printf("Reading section %s: ", sec_name);
+    if(!dump_index_section(scn))
+    {
+      printf("failed.\n");
+      return READ_ELF_FAILED;
+    }
+  }
+
   return SUCCESS;
 }
 
@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+
+import os
+import sys
+import struct
+import argparse
+
+###############################################################################
+# Helpers
+###############################################################################
+
+# Must match the binary layout described in lib/migration/include/mapping.h
+Magic = b"PSCH"
+Version = 1
+MaxRegions = 1 << 20
+DefaultRegion = -1
+
+def parseArguments():
+    desc = "Convert a text thread schedule into a binary thread schedule, " \
+           "which the migration library loads directly rather than parses"
+
+    parser = argparse.ArgumentParser(description=desc,
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+
+    config = parser.add_argument_group("Configuration")
+    config.add_argument("-input", type=str, default="thread-schedule.txt",
+        help="Text thread schedule",
+        dest="input")
+    config.add_argument("-output", type=str, default="thread-schedule.bin",
+        help="Binary thread schedule.  Written to a temporary file & " \
+             "renamed, so running applications watching the file only ever " \
+             "see complete schedules",
+        dest="output")
+    config.add_argument("-verbose", action="store_true",
+        help="Verbose printing",
+        dest="verbose")
+
+    return parser.parse_args()
+
+def readSchedule(filename):
+    ''' Parse text schedule lines of the form
+        "<region #> <# entries> <PTID 0 node> ... <PTID N node>" '''
+    regions = {}
+    with open(filename, 'r') as fp:
+        for lineNum, line in enumerate(fp):
+            fields = line.split()
+            if not fields: continue
+            region, num = int(fields[0]), int(fields[1])
+            nodes = [ int(node) for node in fields[2:] ]
+            if len(nodes) < num:
+                print("ERROR: not enough node mappings, line {}" \
+                      .format(lineNum))
+                sys.exit(1)
+            if region != DefaultRegion and not 0 <= region < MaxRegions:
+                print("ERROR: region ID {} too large, line {}" \
+                      .format(region, lineNum))
+                sys.exit(1)
+            regions[region] = nodes[:num]
+    return regions
+
+def writeSchedule(filename, regions, verbose):
+    numRegions = max([ r for r in regions if r != DefaultRegion ],
+                     default=-1) + 1
+    table = [ (0, 0) ] * numRegions
+    nodes = []
+
+    def addRegion(region):
+        mapping = regions.get(region, [])
+        entry = (len(nodes), len(mapping))
+        nodes.extend(mapping)
+        return entry
+
+    default = addRegion(DefaultRegion)
+    for region in range(numRegions):
+        if region in regions: table[region] = addRegion(region)
+
+    if verbose:
+        print("-> Writing {} regions, {} node mappings to '{}' <-" \
+              .format(numRegions, len(nodes), filename))
+
+    tmp = filename + ".tmp"
+    with open(tmp, 'wb') as fp:
+        fp.write(struct.pack("=4sIIIII", Magic, Version, numRegions,
+                             len(nodes), default[0], default[1]))
+        for offset, num in table: fp.write(struct.pack("=II", offset, num))
+        fp.write(struct.pack("={}i".format(len(nodes)), *nodes))
+    os.rename(tmp, filename)
+
+###############################################################################
+# Driver
+###############################################################################
+
+if __name__ == "__main__":
+    args = parseArguments()
+    writeSchedule(args.output, readSchedule(args.input), args.verbose)
@@ -3,6 +3,7 @@
 import os
 import sys
 import time
+import re
 import random
 import argparse
 import subprocess
@@ -79,7 +80,41 @@ def writeOutput(args, process):
         if args.verbose: print("Writing output to '{}'".format(args.out))
         out, err = process.communicate()
         assert out is not None, "No output from process"
-        fp.write(out.decode("utf-8"))
+        out = out.decode("utf-8")
+        fp.write(out)
+    return out
+
+# Summary line for a timing, dumped by the migration library (built with
+# type=timing) at exit or periodically -- see migrate_timing_dump().
+# Periodic dumps are cumulative, so the last summary for a timing wins.
+summaryRe = re.compile(r"^\[Migration timing\]\s+(\w+) \(ns\) - (\d+) " \
+                       r"sample\(s\), min (\d+), avg ([\d.]+), p50 (\d+), " \
+                       r"p90 (\d+), p99 (\d+), max (\d+)$")
+summaryFields = [ "samples", "min", "avg", "p50", "p90", "p99", "max" ]
+
+def parseSummaries(out):
+    summaries = {}
+    for line in out.splitlines():
+        match = summaryRe.match(line.strip())
+        if match:
+            values = [ float(v) for v in match.groups()[1:] ]
+            summaries[match.group(1)] = dict(zip(summaryFields, values))
+    return summaries
+
+def printSummaries(summaries):
+    if not summaries:
+        print("No migration timings found -- was libmigration built with " \
+              "type=timing?")
+        return
+
+    print("{:>11} {:>8} {:>12} {:>12} {:>12} {:>12} {:>12} {:>12}" \
+          .format("timing (ns)", *summaryFields))
+    for timing, summary in summaries.items():
+        print("{:>11} {:>8} {:>12} {:>12.1f} {:>12} {:>12} {:>12} {:>12}" \
+              .format(timing, int(summary["samples"]), int(summary["min"]),
+                      summary["avg"], int(summary["p50"]),
+                      int(summary["p90"]), int(summary["p99"]),
+                      int(summary["max"])))
 
 ###############################################################################
 # Driver
@@ -89,5 +124,6 @@ if __name__ == "__main__":
     args = parseArguments()
     process = runProcess(args)
     signalProcess(args, process)
-    writeOutput(args, process)
+    out = writeOutput(args, process)
+    printSummaries(parseSummaries(out))
 